@@ -0,0 +1,64 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_BUFPOOL_H
+#define FLB_BUFPOOL_H
+
+#include <fluent-bit/flb_info.h>
+
+#include <stddef.h>
+
+/*
+ * Buffer pool for network input connections: buffers are handed out in
+ * power-of-two size classes starting at 'min_size', released buffers are
+ * kept in per-class free lists and reused by the next connection. A pool
+ * is not thread safe, it belongs to one plugin instance and it's used from
+ * the event loop thread only.
+ */
+
+#define FLB_BUFPOOL_CLASSES     16
+#define FLB_BUFPOOL_CACHE_SIZE  8388608   /* 8MB kept in free lists */
+
+struct flb_bufpool_class {
+    size_t size;                 /* buffer size of this class     */
+    int count;                   /* number of cached buffers      */
+    void *free;                  /* free list head                */
+};
+
+struct flb_bufpool {
+    size_t min_size;             /* size of the smallest class    */
+    size_t limit;                /* max bytes in flight (0 = off) */
+    size_t cache_limit;          /* max bytes in the free lists   */
+    size_t in_use;               /* bytes handed out              */
+    size_t cached;               /* bytes in the free lists       */
+    int classes;                 /* number of size classes        */
+    struct flb_bufpool_class class[FLB_BUFPOOL_CLASSES];
+};
+
+struct flb_bufpool *flb_bufpool_create(size_t min_size, size_t max_size,
+                                       size_t limit);
+void flb_bufpool_destroy(struct flb_bufpool *pool);
+
+size_t flb_bufpool_size(struct flb_bufpool *pool, size_t size);
+void *flb_bufpool_get(struct flb_bufpool *pool, size_t size);
+void *flb_bufpool_realloc(struct flb_bufpool *pool, void *buf,
+                          size_t size, size_t new_size);
+void flb_bufpool_put(struct flb_bufpool *pool, void *buf, size_t size);
+
+#endif
@@ -41,6 +41,8 @@
 #define FLB_CONFIG_HTTP_PORT    "2020"
 #define FLB_CONFIG_DEFAULT_TAG  "fluent_bit"
 
+struct flb_engine_bus;
+
 /* Property configuration: key/value for an input/output instance */
 struct flb_config_prop {
     char *key;
@@ -73,6 +75,7 @@ struct flb_config {
     pthread_t worker;            /* worker tid */
     flb_pipefd_t ch_data[2];     /* pipe to communicate caller with worker */
     flb_pipefd_t ch_manager[2];  /* channel to administrate fluent bit     */
+    struct flb_engine_bus *ch_bus; /* task and input thread completions    */
     flb_pipefd_t ch_notif[2];    /* channel to receive notifications       */
 
     /* Channel event loop (just for ch_notif) */
@@ -111,6 +114,9 @@ struct flb_config {
     /* Filter instances */
     struct mk_list filters;
 
+    /* Router: cache of resolved outputs and filters per Tag */
+    void *route_cache;
+
     struct mk_event_loop *evl;          /* the event loop (mk_core) */
 
     /* Proxies */
@@ -135,6 +141,10 @@ struct flb_config {
     /* Workers: threads spawn using flb_worker_create() */
     struct mk_list workers;
 
+    /* Engine workers: event loops that runs output flushes */
+    int engine_workers;               /* number of engine workers */
+    struct mk_list engine_workers_list;
+
     /* Metrics exporter */
 #ifdef FLB_HAVE_METRICS
     void *metrics;
@@ -196,6 +206,7 @@ enum conf_type {
 #define FLB_CONF_STR_LOGLEVEL "Log_Level"
 #define FLB_CONF_STR_PARSERS_FILE "Parsers_File"
 #define FLB_CONF_STR_PLUGINS_FILE "Plugins_File"
+#define FLB_CONF_STR_WORKERS  "Workers"
 #ifdef FLB_HAVE_HTTP_SERVER
 #define FLB_CONF_STR_HTTP_SERVER  "HTTP_Server"
 #define FLB_CONF_STR_HTTP_LISTEN  "HTTP_Listen"
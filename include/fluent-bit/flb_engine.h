@@ -63,4 +63,9 @@ int flb_engine_exit(struct flb_config *config);
 int flb_engine_shutdown(struct flb_config *config);
 int flb_engine_destroy_tasks(struct mk_list *tasks);
 
+/* Event loop of the running thread (engine or engine worker) */
+void flb_engine_evl_init();
+struct mk_event_loop *flb_engine_evl_get();
+void flb_engine_evl_set(struct mk_event_loop *evl);
+
 #endif
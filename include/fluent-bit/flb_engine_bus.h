@@ -0,0 +1,80 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_ENGINE_BUS_H
+#define FLB_ENGINE_BUS_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_ring.h>
+
+/* Number of slots of the engine bus ring */
+#define FLB_ENGINE_BUS_SIZE   8192
+
+/*
+ * Completion record: unlike the 64 bits values written to the manager
+ * channel, task and thread IDs are carried with their full width.
+ */
+struct flb_engine_bus_event {
+    uint32_t type;                 /* FLB_ENGINE_TASK or FLB_ENGINE_IN_THREAD */
+    int32_t  ret;                  /* FLB_OK, FLB_ERROR or FLB_RETRY         */
+    uint32_t id;                   /* task ID or input thread ID             */
+    uint32_t thread_id;            /* output thread ID                       */
+};
+
+/* Record that did not fit in the ring */
+struct flb_engine_bus_overflow {
+    struct flb_engine_bus_event ev;
+    struct mk_list _head;
+};
+
+/*
+ * The engine bus delivers output and input thread completions to the engine
+ * event loop. Producers push records into a shared ring and ring a single
+ * doorbell (an eventfd when available) only if the engine was not already
+ * notified, the engine then drains every pending record in one pass.
+ *
+ * Producers are serialized by a lock since completions can be reported
+ * from co-routines and from other threads; the engine pops without it.
+ */
+struct flb_engine_bus {
+    struct mk_event event;         /* registered in the engine event loop */
+    flb_pipefd_t fd[2];            /* doorbell, fd[0] == fd[1] on eventfd  */
+    int notified;
+    int overflowed;
+    pthread_mutex_t lock;
+    struct flb_ring *ring;
+    struct mk_list overflow;
+};
+
+struct flb_engine_bus *flb_engine_bus_create(struct mk_event_loop *evl,
+                                             int event_type);
+void flb_engine_bus_destroy(struct flb_engine_bus *bus);
+
+int flb_engine_bus_push(struct flb_engine_bus *bus,
+                        struct flb_engine_bus_event *ev);
+void flb_engine_bus_consume(struct flb_engine_bus *bus);
+int flb_engine_bus_pop(struct flb_engine_bus *bus,
+                       struct flb_engine_bus_event *ev);
+
+#endif
@@ -0,0 +1,100 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_ENGINE_WORKER_H
+#define FLB_ENGINE_WORKER_H
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_ring.h>
+#include <fluent-bit/flb_config.h>
+
+/* Number of slots of the flush and completion rings */
+#define FLB_ENGINE_WORKER_RING   4096
+
+struct flb_task;
+struct flb_thread;
+struct flb_output_instance;
+
+/* Flush request: engine -> worker */
+struct flb_engine_worker_flush {
+    int thread_id;
+    struct flb_task *task;
+    struct flb_output_instance *o_ins;
+};
+
+/* Flush result: worker -> engine */
+struct flb_engine_worker_done {
+    int ret;
+    int thread_id;
+    struct flb_task *task;
+    struct flb_thread *th;              /* NULL if it could not start */
+};
+
+/* Flush request waiting for space in the ring (engine side) */
+struct flb_engine_worker_pending {
+    struct flb_engine_worker_flush req;
+    struct mk_list _head;
+};
+
+/*
+ * An engine worker is a thread with its own event loop that runs the flush
+ * co-routines of the output instances assigned to it. The engine and the
+ * worker exchange flush requests and results through two single-producer
+ * single-consumer rings, each one with a pipe used as a doorbell which is
+ * written only when the consumer is not already notified.
+ */
+struct flb_engine_worker {
+    int id;
+    int running;
+    pthread_t tid;
+    struct mk_event_loop *evl;
+
+    /* Engine -> worker */
+    struct mk_event ev_flush;
+    flb_pipefd_t ch_flush[2];
+    int flush_notified;
+    struct flb_ring *r_flush;
+    struct mk_list pending;             /* only used by the engine */
+
+    /* Worker -> engine */
+    struct mk_event ev_done;
+    flb_pipefd_t ch_done[2];
+    int done_notified;
+    struct flb_ring *r_done;
+
+    struct flb_config *config;
+    struct mk_list _head;               /* link to config->engine_workers_list */
+};
+
+int flb_engine_workers_start(struct flb_config *config);
+void flb_engine_workers_stop(struct flb_config *config);
+void flb_engine_workers_destroy(struct flb_config *config);
+
+int flb_engine_worker_flush(struct flb_task *task,
+                            struct flb_output_instance *o_ins,
+                            struct flb_config *config);
+struct flb_engine_worker *flb_engine_worker_done_fd(flb_pipefd_t fd,
+                                                    struct flb_config *config);
+int flb_engine_worker_done_pop(struct flb_engine_worker *w,
+                               struct flb_engine_worker_done *done);
+void flb_engine_worker_pending_flush(struct flb_engine_worker *w);
+
+#endif
@@ -21,13 +21,16 @@
 #define FLB_FILTER_H
 
 #include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_metrics.h>
 #include <msgpack.h>
 
 #define FLB_FILTER_MODIFIED 1
 #define FLB_FILTER_NOTOUCH  2
+#define FLB_FILTER_DROP     3   /* record callback only */
 
 struct flb_input_instance;
 struct flb_filter_instance;
+struct flb_router_rule;
 
 struct flb_filter_plugin {
     int flags;             /* Flags (not available at the moment */
@@ -40,6 +43,19 @@ struct flb_filter_plugin {
                       void **, size_t *,
                       struct flb_filter_instance *,
                       void *, struct flb_config *);
+
+    /*
+     * Optional record callback: if set, it's used instead of cb_filter. It
+     * receives a single record map already unpacked, so the core can run a
+     * chain of filters over each record with one unpack/pack pass for the
+     * whole chain. The callback can replace the map with a new object
+     * allocated on the given zone (FLB_FILTER_MODIFIED), leave it as is
+     * (FLB_FILTER_NOTOUCH) or discard the record (FLB_FILTER_DROP).
+     */
+    int (*cb_filter_record) (msgpack_object *, msgpack_zone *,
+                             char *, int,
+                             struct flb_filter_instance *,
+                             void *, struct flb_config *);
     int (*cb_exit) (void *, struct flb_config *);
 
     struct mk_list _head;  /* Link to parent list (config->filters) */
@@ -49,12 +65,17 @@ struct flb_filter_instance {
     int id;                        /* instance id              */
     char name[16];                 /* numbered name            */
     char *match;                   /* match rule based on Tags */
+    struct flb_router_rule *match_rule; /* compiled match rule */
     void *context;                 /* Instance local context   */
     void *data;
     struct flb_filter_plugin *p;   /* original plugin          */
     struct mk_list properties;     /* config properties        */
     struct mk_list _head;          /* link to config->filters  */
 
+#ifdef FLB_HAVE_METRICS
+    struct flb_metrics *metrics;   /* metrics registered by the plugin */
+#endif
+
     /* Keep a reference to the original context this instance belongs to */
     struct flb_config *config;
 };
@@ -65,10 +86,10 @@ char *flb_filter_get_property(char *key, struct flb_filter_instance *i);
 struct flb_filter_instance *flb_filter_new(struct flb_config *config,
                                            char *filter, void *data);
 void flb_filter_exit(struct flb_config *config);
-void flb_filter_do(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
-                   void *data, size_t bytes,
-                   char *tag, int tag_len,
-                   struct flb_config *config);
+int flb_filter_do(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
+                  void *data, size_t bytes,
+                  char *tag, int tag_len,
+                  struct flb_config *config);
 void flb_filter_initialize_all(struct flb_config *config);
 void flb_filter_set_context(struct flb_filter_instance *ins, void *context);
 
@@ -28,9 +28,11 @@
 #include <fluent-bit/flb_str.h>
 #include <fluent-bit/flb_bits.h>
 #include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_engine_bus.h>
 #include <fluent-bit/flb_filter.h>
 #include <fluent-bit/flb_thread.h>
 #include <fluent-bit/flb_mp.h>
+#include <fluent-bit/flb_hash.h>
 
 #ifdef FLB_HAVE_METRICS
 #include <fluent-bit/flb_metrics.h>
@@ -54,6 +56,9 @@
 #define FLB_INPUT_RUNNING     1
 #define FLB_INPUT_PAUSED      0
 
+/* Number of slots of the hash table used to index dyntags by tag */
+#define FLB_INPUT_DYNTAGS_HT  1024
+
 struct flb_input_instance;
 
 struct flb_input_plugin {
@@ -123,6 +128,7 @@ struct flb_input_dyntag {
     char *tag;
 
     /* MessagePack */
+    int mp_records;            /* number of records in the buffer */
     size_t mp_buf_write_size;
     msgpack_sbuffer mp_sbuf;   /* msgpack sbuffer */
     msgpack_packer mp_pck;     /* msgpack packer  */
@@ -181,7 +187,7 @@ struct flb_input_instance {
     struct flb_net_host host;
 
     /* MessagePack buffers: the plugin use these contexts to append records */
-    int mp_records;
+    int mp_records;                      /* records in mp_sbuf */
     size_t mp_buf_write_size;
     msgpack_packer  mp_pck;
     msgpack_sbuffer mp_sbuf;
@@ -193,6 +199,15 @@ struct flb_input_instance {
      */
     size_t mp_total_buf_size;
 
+    /*
+     * Dyntags: 'dyntags_ht' index by tag the dyntag nodes that can receive
+     * more data (not busy and not locked), so a lookup don't need to walk
+     * the whole list. 'dyntags_buf_size' keeps the number of bytes used by
+     * all dyntag buffers, it's updated on every write and destroy.
+     */
+    struct flb_hash *dyntags_ht;
+    size_t dyntags_buf_size;
+
     /*
      * Buffer limit: optional limit set by configuration so this input instance
      * cannot exceed more than mp_buf_limit (bytes unit).
@@ -444,26 +459,17 @@ struct flb_thread *flb_input_thread_collect(struct flb_input_collector *coll,
  * will be returned instead.
  */
 static inline void flb_input_return(struct flb_thread *th) {
-    int n;
-    uint64_t val;
     struct flb_input_thread *in_th;
+    struct flb_engine_bus_event ev;
 
     in_th = (struct flb_input_thread *) FLB_THREAD_DATA(th);
 
-    /*
-     * To compose the signal event the relevant info is:
-     *
-     * - Unique Task events id: 2 in this case
-     * - Return value: FLB_OK (0) or FLB_ERROR (1)
-     * - Task ID
-     *
-     * We put together the return value with the task_id on the 32 bits at right
-     */
-    val = FLB_BITS_U64_SET(3 /* FLB_ENGINE_IN_THREAD */, in_th->id);
-    n = flb_pipe_w(in_th->config->ch_manager[1], &val, sizeof(val));
-    if (n == -1) {
-        flb_errno();
-    }
+    /* Notify the engine that this input thread has finished */
+    ev.type      = 3; /* FLB_ENGINE_IN_THREAD */
+    ev.ret       = 0;
+    ev.id        = in_th->id;
+    ev.thread_id = 0;
+    flb_engine_bus_push(in_th->config->ch_bus, &ev);
 }
 
 static inline int flb_input_buf_overlimit(struct flb_input_instance *i)
@@ -490,18 +496,8 @@ static inline int flb_input_buf_paused(struct flb_input_instance *i)
 
 static inline int flb_input_buf_size_set(struct flb_input_instance *in)
 {
-    size_t total = 0;
-    struct mk_list *head;
-    struct flb_input_dyntag *dtp;
-
-    /* Itearate each dyntag structure and count total bytes */
-    mk_list_foreach(head, &in->dyntags) {
-        dtp = mk_list_entry(head, struct flb_input_dyntag, _head);
-        total += dtp->mp_sbuf.size;
-    }
-
-    total += in->mp_sbuf.size;
-    in->mp_total_buf_size = total;
+    /* Fixed buffer plus the bytes used by all dyntags */
+    in->mp_total_buf_size = in->mp_sbuf.size + in->dyntags_buf_size;
 
     if (flb_input_buf_overlimit(in) == FLB_FALSE &&
         flb_input_buf_paused(in) && in->config->is_running == FLB_TRUE) {
@@ -557,11 +553,10 @@ static inline void flb_input_buf_write_start(struct flb_input_instance *i)
 
 static inline void flb_input_buf_write_end(struct flb_input_instance *i)
 {
+    int ret;
+    int records;
     size_t bytes;
     void *buf;
-#ifdef FLB_HAVE_METRICS
-    int records;
-#endif
 
     /* Get the number of new bytes */
     bytes = (i->mp_sbuf.size - i->mp_buf_write_size);
@@ -569,8 +564,8 @@ static inline void flb_input_buf_write_end(struct flb_input_instance *i)
         return;
     }
 
-#ifdef FLB_HAVE_METRICS
     records = flb_mp_count(i->mp_sbuf.data + i->mp_buf_write_size, bytes);
+#ifdef FLB_HAVE_METRICS
     if (records > 0) {
         flb_metrics_sum(FLB_METRIC_N_RECORDS, records, i->metrics);
         flb_metrics_sum(FLB_METRIC_N_BYTES, bytes, i->metrics);
@@ -586,9 +581,18 @@ static inline void flb_input_buf_write_end(struct flb_input_instance *i)
 
     /* Call the filter handler */
     buf = i->mp_sbuf.data + i->mp_buf_write_size;
-    flb_filter_do(&i->mp_sbuf, &i->mp_pck,
-                  buf, bytes,
-                  i->tag, i->tag_len, i->config);
+    ret = flb_filter_do(&i->mp_sbuf, &i->mp_pck,
+                        buf, bytes,
+                        i->tag, i->tag_len, i->config);
+    if (ret == FLB_TRUE) {
+        records = flb_mp_count(i->mp_sbuf.data + i->mp_buf_write_size,
+                               i->mp_sbuf.size - i->mp_buf_write_size);
+    }
+
+    /* Keep the number of records, outputs don't need to count them */
+    if (records > 0) {
+        i->mp_records += records;
+    }
 
     /*
      * Update buffer size counter: this kind of input instance have just
@@ -609,11 +613,10 @@ static inline void flb_input_dbuf_write_start(struct flb_input_dyntag *dt)
 
 static inline void flb_input_dbuf_write_end(struct flb_input_dyntag *dt)
 {
+    int ret;
+    int records;
     size_t bytes;
     void *buf;
-#ifdef FLB_HAVE_METRICS
-    int records;
-#endif
     struct flb_input_instance *in = dt->in;
 
     /* Get the number of new bytes */
@@ -629,8 +632,8 @@ static inline void flb_input_dbuf_write_end(struct flb_input_dyntag *dt)
         return;
     }
 
-#ifdef FLB_HAVE_METRICS
     records = flb_mp_count(dt->mp_sbuf.data + dt->mp_buf_write_size, bytes);
+#ifdef FLB_HAVE_METRICS
     if (records > 0) {
         flb_metrics_sum(FLB_METRIC_N_RECORDS, records, in->metrics);
         flb_metrics_sum(FLB_METRIC_N_BYTES, bytes, in->metrics);
@@ -639,11 +642,19 @@ static inline void flb_input_dbuf_write_end(struct flb_input_dyntag *dt)
 
     /* Call the filter handler */
     buf = dt->mp_sbuf.data + dt->mp_buf_write_size;
-    flb_filter_do(&dt->mp_sbuf, &dt->mp_pck,
-                  buf, bytes,
-                  dt->tag, dt->tag_len, dt->in->config);
+    ret = flb_filter_do(&dt->mp_sbuf, &dt->mp_pck,
+                        buf, bytes,
+                        dt->tag, dt->tag_len, dt->in->config);
+    if (ret == FLB_TRUE) {
+        records = flb_mp_count(dt->mp_sbuf.data + dt->mp_buf_write_size,
+                               dt->mp_sbuf.size - dt->mp_buf_write_size);
+    }
+    if (records > 0) {
+        dt->mp_records += records;
+    }
 
-    /* Itearate each dyntag structure and count total bytes */
+    /* Account the new bytes (after filtering) in the dyntags total */
+    in->dyntags_buf_size += (dt->mp_sbuf.size - dt->mp_buf_write_size);
     flb_input_buf_size_set(in);
     flb_debug("[input %s] [mem buf] size = %lu", in->name, in->mp_total_buf_size);
 
@@ -706,6 +717,9 @@ int flb_input_dyntag_append_obj(struct flb_input_instance *in,
 int flb_input_dyntag_append_raw(struct flb_input_instance *in,
                                 char *tag, size_t tag_len,
                                 void *buf, size_t buf_size);
+struct flb_input_dyntag *flb_input_dyntag_write_start(struct flb_input_instance *in,
+                                                      char *tag, size_t tag_len);
+int flb_input_dyntag_write_end(struct flb_input_dyntag *dt);
 void *flb_input_flush(struct flb_input_instance *i_ins, size_t *size);
 void *flb_input_dyntag_flush(struct flb_input_dyntag *dt, size_t *size);
 void flb_input_dyntag_exit(struct flb_input_instance *in);
@@ -49,6 +49,15 @@ extern FLB_TLS_DEFINE(struct flb_log, flb_log_ctx)
 #define FLB_LOG_EVENT    MK_EVENT_NOTIFICATION
 #define FLB_LOG_MNG      1024
 
+/* Messages on the manager channel */
+#define FLB_LOG_MNG_STOP     1
+#define FLB_LOG_MNG_REOPEN   2
+
+#define FLB_LOG_MSG_SIZE     1024  /* max size of a message            */
+#define FLB_LOG_RING_SIZE    256   /* messages queued per thread       */
+#define FLB_LOG_IOV          64    /* messages per write               */
+#define FLB_LOG_TIMER        1     /* seconds between periodic checks  */
+
 /* Logging main context */
 struct flb_log {
     struct mk_event event;     /* worker event for manager */
@@ -59,6 +68,17 @@ struct flb_log {
     pthread_t tid;             /* thread ID   */
     struct flb_worker *worker; /* non-real worker reference */
     struct mk_event_loop *evl;
+
+    /* Collector state */
+    int fd;                    /* log file, -1 if not open */
+    struct mk_event event_timer;
+
+    /* Repeated messages */
+    int repeated;              /* times the last message was repeated */
+    int last_type;
+    size_t last_size;
+    char last[FLB_LOG_MSG_SIZE];
+    char notice[256];
 };
 
 static inline int flb_log_check(int l) {
@@ -78,6 +98,7 @@ struct flb_log *flb_log_init(struct flb_config *config, int type,
                              int level, char *out);
 int flb_log_set_level(struct flb_config *config, int level);
 int flb_log_set_file(struct flb_config *config, char *out);
+int flb_log_reopen(struct flb_config *config);
 
 int flb_log_stop(struct flb_log *log, struct flb_config *config);
 void flb_log_print(int type, const char *file, int line, const char *fmt, ...);
@@ -109,6 +130,7 @@ void flb_log_print(int type, const char *file, int line, const char *fmt, ...);
 #endif
 
 int flb_log_worker_init(void *data);
+void flb_log_worker_destroy(void *data);
 int flb_errno_print(int errnum, const char *file, int line);
 
 #ifdef __FILENAME__
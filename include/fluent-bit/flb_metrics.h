@@ -24,6 +24,10 @@
 #ifndef FLB_METRICS_H
 #define FLB_METRICS_H
 
+#include <time.h>
+#include <stdint.h>
+#include <monkey/mk_core.h>
+
 /* Metrics IDs for general purpose (used by core and Plugins */
 #define FLB_METRIC_N_RECORDS   0
 #define FLB_METRIC_N_BYTES     1
@@ -34,25 +38,76 @@
 #define FLB_METRIC_OUT_RETRY          13
 #define FLB_METRIC_OUT_RETRY_FAILED   14
 
+/* Histograms */
+#define FLB_METRIC_OUT_FLUSH_TIME     15   /* flush start to return     */
+#define FLB_METRIC_OUT_TASK_AGE       16   /* task creation to delivery */
+#define FLB_METRIC_OUT_RETRY_DELAY    17   /* scheduled retry wait      */
+#define FLB_METRIC_FILTER_TIME        20   /* filter time per chunk     */
+
+/*
+ * Metric IDs index a fixed table, an ID must be lower than FLB_METRICS_MAX.
+ *
+ * Values are not stored in a single counter: every thread updating metrics
+ * is assigned one of FLB_METRICS_SHARDS shards and only adds to its own
+ * copy with a relaxed atomic, shards are cache line aligned so the engine
+ * and the output workers do not write to the same lines. Shards are merged
+ * when the values are read (flb_metrics_get_id(), flb_metrics_dump_values()).
+ */
+#define FLB_METRICS_MAX          32
+#define FLB_METRICS_SHARDS       8
+#define FLB_METRICS_CACHE_LINE   64
+
+#define FLB_METRIC_COUNTER       0
+#define FLB_METRIC_HISTOGRAM     1
+
+/* Histogram buckets, upper bounds in microseconds (100us to 5m) */
+#define FLB_METRICS_HIST_BUCKETS 19
+
+struct flb_metrics_shard {
+    uint64_t val[FLB_METRICS_MAX];
+} __attribute__((aligned(FLB_METRICS_CACHE_LINE)));
+
+struct flb_metrics_hist {
+    uint64_t count;
+    uint64_t sum;                                   /* microseconds */
+    uint64_t buckets[FLB_METRICS_HIST_BUCKETS + 1]; /* last one: +Inf */
+} __attribute__((aligned(FLB_METRICS_CACHE_LINE)));
+
 struct flb_metric {
     int id;
+    int type;
     int title_len;
     char title[32];
-    size_t val;
+    size_t val;                      /* merged value of a counter      */
+    struct flb_metrics_hist *hist;   /* histogram shards               */
     struct mk_list _head;
 };
 
 struct flb_metrics {
+    struct flb_metrics_shard shards[FLB_METRICS_SHARDS];
     int title_len;         /* Title string length */
     char title[32];        /* Title or id for this metrics context */
     int count;             /* Total count of metrics registered */
+    struct flb_metric *index[FLB_METRICS_MAX];
     struct mk_list list;   /* Head of metrics list */
 };
 
+/* Monotonic time in microseconds, used to measure latencies */
+static inline uint64_t flb_metrics_time()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 struct flb_metrics *flb_metrics_create(char *title);
 struct flb_metric *flb_metrics_get_id(int id, struct flb_metrics *metrics);
 int flb_metrics_add(int id, char *title, struct flb_metrics *metrics);
+int flb_metrics_add_histogram(int id, char *title,
+                              struct flb_metrics *metrics);
 int flb_metrics_sum(int id, size_t val, struct flb_metrics *metrics);
+int flb_metrics_observe(int id, uint64_t usec, struct flb_metrics *metrics);
 int flb_metrics_print(struct flb_metrics *metrics);
 int flb_metrics_dump_values(char **out_buf, size_t *out_size,
                             struct flb_metrics *me);
@@ -36,6 +36,7 @@
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_network.h>
 #include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_engine_bus.h>
 #include <fluent-bit/flb_task.h>
 #include <fluent-bit/flb_thread.h>
 #include <fluent-bit/flb_mem.h>
@@ -47,6 +48,8 @@
 #define FLB_OUTPUT_PLUGIN_PROXY  1
 
 struct flb_output_instance;
+struct flb_router_rule;
+struct flb_engine_worker;
 
 struct flb_output_plugin {
     /*
@@ -119,6 +122,15 @@ struct flb_output_instance {
     int retry_limit;                     /* max of retries allowed       */
     int use_tls;                         /* bool, try to use TLS for I/O */
     char *match;                         /* match rule for tag/routing   */
+    struct flb_router_rule *match_rule;  /* compiled match rule          */
+
+    /* Engine worker that runs the flushes (NULL: the engine) */
+    struct flb_engine_worker *worker;
+
+    /* Network keepalive for upstream connections */
+    int net_keepalive;                   /* bool, re-use connections     */
+    int net_keepalive_idle_timeout;      /* max idle time (seconds)      */
+    int net_keepalive_max_recycle;       /* max times a conn is re-used  */
 
 #ifdef FLB_HAVE_TLS
     int tls_verify;                      /* Verify certs (default: true) */
@@ -195,11 +207,17 @@ struct flb_output_instance {
 
 struct flb_output_thread {
     int id;                            /* out-thread ID      */
+    int ret;                           /* flush return value */
+    int done;                          /* flush has finished */
+    struct flb_engine_worker *worker;  /* engine worker      */
     void *buffer;                      /* output buffer      */
     struct flb_task *task;             /* Parent flb_task    */
     struct flb_config *config;         /* FLB context        */
     struct flb_output_instance *o_ins; /* output instance    */
     struct flb_thread *parent;         /* parent thread addr */
+#ifdef FLB_HAVE_METRICS
+    uint64_t start;                    /* flush start, usec  */
+#endif
     struct mk_list _head;              /* Link to struct flb_task->threads */
 };
 
@@ -256,8 +274,9 @@ static FLB_INLINE void cb_output_thread_destroy(void *data)
 /*
  * libco do not support parameters in the entrypoint function due to the
  * complexity of implementation in terms of architecture and compiler, but
- * it provide a workaround using a global structure as a middle entry-point
- * that achieve the same stuff.
+ * it provide a workaround using a structure as a middle entry-point
+ * that achieve the same stuff. The structure is referenced through a
+ * thread-local pointer since engine workers create co-routines too.
  */
 struct flb_libco_out_params {
     void  *data;
@@ -271,7 +290,7 @@ struct flb_libco_out_params {
     struct flb_thread *th;
 };
 
-struct flb_libco_out_params libco_param;
+extern FLB_TLS_DEFINE(struct flb_libco_out_params, libco_param_ctx)
 
 static FLB_INLINE void output_params_set(struct flb_thread *th,
                               void *data, size_t bytes,
@@ -280,6 +299,8 @@ static FLB_INLINE void output_params_set(struct flb_thread *th,
                               struct flb_output_plugin *out_plugin,
                               void *out_context, struct flb_config *config)
 {
+    struct flb_libco_out_params libco_param;
+
     /* Callback parameters in order */
     libco_param.data        = data;
     libco_param.bytes       = bytes;
@@ -291,20 +312,22 @@ static FLB_INLINE void output_params_set(struct flb_thread *th,
     libco_param.out_plugin  = out_plugin;
 
     libco_param.th = th;
+    FLB_TLS_SET(libco_param_ctx, &libco_param);
     co_switch(th->callee);
 }
 
 static FLB_INLINE void output_pre_cb_flush()
 {
-    void *data   = libco_param.data;
-    size_t bytes = libco_param.bytes;
-    char *tag    = libco_param.tag;
-    int tag_len  = libco_param.tag_len;
-    struct flb_input_instance *i_ins = libco_param.i_ins;
-    struct flb_output_plugin *out_p  = libco_param.out_plugin;
-    void *out_context                = libco_param.out_context;
-    struct flb_config *config        = libco_param.config;
-    struct flb_thread *th            = libco_param.th;
+    struct flb_libco_out_params *libco_param = FLB_TLS_GET(libco_param_ctx);
+    void *data   = libco_param->data;
+    size_t bytes = libco_param->bytes;
+    char *tag    = libco_param->tag;
+    int tag_len  = libco_param->tag_len;
+    struct flb_input_instance *i_ins = libco_param->i_ins;
+    struct flb_output_plugin *out_p  = libco_param->out_plugin;
+    void *out_context                = libco_param->out_context;
+    struct flb_config *config        = libco_param->config;
+    struct flb_thread *th            = libco_param->th;
 
     /*
      * Until this point the th->callee already set the variables, so we
@@ -349,11 +372,17 @@ struct flb_thread *flb_output_thread(struct flb_task *task,
      * 'id' is always incremental.
      */
     out_th->id      = 0;
+    out_th->ret     = 0;
+    out_th->done    = FLB_FALSE;
+    out_th->worker  = NULL;
     out_th->o_ins   = o_ins;
     out_th->task    = task;
     out_th->buffer  = buf;
     out_th->config  = config;
     out_th->parent  = th;
+#ifdef FLB_HAVE_METRICS
+    out_th->start   = flb_metrics_time();
+#endif
 
     th->caller = co_active();
     th->callee = co_create(FLB_THREAD_STACK_SIZE,
@@ -421,43 +450,54 @@ struct flb_thread *flb_output_thread(struct flb_task *task,
  * a return value. The return value is either FLB_OK, FLB_RETRY or FLB_ERROR.
  */
 static inline void flb_output_return(int ret, struct flb_thread *th) {
-    int n;
-    uint32_t set;
-    uint64_t val;
     struct flb_task *task;
+    struct flb_engine_bus_event ev;
     struct flb_output_thread *out_th;
 #ifdef FLB_HAVE_METRICS
     int records;
+    uint64_t now;
 #endif
 
     out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
     task = out_th->task;
 
     /*
-     * To compose the signal event the relevant info is:
-     *
-     * - Unique Task events id: 2 in this case
-     * - Return value: FLB_OK (0) or FLB_ERROR (1)
-     * - Task ID
-     *
-     * We put together the return value with the task_id on the 32 bits at right
+     * The completion record carries the return value (FLB_OK, FLB_ERROR or
+     * FLB_RETRY), the Task ID and the output thread ID.
      */
-    set = FLB_TASK_SET(ret, task->id, out_th->id);
-    val = FLB_BITS_U64_SET(2 /* FLB_ENGINE_TASK */, set);
-
-    n = flb_pipe_w(task->config->ch_manager[1], &val, sizeof(val));
-    if (n == -1) {
-        flb_errno();
+    if (out_th->worker) {
+        /*
+         * Running in an engine worker: the worker reports the result to
+         * the engine once this co-routine yields.
+         */
+        out_th->ret  = ret;
+        out_th->done = FLB_TRUE;
+    }
+    else {
+        ev.type      = 2; /* FLB_ENGINE_TASK */
+        ev.ret       = ret;
+        ev.id        = task->id;
+        ev.thread_id = out_th->id;
+        flb_engine_bus_push(task->config->ch_bus, &ev);
     }
 
 #ifdef FLB_HAVE_METRICS
     if (out_th->o_ins->metrics) {
+        now = flb_metrics_time();
+        flb_metrics_observe(FLB_METRIC_OUT_FLUSH_TIME, now - out_th->start,
+                            out_th->o_ins->metrics);
+
         if (ret == FLB_OK) {
-            records = flb_mp_count(task->buf, task->size);
+            records = task->records;
+            if (records < 0) {
+                records = flb_mp_count(task->buf, task->size);
+            }
             flb_metrics_sum(FLB_METRIC_OUT_OK_RECORDS, records,
                             out_th->o_ins->metrics);
             flb_metrics_sum(FLB_METRIC_OUT_OK_BYTES, task->size,
                             out_th->o_ins->metrics);
+            flb_metrics_observe(FLB_METRIC_OUT_TASK_AGE, now - task->created,
+                                out_th->o_ins->metrics);
         }
         else if (ret == FLB_ERROR) {
             flb_metrics_sum(FLB_METRIC_OUT_ERROR, 1, out_th->o_ins->metrics);
@@ -488,11 +528,36 @@ static inline void flb_output_return_do(int x)
     flb_output_return_do(x);                                            \
     return
 
+/*
+ * Number of records of the chunk being flushed, as counted by the input
+ * when they were appended. It returns -1 if it's unknown, e.g: chunks that
+ * come from the buffering storage.
+ */
+static inline int flb_output_flush_records()
+{
+#ifdef FLB_HAVE_FLUSH_LIBCO
+    struct flb_thread *th;
+    struct flb_output_thread *out_th;
+
+    th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+    if (!th) {
+        return -1;
+    }
+
+    out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
+    return out_th->task->records;
+#else
+    return -1;
+#endif
+}
+
 struct flb_output_instance *flb_output_new(struct flb_config *config,
                                            char *output, void *data);
 
 int flb_output_set_property(struct flb_output_instance *out, char *k, char *v);
 char *flb_output_get_property(char *key, struct flb_output_instance *o_ins);
+void flb_output_upstream_set(struct flb_upstream *u,
+                             struct flb_output_instance *ins);
 
 void flb_output_pre_run(struct flb_config *config);
 void flb_output_exit(struct flb_config *config);
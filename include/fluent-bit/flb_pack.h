@@ -25,13 +25,38 @@
 #include <jsmn/jsmn.h>
 #include <msgpack.h>
 
+/* Map or array header to be rewritten once its size is known */
+struct flb_pack_fixup {
+    int type;             /* JSMN_OBJECT or JSMN_ARRAY      */
+    uint32_t count;       /* number of entries              */
+    size_t offset;        /* header offset in the output    */
+};
+
 struct flb_pack_state {
     int multiple;         /* support multiple jsons? */
-    int tokens_count;     /* number of parsed tokens */
-    int tokens_size;      /* array size of tokens    */
     int last_byte;        /* last byte of a full msg */
-    jsmntok_t *tokens;    /* tokens array            */
-    jsmn_parser parser;   /* parser state            */
+
+    /* Streaming parser */
+    size_t pos;           /* next input byte to scan                */
+    int expect;           /* next expected token                    */
+    int token;            /* token in progress: string or primitive */
+    size_t token_start;   /* input offset of the token in progress  */
+    int escape;           /* escape sequence in progress            */
+
+    /* Open containers, index of their fixup */
+    int depth;
+    int levels_size;
+    int *levels;
+
+    /* Headers of the containers of the message in progress */
+    int fixups_count;
+    int fixups_size;
+    struct flb_pack_fixup *fixups;
+
+    /* Output */
+    size_t msg_start;     /* output offset of the message in progress */
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
 };
 
 int flb_pack_json(char *js, size_t len, char **buffer, size_t *size);
@@ -50,6 +75,8 @@ char* flb_msgpack_to_json_str(size_t size, msgpack_object *obj);
 int flb_msgpack_raw_to_json_str(char *buf, size_t buf_size,
                                 char **out_buf, size_t *out_size);
 flb_sds_t flb_msgpack_raw_to_json_sds(void *in_buf, size_t in_size);
+int flb_msgpack_to_json_sds(flb_sds_t *s, msgpack_object *obj);
+flb_sds_t flb_msgpack_raw_to_json_lines(void *in_buf, size_t in_size);
 
 int flb_pack_time_now(msgpack_packer *pck);
 int flb_msgpack_expand_map(char *map_data, size_t map_size,
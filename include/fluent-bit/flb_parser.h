@@ -25,6 +25,7 @@
 #include <fluent-bit/flb_regex.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_parser_time.h>
 #include <msgpack.h>
 
 #define FLB_PARSER_REGEX 1
@@ -56,6 +57,7 @@ struct flb_parser {
     int time_with_year;   /* do time_fmt consider a year (%Y) ? */
     char *time_fmt_year;
     int time_with_tz;     /* do time_fmt consider a timezone ?  */
+    struct flb_parser_time *time_parser; /* compiled time_fmt and cache */
     struct flb_regex *regex;
     struct mk_list _head;
 };
@@ -91,6 +93,9 @@ void flb_parser_destroy(struct flb_parser *parser);
 struct flb_parser *flb_parser_get(char *name, struct flb_config *config);
 int flb_parser_do(struct flb_parser *parser, char *buf, size_t length,
                   void **out_buf, size_t *out_size, struct flb_time *out_time);
+int flb_parser_do_pack(struct flb_parser *parser, char *buf, size_t length,
+                       msgpack_packer *pck, int extra_keys,
+                       struct flb_time *out_time);
 
 void flb_parser_exit(struct flb_config *config);
 int flb_parser_tzone_offset(char *str, int len, int *tmdiff);
@@ -0,0 +1,85 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_PARSER_TIME_H
+#define FLB_PARSER_TIME_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_time.h>
+#include <time.h>
+
+#define FLB_PARSER_TIME_MAX_OPS    32
+#define FLB_PARSER_TIME_KEY_SIZE   64
+
+/* Time format operations */
+#define FLB_PARSER_TIME_LITERAL    0   /* exact character         */
+#define FLB_PARSER_TIME_SPACE      1   /* zero or more spaces     */
+#define FLB_PARSER_TIME_YEAR       2   /* %Y                      */
+#define FLB_PARSER_TIME_YEAR2      3   /* %y                      */
+#define FLB_PARSER_TIME_MONTH      4   /* %m                      */
+#define FLB_PARSER_TIME_MONTH_NAME 5   /* %b, %h, %B              */
+#define FLB_PARSER_TIME_DAY        6   /* %d, %e                  */
+#define FLB_PARSER_TIME_HOUR       7   /* %H                      */
+#define FLB_PARSER_TIME_MINUTE     8   /* %M                      */
+#define FLB_PARSER_TIME_SECOND     9   /* %S                      */
+#define FLB_PARSER_TIME_FRAC       10  /* %L, fractional seconds  */
+#define FLB_PARSER_TIME_TZ         11  /* %z                      */
+
+struct flb_parser;
+
+struct flb_parser_time_op {
+    int type;
+    char c;                    /* FLB_PARSER_TIME_LITERAL */
+};
+
+/*
+ * Compiled Time_Format. Common layouts (ISO8601/RFC3339, Apache common log,
+ * RFC3164 syslog, ...) only use a handful of conversions that are parsed
+ * here by hand; formats using anything else keep going through strptime(3).
+ *
+ * The context also caches the last result: records in a burst usually share
+ * the same second, so when the date/time part of the string (the 'key') did
+ * not change only the fractional seconds and timezone are parsed again. The
+ * cache is not locked, parsers are used from the engine thread.
+ */
+struct flb_parser_time {
+    int n_ops;
+    int key_op;                /* last op of the cached prefix, -1 = none */
+    int with_year;
+    struct flb_parser_time_op ops[FLB_PARSER_TIME_MAX_OPS];
+
+    /* last result */
+    char key[FLB_PARSER_TIME_KEY_SIZE];
+    int key_len;               /* 0 = empty cache                   */
+    time_t epoch;              /* epoch of the key, before timezone */
+    double frac;               /* strptime(3) path only             */
+    int time_offset;           /* strptime(3) path only             */
+
+    /* year assumed by year-less formats and the time range it covers */
+    int year;
+    time_t year_start;
+    time_t year_end;
+};
+
+struct flb_parser_time *flb_parser_time_create(char *time_fmt);
+void flb_parser_time_destroy(struct flb_parser_time *pt);
+int flb_parser_time_parse(char *time_str, size_t tsize, time_t now,
+                          struct flb_parser *parser, struct flb_time *out);
+
+#endif
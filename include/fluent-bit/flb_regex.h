@@ -29,9 +29,18 @@
 
 #include <onigmo.h>
 
+/*
+ * A compiled regex keeps its own match region, reused by every search: a
+ * regex can only run one search at a time and the region is valid until the
+ * next search. 'literal' is a substring every match must contain, inputs
+ * without it are rejected before running the regex engine.
+ */
 struct flb_regex {
     unsigned char *pattern;
     OnigRegex regex;
+    OnigRegion *region;
+    unsigned char *literal;
+    size_t literal_len;
 };
 
 struct flb_regex_search {
@@ -48,6 +57,7 @@ int flb_regex_init();
 struct flb_regex *flb_regex_create(unsigned char *pattern);
 ssize_t flb_regex_do(struct flb_regex *r, unsigned char *str, size_t slen,
                      struct flb_regex_search *result);
+int flb_regex_match(struct flb_regex *r, unsigned char *str, size_t slen);
 int flb_regex_parse(struct flb_regex *r, struct flb_regex_search *result,
                     void (*cb_match) (unsigned char *,          /* name  */
                                       unsigned char *, size_t,  /* value */
@@ -0,0 +1,138 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_RING_H
+#define FLB_RING_H
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_macros.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#define FLB_RING_CACHE_LINE   64
+
+/*
+ * Lock-free single-producer/single-consumer ring buffer of fixed size
+ * entries. One thread pushes and one thread pops, the head and tail
+ * counters are written by a single side each and live in different cache
+ * lines so producer and consumer don't bounce them.
+ */
+struct flb_ring {
+    /* Consumer side */
+    uint64_t head;
+    char pad0[FLB_RING_CACHE_LINE - sizeof(uint64_t)];
+
+    /* Producer side */
+    uint64_t tail;
+    char pad1[FLB_RING_CACHE_LINE - sizeof(uint64_t)];
+
+    /* Read-only after creation */
+    uint64_t mask;                 /* number of entries - 1 */
+    size_t entry_size;             /* bytes per entry       */
+    char *data;
+};
+
+struct flb_ring *flb_ring_create(size_t entry_size, size_t entries);
+void flb_ring_destroy(struct flb_ring *r);
+
+/* Push an entry (producer thread only), returns -1 if the ring is full */
+static FLB_INLINE int flb_ring_push(struct flb_ring *r, void *entry)
+{
+    uint64_t head;
+    uint64_t tail;
+
+    tail = r->tail;
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if (tail - head > r->mask) {
+        return -1;
+    }
+
+    memcpy(r->data + ((tail & r->mask) * r->entry_size),
+           entry, r->entry_size);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Pop an entry (consumer thread only), returns -1 if the ring is empty */
+static FLB_INLINE int flb_ring_pop(struct flb_ring *r, void *entry)
+{
+    uint64_t head;
+    uint64_t tail;
+
+    head = r->head;
+    tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return -1;
+    }
+
+    memcpy(entry, r->data + ((head & r->mask) * r->entry_size),
+           r->entry_size);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/*
+ * Zero-copy variants: the producer gets the next free slot with
+ * flb_ring_reserve() and publishes it with flb_ring_commit(), the consumer
+ * looks at the pending entries with flb_ring_peek() and frees the first
+ * 'n' of them with flb_ring_release().
+ */
+static FLB_INLINE void *flb_ring_reserve(struct flb_ring *r)
+{
+    uint64_t head;
+    uint64_t tail;
+
+    tail = r->tail;
+    head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if (tail - head > r->mask) {
+        return NULL;
+    }
+
+    return r->data + ((tail & r->mask) * r->entry_size);
+}
+
+static FLB_INLINE void flb_ring_commit(struct flb_ring *r)
+{
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Get the pending entry number 'n', NULL if there are not so many */
+static FLB_INLINE void *flb_ring_peek(struct flb_ring *r, uint64_t n)
+{
+    uint64_t head;
+    uint64_t tail;
+
+    head = r->head;
+    tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (tail - head <= n) {
+        return NULL;
+    }
+
+    return r->data + (((head + n) & r->mask) * r->entry_size);
+}
+
+static FLB_INLINE void flb_ring_release(struct flb_ring *r, uint64_t n)
+{
+    __atomic_store_n(&r->head, r->head + n, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -22,12 +22,69 @@
 
 #include <fluent-bit/flb_output.h>
 
+struct flb_filter_instance;
+
+/* Max number of Tags kept in the routes cache */
+#define FLB_ROUTER_CACHE_SIZE   1024
+#define FLB_ROUTER_CACHE_MAX    8192
+
 struct flb_router_path {
     struct flb_output_instance *ins;
     struct mk_list _head;
 };
 
+/* A literal segment of a match rule */
+struct flb_router_part {
+    int len;
+    char *str;
+};
+
+/*
+ * Compiled match rule: the pattern is split by '*' in literal parts, the
+ * first and last parts are anchored to the start and end of the Tag if the
+ * pattern don't start/end with a wildcard.
+ */
+struct flb_router_rule {
+    int match_all;                  /* pattern is '*'             */
+    int exact;                      /* pattern has no wildcards   */
+    int anchor_start;               /* first part is a prefix     */
+    int anchor_end;                 /* last part is a suffix      */
+    int n_parts;                    /* number of literal parts    */
+    struct flb_router_part *parts;  /* literal parts              */
+    char *buf;                      /* copy of the pattern        */
+};
+
+/*
+ * Routes resolved for a Tag, stored as the value of the routes cache. The
+ * array contains first the output instances followed by the filter
+ * instances, both in the order they were registered.
+ */
+struct flb_router_routes {
+    int n_outputs;
+    int n_filters;
+    void *ins[];
+};
+
+#define flb_router_routes_output(r, i) \
+    ((struct flb_output_instance *) (r)->ins[i])
+#define flb_router_routes_filter(r, i) \
+    ((struct flb_filter_instance *) (r)->ins[(r)->n_outputs + i])
+
 int flb_router_match(const char *tag, const char *match);
+
+struct flb_router_rule *flb_router_rule_create(const char *match);
+void flb_router_rule_destroy(struct flb_router_rule *rule);
+int flb_router_rule_match(struct flb_router_rule *rule,
+                          const char *tag, int tag_len);
+int flb_router_output_match(struct flb_output_instance *o_ins,
+                            const char *tag, int tag_len);
+int flb_router_filter_match(struct flb_filter_instance *f_ins,
+                            const char *tag, int tag_len);
+
+struct flb_router_routes *flb_router_routes_get(struct flb_config *config,
+                                                const char *tag, int tag_len);
+void flb_router_cache_invalidate(struct flb_config *config);
+
 int flb_router_io_set(struct flb_config *config);
 void flb_router_exit(struct flb_config *config);
 
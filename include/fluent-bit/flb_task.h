@@ -30,27 +30,14 @@
 #define FLB_TASK_RUNNING  1
 
 /*
- * Macro helpers to determinate return value, task_id and thread_id. When an
- * output plugin returns, it must call FLB_OUTPUT_RETURN(val) where val is
- * the return value, as of now defined as FLB_OK or FLB_ERROR.
- *
- * The FLB_OUTPUT_RETURN macro lookup the current active 'engine thread' and
- * it 'engine task' associated, so it emits an event to the main event loop
- * indicating an output thread has done. In order to specify return values
- * and the proper IDs an unsigned 32 bits number is used:
- *
- *     AAAA     BBBBBBBBBBBBBB CCCCCCCCCCCCCC   > 32 bit number
- *       ^            ^              ^
- *    4 bits       14 bits        14 bits
- *  return val     task_id       thread_id
+ * When an output plugin returns, it must call FLB_OUTPUT_RETURN(val) where
+ * val is the return value, as of now defined as FLB_OK, FLB_ERROR or
+ * FLB_RETRY. The FLB_OUTPUT_RETURN macro lookup the current active 'engine
+ * thread' and it 'engine task' associated, and pushes a completion record
+ * with the return value, the task_id and the thread_id to the engine bus
+ * (see flb_engine_bus.h).
  */
 
-#define FLB_TASK_RET(val)  (val >> 28)
-#define FLB_TASK_ID(val)   (uint32_t) (val & 0xfffc000) >> 14
-#define FLB_TASK_TH(val)   (val & 0x3fff)
-#define FLB_TASK_SET(ret, task_id, th_id)               \
-    (uint32_t) ((ret << 28) | (task_id << 14) | th_id)
-
 struct flb_task_route {
     struct flb_output_instance *out;
     struct mk_list _head;
@@ -84,6 +71,7 @@ struct flb_task {
     char *tag;                          /* original tag              */
     char *buf;                          /* buffer                    */
     size_t size;                        /* buffer data size          */
+    int records;                        /* records in buf, -1 unknown */
 #ifdef FLB_HAVE_BUFFERING
     int worker_id;                      /* Buffer worker that owns this task */
     int qchunk_id;                      /* qchunk id if it comes from buffer */
@@ -97,6 +85,9 @@ struct flb_task {
     struct mk_list retries;             /* queued in-memory retries      */
     struct mk_list _head;               /* link to input_instance        */
     struct flb_config *config;          /* parent flb config             */
+#ifdef FLB_HAVE_METRICS
+    uint64_t created;                   /* creation time, usec (monotonic) */
+#endif
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_t mutex_threads;
@@ -106,6 +97,7 @@ struct flb_task {
 struct flb_task *flb_task_create(uint64_t ref_id,
                                  char *buf,
                                  size_t size,
+                                 int records,
                                  struct flb_input_instance *i_ins,
                                  struct flb_input_dyntag *dt,
                                  char *tag,
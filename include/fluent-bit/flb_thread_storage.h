@@ -41,6 +41,7 @@
 
 /* FIXME: this extern should be auto-populated from flb_thread_storage.h */
 extern FLB_TLS_DEFINE(struct flb_worker, flb_worker_ctx)
+extern FLB_TLS_DEFINE(struct mk_event_loop, flb_engine_evl)
 
 
 #endif /* !FLB_THREAD_STORAGE_H */
@@ -38,9 +38,14 @@
  *   #define  FLB_IO_TCP    1
  *   #define  FLB_IO_TLS    2
  *   #define  FLB_IO_ASYNC  8
+ *   #define  FLB_IO_TCP_KA 32
  * ---
  */
 
+/* Keepalive defaults */
+#define FLB_UPSTREAM_KA_IDLE_TIMEOUT    30   /* seconds */
+#define FLB_UPSTREAM_KA_MAX_RECYCLE   2000   /* max times a conn is re-used */
+
 /* Upstream handler */
 struct flb_upstream {
     struct mk_event_loop *evl;
@@ -51,6 +56,20 @@ struct flb_upstream {
 
     int n_connections;
 
+    /*
+     * Keepalive: when the FLB_IO_TCP_KA flag is set, released connections
+     * are not closed but moved to the 'av_queue' so they can be re-used
+     * later. A connection is discarded if it stays idle more than
+     * 'ka_idle_timeout' seconds or if it was already used 'ka_max_recycle'
+     * times (a value minor or equal to zero means no limit).
+     */
+    int ka_idle_timeout;
+    int ka_max_recycle;
+
+    /* Counters: new TCP connections vs re-used keepalive connections */
+    uint64_t n_conn_new;
+    uint64_t n_conn_reused;
+
     /*
      * An upstream handler may keep open up to 'max_connections' of
      * TCP connections. A value minor or equal to zero means it will
@@ -87,9 +106,22 @@ struct flb_upstream_conn {
     struct mk_event event;
     struct flb_thread *thread;
 
+    /* Event loop where the connection events are registered */
+    struct mk_event_loop *evl;
+
     flb_sockfd_t fd;
     int connect_count;
 
+    /*
+     * Keepalive: number of times this connection has been re-used, the
+     * last time it was released and if it can be recycled once is
+     * released by the caller (e.g: the HTTP client unset this flag if the
+     * server replied with 'Connection: close').
+     */
+    int ka_count;
+    int recycle;
+    time_t ts_available;
+
     /* Upstream parent */
     struct flb_upstream *u;
 
@@ -112,6 +144,8 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
                                          char *host, int port, int flags,
                                          void *tls);
 int flb_upstream_destroy(struct flb_upstream *u);
+void flb_upstream_keepalive(struct flb_upstream *u, int enabled,
+                            int idle_timeout, int max_recycle);
 
 struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u);
 int flb_upstream_conn_release(struct flb_upstream_conn *u_conn);
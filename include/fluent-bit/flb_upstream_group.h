@@ -0,0 +1,91 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_UPSTREAM_GROUP_H
+#define FLB_UPSTREAM_GROUP_H
+
+#include <time.h>
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_upstream.h>
+
+/* Balancing modes */
+#define FLB_UPSTREAM_GROUP_RR       0  /* smooth weighted round-robin     */
+#define FLB_UPSTREAM_GROUP_LEAST    1  /* least outstanding bytes/weight  */
+
+/* Passive health check: backoff of a failed node (seconds) */
+#define FLB_UPSTREAM_NODE_BACKOFF_BASE   1
+#define FLB_UPSTREAM_NODE_BACKOFF_MAX   60
+
+/*
+ * A node is an upstream with a weight. Backup nodes only receive data
+ * when no primary node is healthy.
+ */
+struct flb_upstream_node {
+    int weight;
+    int backup;
+    int current_weight;            /* state of the round-robin        */
+
+    /* Data being flushed through this node */
+    int in_flight;
+    size_t outstanding;
+
+    /* Health: consecutive failures and when the node can be tried again */
+    int failures;
+    time_t retry_at;
+
+    uint64_t n_ok;
+    uint64_t n_failed;
+
+    struct flb_upstream *u;
+    struct mk_list _head;
+};
+
+/*
+ * An upstream group spreads the flushes of an output over many nodes, a
+ * node is selected for every flush so many of them can be in flight at
+ * the same time on different nodes. The caller reports the result with
+ * flb_upstream_group_done(), failed nodes are skipped until their backoff
+ * expires.
+ */
+struct flb_upstream_group {
+    int balance;
+    int n_nodes;
+    int cursor;                    /* first node checked, least mode  */
+    struct mk_list nodes;
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_t mutex;
+#endif
+};
+
+struct flb_upstream_group *flb_upstream_group_create(int balance);
+void flb_upstream_group_destroy(struct flb_upstream_group *g);
+struct flb_upstream_node *flb_upstream_group_add(struct flb_upstream_group *g,
+                                                 struct flb_upstream *u,
+                                                 int weight, int backup);
+
+struct flb_upstream_node *flb_upstream_group_next(struct flb_upstream_group *g,
+                                                  size_t bytes);
+void flb_upstream_group_done(struct flb_upstream_group *g,
+                             struct flb_upstream_node *node,
+                             size_t bytes, int ok);
+
+#endif
@@ -22,6 +22,7 @@
 
 #include <fluent-bit/flb_config.h>
 
+struct flb_ring;
 struct flb_config;
 
 struct flb_worker {
@@ -32,8 +33,11 @@ struct flb_worker {
     void *data;                /* opaque data */
     pthread_t tid;             /* thread ID   */
 
-    /* Logging */
+    /* Logging: messages ring and collector notification */
     int log[2];
+    int log_notified;
+    uint64_t log_dropped;
+    struct flb_ring *log_ring;
 
     /* Runtime context */
     void *config;
@@ -45,6 +45,53 @@ static void delete_rules(struct grep_ctx *ctx)
         mk_list_del(&rule->_head);
         flb_free(rule);
     }
+
+    flb_free(ctx->fields);
+    flb_free(ctx->values);
+    ctx->fields = NULL;
+    ctx->values = NULL;
+    ctx->fields_count = 0;
+}
+
+/* Register the distinct fields used by the rules */
+static int set_fields(struct grep_ctx *ctx)
+{
+    int i;
+    int count;
+    struct mk_list *head;
+    struct grep_rule *rule;
+
+    count = mk_list_size(&ctx->rules);
+    if (count == 0) {
+        return 0;
+    }
+
+    ctx->fields = flb_malloc(sizeof(struct grep_field) * count);
+    ctx->values = flb_malloc(sizeof(msgpack_object *) * count);
+    if (!ctx->fields || !ctx->values) {
+        flb_errno();
+        return -1;
+    }
+
+    mk_list_foreach(head, &ctx->rules) {
+        rule = mk_list_entry(head, struct grep_rule, _head);
+
+        for (i = 0; i < ctx->fields_count; i++) {
+            if (ctx->fields[i].len == rule->field_len &&
+                strncmp(ctx->fields[i].name, rule->field, rule->field_len) == 0) {
+                break;
+            }
+        }
+
+        if (i == ctx->fields_count) {
+            ctx->fields[i].name = rule->field;
+            ctx->fields[i].len = rule->field_len;
+            ctx->fields_count++;
+        }
+        rule->field_id = i;
+    }
+
+    return 0;
 }
 
 static int set_rules(struct grep_ctx *ctx, struct flb_filter_instance *f_ins)
@@ -116,52 +163,66 @@ static int set_rules(struct grep_ctx *ctx, struct flb_filter_instance *f_ins)
     return 0;
 }
 
-/* Given a msgpack record, do some filter action based on the defined rules */
-static inline int grep_filter_data(msgpack_object map, struct grep_ctx *ctx)
+/* Lookup the values of all the rule fields in one pass over the record */
+static inline void grep_lookup_fields(msgpack_object map, struct grep_ctx *ctx)
 {
     int i;
+    int f;
     int klen;
-    int vlen;
+    int found = 0;
     char *key;
-    char *val;
-    ssize_t ret;
     msgpack_object *k;
-    msgpack_object *v;
-    struct mk_list *head;
-    struct grep_rule *rule;
-
-    /* For each rule, validate against map fields */
-    mk_list_foreach(head, &ctx->rules) {
-        rule = mk_list_entry(head, struct grep_rule, _head);
 
-        /* Lookup target key/value */
-        for (i = 0; i < map.via.map.size; i++) {
-            k = &map.via.map.ptr[i].key;
+    for (f = 0; f < ctx->fields_count; f++) {
+        ctx->values[f] = NULL;
+    }
 
-            if (k->type != MSGPACK_OBJECT_BIN &&
-                k->type != MSGPACK_OBJECT_STR) {
-                continue;
-            }
+    for (i = 0; i < map.via.map.size && found < ctx->fields_count; i++) {
+        k = &map.via.map.ptr[i].key;
 
-            if (k->type == MSGPACK_OBJECT_STR) {
-                key  = (char *) k->via.str.ptr;
-                klen = k->via.str.size;
-            }
-            else {
-                key = (char *) k->via.bin.ptr;
-                klen = k->via.bin.size;
-            }
+        if (k->type == MSGPACK_OBJECT_STR) {
+            key  = (char *) k->via.str.ptr;
+            klen = k->via.str.size;
+        }
+        else if (k->type == MSGPACK_OBJECT_BIN) {
+            key = (char *) k->via.bin.ptr;
+            klen = k->via.bin.size;
+        }
+        else {
+            continue;
+        }
 
-            if (rule->field_len == klen &&
-                strncmp(key, rule->field, klen) == 0) {
+        /* The first key with the field name wins */
+        for (f = 0; f < ctx->fields_count; f++) {
+            if (ctx->values[f] == NULL && ctx->fields[f].len == klen &&
+                strncmp(key, ctx->fields[f].name, klen) == 0) {
+                ctx->values[f] = &map.via.map.ptr[i].val;
+                found++;
                 break;
             }
-
-            k = NULL;
         }
+    }
+}
+
+/* Given a msgpack record, do some filter action based on the defined rules */
+static inline int grep_filter_data(msgpack_object map, struct grep_ctx *ctx)
+{
+    int vlen;
+    char *val;
+    int ret;
+    msgpack_object *v;
+    struct mk_list *head;
+    struct grep_rule *rule;
+
+    grep_lookup_fields(map, ctx);
+
+    /* For each rule, validate against map fields */
+    mk_list_foreach(head, &ctx->rules) {
+        rule = mk_list_entry(head, struct grep_rule, _head);
 
         /* If the key don't exists, take an action */
-        if (!k) {
+        v = ctx->values[rule->field_id];
+        if (!v) {
             if (rule->type == GREP_REGEX) {
                 return GREP_RET_EXCLUDE;
             }
@@ -170,9 +231,6 @@ static inline int grep_filter_data(msgpack_object map, struct grep_ctx *ctx)
             }
         }
 
-        /* Based on the value of the key, do the regex */
-        v = &map.via.map.ptr[i].val;
-
         /* a value must be a string */
         if (v->type == MSGPACK_OBJECT_STR) {
             val  = (char *)v->via.str.ptr;
@@ -186,11 +244,8 @@ static inline int grep_filter_data(msgpack_object map, struct grep_ctx *ctx)
             return GREP_RET_EXCLUDE;
         }
 
-        struct flb_regex_search result;
-
-        ret = flb_regex_do(rule->regex,
-                           (unsigned char *) val, vlen, &result);
-        if (ret != 0) { /* no match */
+        ret = flb_regex_match(rule->regex, (unsigned char *) val, vlen);
+        if (ret != FLB_TRUE) { /* no match */
             if (rule->type == GREP_REGEX) {
                 return GREP_RET_EXCLUDE;
             }
@@ -216,7 +271,7 @@ static int cb_grep_init(struct flb_filter_instance *f_ins,
     struct grep_ctx *ctx;
 
     /* Create context */
-    ctx = flb_malloc(sizeof(struct grep_ctx));
+    ctx = flb_calloc(1, sizeof(struct grep_ctx));
     if (!ctx) {
         flb_errno();
         return -1;
@@ -230,70 +285,37 @@ static int cb_grep_init(struct flb_filter_instance *f_ins,
         return -1;
     }
 
+    ret = set_fields(ctx);
+    if (ret == -1) {
+        delete_rules(ctx);
+        flb_free(ctx);
+        return -1;
+    }
+
     /* Set our context */
     flb_filter_set_context(f_ins, ctx);
     return 0;
 }
 
-static int cb_grep_filter(void *data, size_t bytes,
+static int cb_grep_filter(msgpack_object *map, msgpack_zone *zone,
                           char *tag, int tag_len,
-                          void **out_buf, size_t *out_size,
                           struct flb_filter_instance *f_ins,
                           void *context,
                           struct flb_config *config)
 {
     int ret;
-    int old_size = 0;
-    int new_size = 0;
-    msgpack_unpacked result;
-    msgpack_object map;
-    msgpack_object root;
-    size_t off = 0;
+    (void) zone;
+    (void) tag;
+    (void) tag_len;
     (void) f_ins;
     (void) config;
-    msgpack_sbuffer tmp_sbuf;
-    msgpack_packer tmp_pck;
-
-    /* Create temporal msgpack buffer */
-    msgpack_sbuffer_init(&tmp_sbuf);
-    msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
-
-    /* Iterate each item array and apply rules */
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        root = result.data;
-        if (root.type != MSGPACK_OBJECT_ARRAY) {
-            continue;
-        }
-
-        old_size++;
-
-        /* get time and map */
-        map  = root.via.array.ptr[1];
 
-        ret = grep_filter_data(map, context);
-        if (ret == GREP_RET_KEEP) {
-            msgpack_pack_object(&tmp_pck, root);
-            new_size++;
-        }
-        else if (ret == GREP_RET_EXCLUDE) {
-            /* Do nothing */
-        }
-    }
-    msgpack_unpacked_destroy(&result);
-
-    /* we keep everything ? */
-    if (old_size == new_size) {
-        /* Destroy the buffer to avoid more overhead */
-        msgpack_sbuffer_destroy(&tmp_sbuf);
+    ret = grep_filter_data(*map, context);
+    if (ret == GREP_RET_KEEP) {
         return FLB_FILTER_NOTOUCH;
     }
 
-    /* link new buffers */
-    *out_buf   = tmp_sbuf.data;
-    *out_size = tmp_sbuf.size;
-
-    return FLB_FILTER_MODIFIED;
+    return FLB_FILTER_DROP;
 }
 
 static int cb_grep_exit(void *data, struct flb_config *config)
@@ -309,7 +331,7 @@ struct flb_filter_plugin filter_grep_plugin = {
     .name         = "grep",
     .description  = "grep events by specified field values",
     .cb_init      = cb_grep_init,
-    .cb_filter    = cb_grep_filter,
+    .cb_filter_record = cb_grep_filter,
     .cb_exit      = cb_grep_exit,
     .flags        = 0
 };
@@ -20,6 +20,9 @@
 #ifndef FLB_FILTER_GREP_H
 #define FLB_FILTER_GREP_H
 
+#include <msgpack.h>
+#include <monkey/mk_core.h>
+
 /* rule types */
 #define GREP_REGEX    1
 #define GREP_EXCLUDE  2
@@ -28,13 +31,25 @@
 #define GREP_RET_KEEP     0
 #define GREP_RET_EXCLUDE  1
 
+/* Distinct record fields referenced by the rules */
+struct grep_field {
+    int len;
+    char *name;
+};
+
 struct grep_ctx {
     struct mk_list rules;
+
+    /* fields lookup, resolved in one pass over each record */
+    int fields_count;
+    struct grep_field *fields;
+    msgpack_object **values;        /* value of each field, per record */
 };
 
 struct grep_rule {
     int type;
     int field_len;
+    int field_id;                   /* index in grep_ctx->fields */
     char *field;
     char *regex_pattern;
     struct flb_regex *regex;
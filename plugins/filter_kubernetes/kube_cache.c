@@ -0,0 +1,264 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+
+#include "kube_cache.h"
+
+/* FNV-1a */
+static inline unsigned int key_hash(char *key, int len)
+{
+    int i;
+    unsigned int h = 2166136261u;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void entry_free(struct kube_cache_entry *entry)
+{
+    flb_free(entry->key);
+    flb_free(entry->buf);
+    flb_free(entry);
+}
+
+/* Unlink an entry from the cache, must be called with the lock held */
+static void entry_unlink(struct kube_cache *cache,
+                         struct kube_cache_entry *entry)
+{
+    mk_list_del(&entry->_head);
+    mk_list_del(&entry->_lru);
+    cache->count--;
+
+    /* Drop the reference held by the cache itself */
+    entry->refs--;
+    if (entry->refs == 0) {
+        entry_free(entry);
+    }
+}
+
+static struct kube_cache_entry *entry_lookup(struct kube_cache *cache,
+                                             char *key, int key_len,
+                                             unsigned int hash)
+{
+    struct mk_list *head;
+    struct mk_list *bucket;
+    struct kube_cache_entry *entry;
+
+    bucket = &cache->buckets[hash % cache->n_buckets];
+    mk_list_foreach(head, bucket) {
+        entry = mk_list_entry(head, struct kube_cache_entry, _head);
+        if (entry->hash == hash && entry->key_len == key_len &&
+            memcmp(entry->key, key, key_len) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+struct kube_cache *kube_cache_create(int max_entries)
+{
+    int i;
+    struct kube_cache *cache;
+
+    if (max_entries <= 0) {
+        return NULL;
+    }
+
+    cache = flb_calloc(1, sizeof(struct kube_cache));
+    if (!cache) {
+        flb_errno();
+        return NULL;
+    }
+
+    cache->max_entries = max_entries;
+    cache->n_buckets = max_entries;
+    cache->buckets = flb_malloc(sizeof(struct mk_list) * cache->n_buckets);
+    if (!cache->buckets) {
+        flb_errno();
+        flb_free(cache);
+        return NULL;
+    }
+
+    for (i = 0; i < cache->n_buckets; i++) {
+        mk_list_init(&cache->buckets[i]);
+    }
+    mk_list_init(&cache->lru);
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+void kube_cache_destroy(struct kube_cache *cache)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct kube_cache_entry *entry;
+
+    if (!cache) {
+        return;
+    }
+
+    mk_list_foreach_safe(head, tmp, &cache->lru) {
+        entry = mk_list_entry(head, struct kube_cache_entry, _lru);
+        entry_unlink(cache, entry);
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+    flb_free(cache->buckets);
+    flb_free(cache);
+}
+
+/*
+ * Lookup an entry. On KUBE_CACHE_HIT and KUBE_CACHE_STALE a reference to the
+ * entry is returned in 'out_entry'. Expired entries of failed lookups are
+ * reported as a miss so they get requested again.
+ */
+int kube_cache_get(struct kube_cache *cache, char *key, int key_len,
+                   struct kube_cache_entry **out_entry)
+{
+    int ret = KUBE_CACHE_HIT;
+    unsigned int hash;
+    struct kube_cache_entry *entry;
+
+    hash = key_hash(key, key_len);
+
+    pthread_mutex_lock(&cache->lock);
+    entry = entry_lookup(cache, key, key_len, hash);
+    if (!entry) {
+        pthread_mutex_unlock(&cache->lock);
+        return KUBE_CACHE_MISS;
+    }
+
+    if (entry->expire > 0 && entry->expire <= time(NULL)) {
+        if (!entry->buf) {
+            pthread_mutex_unlock(&cache->lock);
+            return KUBE_CACHE_MISS;
+        }
+        ret = KUBE_CACHE_STALE;
+    }
+
+    /* Move to the tail of the LRU list */
+    mk_list_del(&entry->_lru);
+    mk_list_add(&entry->_lru, &cache->lru);
+
+    entry->refs++;
+    pthread_mutex_unlock(&cache->lock);
+
+    *out_entry = entry;
+    return ret;
+}
+
+/*
+ * Insert or replace the metadata of 'key'. The cache takes ownership of 'buf'
+ * (it can be NULL to register a failed lookup). A 'ttl' of zero means the
+ * entry never expires.
+ */
+int kube_cache_put(struct kube_cache *cache, char *key, int key_len,
+                   char *buf, size_t size, int ttl)
+{
+    unsigned int hash;
+    struct kube_cache_entry *entry;
+    struct kube_cache_entry *old;
+
+    entry = flb_calloc(1, sizeof(struct kube_cache_entry));
+    if (!entry) {
+        flb_errno();
+        flb_free(buf);
+        return -1;
+    }
+
+    entry->key = flb_malloc(key_len + 1);
+    if (!entry->key) {
+        flb_errno();
+        flb_free(entry);
+        flb_free(buf);
+        return -1;
+    }
+    memcpy(entry->key, key, key_len);
+    entry->key[key_len] = '\0';
+    entry->key_len = key_len;
+
+    hash = key_hash(key, key_len);
+    entry->hash = hash;
+    entry->buf = buf;
+    entry->size = size;
+    entry->expire = ttl > 0 ? time(NULL) + ttl : 0;
+    entry->refs = 1;
+    entry->cache = cache;
+
+    pthread_mutex_lock(&cache->lock);
+
+    old = entry_lookup(cache, key, key_len, hash);
+    if (old) {
+        entry_unlink(cache, old);
+    }
+
+    /* Evict the least recently used entries */
+    while (cache->count >= cache->max_entries) {
+        old = mk_list_entry_first(&cache->lru, struct kube_cache_entry, _lru);
+        flb_debug("[filter_kube] cache full, evicting %s", old->key);
+        entry_unlink(cache, old);
+    }
+
+    mk_list_add(&entry->_head, &cache->buckets[hash % cache->n_buckets]);
+    mk_list_add(&entry->_lru, &cache->lru);
+    cache->count++;
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return 0;
+}
+
+int kube_cache_del(struct kube_cache *cache, char *key, int key_len)
+{
+    struct kube_cache_entry *entry;
+
+    pthread_mutex_lock(&cache->lock);
+    entry = entry_lookup(cache, key, key_len, key_hash(key, key_len));
+    if (!entry) {
+        pthread_mutex_unlock(&cache->lock);
+        return -1;
+    }
+    entry_unlink(cache, entry);
+    pthread_mutex_unlock(&cache->lock);
+
+    return 0;
+}
+
+/* Give back a reference obtained through kube_cache_get() */
+void kube_cache_release(struct kube_cache_entry *entry)
+{
+    int refs;
+    struct kube_cache *cache = entry->cache;
+
+    pthread_mutex_lock(&cache->lock);
+    refs = --entry->refs;
+    pthread_mutex_unlock(&cache->lock);
+
+    if (refs == 0) {
+        entry_free(entry);
+    }
+}
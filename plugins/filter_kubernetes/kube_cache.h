@@ -0,0 +1,79 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_FILTER_KUBE_CACHE_H
+#define FLB_FILTER_KUBE_CACHE_H
+
+#include <fluent-bit/flb_info.h>
+#include <monkey/mk_core.h>
+
+#include <time.h>
+#include <pthread.h>
+
+/*
+ * Metadata cache: 'namespace:pod' -> merged msgpack metadata. The cache is
+ * shared between the filter callback and the API server workers, so every
+ * operation takes the cache lock. Entries are reference counted: a lookup
+ * hands out a reference that must be given back with kube_cache_release(),
+ * so an entry replaced or evicted by a worker stays valid for the record
+ * being processed.
+ */
+
+/* Lookup results */
+#define KUBE_CACHE_MISS    -1
+#define KUBE_CACHE_HIT      0
+#define KUBE_CACHE_STALE    1   /* expired, still usable while refreshed */
+
+struct kube_cache;
+
+struct kube_cache_entry {
+    char *key;
+    int key_len;
+    unsigned int hash;
+
+    char *buf;                  /* merged metadata, NULL on lookup errors */
+    size_t size;
+    time_t expire;              /* 0 = never expires */
+
+    int refs;
+    struct kube_cache *cache;
+    struct mk_list _head;       /* link to hash table bucket */
+    struct mk_list _lru;        /* link to cache LRU list */
+};
+
+struct kube_cache {
+    int count;                  /* number of entries */
+    int max_entries;
+    int n_buckets;
+    struct mk_list *buckets;
+    struct mk_list lru;         /* least recently used first */
+    pthread_mutex_t lock;
+};
+
+struct kube_cache *kube_cache_create(int max_entries);
+void kube_cache_destroy(struct kube_cache *cache);
+
+int kube_cache_get(struct kube_cache *cache, char *key, int key_len,
+                   struct kube_cache_entry **out_entry);
+int kube_cache_put(struct kube_cache *cache, char *key, int key_len,
+                   char *buf, size_t size, int ttl);
+int kube_cache_del(struct kube_cache *cache, char *key, int key_len);
+void kube_cache_release(struct kube_cache_entry *entry);
+
+#endif
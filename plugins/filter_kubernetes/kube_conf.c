@@ -22,7 +22,6 @@
 #include <fluent-bit/flb_log.h>
 #include <fluent-bit/flb_str.h>
 #include <fluent-bit/flb_filter.h>
-#include <fluent-bit/flb_hash.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_parser.h>
 #include <fluent-bit/flb_http_client.h>
@@ -33,6 +32,7 @@
 
 #include "kube_meta.h"
 #include "kube_conf.h"
+#include "kube_cache.h"
 
 struct flb_kube *flb_kube_conf_create(struct flb_filter_instance *i,
                                       struct flb_config *config)
@@ -57,6 +57,11 @@ struct flb_kube *flb_kube_conf_create(struct flb_filter_instance *i,
     ctx->tls_debug = -1;
     ctx->tls_verify = FLB_TRUE;
     ctx->tls_ca_path = NULL;
+    ctx->fetch_fd = -1;
+    ctx->watch_fd = -1;
+    mk_list_init(&ctx->requests);
+    pthread_mutex_init(&ctx->workers_lock, NULL);
+    pthread_cond_init(&ctx->workers_cond, NULL);
 
     /* Buffer size for HTTP Client when reading responses from API Server */
     ctx->buffer_size = (FLB_HTTP_DATA_SIZE_MAX * 8);
@@ -186,14 +191,68 @@ struct flb_kube *flb_kube_conf_create(struct flb_filter_instance *i,
              ctx->api_https ? "https" : "http",
              ctx->api_host, ctx->api_port);
 
-    ctx->hash_table = flb_hash_create(FLB_HASH_EVICT_RANDOM,
-                                      FLB_HASH_TABLE_SIZE,
-                                      FLB_HASH_TABLE_SIZE);
-    if (!ctx->hash_table) {
+    /* Metadata cache: number of Pods and expiration time in seconds */
+    ctx->cache_size = FLB_KUBE_CACHE_SIZE;
+    tmp = flb_filter_get_property("cache_size", i);
+    if (tmp) {
+        ctx->cache_size = atoi(tmp);
+        if (ctx->cache_size <= 0) {
+            flb_error("[filter_kube] invalid cache_size=%s, using default",
+                      tmp);
+            ctx->cache_size = FLB_KUBE_CACHE_SIZE;
+        }
+    }
+
+    ctx->cache_ttl = FLB_KUBE_CACHE_TTL;
+    tmp = flb_filter_get_property("cache_ttl", i);
+    if (tmp) {
+        ctx->cache_ttl = atoi(tmp);
+        if (ctx->cache_ttl < 0) {
+            ctx->cache_ttl = FLB_KUBE_CACHE_TTL;
+        }
+    }
+
+    /*
+     * By default a cache miss waits for the Pod lookup, so the first records
+     * of a Pod get its labels, annotations and the exclude/parser
+     * suggestions too. With async_lookup the records seen while the lookup
+     * is pending only carry the Tag metadata.
+     */
+    ctx->async_lookup = FLB_FALSE;
+    tmp = flb_filter_get_property("async_lookup", i);
+    if (tmp) {
+        ctx->async_lookup = flb_utils_bool(tmp);
+    }
+
+    ctx->cache = kube_cache_create(ctx->cache_size);
+    if (!ctx->cache) {
         flb_kube_conf_destroy(ctx);
         return NULL;
     }
 
+    /*
+     * Pods prefetch: list and watch the Pods of a namespace or the ones
+     * scheduled on a node (e.g: Watch_Node ${NODE_NAME} on a DaemonSet).
+     */
+    tmp = flb_filter_get_property("watch_namespace", i);
+    if (tmp) {
+        ctx->watch_namespace = flb_strdup(tmp);
+    }
+
+    tmp = flb_filter_get_property("watch_node", i);
+    if (tmp) {
+        ctx->watch_node = flb_strdup(tmp);
+    }
+
+    ctx->watch_timeout = FLB_KUBE_WATCH_TIMEOUT;
+    tmp = flb_filter_get_property("watch_timeout", i);
+    if (tmp) {
+        ctx->watch_timeout = atoi(tmp);
+        if (ctx->watch_timeout <= 0) {
+            ctx->watch_timeout = FLB_KUBE_WATCH_TIMEOUT;
+        }
+    }
+
     /* Include Kubernetes Annotations in the final record */
     tmp = flb_filter_get_property("annotations", i);
     if (tmp) {
@@ -289,9 +348,9 @@ void flb_kube_conf_destroy(struct flb_kube *ctx)
         return;
     }
 
-    if (ctx->hash_table) {
-        flb_hash_destroy(ctx->hash_table);
-    }
+    kube_cache_destroy(ctx->cache);
+    pthread_mutex_destroy(&ctx->workers_lock);
+    pthread_cond_destroy(&ctx->workers_cond);
 
     if (ctx->merge_log == FLB_TRUE) {
         flb_free(ctx->unesc_buf);
@@ -314,15 +373,24 @@ void flb_kube_conf_destroy(struct flb_kube *ctx)
     flb_free(ctx->namespace);
     flb_free(ctx->podname);
     flb_free(ctx->auth);
+    flb_free(ctx->watch_namespace);
+    flb_free(ctx->watch_node);
+    flb_free(ctx->watch_rv);
 
     if (ctx->upstream) {
         flb_upstream_destroy(ctx->upstream);
     }
+    if (ctx->watch_upstream) {
+        flb_upstream_destroy(ctx->watch_upstream);
+    }
 
 #ifdef FLB_HAVE_TLS
     if (ctx->tls.context) {
         flb_tls_context_destroy(ctx->tls.context);
     }
+    if (ctx->watch_tls.context) {
+        flb_tls_context_destroy(ctx->watch_tls.context);
+    }
 #endif
 
     flb_free(ctx);
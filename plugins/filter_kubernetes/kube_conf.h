@@ -28,15 +28,25 @@
 #include <fluent-bit/flb_io.h>
 #include <fluent-bit/flb_regex.h>
 
+#include <pthread.h>
+
 /*
  * Since this filter might get a high number of request per second,
  * we need to keep some cached data to perform filtering, e.g:
  *
  *  tag -> regex: pod name, container ID, container name, etc
  *
- * By default, we define a hash table for 256 entries.
+ * By default the metadata cache holds 256 Pods and entries don't expire.
  */
-#define FLB_HASH_TABLE_SIZE 256
+#define FLB_KUBE_CACHE_SIZE     256
+#define FLB_KUBE_CACHE_TTL      0
+
+/*
+ * When a namespace or node scope is set, Pods are listed at startup and the
+ * cache is kept up to date through watch requests, every watch request lasts
+ * up to FLB_KUBE_WATCH_TIMEOUT seconds.
+ */
+#define FLB_KUBE_WATCH_TIMEOUT  30
 
 /*
  * When merging nested JSON strings from Docker logs, we need a temporal
@@ -54,6 +64,7 @@
 #define FLB_API_TLS   FLB_TRUE
 
 struct kube_meta;
+struct kube_cache;
 
 /* Filter context */
 struct flb_kube {
@@ -114,10 +125,35 @@ struct flb_kube {
     char *auth;
     size_t auth_len;
 
+    /* Metadata cache */
+    int cache_size;
+    int cache_ttl;
+    int async_lookup;          /* don't wait for Pod lookups on a miss ? */
+    struct kube_cache *cache;
+
+    /* Pods watch scope */
+    char *watch_namespace;
+    char *watch_node;
+    int watch_timeout;
+    char *watch_rv;            /* last seen resourceVersion */
+
+    /* API server workers */
+    int fetch_worker;          /* fetch thread running ? */
+    int watch_worker;          /* watch thread running ? */
+    int workers_exit;          /* stop requested ? */
+    int fetch_fd;              /* socket of the in-flight Pod lookup */
+    int watch_fd;              /* socket of the in-flight watch request */
+    pthread_t fetch_tid;
+    pthread_t watch_tid;
+    pthread_mutex_t workers_lock;
+    pthread_cond_t workers_cond;
+    struct mk_list requests;   /* pending and in-flight Pod lookups */
+
     struct flb_tls tls;
+    struct flb_tls watch_tls;
     struct flb_config *config;
-    struct flb_hash *hash_table;
     struct flb_upstream *upstream;
+    struct flb_upstream *watch_upstream;
 };
 
 struct flb_kube *flb_kube_conf_create(struct flb_filter_instance *i,
@@ -18,22 +18,35 @@
  */
 
 #include <fluent-bit/flb_info.h>
-#include <fluent-bit/flb_hash.h>
 #include <fluent-bit/flb_regex.h>
 #include <fluent-bit/flb_io.h>
 #include <fluent-bit/flb_upstream.h>
 #include <fluent-bit/flb_http_client.h>
 #include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_worker.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <msgpack.h>
 
 #include "kube_conf.h"
 #include "kube_meta.h"
+#include "kube_cache.h"
 #include "kube_property.h"
 
+/* Pod lookup queued for the fetch worker */
+struct kube_request {
+    char *namespace;
+    char *podname;
+    char *cache_key;
+    int cache_key_len;
+    struct mk_list _head;       /* link to flb_kube->requests */
+};
+
 static int file_to_buffer(char *path, char **out_buf, size_t *out_size)
 {
     int ret;
@@ -134,53 +147,65 @@ static int get_local_pod_info(struct flb_kube *ctx)
     return FLB_TRUE;
 }
 
-/* Gather metadata from API Server */
-static int get_api_server_info(struct flb_kube *ctx,
-                               char *namespace, char *podname,
-                               char **out_buf, size_t *out_size)
+/*
+ * Perform a GET request against the API server and pack the JSON response
+ * as msgpack. Worker threads pass 'fd_slot' to publish the socket in use,
+ * so flb_kube_meta_exit() can abort a blocked request.
+ */
+static int api_get(struct flb_kube *ctx, struct flb_upstream *u,
+                   char *uri, size_t buffer_size, int *fd_slot,
+                   char **out_buf, size_t *out_size)
 {
     int ret;
     size_t b_sent;
-    char uri[1024];
     char *buf;
     size_t size;
     struct flb_http_client *c;
     struct flb_upstream_conn *u_conn;
 
-    if (!ctx->upstream) {
+    if (!u) {
         return -1;
     }
 
-    u_conn = flb_upstream_conn_get(ctx->upstream);
+    u_conn = flb_upstream_conn_get(u);
     if (!u_conn) {
         flb_error("[filter_kube] upstream connection error");
         return -1;
     }
 
-    ret = snprintf(uri, sizeof(uri) - 1,
-                   FLB_KUBE_API_FMT,
-                   namespace, podname);
-    if (ret == -1) {
-        flb_upstream_conn_release(u_conn);
-        return -1;
-    }
-
     /* Compose HTTP Client request */
     c = flb_http_client(u_conn, FLB_HTTP_GET,
                         uri,
                         NULL, 0, NULL, 0, NULL, 0);
-    flb_http_buffer_size(c, ctx->buffer_size);
+    flb_http_buffer_size(c, buffer_size);
 
     flb_http_add_header(c, "User-Agent", 10, "Fluent-Bit", 10);
-    flb_http_add_header(c, "Connection", 10, "close", 5);
     if (ctx->auth_len > 0) {
         flb_http_add_header(c, "Authorization", 13, ctx->auth, ctx->auth_len);
     }
 
+    if (fd_slot) {
+        pthread_mutex_lock(&ctx->workers_lock);
+        if (ctx->workers_exit == FLB_TRUE) {
+            pthread_mutex_unlock(&ctx->workers_lock);
+            flb_http_client_destroy(c);
+            flb_upstream_conn_release(u_conn);
+            return -1;
+        }
+        *fd_slot = u_conn->fd;
+        pthread_mutex_unlock(&ctx->workers_lock);
+    }
+
     /* Perform request */
     ret = flb_http_do(c, &b_sent);
-    flb_debug("[filter_kube] API Server (ns=%s, pod=%s) http_do=%i, HTTP Status: %i",
-              namespace, podname, ret, c->resp.status);
+    flb_debug("[filter_kube] API Server (%s) http_do=%i, HTTP Status: %i",
+              uri, ret, c->resp.status);
+
+    if (fd_slot) {
+        pthread_mutex_lock(&ctx->workers_lock);
+        *fd_slot = -1;
+        pthread_mutex_unlock(&ctx->workers_lock);
+    }
 
     if (ret != 0 || c->resp.status != 200) {
         if (c->resp.payload_size > 0) {
@@ -192,8 +217,15 @@ static int get_api_server_info(struct flb_kube *ctx,
         return -1;
     }
 
-    ret = flb_pack_json(c->resp.payload, c->resp.payload_size,
-                        &buf, &size);
+    if (c->resp.payload_size == 0) {
+        buf = NULL;
+        size = 0;
+        ret = 0;
+    }
+    else {
+        ret = flb_pack_json(c->resp.payload, c->resp.payload_size,
+                            &buf, &size);
+    }
 
     /* release resources */
     flb_http_client_destroy(c);
@@ -210,6 +242,31 @@ static int get_api_server_info(struct flb_kube *ctx,
     return 0;
 }
 
+/* Gather metadata from API Server */
+static int get_api_server_info(struct flb_kube *ctx,
+                               char *namespace, char *podname,
+                               int *fd_slot,
+                               char **out_buf, size_t *out_size)
+{
+    int ret;
+    char uri[1024];
+
+    ret = snprintf(uri, sizeof(uri) - 1,
+                   FLB_KUBE_API_FMT,
+                   namespace, podname);
+    if (ret == -1) {
+        return -1;
+    }
+
+    ret = api_get(ctx, ctx->upstream, uri, ctx->buffer_size, fd_slot,
+                  out_buf, out_size);
+    if (ret == 0 && !*out_buf) {
+        return -1;
+    }
+
+    return ret;
+}
+
 static void cb_results(unsigned char *name, unsigned char *value,
                        size_t vlen, void *data)
 {
@@ -249,11 +306,10 @@ static void cb_results(unsigned char *name, unsigned char *value,
 }
 
 static int merge_meta(struct flb_kube_meta *meta, struct flb_kube *ctx,
-                      char *api_buf, size_t api_size,
+                      msgpack_object api_map,
                       char **out_buf, size_t *out_size)
 {
     int i;
-    int ret;
     int map_size;
     int meta_found = FLB_FALSE;
     int spec_found = FLB_FALSE;
@@ -261,24 +317,21 @@ static int merge_meta(struct flb_kube_meta *meta, struct flb_kube *ctx,
     int have_labels = -1;
     int have_annotations = -1;
     int have_nodename = -1;
-    size_t off = 0;
     msgpack_sbuffer mp_sbuf;
     msgpack_packer mp_pck;
 
-    msgpack_unpacked api_result;
     msgpack_unpacked meta_result;
     msgpack_object k;
     msgpack_object v;
     msgpack_object meta_val;
     msgpack_object spec_val;
-    msgpack_object api_map;
     msgpack_object ann_map;
     struct flb_kube_props props = {0};
 
     /*
      * - reg_buf: is a msgpack Map containing meta captured using Regex
      *
-     * - api_buf: metadata associated to namespace and POD Name coming from
+     * - api_map: metadata associated to namespace and POD Name coming from
      *            the API server.
      *
      * When merging data we aim to add the following keys from the API server:
@@ -288,6 +341,10 @@ static int merge_meta(struct flb_kube_meta *meta, struct flb_kube *ctx,
      * - annotations
      */
 
+    if (api_map.type != MSGPACK_OBJECT_MAP) {
+        return -1;
+    }
+
     /* Initialize output msgpack buffer */
     msgpack_sbuffer_init(&mp_sbuf);
     msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
@@ -295,18 +352,6 @@ static int merge_meta(struct flb_kube_meta *meta, struct flb_kube *ctx,
     /* Set map size: current + pod_id, labels and annotations */
     map_size = meta->fields;
 
-    /* Iterate API server msgpack and lookup specific fields */
-    off = 0;
-    msgpack_unpacked_init(&api_result);
-    ret = msgpack_unpack_next(&api_result, api_buf, api_size, &off);
-    if (ret != MSGPACK_UNPACK_SUCCESS) {
-        msgpack_sbuffer_destroy(&mp_sbuf);
-        msgpack_unpacked_destroy(&api_result);
-        return -1;
-    }
-
-    api_map = api_result.data;
-
     /* At this point map points to the ROOT map, eg:
      *
      * {
@@ -342,7 +387,6 @@ static int merge_meta(struct flb_kube_meta *meta, struct flb_kube *ctx,
     }
 
     if (meta_found == FLB_FALSE) {
-        msgpack_unpacked_destroy(&api_result);
         msgpack_sbuffer_destroy(&mp_sbuf);
         return -1;
     }
@@ -470,7 +514,6 @@ static int merge_meta(struct flb_kube_meta *meta, struct flb_kube *ctx,
         flb_free(prop_buf);
     }
 
-    msgpack_unpacked_destroy(&api_result);
     msgpack_unpacked_destroy(&meta_result);
 
     /* Set outgoing msgpack buffer */
@@ -588,24 +631,36 @@ static inline int extract_meta(struct flb_kube *ctx, char *tag, int tag_len,
  * and merge buffers.
  */
 static int get_and_merge_meta(struct flb_kube *ctx, struct flb_kube_meta *meta,
+                              int *fd_slot,
                               char **out_buf, size_t *out_size)
 {
     int ret;
+    size_t off = 0;
     char *api_buf;
     size_t api_size;
     char *merge_buf;
     size_t merge_size;
+    msgpack_unpacked api_result;
 
     ret = get_api_server_info(ctx,
-                              meta->namespace, meta->podname,
+                              meta->namespace, meta->podname, fd_slot,
                               &api_buf, &api_size);
     if (ret == -1) {
         return -1;
     }
 
+    msgpack_unpacked_init(&api_result);
+    ret = msgpack_unpack_next(&api_result, api_buf, api_size, &off);
+    if (ret != MSGPACK_UNPACK_SUCCESS) {
+        msgpack_unpacked_destroy(&api_result);
+        flb_free(api_buf);
+        return -1;
+    }
+
     ret = merge_meta(meta, ctx,
-                     api_buf, api_size,
+                     api_result.data,
                      &merge_buf, &merge_size);
+    msgpack_unpacked_destroy(&api_result);
     flb_free(api_buf);
 
     if (ret == -1) {
@@ -618,41 +673,102 @@ static int get_and_merge_meta(struct flb_kube *ctx, struct flb_kube_meta *meta,
     return 0;
 }
 
+/*
+ * Metadata composed with the Tag information only (pod_name and
+ * namespace_name), used for records processed while the Pod metadata is
+ * being requested to the API server.
+ */
+static int local_meta(struct flb_kube_meta *meta,
+                      char **out_buf, size_t *out_size)
+{
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
 
-static int flb_kube_network_init(struct flb_kube *ctx, struct flb_config *config)
+    msgpack_pack_map(&mp_pck, meta->fields);
+    if (meta->podname != NULL) {
+        msgpack_pack_str(&mp_pck, 8);
+        msgpack_pack_str_body(&mp_pck, "pod_name", 8);
+        msgpack_pack_str(&mp_pck, meta->podname_len);
+        msgpack_pack_str_body(&mp_pck, meta->podname, meta->podname_len);
+    }
+    if (meta->namespace != NULL) {
+        msgpack_pack_str(&mp_pck, 14);
+        msgpack_pack_str_body(&mp_pck, "namespace_name", 14);
+        msgpack_pack_str(&mp_pck, meta->namespace_len);
+        msgpack_pack_str_body(&mp_pck, meta->namespace, meta->namespace_len);
+    }
+
+    *out_buf = mp_sbuf.data;
+    *out_size = mp_sbuf.size;
+
+    return 0;
+}
+
+static int api_upstream_create(struct flb_kube *ctx, struct flb_config *config,
+                               struct flb_tls *tls, struct flb_upstream **u)
 {
     int io_type = FLB_IO_TCP;
 
-    ctx->upstream = NULL;
-
     if (ctx->api_https == FLB_TRUE) {
         if (!ctx->tls_ca_path && !ctx->tls_ca_file) {
             ctx->tls_ca_file  = flb_strdup(FLB_KUBE_CA);
         }
-        ctx->tls.context = flb_tls_context_new(ctx->tls_verify,
-                                               ctx->tls_debug,
-                                               ctx->tls_ca_path,
-                                               ctx->tls_ca_file,
-                                               NULL, NULL, NULL);
-        if (!ctx->tls.context) {
+        tls->context = flb_tls_context_new(ctx->tls_verify,
+                                           ctx->tls_debug,
+                                           ctx->tls_ca_path,
+                                           ctx->tls_ca_file,
+                                           NULL, NULL, NULL);
+        if (!tls->context) {
             return -1;
         }
         io_type = FLB_IO_TLS;
     }
 
     /* Create an Upstream context */
-    ctx->upstream = flb_upstream_create(config,
-                                        ctx->api_host,
-                                        ctx->api_port,
-                                        io_type,
-                                        &ctx->tls);
-    if (!ctx->upstream) {
-        /* note: if ctx->tls.context is set, it's destroyed upon context exit */
+    *u = flb_upstream_create(config,
+                             ctx->api_host,
+                             ctx->api_port,
+                             io_type,
+                             tls);
+    if (!*u) {
+        /* note: if tls->context is set, it's destroyed upon context exit */
         return -1;
     }
 
     /* Remove async flag from upstream */
-    ctx->upstream->flags &= ~(FLB_IO_ASYNC);
+    (*u)->flags &= ~(FLB_IO_ASYNC);
+
+    return 0;
+}
+
+static int flb_kube_network_init(struct flb_kube *ctx, struct flb_config *config)
+{
+    int ret;
+
+    ctx->upstream = NULL;
+    ctx->watch_upstream = NULL;
+
+    /* Pod lookups: keep the connection open between requests */
+    ret = api_upstream_create(ctx, config, &ctx->tls, &ctx->upstream);
+    if (ret == -1) {
+        return -1;
+    }
+    flb_upstream_keepalive(ctx->upstream, FLB_TRUE, 0, 0);
+
+    /*
+     * The watch worker runs on its own thread, it gets a separate upstream
+     * and TLS context.
+     */
+    if (ctx->watch_namespace || ctx->watch_node) {
+        ret = api_upstream_create(ctx, config,
+                                  &ctx->watch_tls, &ctx->watch_upstream);
+        if (ret == -1) {
+            return -1;
+        }
+    }
 
     return 0;
 }
@@ -686,6 +802,495 @@ static int flb_dummy_meta(char **out_buf, size_t *out_size)
     return 0;
 }
 
+/* Lookup the value of 'key' in a msgpack map */
+static msgpack_object *map_get(msgpack_object *map, char *key, int key_len)
+{
+    int i;
+    msgpack_object *k;
+
+    if (map->type != MSGPACK_OBJECT_MAP) {
+        return NULL;
+    }
+
+    for (i = 0; i < map->via.map.size; i++) {
+        k = &map->via.map.ptr[i].key;
+        if (k->type == MSGPACK_OBJECT_STR && k->via.str.size == key_len &&
+            strncmp(k->via.str.ptr, key, key_len) == 0) {
+            return &map->via.map.ptr[i].val;
+        }
+    }
+
+    return NULL;
+}
+
+static char *map_get_str(msgpack_object *map, char *key, int key_len,
+                         int *out_len)
+{
+    msgpack_object *val;
+
+    val = map_get(map, key, key_len);
+    if (!val || val->type != MSGPACK_OBJECT_STR) {
+        return NULL;
+    }
+
+    *out_len = val->via.str.size;
+    return (char *) val->via.str.ptr;
+}
+
+/*
+ * Compose the metadata of a Pod object received from a list or watch
+ * request and store it (or drop it if 'delete' is set) in the cache.
+ */
+static int pod_to_cache(struct flb_kube *ctx, msgpack_object *pod, int delete)
+{
+    int ret;
+    int ns_len;
+    int pod_len;
+    char *ns;
+    char *name;
+    char *buf;
+    size_t size;
+    msgpack_object *metadata;
+    struct flb_kube_meta meta = {0};
+
+    metadata = map_get(pod, "metadata", 8);
+    if (!metadata) {
+        return -1;
+    }
+
+    name = map_get_str(metadata, "name", 4, &pod_len);
+    ns = map_get_str(metadata, "namespace", 9, &ns_len);
+    if (!name || !ns) {
+        return -1;
+    }
+
+    meta.podname = flb_strndup(name, pod_len);
+    meta.podname_len = pod_len;
+    meta.namespace = flb_strndup(ns, ns_len);
+    meta.namespace_len = ns_len;
+    meta.fields = 2;
+
+    meta.cache_key_len = ns_len + 1 + pod_len;
+    meta.cache_key = flb_malloc(meta.cache_key_len + 1);
+    if (!meta.podname || !meta.namespace || !meta.cache_key) {
+        flb_errno();
+        flb_kube_meta_release(&meta);
+        return -1;
+    }
+    snprintf(meta.cache_key, meta.cache_key_len + 1, "%.*s:%.*s",
+             ns_len, ns, pod_len, name);
+
+    if (delete == FLB_TRUE) {
+        kube_cache_del(ctx->cache, meta.cache_key, meta.cache_key_len);
+        flb_kube_meta_release(&meta);
+        return 0;
+    }
+
+    ret = merge_meta(&meta, ctx, *pod, &buf, &size);
+    if (ret == 0) {
+        ret = kube_cache_put(ctx->cache, meta.cache_key, meta.cache_key_len,
+                             buf, size, ctx->cache_ttl);
+    }
+    flb_kube_meta_release(&meta);
+
+    return ret;
+}
+
+/* Compose the URI to list or watch the Pods in the configured scope */
+static int pods_uri(struct flb_kube *ctx, int watch, char *uri, size_t size)
+{
+    int len;
+
+    if (ctx->watch_namespace) {
+        len = snprintf(uri, size, FLB_KUBE_API_NS_PODS "?",
+                       ctx->watch_namespace);
+    }
+    else {
+        len = snprintf(uri, size, FLB_KUBE_API_PODS "?");
+    }
+
+    if (ctx->watch_node) {
+        len += snprintf(uri + len, size - len,
+                        "fieldSelector=spec.nodeName%%3D%s&", ctx->watch_node);
+    }
+
+    if (watch == FLB_TRUE) {
+        len += snprintf(uri + len, size - len,
+                        "watch=1&resourceVersion=%s&timeoutSeconds=%i",
+                        ctx->watch_rv, ctx->watch_timeout);
+    }
+    else {
+        uri[--len] = '\0';
+    }
+
+    if (len >= size) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * List the Pods in the watch scope and load them into the cache. The
+ * resourceVersion of the list is the starting point of the next watch.
+ */
+static int pods_list(struct flb_kube *ctx, int *fd_slot)
+{
+    int i;
+    int ret;
+    int rv_len;
+    int count = 0;
+    char *rv;
+    char *buf;
+    char uri[1024];
+    size_t size;
+    size_t off = 0;
+    msgpack_unpacked result;
+    msgpack_object *metadata;
+    msgpack_object *items;
+
+    ret = pods_uri(ctx, FLB_FALSE, uri, sizeof(uri));
+    if (ret == -1) {
+        return -1;
+    }
+
+    ret = api_get(ctx, ctx->watch_upstream, uri, 0, fd_slot, &buf, &size);
+    if (ret == -1 || !buf) {
+        flb_warn("[filter_kube] could not list Pods");
+        return -1;
+    }
+
+    msgpack_unpacked_init(&result);
+    ret = msgpack_unpack_next(&result, buf, size, &off);
+    if (ret != MSGPACK_UNPACK_SUCCESS) {
+        msgpack_unpacked_destroy(&result);
+        flb_free(buf);
+        return -1;
+    }
+
+    metadata = map_get(&result.data, "metadata", 8);
+    rv = metadata ? map_get_str(metadata, "resourceVersion", 15, &rv_len) : NULL;
+    items = map_get(&result.data, "items", 5);
+    if (!rv || !items || items->type != MSGPACK_OBJECT_ARRAY) {
+        flb_warn("[filter_kube] invalid Pods list");
+        msgpack_unpacked_destroy(&result);
+        flb_free(buf);
+        return -1;
+    }
+
+    for (i = 0; i < items->via.array.size; i++) {
+        if (pod_to_cache(ctx, &items->via.array.ptr[i], FLB_FALSE) == 0) {
+            count++;
+        }
+    }
+
+    flb_free(ctx->watch_rv);
+    ctx->watch_rv = flb_strndup(rv, rv_len);
+
+    msgpack_unpacked_destroy(&result);
+    flb_free(buf);
+
+    flb_info("[filter_kube] %i Pods loaded in the cache", count);
+    return 0;
+}
+
+/*
+ * Watch the Pods in the scope since the last resourceVersion. The response
+ * is a stream of events (one JSON map per line) which is processed once the
+ * API server ends the request after 'watch_timeout' seconds.
+ */
+static int pods_watch(struct flb_kube *ctx)
+{
+    int ret;
+    int len;
+    int rv_len;
+    int events = 0;
+    char *type;
+    char *rv;
+    char *buf;
+    char uri[1024];
+    size_t size;
+    size_t off = 0;
+    msgpack_unpacked result;
+    msgpack_object *pod;
+    msgpack_object *metadata;
+
+    ret = pods_uri(ctx, FLB_TRUE, uri, sizeof(uri));
+    if (ret == -1) {
+        return -1;
+    }
+
+    ret = api_get(ctx, ctx->watch_upstream, uri, 0, &ctx->watch_fd,
+                  &buf, &size);
+    if (ret == -1) {
+        return -1;
+    }
+    if (!buf) {
+        return 0;
+    }
+
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, buf, size, &off) ==
+           MSGPACK_UNPACK_SUCCESS) {
+        type = map_get_str(&result.data, "type", 4, &len);
+        pod = map_get(&result.data, "object", 6);
+        if (!type || !pod) {
+            continue;
+        }
+
+        /* The resourceVersion is too old (410 Gone): list again */
+        if (len == 5 && strncmp(type, "ERROR", 5) == 0) {
+            flb_debug("[filter_kube] watch error, listing Pods again");
+            flb_free(ctx->watch_rv);
+            ctx->watch_rv = NULL;
+            break;
+        }
+
+        if (len == 7 && strncmp(type, "DELETED", 7) == 0) {
+            pod_to_cache(ctx, pod, FLB_TRUE);
+        }
+        else if ((len == 5 && strncmp(type, "ADDED", 5) == 0) ||
+                 (len == 8 && strncmp(type, "MODIFIED", 8) == 0)) {
+            pod_to_cache(ctx, pod, FLB_FALSE);
+        }
+        else {
+            continue;
+        }
+        events++;
+
+        metadata = map_get(pod, "metadata", 8);
+        rv = metadata ?
+            map_get_str(metadata, "resourceVersion", 15, &rv_len) : NULL;
+        if (rv) {
+            flb_free(ctx->watch_rv);
+            ctx->watch_rv = flb_strndup(rv, rv_len);
+        }
+    }
+    msgpack_unpacked_destroy(&result);
+    flb_free(buf);
+
+    flb_debug("[filter_kube] watch: %i Pod events", events);
+    return ctx->watch_rv ? 0 : -1;
+}
+
+/*
+ * Wait up to 'seconds' or until the workers are stopped, the caller holds
+ * the workers lock.
+ */
+static void workers_wait(struct flb_kube *ctx, int seconds)
+{
+    int ret;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += seconds;
+
+    while (ctx->workers_exit == FLB_FALSE) {
+        ret = pthread_cond_timedwait(&ctx->workers_cond, &ctx->workers_lock,
+                                     &ts);
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+    }
+}
+
+/* Watch worker: keep the cache in sync with the Pods in the scope */
+static void kube_watch_worker(void *data)
+{
+    int ret;
+    int backoff = 1;
+    time_t start;
+    struct flb_kube *ctx = data;
+
+    pthread_mutex_lock(&ctx->workers_lock);
+    while (ctx->workers_exit == FLB_FALSE) {
+        pthread_mutex_unlock(&ctx->workers_lock);
+
+        start = time(NULL);
+        if (!ctx->watch_rv) {
+            ret = pods_list(ctx, &ctx->watch_fd);
+        }
+        else {
+            ret = pods_watch(ctx);
+        }
+
+        pthread_mutex_lock(&ctx->workers_lock);
+        if (ret == -1) {
+            workers_wait(ctx, backoff);
+            if (backoff < 30) {
+                backoff *= 2;
+            }
+            continue;
+        }
+        backoff = 1;
+
+        /* Don't hammer an API server which ends the watch right away */
+        if (time(NULL) - start < 1) {
+            workers_wait(ctx, 1);
+        }
+    }
+    pthread_mutex_unlock(&ctx->workers_lock);
+}
+
+static void request_destroy(struct kube_request *req)
+{
+    flb_free(req->namespace);
+    flb_free(req->podname);
+    flb_free(req->cache_key);
+    flb_free(req);
+}
+
+/*
+ * Queue a Pod lookup for the fetch worker. Misses on a Pod already queued
+ * or being requested join that request.
+ */
+static int request_add(struct flb_kube *ctx, struct flb_kube_meta *meta)
+{
+    struct mk_list *head;
+    struct kube_request *req;
+
+    pthread_mutex_lock(&ctx->workers_lock);
+
+    if (ctx->fetch_worker == FLB_FALSE || ctx->workers_exit == FLB_TRUE) {
+        pthread_mutex_unlock(&ctx->workers_lock);
+        return -1;
+    }
+
+    mk_list_foreach(head, &ctx->requests) {
+        req = mk_list_entry(head, struct kube_request, _head);
+        if (req->cache_key_len == meta->cache_key_len &&
+            memcmp(req->cache_key, meta->cache_key, meta->cache_key_len) == 0) {
+            pthread_mutex_unlock(&ctx->workers_lock);
+            return 0;
+        }
+    }
+
+    req = flb_calloc(1, sizeof(struct kube_request));
+    if (!req) {
+        flb_errno();
+        pthread_mutex_unlock(&ctx->workers_lock);
+        return -1;
+    }
+    req->namespace = flb_strndup(meta->namespace, meta->namespace_len);
+    req->podname = flb_strndup(meta->podname, meta->podname_len);
+    req->cache_key = flb_strndup(meta->cache_key, meta->cache_key_len);
+    req->cache_key_len = meta->cache_key_len;
+    if (!req->namespace || !req->podname || !req->cache_key) {
+        request_destroy(req);
+        pthread_mutex_unlock(&ctx->workers_lock);
+        return -1;
+    }
+
+    mk_list_add(&req->_head, &ctx->requests);
+    pthread_cond_broadcast(&ctx->workers_cond);
+    pthread_mutex_unlock(&ctx->workers_lock);
+
+    return 0;
+}
+
+/*
+ * Wait until the fetch worker is done with the lookup of the Pod, the
+ * caller queued it with request_add().
+ */
+static void request_wait(struct flb_kube *ctx, struct flb_kube_meta *meta)
+{
+    int found;
+    struct mk_list *head;
+    struct kube_request *req;
+
+    pthread_mutex_lock(&ctx->workers_lock);
+    while (ctx->workers_exit == FLB_FALSE) {
+        found = FLB_FALSE;
+        mk_list_foreach(head, &ctx->requests) {
+            req = mk_list_entry(head, struct kube_request, _head);
+            if (req->cache_key_len == meta->cache_key_len &&
+                memcmp(req->cache_key, meta->cache_key,
+                       meta->cache_key_len) == 0) {
+                found = FLB_TRUE;
+                break;
+            }
+        }
+        if (found == FLB_FALSE) {
+            break;
+        }
+        pthread_cond_wait(&ctx->workers_cond, &ctx->workers_lock);
+    }
+    pthread_mutex_unlock(&ctx->workers_lock);
+}
+
+/*
+ * Fetch worker: serve the queued Pod lookups. A request stays at the head
+ * of the queue while it's in flight so new misses for the same Pod join it.
+ */
+static void kube_fetch_worker(void *data)
+{
+    int ret;
+    char *buf;
+    char *copy;
+    size_t size;
+    struct kube_request *req;
+    struct kube_cache_entry *entry;
+    struct flb_kube_meta meta;
+    struct flb_kube *ctx = data;
+
+    pthread_mutex_lock(&ctx->workers_lock);
+    while (1) {
+        while (ctx->workers_exit == FLB_FALSE &&
+               mk_list_is_empty(&ctx->requests) == 0) {
+            pthread_cond_wait(&ctx->workers_cond, &ctx->workers_lock);
+        }
+        if (ctx->workers_exit == FLB_TRUE) {
+            break;
+        }
+
+        req = mk_list_entry_first(&ctx->requests, struct kube_request, _head);
+        pthread_mutex_unlock(&ctx->workers_lock);
+
+        memset(&meta, '\0', sizeof(meta));
+        meta.namespace = req->namespace;
+        meta.namespace_len = strlen(req->namespace);
+        meta.podname = req->podname;
+        meta.podname_len = strlen(req->podname);
+        meta.fields = 2;
+
+        ret = get_and_merge_meta(ctx, &meta, &ctx->fetch_fd, &buf, &size);
+        if (ret == 0) {
+            kube_cache_put(ctx->cache, req->cache_key, req->cache_key_len,
+                           buf, size, ctx->cache_ttl);
+        }
+        else {
+            /*
+             * Keep serving the expired metadata if there is one, otherwise
+             * register the failure so the Pod is not requested again on
+             * every record until FLB_KUBE_META_RETRY seconds passed.
+             */
+            copy = NULL;
+            size = 0;
+            ret = kube_cache_get(ctx->cache, req->cache_key,
+                                 req->cache_key_len, &entry);
+            if (ret != KUBE_CACHE_MISS) {
+                if (entry->buf) {
+                    copy = flb_malloc(entry->size);
+                    if (copy) {
+                        memcpy(copy, entry->buf, entry->size);
+                        size = entry->size;
+                    }
+                }
+                kube_cache_release(entry);
+            }
+            kube_cache_put(ctx->cache, req->cache_key, req->cache_key_len,
+                           copy, size, FLB_KUBE_META_RETRY);
+        }
+
+        /* Wake up the filter if it waits for this Pod */
+        pthread_mutex_lock(&ctx->workers_lock);
+        mk_list_del(&req->_head);
+        request_destroy(req);
+        pthread_cond_broadcast(&ctx->workers_cond);
+    }
+    pthread_mutex_unlock(&ctx->workers_lock);
+}
+
 /* Initialize local context */
 int flb_kube_meta_init(struct flb_kube *ctx, struct flb_config *config)
 {
@@ -712,7 +1317,7 @@ int flb_kube_meta_init(struct flb_kube *ctx, struct flb_config *config)
 
     /* Gather info from API server */
     flb_info("[filter_kube] testing connectivity with API server...");
-    ret = get_api_server_info(ctx, ctx->namespace, ctx->podname,
+    ret = get_api_server_info(ctx, ctx->namespace, ctx->podname, NULL,
                               &meta_buf, &meta_size);
     if (ret == -1) {
         if (!ctx->podname) {
@@ -722,15 +1327,72 @@ int flb_kube_meta_init(struct flb_kube *ctx, struct flb_config *config)
             flb_warn("[filter_kube] could not get meta for POD %s",
                      ctx->podname);
         }
+    }
+    else {
+        flb_info("[filter_kube] API server connectivity OK");
+        flb_free(meta_buf);
+    }
+
+    /*
+     * Metadata is requested on the background, the filter only waits for
+     * the API server on a miss: start the lookups worker and if a scope was
+     * set, load its Pods now and keep them updated through the watch worker.
+     */
+    ret = flb_worker_create(kube_fetch_worker, ctx, &ctx->fetch_tid, config);
+    if (ret == -1) {
+        flb_error("[filter_kube] could not start metadata worker");
         return -1;
     }
-    flb_info("[filter_kube] API server connectivity OK");
+    ctx->fetch_worker = FLB_TRUE;
 
-    flb_free(meta_buf);
+    if (ctx->watch_upstream) {
+        pods_list(ctx, NULL);
+        ret = flb_worker_create(kube_watch_worker, ctx,
+                                &ctx->watch_tid, config);
+        if (ret == -1) {
+            flb_error("[filter_kube] could not start watch worker");
+            return -1;
+        }
+        ctx->watch_worker = FLB_TRUE;
+    }
 
     return 0;
 }
 
+/* Stop the API server workers, blocked requests are aborted */
+void flb_kube_meta_exit(struct flb_kube *ctx)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct kube_request *req;
+
+    pthread_mutex_lock(&ctx->workers_lock);
+    ctx->workers_exit = FLB_TRUE;
+    if (ctx->fetch_fd >= 0) {
+        shutdown(ctx->fetch_fd, SHUT_RDWR);
+    }
+    if (ctx->watch_fd >= 0) {
+        shutdown(ctx->watch_fd, SHUT_RDWR);
+    }
+    pthread_cond_broadcast(&ctx->workers_cond);
+    pthread_mutex_unlock(&ctx->workers_lock);
+
+    if (ctx->fetch_worker == FLB_TRUE) {
+        pthread_join(ctx->fetch_tid, NULL);
+        ctx->fetch_worker = FLB_FALSE;
+    }
+    if (ctx->watch_worker == FLB_TRUE) {
+        pthread_join(ctx->watch_tid, NULL);
+        ctx->watch_worker = FLB_FALSE;
+    }
+
+    mk_list_foreach_safe(head, tmp, &ctx->requests) {
+        req = mk_list_entry(head, struct kube_request, _head);
+        mk_list_del(&req->_head);
+        request_destroy(req);
+    }
+}
+
 int flb_kube_meta_get(struct flb_kube *ctx,
                       char *tag, int tag_len,
                       char *data, size_t data_size,
@@ -738,12 +1400,12 @@ int flb_kube_meta_get(struct flb_kube *ctx,
                       struct flb_kube_meta *meta,
                       struct flb_kube_props *props)
 {
-    int id;
     int ret;
-    char *hash_meta_buf;
+    char *meta_buf;
     size_t off = 0;
-    size_t hash_meta_size;
+    size_t meta_size;
     msgpack_unpacked result;
+    struct kube_cache_entry *entry = NULL;
 
     if (ctx->dummy_meta == FLB_TRUE) {
         flb_dummy_meta(out_buf, out_size);
@@ -756,31 +1418,46 @@ int flb_kube_meta_get(struct flb_kube *ctx,
         return -1;
     }
 
+    if (!meta->cache_key) {
+        return -1;
+    }
+
     /* Check if we have some data associated to the cache key */
-    ret = flb_hash_get(ctx->hash_table,
-                       meta->cache_key, meta->cache_key_len,
-                       &hash_meta_buf, &hash_meta_size);
-    if (ret == -1) {
-        /* Retrieve API server meta and merge with local meta */
-        ret = get_and_merge_meta(ctx, meta,
-                                 &hash_meta_buf, &hash_meta_size);
-        if (ret == -1) {
-            return -1;
+    ret = kube_cache_get(ctx->cache, meta->cache_key, meta->cache_key_len,
+                         &entry);
+    if (ret != KUBE_CACHE_HIT) {
+        /*
+         * Missing or expired: request it to the fetch worker, expired
+         * metadata is used until the new one arrives.
+         */
+        ret = request_add(ctx, meta);
+
+        /*
+         * Without metadata the records would miss the Pod labels and
+         * annotations, wait for the lookup unless async_lookup was set.
+         * Exclusion can't be decided from the Tag, so when it's allowed
+         * the lookup is always waited for.
+         */
+        if (ret == 0 && !entry &&
+            (ctx->async_lookup == FLB_FALSE ||
+             ctx->k8s_logging_exclude == FLB_TRUE)) {
+            request_wait(ctx, meta);
+            kube_cache_get(ctx->cache, meta->cache_key, meta->cache_key_len,
+                           &entry);
         }
+    }
 
-        id = flb_hash_add(ctx->hash_table,
-                          meta->cache_key, meta->cache_key_len,
-                          hash_meta_buf, hash_meta_size);
-        if (id >= 0) {
-            /*
-             * Release the original buffer created on extract_meta() as a new
-             * copy have been generated into the hash table, then re-set
-             * the outgoing buffer and size.
-             */
-            flb_free(hash_meta_buf);
-            flb_hash_get_by_id(ctx->hash_table, id, meta->cache_key,
-                               &hash_meta_buf, &hash_meta_size);
+    if (entry && entry->buf) {
+        meta->cache_entry = entry;
+        meta_buf = entry->buf;
+        meta_size = entry->size;
+    }
+    else {
+        if (entry) {
+            kube_cache_release(entry);
         }
+        local_meta(meta, &meta->local_buf, &meta_size);
+        meta_buf = meta->local_buf;
     }
 
     /*
@@ -794,19 +1471,19 @@ int flb_kube_meta_get(struct flb_kube *ctx,
     msgpack_unpacked_init(&result);
 
     /* Unpack to get the offset/bytes of the first item */
-    msgpack_unpack_next(&result, hash_meta_buf, hash_meta_size, &off);
+    msgpack_unpack_next(&result, meta_buf, meta_size, &off);
 
     /* Set the pointer and proper size for the caller */
-    *out_buf = hash_meta_buf;
+    *out_buf = meta_buf;
     *out_size = off;
 
     /* A new unpack_next() call will succeed If annotation properties exists */
-    ret = msgpack_unpack_next(&result, hash_meta_buf, hash_meta_size, &off);
+    ret = msgpack_unpack_next(&result, meta_buf, meta_size, &off);
     if (ret == MSGPACK_UNPACK_SUCCESS) {
         /* Unpack the remaining data into properties structure */
         flb_kube_prop_unpack(props,
-                             hash_meta_buf + *out_size,
-                             hash_meta_size - *out_size);
+                             meta_buf + *out_size,
+                             meta_size - *out_size);
     }
     msgpack_unpacked_destroy(&result);
 
@@ -846,5 +1523,13 @@ int flb_kube_meta_release(struct flb_kube_meta *meta)
         flb_free(meta->cache_key);
     }
 
+    if (meta->cache_entry) {
+        kube_cache_release(meta->cache_entry);
+    }
+
+    if (meta->local_buf) {
+        flb_free(meta->local_buf);
+    }
+
     return r;
 }
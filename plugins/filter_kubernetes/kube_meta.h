@@ -23,6 +23,7 @@
 #include "kube_props.h"
 
 struct flb_kube;
+struct kube_cache_entry;
 
 struct flb_kube_meta {
     int fields;
@@ -43,6 +44,12 @@ struct flb_kube_meta {
     char *container_hash;   /* set only on Systemd mode */
 
     char *cache_key;
+
+    /* Reference to the cached metadata, NULL while it's being requested */
+    struct kube_cache_entry *cache_entry;
+
+    /* Metadata composed from the Tag only, used on cache misses */
+    char *local_buf;
 };
 
 /* Constant Kubernetes paths */
@@ -52,6 +59,11 @@ struct flb_kube_meta {
 #define FLB_KUBE_API_HOST "kubernetes.default.svc"
 #define FLB_KUBE_API_PORT 443
 #define FLB_KUBE_API_FMT "/api/v1/namespaces/%s/pods/%s"
+#define FLB_KUBE_API_PODS "/api/v1/pods"
+#define FLB_KUBE_API_NS_PODS "/api/v1/namespaces/%s/pods"
+
+/* Seconds before retrying a failed Pod lookup */
+#define FLB_KUBE_META_RETRY 10
 
 int flb_kube_meta_init(struct flb_kube *ctx, struct flb_config *config);
 int flb_kube_meta_fetch(struct flb_kube *ctx);
@@ -62,5 +74,6 @@ int flb_kube_meta_get(struct flb_kube *ctx,
                       struct flb_kube_meta *meta,
                       struct flb_kube_props *props);
 int flb_kube_meta_release(struct flb_kube_meta *meta);
+void flb_kube_meta_exit(struct flb_kube *ctx);
 
 #endif
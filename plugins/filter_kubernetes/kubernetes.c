@@ -172,9 +172,9 @@ static int cb_kube_init(struct flb_filter_instance *f_ins,
     flb_filter_set_context(f_ins, ctx);
 
     /*
-     * Get Kubernetes Metadata: we gather this at the beginning
-     * as we need this information to process logs in Kubernetes
-     * environment, otherwise the service should not start.
+     * Setup the access to the Kubernetes API server: Pods metadata is
+     * requested by background workers, records of Pods not yet in the
+     * cache only get the information found in the Tag.
      */
     flb_kube_meta_init(ctx, config);
 
@@ -419,6 +419,7 @@ static int cb_kube_filter(void *data, size_t bytes,
                                 data, bytes,
                                 &cache_buf, &cache_size, &meta, &props);
         if (ret == -1) {
+            flb_kube_meta_release(&meta);
             flb_kube_prop_destroy(&props);
             return FLB_FILTER_NOTOUCH;
         }
@@ -430,6 +431,7 @@ static int cb_kube_filter(void *data, size_t bytes,
         if (props.exclude == FLB_TRUE) {
             *out_buf   = NULL;
             *out_bytes = 0;
+            flb_kube_meta_release(&meta);
             flb_kube_prop_destroy(&props);
             return FLB_FILTER_MODIFIED;
         }
@@ -464,7 +466,10 @@ static int cb_kube_filter(void *data, size_t bytes,
                                     data + pre, off - pre,
                                     &cache_buf, &cache_size, &meta, &props);
             if (ret == -1) {
+                flb_kube_meta_release(&meta);
                 flb_kube_prop_destroy(&props);
+                msgpack_sbuffer_destroy(&tmp_sbuf);
+                msgpack_unpacked_destroy(&result);
                 return FLB_FILTER_NOTOUCH;
             }
 
@@ -474,6 +479,7 @@ static int cb_kube_filter(void *data, size_t bytes,
 
             if (props.exclude == FLB_TRUE) {
                 /* Skip this record */
+                flb_kube_meta_release(&meta);
                 continue;
             }
 
@@ -532,6 +538,7 @@ static int cb_kube_exit(void *data, struct flb_config *config)
     struct flb_kube *ctx;
 
     ctx = data;
+    flb_kube_meta_exit(ctx);
     flb_kube_conf_destroy(ctx);
 
     return 0;
@@ -242,103 +242,73 @@ static int make_bool_map(struct record_modifier_ctx *ctx, msgpack_object *map,
     return ret;
 }
 
-static int cb_modifier_filter(void *data, size_t bytes,
-                                  char *tag, int tag_len,
-                                  void **out_buf, size_t *out_size,
-                                  struct flb_filter_instance *f_ins,
-                                  void *context,
-                                  struct flb_config *config)
+static int cb_modifier_filter(msgpack_object *map, msgpack_zone *zone,
+                              char *tag, int tag_len,
+                              struct flb_filter_instance *f_ins,
+                              void *context,
+                              struct flb_config *config)
 {
     struct record_modifier_ctx *ctx = context;
-    char is_modified = FLB_FALSE;
-    size_t off = 0;
     int i;
+    int n = 0;
     int removed_map_num  = 0;
     int map_num          = 0;
     bool_map_t bool_map[128];
+    (void) tag;
+    (void) tag_len;
     (void) f_ins;
     (void) config;
-    struct flb_time tm;
     struct modifier_record *mod_rec;
-    msgpack_sbuffer tmp_sbuf;
-    msgpack_packer tmp_pck;
-    msgpack_unpacked result;
-    msgpack_object  *obj;
     msgpack_object_kv *kv;
-    struct mk_list *tmp;
+    msgpack_object_kv *new_kv;
     struct mk_list *head;
 
-    /* Create temporal msgpack buffer */
-    msgpack_sbuffer_init(&tmp_sbuf);
-    msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
-
-    /* Iterate each item to know map number */
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        map_num = 0;
-        removed_map_num = 0;
-        if (result.data.type != MSGPACK_OBJECT_ARRAY) {
-            continue;
-        }
-
-        flb_time_pop_from_msgpack(&tm, &result, &obj);
-
-        /* grep keys */
-        if (obj->type == MSGPACK_OBJECT_MAP) {
-            map_num = obj->via.map.size;
-            removed_map_num = make_bool_map(ctx, obj,
-                                            bool_map, obj->via.map.size);
-        }
-        else {
-            continue;
-        }
+    if (map->type != MSGPACK_OBJECT_MAP) {
+        return FLB_FILTER_DROP;
+    }
 
-        if (removed_map_num != map_num) {
-            is_modified = FLB_TRUE;
-        }
+    /* grep keys */
+    map_num = map->via.map.size;
+    removed_map_num = make_bool_map(ctx, map, bool_map, map_num);
 
-        removed_map_num += ctx->records_num;
-        if (removed_map_num <= 0) {
-            continue;
-        }
+    if (removed_map_num == map_num && ctx->records_num == 0) {
+        return FLB_FILTER_NOTOUCH;
+    }
 
-        msgpack_pack_array(&tmp_pck, 2);
-        flb_time_append_to_msgpack(&tm, &tmp_pck, 0);
+    if (removed_map_num + ctx->records_num <= 0) {
+        return FLB_FILTER_DROP;
+    }
 
-        msgpack_pack_map(&tmp_pck, removed_map_num);
-        kv = obj->via.map.ptr;
-        for(i=0; bool_map[i] != TAIL_OF_ARRAY; i++) {
-            if (bool_map[i] == TO_BE_REMAINED) {
-                msgpack_pack_object(&tmp_pck, (kv+i)->key);
-                msgpack_pack_object(&tmp_pck, (kv+i)->val);
-            }
-        }
+    /* Compose the new map on the record zone, values are not copied */
+    new_kv = msgpack_zone_malloc(zone, sizeof(msgpack_object_kv) *
+                                 (removed_map_num + ctx->records_num));
+    if (!new_kv) {
+        flb_errno();
+        return FLB_FILTER_NOTOUCH;
+    }
 
-        /* append record */
-        if (ctx->records_num > 0) {
-            is_modified = FLB_TRUE;
-            mk_list_foreach_safe(head, tmp, &ctx->records) {
-                mod_rec = mk_list_entry(head, struct modifier_record,  _head);
-                msgpack_pack_str(&tmp_pck, mod_rec->key_len);
-                msgpack_pack_str_body(&tmp_pck,
-                                      mod_rec->key, mod_rec->key_len);
-                msgpack_pack_str(&tmp_pck, mod_rec->val_len);
-                msgpack_pack_str_body(&tmp_pck,
-                                      mod_rec->val, mod_rec->val_len);
-            }
+    kv = map->via.map.ptr;
+    for (i = 0; bool_map[i] != TAIL_OF_ARRAY; i++) {
+        if (bool_map[i] == TO_BE_REMAINED) {
+            new_kv[n++] = kv[i];
         }
     }
-    msgpack_unpacked_destroy(&result);
 
-    if (is_modified != FLB_TRUE) {
-        /* Destroy the buffer to avoid more overhead */
-        msgpack_sbuffer_destroy(&tmp_sbuf);
-        return FLB_FILTER_NOTOUCH;
+    /* append record */
+    mk_list_foreach(head, &ctx->records) {
+        mod_rec = mk_list_entry(head, struct modifier_record,  _head);
+        new_kv[n].key.type = MSGPACK_OBJECT_STR;
+        new_kv[n].key.via.str.ptr  = mod_rec->key;
+        new_kv[n].key.via.str.size = mod_rec->key_len;
+        new_kv[n].val.type = MSGPACK_OBJECT_STR;
+        new_kv[n].val.via.str.ptr  = mod_rec->val;
+        new_kv[n].val.via.str.size = mod_rec->val_len;
+        n++;
     }
 
-    /* link new buffers */
-    *out_buf  = tmp_sbuf.data;
-    *out_size = tmp_sbuf.size;
+    map->via.map.ptr  = new_kv;
+    map->via.map.size = n;
+
     return FLB_FILTER_MODIFIED;
 }
 
@@ -357,7 +327,7 @@ struct flb_filter_plugin filter_record_modifier_plugin = {
     .name         = "record_modifier",
     .description  = "modify record",
     .cb_init      = cb_modifier_init,
-    .cb_filter    = cb_modifier_filter,
+    .cb_filter_record = cb_modifier_filter,
     .cb_exit      = cb_modifier_exit,
     .flags        = 0
 };
@@ -0,0 +1,192 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+
+#include "bucket.h"
+#include "throttle.h"
+
+/* FNV-1a */
+static inline unsigned int key_hash(char *key, int len)
+{
+    int i;
+    unsigned int h = 2166136261u;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+struct throttle_buckets *buckets_create(double rate, double capacity,
+                                        int max_keys)
+{
+    int i;
+    struct throttle_buckets *tb;
+
+    if (max_keys <= 0) {
+        return NULL;
+    }
+
+    tb = flb_calloc(1, sizeof(struct throttle_buckets));
+    if (!tb) {
+        flb_errno();
+        return NULL;
+    }
+
+    tb->rate = rate;
+    tb->capacity = capacity;
+    tb->max_keys = max_keys;
+    tb->n_slots = max_keys;
+    tb->slots = flb_malloc(sizeof(struct mk_list) * tb->n_slots);
+    if (!tb->slots) {
+        flb_errno();
+        flb_free(tb);
+        return NULL;
+    }
+
+    for (i = 0; i < tb->n_slots; i++) {
+        mk_list_init(&tb->slots[i]);
+    }
+    mk_list_init(&tb->lru);
+
+    return tb;
+}
+
+void buckets_destroy(struct throttle_buckets *tb)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct throttle_bucket *b;
+
+    if (!tb) {
+        return;
+    }
+
+    mk_list_foreach_safe(head, tmp, &tb->lru) {
+        b = mk_list_entry(head, struct throttle_bucket, _lru);
+        flb_free(b->key);
+        flb_free(b);
+    }
+    flb_free(tb->slots);
+    flb_free(tb);
+}
+
+static struct throttle_bucket *bucket_new(struct throttle_buckets *tb,
+                                          char *key, int key_len,
+                                          unsigned int hash, double now)
+{
+    char *tmp;
+    struct throttle_bucket *b;
+
+    if (tb->count < tb->max_keys) {
+        b = flb_calloc(1, sizeof(struct throttle_bucket));
+        if (!b) {
+            flb_errno();
+            return NULL;
+        }
+        tb->count++;
+    }
+    else {
+        /* Recycle the least recently used bucket */
+        b = mk_list_entry_first(&tb->lru, struct throttle_bucket, _lru);
+        mk_list_del(&b->_head);
+        mk_list_del(&b->_lru);
+    }
+
+    if (b->key_size < key_len + 1) {
+        tmp = flb_realloc(b->key, key_len + 1);
+        if (!tmp) {
+            flb_errno();
+            flb_free(b->key);
+            flb_free(b);
+            tb->count--;
+            return NULL;
+        }
+        b->key = tmp;
+        b->key_size = key_len + 1;
+    }
+    memcpy(b->key, key, key_len);
+    b->key[key_len] = '\0';
+    b->key_len = key_len;
+    b->hash = hash;
+
+    /* A new key starts with a full bucket */
+    b->tokens = tb->capacity;
+    b->last = now;
+
+    mk_list_add(&b->_head, &tb->slots[hash % tb->n_slots]);
+    mk_list_add(&b->_lru, &tb->lru);
+
+    return b;
+}
+
+/*
+ * Take a token from the bucket of 'key' at time 'now' (seconds), refilling
+ * it first with the tokens earned since the last access.
+ */
+int buckets_take(struct throttle_buckets *tb, char *key, int key_len,
+                 double now)
+{
+    unsigned int hash;
+    struct mk_list *head;
+    struct throttle_bucket *b = NULL;
+    struct throttle_bucket *entry;
+
+    hash = key_hash(key, key_len);
+    mk_list_foreach(head, &tb->slots[hash % tb->n_slots]) {
+        entry = mk_list_entry(head, struct throttle_bucket, _head);
+        if (entry->hash == hash && entry->key_len == key_len &&
+            memcmp(entry->key, key, key_len) == 0) {
+            b = entry;
+            break;
+        }
+    }
+
+    if (b) {
+        mk_list_del(&b->_lru);
+        mk_list_add(&b->_lru, &tb->lru);
+
+        if (now > b->last) {
+            b->tokens += (now - b->last) * tb->rate;
+            if (b->tokens > tb->capacity) {
+                b->tokens = tb->capacity;
+            }
+            b->last = now;
+        }
+    }
+    else {
+        b = bucket_new(tb, key, key_len, hash, now);
+        if (!b) {
+            /* Out of memory, don't lose data */
+            return THROTTLE_RET_KEEP;
+        }
+    }
+
+    if (b->tokens < 1.0) {
+        return THROTTLE_RET_DROP;
+    }
+
+    b->tokens -= 1.0;
+    return THROTTLE_RET_KEEP;
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_FILTER_THROTTLE_BUCKET_H
+#define FLB_FILTER_THROTTLE_BUCKET_H
+
+#include <monkey/mk_core.h>
+
+/*
+ * Keyed throttling: every key (a record field value or the Tag) owns a
+ * token bucket. Buckets are refilled when they are accessed, so no timer is
+ * needed, and the table holds up to 'max_keys' buckets: the least recently
+ * used one is recycled for a new key.
+ */
+
+struct throttle_bucket {
+    char *key;
+    int key_len;
+    int key_size;                /* allocated bytes for key       */
+    unsigned int hash;
+    double tokens;
+    double last;                 /* last refill time (seconds)    */
+    struct mk_list _head;        /* link to hash table slot       */
+    struct mk_list _lru;         /* link to LRU list              */
+};
+
+struct throttle_buckets {
+    double rate;                 /* tokens added per second       */
+    double capacity;             /* max tokens (burst)            */
+    int max_keys;
+    int count;
+    int n_slots;
+    struct mk_list *slots;
+    struct mk_list lru;          /* least recently used first     */
+};
+
+struct throttle_buckets *buckets_create(double rate, double capacity,
+                                        int max_keys);
+void buckets_destroy(struct throttle_buckets *tb);
+int buckets_take(struct throttle_buckets *tb, char *key, int key_len,
+                 double now);
+
+#endif
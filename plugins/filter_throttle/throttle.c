@@ -18,6 +18,8 @@
  */
 
 #include <stdio.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/types.h>
 
 #include <fluent-bit/flb_info.h>
@@ -28,11 +30,13 @@
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_log.h>
 #include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_metrics.h>
 #include <msgpack.h>
 #include "stdlib.h"
 
 #include "throttle.h"
 #include "window.h"
+#include "bucket.h"
 
 
 static bool apply_suffix (double *x, char suffix_char)
@@ -64,29 +68,66 @@ static bool apply_suffix (double *x, char suffix_char)
 }
 
 
+/*
+ * Wait up to the slide interval or until the ticker is stopped, the caller
+ * holds the ticker lock.
+ */
+static void ticker_wait(struct ticker *t)
+{
+    int ret;
+    long nsec;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    nsec = ts.tv_nsec + (long) ((t->seconds - (time_t) t->seconds) * 1e9);
+    ts.tv_sec += (time_t) t->seconds + (nsec / 1000000000L);
+    ts.tv_nsec = nsec % 1000000000L;
+
+    while (!t->done) {
+        ret = pthread_cond_timedwait(&t->cond, &t->lock, &ts);
+        if (ret == ETIMEDOUT) {
+            break;
+        }
+    }
+}
+
 void *time_ticker(void *args)
 {
     struct ticker *t = args;
     struct flb_time ftm;
+    struct throttle_window *hash = t->ctx->hash;
     long timestamp;
+    unsigned rate;
 
+    pthread_mutex_lock(&t->lock);
     while (!t->done) {
+        pthread_mutex_unlock(&t->lock);
+
         flb_time_get(&ftm);
         timestamp = flb_time_to_double(&ftm);
-        window_add(t->ctx->hash, timestamp, 0);
 
-        t->ctx->hash->current_timestamp = timestamp;
+        /* The filter callback counts records in the same window */
+        pthread_mutex_lock(&hash->result_mutex);
+        window_add(hash, timestamp, 0);
+        rate = hash->total / hash->size;
+        pthread_mutex_unlock(&hash->result_mutex);
 
         if (t->ctx->print_status) {
-            flb_info("[filter_throttle] %i: limit is %0.2f per %s with window size of %i, current rate is: %i per interval", timestamp, t->ctx->max_rate, t->ctx->slide_interval, t->ctx->window_size, t->ctx->hash->total / t->ctx->hash->size);
+            flb_info("[filter_throttle] %i: limit is %0.2f per %s with window size of %i, current rate is: %i per interval", timestamp, t->ctx->max_rate, t->ctx->slide_interval, t->ctx->window_size, rate);
         }
-        sleep(t->seconds);
+
+        pthread_mutex_lock(&t->lock);
+        ticker_wait(t);
     }
+    pthread_mutex_unlock(&t->lock);
 
     return NULL;
 }
 
-/* Given a msgpack record, do some filter action based on the defined rules */
+/*
+ * Given a msgpack record, do some filter action based on the defined rules,
+ * the caller holds the window lock.
+ */
 static inline int throttle_data(struct flb_filter_throttle_ctx *ctx)
 {
     if ((ctx->hash->total / (double) ctx->hash->size) >= ctx->max_rate) {
@@ -98,6 +139,58 @@ static inline int throttle_data(struct flb_filter_throttle_ctx *ctx)
     return THROTTLE_RET_KEEP;
 }
 
+/* Keyed mode: take a token from the bucket of the record key */
+static inline int throttle_key(struct flb_filter_throttle_ctx *ctx,
+                               char *tag, int tag_len,
+                               msgpack_object *root, double now)
+{
+    int i;
+    int len = 0;
+    char *key = "";
+    char num[32];
+    msgpack_object map;
+    msgpack_object *k;
+    msgpack_object *v;
+
+    if (ctx->key_tag == FLB_TRUE) {
+        return buckets_take(ctx->buckets, tag, tag_len, now);
+    }
+
+    /* Records without the key share one bucket */
+    map = root->via.array.ptr[1];
+    if (map.type == MSGPACK_OBJECT_MAP) {
+        for (i = 0; i < map.via.map.size; i++) {
+            k = &map.via.map.ptr[i].key;
+            if (k->type != MSGPACK_OBJECT_STR ||
+                k->via.str.size != ctx->key_len ||
+                strncmp(k->via.str.ptr, ctx->key, ctx->key_len) != 0) {
+                continue;
+            }
+
+            v = &map.via.map.ptr[i].val;
+            if (v->type == MSGPACK_OBJECT_STR) {
+                key = (char *) v->via.str.ptr;
+                len = v->via.str.size;
+            }
+            else if (v->type == MSGPACK_OBJECT_BIN) {
+                key = (char *) v->via.bin.ptr;
+                len = v->via.bin.size;
+            }
+            else if (v->type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
+                len = snprintf(num, sizeof(num), "%" PRIu64, v->via.u64);
+                key = num;
+            }
+            else if (v->type == MSGPACK_OBJECT_NEGATIVE_INTEGER) {
+                len = snprintf(num, sizeof(num), "%" PRId64, v->via.i64);
+                key = num;
+            }
+            break;
+        }
+    }
+
+    return buckets_take(ctx->buckets, key, len, now);
+}
+
 static int configure(struct flb_filter_throttle_ctx *ctx, struct flb_filter_instance *f_ins)
 {
     char *str = NULL;
@@ -136,6 +229,27 @@ static int configure(struct flb_filter_throttle_ctx *ctx, struct flb_filter_inst
     } else {
         ctx->slide_interval = THROTTLE_DEFAULT_INTERVAL;
     }
+
+    /* keyed mode: record field name or $tag */
+    str = flb_filter_get_property("key", f_ins);
+    if (str != NULL) {
+        if (strcasecmp(str, THROTTLE_KEY_TAG) == 0) {
+            ctx->key_tag = FLB_TRUE;
+        }
+        else {
+            ctx->key = str;
+            ctx->key_len = strlen(str);
+        }
+    }
+
+    /* max number of keys tracked in keyed mode */
+    str = flb_filter_get_property("max_keys", f_ins);
+    if (str != NULL && (val = strtoul(str, &endp, 10)) > 0) {
+        ctx->max_keys = val;
+    } else {
+        ctx->max_keys = THROTTLE_DEFAULT_MAX_KEYS;
+    }
+
     return 0;
 }
 
@@ -164,12 +278,12 @@ static int cb_throttle_init(struct flb_filter_instance *f_ins,
                         void *data)
 {
     int ret;
+    double seconds;
     struct flb_filter_throttle_ctx *ctx;
-    pthread_t tid;
     struct ticker *ticker_ctx;
 
     /* Create context */
-    ctx = flb_malloc(sizeof(struct flb_filter_throttle_ctx));
+    ctx = flb_calloc(1, sizeof(struct flb_filter_throttle_ctx));
     if (!ctx) {
         flb_errno();
         return -1;
@@ -182,7 +296,40 @@ static int cb_throttle_init(struct flb_filter_instance *f_ins,
         return -1;
     }
 
+#ifdef FLB_HAVE_METRICS
+    if (f_ins->metrics) {
+        flb_metrics_add(THROTTLE_METRIC_DROPPED, "drop_records", f_ins->metrics);
+        flb_metrics_add(THROTTLE_METRIC_PASSED, "pass_records", f_ins->metrics);
+    }
+#endif
+
+    seconds = parse_duration(ctx->slide_interval);
+    if (seconds <= 0) {
+        seconds = 1;
+    }
+
+    /*
+     * Keyed mode: 'rate' tokens per 'interval' for every key, with bursts of
+     * up to 'rate' x 'window' records, the same limits the sliding window
+     * applies globally.
+     */
+    if (ctx->key || ctx->key_tag == FLB_TRUE) {
+        ctx->buckets = buckets_create(ctx->max_rate / seconds,
+                                      ctx->max_rate * ctx->window_size,
+                                      ctx->max_keys);
+        if (!ctx->buckets) {
+            flb_free(ctx);
+            return -1;
+        }
+        flb_filter_set_context(f_ins, ctx);
+        return 0;
+    }
+
     ctx->hash = window_create(ctx->window_size);
+    if (!ctx->hash) {
+        flb_free(ctx);
+        return -1;
+    }
 
     /* Set our context */
     flb_filter_set_context(f_ins, ctx);
@@ -190,8 +337,11 @@ static int cb_throttle_init(struct flb_filter_instance *f_ins,
     ticker_ctx = flb_malloc(sizeof(struct ticker));
     ticker_ctx->ctx = ctx;
     ticker_ctx->done = false;
-    ticker_ctx->seconds = parse_duration(ctx->slide_interval);
-    pthread_create(&tid, NULL, &time_ticker, ticker_ctx);
+    ticker_ctx->seconds = seconds;
+    pthread_mutex_init(&ticker_ctx->lock, NULL);
+    pthread_cond_init(&ticker_ctx->cond, NULL);
+    ctx->ticker = ticker_ctx;
+    pthread_create(&ctx->ticker_tid, NULL, &time_ticker, ticker_ctx);
     return 0;
 }
 
@@ -205,10 +355,12 @@ static int cb_throttle_filter(void *data, size_t bytes,
     int ret;
     int old_size = 0;
     int new_size = 0;
+    double now = 0;
+    struct flb_time tm;
+    struct flb_filter_throttle_ctx *ctx = context;
     msgpack_unpacked result;
     msgpack_object root;
     size_t off = 0;
-    (void) f_ins;
     (void) config;
     msgpack_sbuffer tmp_sbuf;
     msgpack_packer tmp_pck;
@@ -217,6 +369,15 @@ static int cb_throttle_filter(void *data, size_t bytes,
     msgpack_sbuffer_init(&tmp_sbuf);
     msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
 
+    if (ctx->buckets) {
+        flb_time_get(&tm);
+        now = flb_time_to_double(&tm);
+    }
+
+    /* The ticker thread slides the window, hold it for the whole chunk */
+    if (ctx->hash) {
+        pthread_mutex_lock(&ctx->hash->result_mutex);
+    }
 
     /* Iterate each item array and apply rules */
     msgpack_unpacked_init(&result);
@@ -228,7 +389,12 @@ static int cb_throttle_filter(void *data, size_t bytes,
 
         old_size++;
 
-        ret = throttle_data(context);
+        if (ctx->buckets) {
+            ret = throttle_key(ctx, tag, tag_len, &root, now);
+        }
+        else {
+            ret = throttle_data(ctx);
+        }
         if (ret == THROTTLE_RET_KEEP) {
             msgpack_pack_object(&tmp_pck, root);
             new_size++;
@@ -239,6 +405,18 @@ static int cb_throttle_filter(void *data, size_t bytes,
     }
     msgpack_unpacked_destroy(&result);
 
+    if (ctx->hash) {
+        pthread_mutex_unlock(&ctx->hash->result_mutex);
+    }
+
+#ifdef FLB_HAVE_METRICS
+    if (f_ins->metrics) {
+        flb_metrics_sum(THROTTLE_METRIC_PASSED, new_size, f_ins->metrics);
+        flb_metrics_sum(THROTTLE_METRIC_DROPPED, old_size - new_size,
+                        f_ins->metrics);
+    }
+#endif
+
     /* we keep everything ? */
     if (old_size == new_size) {
         /* Destroy the buffer to avoid more overhead */
@@ -257,6 +435,25 @@ static int cb_throttle_exit(void *data, struct flb_config *config)
 {
     struct flb_filter_throttle_ctx *ctx = data;
 
+    if (ctx->ticker) {
+        /* Wake the ticker up, it may be waiting for a whole interval */
+        pthread_mutex_lock(&ctx->ticker->lock);
+        ctx->ticker->done = true;
+        pthread_cond_signal(&ctx->ticker->cond);
+        pthread_mutex_unlock(&ctx->ticker->lock);
+
+        pthread_join(ctx->ticker_tid, NULL);
+        pthread_cond_destroy(&ctx->ticker->cond);
+        pthread_mutex_destroy(&ctx->ticker->lock);
+        flb_free(ctx->ticker);
+    }
+
+    if (ctx->hash) {
+        pthread_mutex_destroy(&ctx->hash->result_mutex);
+        flb_free(ctx->hash->table);
+        flb_free(ctx->hash);
+    }
+    buckets_destroy(ctx->buckets);
     flb_free(ctx);
     return 0;
 }
@@ -20,6 +20,11 @@
 #ifndef FLB_FILTER_THROTTLE_H
 #define FLB_FILTER_THROTTLE_H
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <fluent-bit/flb_filter.h>
+
 /* actions */
 #define THROTTLE_RET_KEEP  0
 #define THROTTLE_RET_DROP  1
@@ -29,6 +34,16 @@
 #define THROTTLE_DEFAULT_WINDOW  5
 #define THROTTLE_DEFAULT_INTERVAL  "1"
 #define THROTTLE_DEFAULT_STATUS FLB_FALSE;
+#define THROTTLE_DEFAULT_MAX_KEYS  1024
+
+/* Throttle by Tag instead of a record field (Key $tag) */
+#define THROTTLE_KEY_TAG  "$tag"
+
+/* metrics */
+#define THROTTLE_METRIC_DROPPED  10
+#define THROTTLE_METRIC_PASSED   11
+
+struct throttle_buckets;
 
 struct flb_filter_throttle_ctx {
     double    max_rate;
@@ -36,14 +51,25 @@ struct flb_filter_throttle_ctx {
     char  *slide_interval;
     int print_status;
 
+    /* keyed mode: one token bucket per record field value or Tag */
+    char *key;
+    int key_len;
+    int key_tag;
+    int max_keys;
+
     /* internal */
     struct throttle_window *hash;
+    struct throttle_buckets *buckets;
+    struct ticker *ticker;
+    pthread_t ticker_tid;
 };
 
 struct ticker {
     struct flb_filter_throttle_ctx *ctx;
-    bool done;
+    bool done;                  /* protected by 'lock' */
     double seconds;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        /* signaled on exit to stop the ticker */
 };
 
 #endif
@@ -50,6 +50,7 @@ struct throttle_window *window_create(size_t size) {
         flb_free(tw);
         return NULL;
     }
+    pthread_mutex_init(&tw->result_mutex, NULL);
 
     return tw;
 }
@@ -30,48 +30,37 @@ int fw_conn_event(void *data)
 {
     int ret;
     int bytes;
-    int available;
-    int size;
-    char *tmp;
+    size_t available;
     struct mk_event *event;
     struct fw_conn *conn = data;
-    struct flb_in_fw_config *ctx = conn->ctx;
+    msgpack_unpacker *unp = conn->unp;
 
     event = &conn->event;
     if (event->mask & MK_EVENT_READ) {
-        available = (conn->buf_size - conn->buf_len);
-        if (available < 1) {
-            if (conn->buf_size + ctx->buffer_chunk_size > ctx->buffer_max_size) {
-                flb_warn("[in_fw] fd=%i incoming data exceed limit (%i bytes)",
-                         event->fd, (ctx->buffer_max_size));
+        /*
+         * Read straight into the unpacker: an incomplete message stays
+         * there until the rest of it arrives.
+         */
+        available = msgpack_unpacker_buffer_capacity(unp);
+        if (available < conn->ctx->buffer_chunk_size) {
+            if (!msgpack_unpacker_reserve_buffer(unp,
+                                                 conn->ctx->buffer_chunk_size)) {
+                flb_error("[in_fw] could not expand unpacker buffer");
                 fw_conn_del(conn);
                 return -1;
             }
-
-            size = conn->buf_size + ctx->buffer_chunk_size;
-            tmp = flb_realloc(conn->buf, size);
-            if (!tmp) {
-                flb_errno();
-                return -1;
-            }
-            flb_trace("[in_fw] fd=%i buffer realloc %i -> %i",
-                      event->fd, conn->buf_size, size);
-
-            conn->buf = tmp;
-            conn->buf_size = size;
-            available = (conn->buf_size - conn->buf_len);
+            available = msgpack_unpacker_buffer_capacity(unp);
         }
 
-        bytes = read(conn->fd,
-                     conn->buf + conn->buf_len, available);
+        bytes = read(conn->fd, msgpack_unpacker_buffer(unp), available);
 
         if (bytes > 0) {
-            flb_trace("[in_fw] read()=%i pre_len=%i now_len=%i",
-                      bytes, conn->buf_len, conn->buf_len + bytes);
-            conn->buf_len += bytes;
+            flb_trace("[in_fw] read()=%i", bytes);
+            msgpack_unpacker_buffer_consumed(unp, bytes);
 
             ret = fw_prot_process(conn);
             if (ret == -1) {
+                fw_conn_del(conn);
                 return -1;
             }
             return bytes;
@@ -113,27 +102,23 @@ struct fw_conn *fw_conn_add(int fd, struct flb_in_fw_config *ctx)
     /* Connection info */
     conn->fd      = fd;
     conn->ctx     = ctx;
-    conn->buf_len = 0;
-    conn->rest    = 0;
     conn->status  = FW_NEW;
+    conn->in      = ctx->in;
 
-    /* Allocate read buffer */
-    conn->buf = flb_malloc(ctx->buffer_chunk_size);
-    if (!conn->buf) {
-        flb_errno();
+    conn->unp = msgpack_unpacker_new(ctx->buffer_chunk_size);
+    if (!conn->unp) {
+        flb_error("[in_fw] could not allocate unpacker");
         close(fd);
         flb_free(conn);
         return NULL;
     }
-    conn->buf_size = ctx->buffer_chunk_size;
-    conn->in       = ctx->in;
 
     /* Register instance into the event loop */
     ret = mk_event_add(ctx->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
     if (ret == -1) {
         flb_error("[in_fw] could not register new connection");
         close(fd);
-        flb_free(conn->buf);
+        msgpack_unpacker_free(conn->unp);
         flb_free(conn);
         return NULL;
     }
@@ -151,7 +136,7 @@ int fw_conn_del(struct fw_conn *conn)
     /* Release resources */
     mk_list_del(&conn->_head);
     close(conn->fd);
-    flb_free(conn->buf);
+    msgpack_unpacker_free(conn->unp);
     flb_free(conn);
 
     return 0;
@@ -20,6 +20,8 @@
 #ifndef FLB_IN_FW_CONN_H
 #define FLB_IN_FW_CONN_H
 
+#include <msgpack.h>
+
 #define FLB_IN_FW_CHUNK 32768
 
 enum {
@@ -39,10 +41,7 @@ struct fw_conn {
     int status;                      /* Connection status                 */
 
     /* Buffer */
-    char *buf;                       /* Buffer data                       */
-    int  buf_len;                    /* Data length                       */
-    int  buf_size;                   /* Buffer size                       */
-    size_t rest;                     /* Unpacking offset                  */
+    msgpack_unpacker *unp;           /* Stream unpacker                   */
 
     struct flb_input_instance *in;   /* Parent plugin instance            */
     struct flb_in_fw_config *ctx;    /* Plugin configuration context      */
@@ -0,0 +1,182 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <unistd.h>
+#include <msgpack.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_network.h>
+
+#include "http.h"
+#include "http_conn.h"
+#include "http_prot.h"
+#include "http_config.h"
+
+/*
+ * For a server event, the collection event means a new client have arrived,
+ * we accept the connection and register it in the event loop.
+ */
+static int in_http_collect(struct flb_input_instance *i_ins,
+                           struct flb_config *config, void *in_context)
+{
+    int fd;
+    struct flb_in_http_config *ctx = in_context;
+    struct http_conn *conn;
+    (void) i_ins;
+
+    /* Accept the new connection */
+    fd = flb_net_accept(ctx->server_fd);
+    if (fd == -1) {
+        flb_error("[in_http] could not accept new connection");
+        return -1;
+    }
+
+    flb_trace("[in_http] new TCP connection arrived FD=%i", fd);
+    conn = http_conn_add(fd, ctx);
+    if (!conn) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Initialize plugin */
+static int in_http_init(struct flb_input_instance *in,
+                        struct flb_config *config, void *data)
+{
+    int ret;
+    struct flb_in_http_config *ctx;
+    (void) data;
+
+    /* Allocate space for the configuration */
+    ctx = http_config_init(in);
+    if (!ctx) {
+        return -1;
+    }
+    ctx->in = in;
+    mk_list_init(&ctx->connections);
+
+    /* Set the context */
+    flb_input_set_context(in, ctx);
+
+    /* Create TCP server */
+    ctx->server_fd = flb_net_server(ctx->tcp_port, ctx->listen);
+    if (ctx->server_fd > 0) {
+        flb_info("[in_http] binding %s:%s", ctx->listen, ctx->tcp_port);
+    }
+    else {
+        flb_error("[in_http] could not bind address %s:%s. Aborting",
+                  ctx->listen, ctx->tcp_port);
+        http_config_destroy(ctx);
+        return -1;
+    }
+    flb_net_socket_nonblocking(ctx->server_fd);
+
+    ctx->evl = config->evl;
+
+    /* Collect upon new connections */
+    ret = flb_input_set_collector_socket(in,
+                                         in_http_collect,
+                                         ctx->server_fd,
+                                         config);
+    if (ret == -1) {
+        flb_error("Could not set collector for IN_HTTP input plugin");
+        close(ctx->server_fd);
+        http_config_destroy(ctx);
+        return -1;
+    }
+    ctx->coll_fd = ret;
+
+    return 0;
+}
+
+/*
+ * The engine buffers are full: stop accepting connections and reading
+ * requests, the clients get the pressure through the TCP window.
+ */
+static void in_http_pause(void *data, struct flb_config *config)
+{
+    struct mk_list *head;
+    struct http_conn *conn;
+    struct flb_in_http_config *ctx = data;
+
+    if (ctx->paused == FLB_TRUE) {
+        return;
+    }
+    ctx->paused = FLB_TRUE;
+    flb_input_collector_pause(ctx->coll_fd, ctx->in);
+
+    mk_list_foreach(head, &ctx->connections) {
+        conn = mk_list_entry(head, struct http_conn, _head);
+        http_conn_update(conn);
+    }
+}
+
+/* Process the requests buffered while paused and read again */
+static void in_http_resume(void *data, struct flb_config *config)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct http_conn *conn;
+    struct flb_in_http_config *ctx = data;
+
+    if (ctx->paused == FLB_FALSE) {
+        return;
+    }
+    ctx->paused = FLB_FALSE;
+    flb_input_collector_resume(ctx->coll_fd, ctx->in);
+
+    mk_list_foreach_safe(head, tmp, &ctx->connections) {
+        conn = mk_list_entry(head, struct http_conn, _head);
+        if (http_prot_process(conn) == -1) {
+            continue;
+        }
+        http_conn_update(conn);
+    }
+}
+
+static int in_http_exit(void *data, struct flb_config *config)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct http_conn *conn;
+    struct flb_in_http_config *ctx = data;
+    (void) config;
+
+    mk_list_foreach_safe(head, tmp, &ctx->connections) {
+        conn = mk_list_entry(head, struct http_conn, _head);
+        http_conn_del(conn);
+    }
+
+    close(ctx->server_fd);
+    http_config_destroy(ctx);
+    return 0;
+}
+
+/* Plugin reference */
+struct flb_input_plugin in_http_plugin = {
+    .name         = "http",
+    .description  = "HTTP",
+    .cb_init      = in_http_init,
+    .cb_pre_run   = NULL,
+    .cb_collect   = in_http_collect,
+    .cb_flush_buf = NULL,
+    .cb_pause     = in_http_pause,
+    .cb_resume    = in_http_resume,
+    .cb_exit      = in_http_exit,
+    .flags        = FLB_INPUT_NET | FLB_INPUT_DYN_TAG
+};
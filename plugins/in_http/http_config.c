@@ -0,0 +1,118 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <fluent-bit/flb_utils.h>
+
+#include "http.h"
+#include "http_config.h"
+
+struct flb_in_http_config *http_config_init(struct flb_input_instance *i_ins)
+{
+    char tmp[16];
+    ssize_t chunk;
+    ssize_t max;
+    char *listen;
+    char *buffer_size;
+    char *chunk_size;
+    char *pool_limit;
+    ssize_t limit = 0;
+    struct flb_in_http_config *config;
+
+    config = flb_calloc(1, sizeof(struct flb_in_http_config));
+    if (!config) {
+        flb_errno();
+        return NULL;
+    }
+
+    /* Listen interface (if not set, defaults to 0.0.0.0) */
+    if (!i_ins->host.listen) {
+        listen = flb_input_get_property("listen", i_ins);
+        if (listen) {
+            config->listen = flb_strdup(listen);
+        }
+        else {
+            config->listen = flb_strdup("0.0.0.0");
+        }
+    }
+    else {
+        config->listen = flb_strdup(i_ins->host.listen);
+    }
+
+    /* Listener TCP Port */
+    if (i_ins->host.port == 0) {
+        config->tcp_port = flb_strdup("9880");
+    }
+    else {
+        snprintf(tmp, sizeof(tmp) - 1, "%d", i_ins->host.port);
+        config->tcp_port = flb_strdup(tmp);
+    }
+
+    /* Chunk size */
+    chunk_size = flb_input_get_property("buffer_chunk_size", i_ins);
+    if (!chunk_size) {
+        chunk_size = HTTP_BUFFER_CHUNK_SIZE;
+    }
+    chunk = flb_utils_size_to_bytes(chunk_size);
+
+    /* Buffer size: the largest request accepted */
+    buffer_size = flb_input_get_property("buffer_max_size", i_ins);
+    if (!buffer_size) {
+        buffer_size = HTTP_BUFFER_MAX_SIZE;
+    }
+    max = flb_utils_size_to_bytes(buffer_size);
+
+    if (chunk <= 0 || max <= 0 || chunk > max) {
+        flb_error("[in_http] invalid buffer_chunk_size/buffer_max_size");
+        http_config_destroy(config);
+        return NULL;
+    }
+    config->buffer_chunk_size = chunk;
+    config->buffer_max_size = max;
+
+    /* Connection buffers: optional limit of bytes in use by all of them */
+    pool_limit = flb_input_get_property("buffer_pool_limit", i_ins);
+    if (pool_limit) {
+        limit = flb_utils_size_to_bytes(pool_limit);
+        if (limit < 0) {
+            flb_error("[in_http] invalid buffer_pool_limit");
+            http_config_destroy(config);
+            return NULL;
+        }
+    }
+    config->pool = flb_bufpool_create(chunk, max, limit);
+    if (!config->pool) {
+        http_config_destroy(config);
+        return NULL;
+    }
+
+    flb_debug("[in_http] Listen='%s' TCP_Port=%s",
+              config->listen, config->tcp_port);
+    return config;
+}
+
+int http_config_destroy(struct flb_in_http_config *config)
+{
+    flb_bufpool_destroy(config->pool);
+    flb_free(config->listen);
+    flb_free(config->tcp_port);
+    flb_free(config);
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_network.h>
+
+#include "http.h"
+#include "http_prot.h"
+#include "http_conn.h"
+
+/*
+ * Register the events the connection waits for: nothing is read while the
+ * input is paused or the connection is going to be closed, pending output
+ * waits for the socket to be writable.
+ */
+int http_conn_update(struct http_conn *conn)
+{
+    int mask = MK_EVENT_EMPTY;
+    struct flb_in_http_config *ctx = conn->ctx;
+
+    if (ctx->paused == FLB_FALSE && conn->close == FLB_FALSE) {
+        mask |= MK_EVENT_READ;
+    }
+    if (conn->out_off < flb_sds_len(conn->out)) {
+        mask |= MK_EVENT_WRITE;
+    }
+
+    if (mask == conn->event.mask) {
+        return 0;
+    }
+
+    if (mask == MK_EVENT_EMPTY) {
+        return mk_event_del(ctx->evl, &conn->event);
+    }
+
+    return mk_event_add(ctx->evl, conn->fd, FLB_ENGINE_EV_CUSTOM, mask, conn);
+}
+
+/*
+ * Write the pending responses, returns -1 if the connection was closed,
+ * otherwise zero (the rest is written when the socket is writable).
+ */
+int http_conn_write(struct http_conn *conn)
+{
+    ssize_t bytes;
+    size_t len;
+
+    len = flb_sds_len(conn->out);
+    while (conn->out_off < len) {
+        bytes = write(conn->fd, conn->out + conn->out_off,
+                      len - conn->out_off);
+        if (bytes == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            else if (errno == EINTR) {
+                continue;
+            }
+            flb_trace("[in_http] fd=%i write error", conn->fd);
+            http_conn_del(conn);
+            return -1;
+        }
+        conn->out_off += bytes;
+    }
+
+    if (conn->out_off == len) {
+        flb_sds_len_set(conn->out, 0);
+        conn->out_off = 0;
+        if (conn->close == FLB_TRUE) {
+            http_conn_del(conn);
+            return -1;
+        }
+    }
+
+    http_conn_update(conn);
+    return 0;
+}
+
+/* Make room in the input buffer, returns -1 if the limit was reached */
+static int conn_buf_grow(struct http_conn *conn)
+{
+    size_t size;
+    char *tmp;
+    struct flb_in_http_config *ctx = conn->ctx;
+
+    /* The buffer holds at most one complete request */
+    if (conn->buf_size >= ctx->buffer_max_size) {
+        return -1;
+    }
+
+    size = conn->buf_size + ctx->buffer_chunk_size;
+    if (size > ctx->buffer_max_size) {
+        size = ctx->buffer_max_size;
+    }
+    tmp = flb_bufpool_realloc(ctx->pool, conn->buf, conn->buf_size, size);
+    if (!tmp) {
+        return -1;
+    }
+    flb_trace("[in_http] fd=%i buffer realloc %lu -> %lu",
+              conn->fd, conn->buf_size, size);
+
+    conn->buf = tmp;
+    conn->buf_size = size;
+    return 0;
+}
+
+/* Callback invoked every time an event is triggered for a connection */
+static int http_conn_event(void *data)
+{
+    int ret;
+    ssize_t bytes;
+    size_t available;
+    struct mk_event *event;
+    struct http_conn *conn = data;
+    struct flb_in_http_config *ctx = conn->ctx;
+
+    event = &conn->event;
+    if (event->mask & MK_EVENT_WRITE) {
+        ret = http_conn_write(conn);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+
+    if ((event->mask & MK_EVENT_READ) && ctx->paused == FLB_FALSE &&
+        conn->close == FLB_FALSE) {
+        available = conn->buf_size - conn->buf_len;
+        if (available < 1) {
+            if (conn_buf_grow(conn) == -1) {
+                flb_warn("[in_http] fd=%i request exceeds the limit "
+                         "(%lu bytes)", event->fd, ctx->buffer_max_size);
+                http_conn_del(conn);
+                return -1;
+            }
+            available = conn->buf_size - conn->buf_len;
+        }
+
+        bytes = read(conn->fd, conn->buf + conn->buf_len, available);
+        if (bytes <= 0) {
+            if (bytes == -1 && (errno == EAGAIN || errno == EINTR)) {
+                return 0;
+            }
+            flb_trace("[in_http] fd=%i closed connection", event->fd);
+            http_conn_del(conn);
+            return -1;
+        }
+
+        flb_trace("[in_http] read()=%zi pre_len=%lu now_len=%lu",
+                  bytes, conn->buf_len, conn->buf_len + bytes);
+        conn->buf_len += bytes;
+
+        ret = http_prot_process(conn);
+        if (ret == -1) {
+            return -1;
+        }
+        return bytes;
+    }
+
+    if (event->mask & MK_EVENT_CLOSE) {
+        flb_trace("[in_http] fd=%i hangup", event->fd);
+        http_conn_del(conn);
+        return -1;
+    }
+    return 0;
+}
+
+/* Create a new connection instance */
+struct http_conn *http_conn_add(int fd, struct flb_in_http_config *ctx)
+{
+    int ret;
+    struct http_conn *conn;
+    struct mk_event *event;
+
+    conn = flb_calloc(1, sizeof(struct http_conn));
+    if (!conn) {
+        flb_errno();
+        close(fd);
+        return NULL;
+    }
+
+    /* Set data for the event-loop */
+    event = &conn->event;
+    MK_EVENT_NEW(event);
+    event->fd           = fd;
+    event->type         = FLB_ENGINE_EV_CUSTOM;
+    event->handler      = http_conn_event;
+
+    /* Connection info */
+    conn->fd      = fd;
+    conn->ctx     = ctx;
+    conn->in      = ctx->in;
+    conn->close   = FLB_FALSE;
+
+    /* Allocate buffers */
+    conn->buf = flb_bufpool_get(ctx->pool, ctx->buffer_chunk_size);
+    conn->buf_size = ctx->buffer_chunk_size;
+    conn->out = flb_sds_create_size(256);
+    if (!conn->buf || !conn->out) {
+        flb_error("[in_http] could not allocate new connection");
+        close(fd);
+        flb_bufpool_put(ctx->pool, conn->buf, conn->buf_size);
+        if (conn->out) {
+            flb_sds_destroy(conn->out);
+        }
+        flb_free(conn);
+        return NULL;
+    }
+
+    mk_list_add(&conn->_head, &ctx->connections);
+
+    /* Register instance into the event loop */
+    ret = http_conn_update(conn);
+    if (ret == -1) {
+        flb_error("[in_http] could not register new connection");
+        http_conn_del(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+int http_conn_del(struct http_conn *conn)
+{
+    /* Unregister the file descriptior from the event-loop */
+    if (conn->event.status & MK_EVENT_REGISTERED) {
+        mk_event_del(conn->ctx->evl, &conn->event);
+    }
+
+    /* Release resources */
+    mk_list_del(&conn->_head);
+    close(conn->fd);
+    flb_bufpool_put(conn->ctx->pool, conn->buf, conn->buf_size);
+    flb_sds_destroy(conn->out);
+    flb_free(conn);
+
+    return 0;
+}
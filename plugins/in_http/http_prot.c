@@ -0,0 +1,639 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <strings.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_gzip.h>
+
+#include "http.h"
+#include "http_conn.h"
+#include "http_prot.h"
+
+/* Incomplete request, more data is needed */
+#define HTTP_AGAIN         0
+
+/* Body formats */
+#define HTTP_BODY_JSON     0
+#define HTTP_BODY_MSGPACK  1
+
+/* A parsed request, pointers reference the connection buffer */
+struct http_request {
+    int http_10;              /* HTTP/1.0 client                  */
+    int keep_alive;           /* 'Connection: keep-alive'         */
+    int close;                /* 'Connection: close'              */
+    int chunked;              /* 'Transfer-Encoding: chunked'     */
+    int gzip;                 /* 'Content-Encoding: gzip'         */
+    int expect;               /* 'Expect: 100-continue'           */
+    int format;               /* HTTP_BODY_JSON, HTTP_BODY_MSGPACK */
+    int status;               /* Status to reply, if already known */
+    char *method;
+    size_t method_len;
+    char *path;
+    size_t path_len;
+    ssize_t content_length;   /* -1 if not set                    */
+    char *body;
+    size_t body_len;
+};
+
+static inline int header_is(char *name, size_t len, char *str)
+{
+    size_t str_len = strlen(str);
+
+    return (len == str_len && strncasecmp(name, str, len) == 0);
+}
+
+static inline int value_has(char *value, size_t len, char *str)
+{
+    size_t i;
+    size_t str_len = strlen(str);
+
+    for (i = 0; i + str_len <= len; i++) {
+        if (strncasecmp(value + i, str, str_len) == 0) {
+            return FLB_TRUE;
+        }
+    }
+    return FLB_FALSE;
+}
+
+/* Queue a response, the content is written once the request is done */
+static int http_response(struct http_conn *conn, int status, int close)
+{
+    int len;
+    char *reason;
+    char buf[128];
+    flb_sds_t tmp;
+
+    switch (status) {
+    case 201:
+        reason = "Created";
+        break;
+    case 400:
+        reason = "Bad Request";
+        break;
+    case 405:
+        reason = "Method Not Allowed";
+        break;
+    case 413:
+        reason = "Payload Too Large";
+        break;
+    case 415:
+        reason = "Unsupported Media Type";
+        break;
+    default:
+        reason = "Internal Server Error";
+    }
+
+    len = snprintf(buf, sizeof(buf) - 1,
+                   "HTTP/1.1 %i %s\r\n"
+                   "Content-Length: 0\r\n"
+                   "%s\r\n",
+                   status, reason,
+                   close ? "Connection: close\r\n" : "");
+
+    tmp = flb_sds_cat(conn->out, buf, len);
+    if (!tmp) {
+        return -1;
+    }
+    conn->out = tmp;
+
+    if (close) {
+        conn->close = FLB_TRUE;
+    }
+    return 0;
+}
+
+/*
+ * Parse the request line and headers, 'len' is the size of the header
+ * block without the final empty line.
+ */
+static int http_headers(struct http_request *req, char *buf, size_t len)
+{
+    char *p;
+    char *end;
+    char *eol;
+    char *sep;
+    char *name;
+    char *value;
+    size_t name_len;
+    size_t value_len;
+
+    end = buf + len;
+
+    /* Request line: METHOD SP URI SP VERSION */
+    eol = memchr(buf, '\r', len);
+    if (!eol) {
+        eol = end;
+    }
+
+    p = memchr(buf, ' ', eol - buf);
+    if (!p || p == buf) {
+        return -1;
+    }
+    req->method = buf;
+    req->method_len = p - buf;
+
+    req->path = p + 1;
+    p = memchr(req->path, ' ', eol - req->path);
+    if (!p || p == req->path || *req->path != '/') {
+        return -1;
+    }
+    req->path_len = p - req->path;
+
+    p++;
+    if (eol - p != 8 || strncmp(p, "HTTP/1.", 7) != 0) {
+        return -1;
+    }
+    if (p[7] == '0') {
+        req->http_10 = FLB_TRUE;
+    }
+    else if (p[7] != '1') {
+        return -1;
+    }
+
+    /* Headers */
+    p = eol + 2;
+    while (p < end) {
+        eol = memchr(p, '\r', end - p);
+        if (!eol) {
+            eol = end;
+        }
+
+        sep = memchr(p, ':', eol - p);
+        if (!sep) {
+            return -1;
+        }
+        name = p;
+        name_len = sep - p;
+
+        value = sep + 1;
+        while (value < eol && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        value_len = eol - value;
+        while (value_len > 0 &&
+               (value[value_len - 1] == ' ' || value[value_len - 1] == '\t')) {
+            value_len--;
+        }
+
+        if (header_is(name, name_len, "Content-Length")) {
+            if (value_len == 0 || value_len > 18) {
+                return -1;
+            }
+            req->content_length = 0;
+            for (sep = value; sep < value + value_len; sep++) {
+                if (*sep < '0' || *sep > '9') {
+                    return -1;
+                }
+                req->content_length = (req->content_length * 10) + (*sep - '0');
+            }
+        }
+        else if (header_is(name, name_len, "Transfer-Encoding")) {
+            if (value_has(value, value_len, "chunked")) {
+                req->chunked = FLB_TRUE;
+            }
+            else if (!header_is(value, value_len, "identity")) {
+                req->status = 415;
+            }
+        }
+        else if (header_is(name, name_len, "Content-Encoding")) {
+            if (header_is(value, value_len, "gzip") ||
+                header_is(value, value_len, "x-gzip")) {
+                req->gzip = FLB_TRUE;
+            }
+            else if (!header_is(value, value_len, "identity")) {
+                req->status = 415;
+            }
+        }
+        else if (header_is(name, name_len, "Content-Type")) {
+            /* Anything else is parsed as JSON */
+            if (value_has(value, value_len, "msgpack")) {
+                req->format = HTTP_BODY_MSGPACK;
+            }
+        }
+        else if (header_is(name, name_len, "Connection")) {
+            if (value_has(value, value_len, "close")) {
+                req->close = FLB_TRUE;
+            }
+            else if (value_has(value, value_len, "keep-alive")) {
+                req->keep_alive = FLB_TRUE;
+            }
+        }
+        else if (header_is(name, name_len, "Expect")) {
+            if (header_is(value, value_len, "100-continue")) {
+                req->expect = FLB_TRUE;
+            }
+        }
+
+        p = eol + 2;
+    }
+
+    return 0;
+}
+
+/*
+ * Chunked body: the first pass validates the chunks and reports the
+ * encoded size, returns HTTP_AGAIN if the body is not complete. The second
+ * pass (decode == FLB_TRUE) moves the chunks data to the beginning of the
+ * body, the final size is stored in 'out_len'.
+ */
+static int http_chunked(char *buf, size_t len, int decode,
+                        size_t *enc_len, size_t *out_len)
+{
+    int digits;
+    size_t chunk;
+    size_t total = 0;
+    char *p = buf;
+    char *end = buf + len;
+    char *eol;
+
+    while (1) {
+        eol = memchr(p, '\n', end - p);
+        if (!eol) {
+            return HTTP_AGAIN;
+        }
+        if (eol == p || eol[-1] != '\r') {
+            return -1;
+        }
+
+        /* Chunk size in hex, extensions are ignored */
+        chunk = 0;
+        digits = 0;
+        while (p < eol - 1 && *p != ';') {
+            if (*p >= '0' && *p <= '9') {
+                chunk = (chunk << 4) | (*p - '0');
+            }
+            else if (*p >= 'a' && *p <= 'f') {
+                chunk = (chunk << 4) | (*p - 'a' + 10);
+            }
+            else if (*p >= 'A' && *p <= 'F') {
+                chunk = (chunk << 4) | (*p - 'A' + 10);
+            }
+            else {
+                return -1;
+            }
+            if (++digits > 15) {
+                return -1;
+            }
+            p++;
+        }
+        if (digits == 0) {
+            return -1;
+        }
+        p = eol + 1;
+
+        if (chunk == 0) {
+            break;
+        }
+
+        if ((size_t) (end - p) < chunk + 2) {
+            return HTTP_AGAIN;
+        }
+        if (p[chunk] != '\r' || p[chunk + 1] != '\n') {
+            return -1;
+        }
+
+        if (decode == FLB_TRUE) {
+            memmove(buf + total, p, chunk);
+        }
+        total += chunk;
+        p += chunk + 2;
+    }
+
+    /* Trailer headers up to the final empty line */
+    while (1) {
+        eol = memchr(p, '\n', end - p);
+        if (!eol) {
+            return HTTP_AGAIN;
+        }
+        if (eol == p || eol[-1] != '\r') {
+            return -1;
+        }
+        if (eol == p + 1) {
+            p = eol + 1;
+            break;
+        }
+        p = eol + 1;
+    }
+
+    *enc_len = p - buf;
+    *out_len = total;
+    return 1;
+}
+
+/*
+ * Build the Tag from the request path: '/app/logs?x=y' becomes 'app.logs',
+ * the root path uses the Tag of the instance.
+ */
+static int http_tag(struct http_conn *conn, struct http_request *req,
+                    char *tag, size_t size)
+{
+    size_t i;
+    size_t len;
+    char *q;
+    char *name;
+
+    q = memchr(req->path, '?', req->path_len);
+    len = q ? (size_t) (q - req->path) : req->path_len;
+
+    /* Skip the leading slash */
+    len--;
+    if (len == 0) {
+        /* Dynamic tag instances have no Tag unless it was set */
+        name = conn->in->tag ? conn->in->tag : conn->in->name;
+        len = strlen(name);
+        if (len >= size) {
+            return -1;
+        }
+        memcpy(tag, name, len);
+        tag[len] = '\0';
+        return len;
+    }
+
+    if (len >= size) {
+        return -1;
+    }
+    for (i = 0; i < len; i++) {
+        tag[i] = (req->path[i + 1] == '/') ? '.' : req->path[i + 1];
+    }
+    tag[len] = '\0';
+    return len;
+}
+
+/*
+ * Append the records of a msgpack buffer: every root object is a map or an
+ * array of maps. Nothing is appended if the content is not valid.
+ */
+static int http_records(struct http_conn *conn, char *tag, int tag_len,
+                        char *data, size_t size)
+{
+    int ret;
+    int records = 0;
+    size_t i;
+    size_t off = 0;
+    size_t prev = 0;
+    struct flb_time tm;
+    struct flb_input_dyntag *dt;
+    msgpack_unpacked result;
+    msgpack_object *root;
+
+    dt = flb_input_dyntag_write_start(conn->in, tag, tag_len);
+    if (!dt) {
+        return -1;
+    }
+
+    flb_time_get(&tm);
+
+    msgpack_unpacked_init(&result);
+    while ((ret = msgpack_unpack_next(&result, data, size, &off)) ==
+           MSGPACK_UNPACK_SUCCESS) {
+        root = &result.data;
+        if (root->type == MSGPACK_OBJECT_MAP) {
+            /* Copy the map as it comes */
+            msgpack_pack_array(&dt->mp_pck, 2);
+            flb_time_append_to_msgpack(&tm, &dt->mp_pck, 0);
+            msgpack_sbuffer_write(&dt->mp_sbuf, data + prev, off - prev);
+            records++;
+        }
+        else if (root->type == MSGPACK_OBJECT_ARRAY) {
+            for (i = 0; i < root->via.array.size; i++) {
+                if (root->via.array.ptr[i].type != MSGPACK_OBJECT_MAP) {
+                    goto error;
+                }
+                msgpack_pack_array(&dt->mp_pck, 2);
+                flb_time_append_to_msgpack(&tm, &dt->mp_pck, 0);
+                msgpack_pack_object(&dt->mp_pck, root->via.array.ptr[i]);
+                records++;
+            }
+        }
+        else {
+            goto error;
+        }
+        prev = off;
+    }
+    msgpack_unpacked_destroy(&result);
+
+    /* The whole buffer must be consumed */
+    if (off != size || records == 0) {
+        dt->mp_sbuf.size = dt->mp_buf_write_size;
+        return -1;
+    }
+
+    flb_input_dyntag_write_end(dt);
+    return records;
+
+ error:
+    msgpack_unpacked_destroy(&result);
+    dt->mp_sbuf.size = dt->mp_buf_write_size;
+    return -1;
+}
+
+/* Decode the body and register its records */
+static int http_body(struct http_conn *conn, struct http_request *req)
+{
+    int ret;
+    int tag_len;
+    char tag[256];
+    char *data;
+    size_t size;
+    void *gz_data = NULL;
+    size_t gz_size;
+    char *mp_data = NULL;
+    size_t mp_size;
+
+    tag_len = http_tag(conn, req, tag, sizeof(tag));
+    if (tag_len <= 0) {
+        return 400;
+    }
+
+    data = req->body;
+    size = req->body_len;
+    if (size == 0) {
+        return 400;
+    }
+
+    if (req->gzip == FLB_TRUE) {
+        ret = flb_gzip_uncompress(data, size, &gz_data, &gz_size);
+        if (ret == -1) {
+            return 400;
+        }
+        data = gz_data;
+        size = gz_size;
+    }
+
+    if (req->format == HTTP_BODY_JSON) {
+        ret = flb_pack_json(data, size, &mp_data, &mp_size);
+        if (ret != 0) {
+            flb_free(gz_data);
+            return 400;
+        }
+        data = mp_data;
+        size = mp_size;
+    }
+
+    ret = http_records(conn, tag, tag_len, data, size);
+    flb_free(mp_data);
+    flb_free(gz_data);
+    if (ret == -1) {
+        return 400;
+    }
+
+    flb_trace("[in_http] fd=%i tag=%s records=%i", conn->fd, tag, ret);
+    return 201;
+}
+
+/*
+ * Process the next request in the buffer, returns the number of bytes
+ * consumed, HTTP_AGAIN if the request is not complete or -1 if the
+ * connection must be closed once the response is written.
+ */
+static ssize_t http_request(struct http_conn *conn)
+{
+    int ret;
+    int status;
+    int close;
+    char *p;
+    size_t hdr_len;
+    size_t enc_len;
+    size_t total;
+    flb_sds_t tmp;
+    struct http_request req;
+    struct flb_in_http_config *ctx = conn->ctx;
+
+    p = memmem(conn->buf, conn->buf_len, "\r\n\r\n", 4);
+    if (!p) {
+        if (conn->buf_len >= ctx->buffer_max_size) {
+            http_response(conn, 413, FLB_TRUE);
+            return -1;
+        }
+        return HTTP_AGAIN;
+    }
+    hdr_len = (p - conn->buf) + 4;
+
+    memset(&req, '\0', sizeof(req));
+    req.content_length = -1;
+    req.format = HTTP_BODY_JSON;
+
+    ret = http_headers(&req, conn->buf, hdr_len - 4);
+    if (ret == -1) {
+        http_response(conn, 400, FLB_TRUE);
+        return -1;
+    }
+
+    close = req.close || (req.http_10 && !req.keep_alive);
+
+    /* The body must be known before replying: skip it or fail */
+    if (req.chunked == FLB_TRUE) {
+        req.body = conn->buf + hdr_len;
+        ret = http_chunked(req.body, conn->buf_len - hdr_len, FLB_FALSE,
+                           &enc_len, &req.body_len);
+        if (ret == -1) {
+            http_response(conn, 400, FLB_TRUE);
+            return -1;
+        }
+        else if (ret == HTTP_AGAIN) {
+            if (conn->buf_len >= ctx->buffer_max_size) {
+                http_response(conn, 413, FLB_TRUE);
+                return -1;
+            }
+            goto again;
+        }
+        http_chunked(req.body, enc_len, FLB_TRUE, &enc_len, &req.body_len);
+        total = hdr_len + enc_len;
+    }
+    else {
+        if (req.content_length < 0) {
+            req.content_length = 0;
+        }
+        total = hdr_len + req.content_length;
+        if (total > ctx->buffer_max_size) {
+            http_response(conn, 413, FLB_TRUE);
+            return -1;
+        }
+        if (conn->buf_len < total) {
+            goto again;
+        }
+        req.body = conn->buf + hdr_len;
+        req.body_len = req.content_length;
+    }
+    conn->continue_sent = FLB_FALSE;
+
+    if (req.method_len != 4 || strncmp(req.method, "POST", 4) != 0) {
+        status = 405;
+    }
+    else if (req.status != 0) {
+        status = req.status;
+    }
+    else {
+        status = http_body(conn, &req);
+    }
+
+    ret = http_response(conn, status, close);
+    if (ret == -1 || close) {
+        return -1;
+    }
+
+    return total;
+
+ again:
+    if (req.expect && conn->continue_sent == FLB_FALSE) {
+        /* Let the client send the body */
+        tmp = flb_sds_cat(conn->out, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+        if (tmp) {
+            conn->out = tmp;
+            conn->continue_sent = FLB_TRUE;
+        }
+    }
+    return HTTP_AGAIN;
+}
+
+/*
+ * Process the complete requests available in the connection buffer. The
+ * loop stops as soon as the engine pauses the instance, the remaining
+ * requests are processed on resume.
+ */
+int http_prot_process(struct http_conn *conn)
+{
+    ssize_t bytes;
+    struct flb_in_http_config *ctx = conn->ctx;
+
+    while (conn->buf_len > 0 && ctx->paused == FLB_FALSE &&
+           conn->close == FLB_FALSE) {
+        bytes = http_request(conn);
+        if (bytes == HTTP_AGAIN) {
+            break;
+        }
+        else if (bytes == -1) {
+            conn->buf_len = 0;
+            break;
+        }
+
+        if ((size_t) bytes < conn->buf_len) {
+            memmove(conn->buf, conn->buf + bytes, conn->buf_len - bytes);
+        }
+        conn->buf_len -= bytes;
+    }
+
+    return http_conn_write(conn);
+}
@@ -17,9 +17,11 @@
  *  limitations under the License.
  */
 
-#ifndef FLB_IN_HTTP_INFO_H
-#define FLB_IN_HTTP_INFO_H
+#ifndef FLB_IN_HTTP_PROT_H
+#define FLB_IN_HTTP_PROT_H
 
-#define FLB_HTTP_CONF_PATH  "@IN_HTTP_CONF_PATH@"
+#include "http_conn.h"
+
+int http_prot_process(struct http_conn *conn);
 
 #endif
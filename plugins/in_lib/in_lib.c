@@ -150,16 +150,12 @@ static int in_lib_exit(void *data, struct flb_config *config)
 {
     (void) config;
     struct flb_in_lib_config *ctx = data;
-    struct flb_pack_state *s;
 
     if (ctx->buf_data) {
         flb_free(ctx->buf_data);
     }
 
-    s = &ctx->state;
-    if (s->tokens) {
-        flb_free(s->tokens);
-    }
+    flb_pack_state_reset(&ctx->state);
 
     flb_free(ctx);
     return 0;
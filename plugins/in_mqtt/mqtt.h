@@ -20,13 +20,18 @@
 #ifndef FLB_IN_MQTT_H
 #define FLB_IN_MQTT_H
 
+#include <fluent-bit/flb_bufpool.h>
+
 #define MQTT_MSGP_BUF_SIZE 8192
+#define MQTT_CONN_BUF_SIZE 1024     /* Initial connection buffer   */
+#define MQTT_CONN_BUF_MAX  262144   /* Max control packet size     */
 
 struct flb_in_mqtt_config {
     int server_fd;                     /* TCP server file descriptor  */
 
     char *listen;                      /* Listen interface            */
     char *tcp_port;                    /* TCP Port                    */
+    struct flb_bufpool *pool;          /* Connection buffers pool     */
 
     int msgp_len;                      /* msgpack data length         */
     char msgp[MQTT_MSGP_BUF_SIZE];     /* msgpack static buffer       */
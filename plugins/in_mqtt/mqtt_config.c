@@ -28,6 +28,8 @@ struct flb_in_mqtt_config *mqtt_config_init(struct flb_input_instance *i_ins)
 {
     char tmp[16];
     char *listen;
+    char *pool_limit;
+    ssize_t limit = 0;
     struct flb_in_mqtt_config *config;
 
     config = flb_malloc(sizeof(struct flb_in_mqtt_config));
@@ -56,6 +58,22 @@ struct flb_in_mqtt_config *mqtt_config_init(struct flb_input_instance *i_ins)
         config->tcp_port = flb_strdup(tmp);
     }
 
+    /* Connection buffers: optional limit of bytes in use by all of them */
+    pool_limit = flb_input_get_property("buffer_pool_limit", i_ins);
+    if (pool_limit) {
+        limit = flb_utils_size_to_bytes(pool_limit);
+        if (limit < 0) {
+            flb_warn("[in_mqtt] invalid buffer_pool_limit '%s'", pool_limit);
+            limit = 0;
+        }
+    }
+    config->pool = flb_bufpool_create(MQTT_CONN_BUF_SIZE, MQTT_CONN_BUF_MAX,
+                                      limit);
+    if (!config->pool) {
+        mqtt_config_free(config);
+        return NULL;
+    }
+
     flb_debug("[in_mqtt] Listen='%s' TCP_Port=%s",
               config->listen, config->tcp_port);
 
@@ -67,6 +85,7 @@ void mqtt_config_free(struct flb_in_mqtt_config *config)
     if (config->server_fd > 0) {
         close(config->server_fd);
     }
+    flb_bufpool_destroy(config->pool);
     flb_free(config->listen);
     flb_free(config->tcp_port);
     flb_free(config);
@@ -31,12 +31,35 @@ int mqtt_conn_event(void *data)
     int ret;
     int bytes;
     int available;
+    int size;
+    unsigned char *tmp;
     struct mk_event *event;
     struct mqtt_conn *conn = data;
+    struct flb_in_mqtt_config *ctx = conn->ctx;
 
     event = &conn->event;
     if (event->mask & MK_EVENT_READ) {
-        available = sizeof(conn->buf) - conn->buf_len;
+        available = conn->buf_size - conn->buf_len;
+        if (available < 1) {
+            /* The buffer holds an incomplete packet, make room for it */
+            size = conn->buf_size * 2;
+            if (size > MQTT_CONN_BUF_MAX) {
+                flb_warn("[in_mqtt] [fd=%i] packet exceed limit (%i bytes)",
+                         event->fd, MQTT_CONN_BUF_MAX);
+                mqtt_conn_del(conn);
+                return -1;
+            }
+
+            tmp = flb_bufpool_realloc(ctx->pool, conn->buf,
+                                      conn->buf_size, size);
+            if (!tmp) {
+                mqtt_conn_del(conn);
+                return -1;
+            }
+            conn->buf = tmp;
+            conn->buf_size = size;
+            available = conn->buf_size - conn->buf_len;
+        }
 
         bytes = read(conn->fd,
                      conn->buf + conn->buf_len, available);
@@ -90,11 +113,21 @@ struct mqtt_conn *mqtt_conn_add(int fd, struct flb_in_mqtt_config *ctx)
     conn->buf_frame_end = 0;
     conn->status  = MQTT_NEW;
 
+    conn->buf = flb_bufpool_get(ctx->pool, MQTT_CONN_BUF_SIZE);
+    if (!conn->buf) {
+        flb_error("[mqtt] could not allocate new connection");
+        close(fd);
+        flb_free(conn);
+        return NULL;
+    }
+    conn->buf_size = MQTT_CONN_BUF_SIZE;
+
     /* Register instance into the event loop */
     ret = mk_event_add(ctx->evl, fd, FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, conn);
     if (ret == -1) {
         flb_error("[mqtt] could not register new connection");
         close(fd);
+        flb_bufpool_put(ctx->pool, conn->buf, conn->buf_size);
         flb_free(conn);
         return NULL;
     }
@@ -109,6 +142,7 @@ int mqtt_conn_del(struct mqtt_conn *conn)
 
     /* Release resources */
     close(conn->fd);
+    flb_bufpool_put(conn->ctx->pool, conn->buf, conn->buf_size);
     flb_free(conn);
 
     return 0;
@@ -36,7 +36,8 @@ struct mqtt_conn {
     int  buf_frame_end;              /* Frame end position                */
     int  buf_pos;                    /* Index position                    */
     int  buf_len;                    /* Buffer content length             */
-    unsigned char buf[1024];         /* Buffer data                       */
+    int  buf_size;                   /* Buffer size                       */
+    unsigned char *buf;              /* Buffer data                       */
     struct flb_in_mqtt_config *ctx;  /* Plugin configuration context      */
 };
 
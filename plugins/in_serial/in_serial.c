@@ -212,10 +212,6 @@ static int in_serial_collect(struct flb_input_instance *in,
             consume_bytes(ctx->buf_data, ctx->pack_state.last_byte, ctx->buf_len);
             ctx->buf_len -= ctx->pack_state.last_byte;
             ctx->buf_data[ctx->buf_len] = '\0';
-
-            flb_pack_state_reset(&ctx->pack_state);
-            flb_pack_state_init(&ctx->pack_state);
-            ctx->pack_state.multiple = FLB_TRUE;
         }
         else {
             /* Process and enqueue the received line */
@@ -138,10 +138,6 @@ static int in_stdin_collect(struct flb_input_instance *i_ins,
             ctx->buf_len -= ctx->pack_state.last_byte;
             ctx->buf[ctx->buf_len] = '\0';
 
-            flb_pack_state_reset(&ctx->pack_state);
-            flb_pack_state_init(&ctx->pack_state);
-            ctx->pack_state.multiple = FLB_TRUE;
-
             flb_free(pack);
 
             return 0;
@@ -35,6 +35,7 @@
 #include "syslog_server.h"
 #include "syslog_conn.h"
 #include "syslog_prot.h"
+#include "syslog_udp.h"
 
 /* cb_collect callback */
 static int in_syslog_collect_tcp(struct flb_input_instance *i_ins,
@@ -62,26 +63,17 @@ static int in_syslog_collect_tcp(struct flb_input_instance *i_ins,
 }
 
 /*
- * Collect a datagram, per Syslog specification a datagram contains only
- * one syslog message and it should not exceed 1KB.
+ * Collect the datagrams available, the sockets are drained in batches of
+ * 'receive_batch' messages.
  */
 static int in_syslog_collect_udp(struct flb_input_instance *i_ins,
                                  struct flb_config *config, void *in_context)
 {
-    int bytes;
-    char buf[1024];
     struct flb_syslog *ctx = in_context;
     (void) i_ins;
+    (void) config;
 
-    bytes = recvfrom(ctx->server_fd, buf, sizeof(buf) - 1, 0, NULL, NULL);
-    if (bytes > 0) {
-        buf[bytes] = '\0';
-        syslog_prot_process_udp(buf, bytes, ctx);
-    }
-    else {
-        flb_errno();
-    }
-
+    syslog_udp_collect(ctx);
     return 0;
 }
 
@@ -89,6 +81,7 @@ static int in_syslog_collect_udp(struct flb_input_instance *i_ins,
 static int in_syslog_init(struct flb_input_instance *in,
                           struct flb_config *config, void *data)
 {
+    int i;
     int ret;
     struct flb_syslog *ctx;
 
@@ -125,15 +118,20 @@ static int in_syslog_init(struct flb_input_instance *in,
                                              config);
     }
     else {
-        ret = flb_input_set_collector_socket(in,
-                                             in_syslog_collect_udp,
-                                             ctx->server_fd,
-                                             config);
+        ret = syslog_udp_create(ctx);
+        for (i = 0; i < ctx->udp_sockets && ret != -1; i++) {
+            ret = flb_input_set_collector_socket(in,
+                                                 in_syslog_collect_udp,
+                                                 ctx->udp_fds[i],
+                                                 config);
+        }
     }
 
     if (ret == -1) {
         flb_error("[in_syslog] Could not set collector");
+        syslog_udp_destroy(ctx);
         syslog_conf_destroy(ctx);
+        return -1;
     }
 
     return 0;
@@ -145,6 +143,7 @@ static int in_syslog_exit(void *data, struct flb_config *config)
     (void) config;
 
     syslog_conn_exit(ctx);
+    syslog_udp_destroy(ctx);
     syslog_conf_destroy(ctx);
 
     return 0;
@@ -22,24 +22,42 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_bufpool.h>
 
 /* Syslog modes */
 #define FLB_SYSLOG_UNIX_TCP  1
 #define FLB_SYSLOG_UNIX_UDP  2
 #define FLB_SYSLOG_TCP       3
+#define FLB_SYSLOG_UDP       4
 
 /* 32KB chunk size */
 #define FLB_SYSLOG_CHUNK   32768
 
+/* UDP: datagrams received per call and largest datagram accepted */
+#define FLB_SYSLOG_UDP_BATCH    64
+#define FLB_SYSLOG_UDP_MSG_SIZE 8192
+
+/* Maximum number of sockets sharing the UDP port */
+#define FLB_SYSLOG_UDP_SOCKETS  32
+
+struct syslog_udp;
+
 /* Context / Config*/
 struct flb_syslog {
-    /* Listening mode: unix udp, unix tcp or normal tcp */
+    /* Listening mode: unix udp, unix tcp, normal tcp or udp */
     int mode;
 
-    /* TCP Network mode */
+    /* TCP/UDP Network mode */
     char *listen;
     char *tcp_port;
 
+    /* UDP: sockets bound with SO_REUSEPORT and the receive batch */
+    int udp_sockets;
+    int udp_fds[FLB_SYSLOG_UDP_SOCKETS];
+    int receive_batch;
+    size_t receive_buffer_size;
+    struct syslog_udp *udp;
+
     /* Unix socket (UDP/TCP)*/
     int server_fd;
     char *unix_path;
@@ -47,6 +65,7 @@ struct flb_syslog {
     /* Buffers setup */
     size_t buffer_max_size;
     size_t buffer_chunk_size;
+    struct flb_bufpool *pool;
 
     /* Configuration */
     struct flb_parser *parser;
@@ -17,6 +17,8 @@
  *  limitations under the License.
  */
 
+#include <stdlib.h>
+
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_input.h>
@@ -32,8 +34,10 @@
 struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
                                       struct flb_config *config)
 {
+    int i;
     char *tmp;
     char port[16];
+    ssize_t size;
     struct flb_syslog *ctx;
 
     ctx = flb_calloc(1, sizeof(struct flb_syslog));
@@ -43,9 +47,13 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
     }
     ctx->evl = config->evl;
     ctx->i_ins = i_ins;
+    ctx->server_fd = -1;
+    for (i = 0; i < FLB_SYSLOG_UDP_SOCKETS; i++) {
+        ctx->udp_fds[i] = -1;
+    }
     mk_list_init(&ctx->connections);
 
-    /* Syslog mode: unix_udp, unix_tcp, or tcp */
+    /* Syslog mode: unix_udp, unix_tcp, tcp or udp */
     tmp = flb_input_get_property("mode", i_ins);
     if (tmp) {
         if (strcasecmp(tmp, "unix_tcp") == 0) {
@@ -57,6 +65,9 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
         else if (strcasecmp(tmp, "tcp") == 0) {
             ctx->mode = FLB_SYSLOG_TCP;
         }
+        else if (strcasecmp(tmp, "udp") == 0) {
+            ctx->mode = FLB_SYSLOG_UDP;
+        }
         else {
             flb_error("[in_syslog] Unknown syslog mode %s", tmp);
             flb_free(ctx);
@@ -67,8 +78,8 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
         ctx->mode = FLB_SYSLOG_UNIX_UDP;
     }
 
-    /* Check if TCP mode was requested */
-    if (ctx->mode == FLB_SYSLOG_TCP) {
+    /* Check if a network mode was requested */
+    if (ctx->mode == FLB_SYSLOG_TCP || ctx->mode == FLB_SYSLOG_UDP) {
         /* Listen interface */
         if (!i_ins->host.listen) {
             tmp = flb_input_get_property("listen", i_ins);
@@ -83,7 +94,7 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
             ctx->listen = flb_strdup(i_ins->host.listen);
         }
 
-        /* TCP port */
+        /* TCP/UDP port */
         if (i_ins->host.port == 0) {
             ctx->tcp_port = flb_strdup("5140");
         }
@@ -119,6 +130,65 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
         ctx->buffer_max_size  = flb_utils_size_to_bytes(tmp);
     }
 
+    /* UDP: sockets sharing the port (SO_REUSEPORT) */
+    ctx->udp_sockets = 1;
+    tmp = flb_input_get_property("sockets", i_ins);
+    if (tmp && ctx->mode == FLB_SYSLOG_UDP) {
+        ctx->udp_sockets = atoi(tmp);
+        if (ctx->udp_sockets < 1 ||
+            ctx->udp_sockets > FLB_SYSLOG_UDP_SOCKETS) {
+            flb_error("[in_syslog] invalid sockets value %s (1-%i)",
+                      tmp, FLB_SYSLOG_UDP_SOCKETS);
+            syslog_conf_destroy(ctx);
+            return NULL;
+        }
+    }
+
+    /* UDP: datagrams received per system call */
+    tmp = flb_input_get_property("receive_batch", i_ins);
+    if (tmp) {
+        ctx->receive_batch = atoi(tmp);
+        if (ctx->receive_batch < 1 || ctx->receive_batch > 1024) {
+            flb_error("[in_syslog] invalid receive_batch value %s (1-1024)",
+                      tmp);
+            syslog_conf_destroy(ctx);
+            return NULL;
+        }
+    }
+    else {
+        ctx->receive_batch = FLB_SYSLOG_UDP_BATCH;
+    }
+
+    /* UDP: socket receive buffer (SO_RCVBUF), the system default if unset */
+    tmp = flb_input_get_property("receive_buffer_size", i_ins);
+    if (tmp) {
+        size = flb_utils_size_to_bytes(tmp);
+        if (size <= 0) {
+            flb_error("[in_syslog] invalid receive_buffer_size %s", tmp);
+            syslog_conf_destroy(ctx);
+            return NULL;
+        }
+        ctx->receive_buffer_size = size;
+    }
+
+    /* Connection buffers: optional limit of bytes in use by all of them */
+    size = 0;
+    tmp = flb_input_get_property("buffer_pool_limit", i_ins);
+    if (tmp) {
+        size = flb_utils_size_to_bytes(tmp);
+        if (size < 0) {
+            flb_error("[in_syslog] invalid buffer_pool_limit %s", tmp);
+            syslog_conf_destroy(ctx);
+            return NULL;
+        }
+    }
+    ctx->pool = flb_bufpool_create(ctx->buffer_chunk_size,
+                                   ctx->buffer_max_size, size);
+    if (!ctx->pool) {
+        syslog_conf_destroy(ctx);
+        return NULL;
+    }
+
     /* Parser */
     tmp = flb_input_get_property("parser", i_ins);
     if (tmp) {
@@ -128,6 +198,9 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
         if (ctx->mode == FLB_SYSLOG_TCP) {
             ctx->parser = flb_parser_get("syslog-rfc5424", config);
         }
+        else if (ctx->mode == FLB_SYSLOG_UDP) {
+            ctx->parser = flb_parser_get("syslog-rfc3164", config);
+        }
         else {
             ctx->parser = flb_parser_get("syslog-rfc3164-local", config);
         }
@@ -145,6 +218,7 @@ struct flb_syslog *syslog_conf_create(struct flb_input_instance *i_ins,
 int syslog_conf_destroy(struct flb_syslog *ctx)
 {
     syslog_server_destroy(ctx);
+    flb_bufpool_destroy(ctx->pool);
     flb_free(ctx);
 
     return 0;
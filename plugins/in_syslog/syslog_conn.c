@@ -17,6 +17,11 @@
  *  limitations under the License.
  */
 
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_engine.h>
@@ -27,56 +32,97 @@
 #include "syslog_conn.h"
 #include "syslog_prot.h"
 
+/*
+ * The ring is full: move the content to a bigger buffer starting at offset
+ * zero. This only happens while a message does not fit in the buffer.
+ */
+static int conn_buf_grow(struct syslog_conn *conn)
+{
+    size_t size;
+    size_t first;
+    char *tmp;
+    struct flb_syslog *ctx = conn->ctx;
+
+    if (conn->buf_size + ctx->buffer_chunk_size > ctx->buffer_max_size) {
+        flb_debug("[in_syslog] fd=%i incoming data exceed limit (%lu bytes)",
+                  conn->fd, ctx->buffer_max_size);
+        return -1;
+    }
+
+    size = conn->buf_size + ctx->buffer_chunk_size;
+    tmp = flb_bufpool_get(ctx->pool, size);
+    if (!tmp) {
+        return -1;
+    }
+
+    first = conn->buf_size - conn->buf_head;
+    if (first > conn->buf_len) {
+        first = conn->buf_len;
+    }
+    memcpy(tmp, conn->buf_data + conn->buf_head, first);
+    memcpy(tmp + first, conn->buf_data, conn->buf_len - first);
+
+    flb_trace("[in_syslog] fd=%i buffer realloc %lu -> %lu",
+              conn->fd, conn->buf_size, size);
+
+    flb_bufpool_put(ctx->pool, conn->buf_data, conn->buf_size);
+    conn->buf_data = tmp;
+    conn->buf_size = size;
+    conn->buf_head = 0;
+
+    return 0;
+}
+
 /* Callback invoked every time an event is triggered for a connection */
 int syslog_conn_event(void *data)
 {
     int ret;
-    int bytes;
-    int available;
-    int size;
-    char *tmp;
+    int iovcnt;
+    ssize_t bytes;
+    size_t tail;
+    struct iovec iov[2];
     struct mk_event *event;
     struct syslog_conn *conn = data;
-    struct flb_syslog *ctx = conn->ctx;
 
     event = &conn->event;
     if (event->mask & MK_EVENT_READ) {
-        available = (conn->buf_size - conn->buf_len) - 1;
-        if (available < 1) {
-            if (conn->buf_size + ctx->buffer_chunk_size > ctx->buffer_max_size) {
-                flb_debug("[in_syslog] fd=%i incoming data exceed limit (%i bytes)",
-                          event->fd, (ctx->buffer_max_size));
+        if (conn->buf_len == conn->buf_size) {
+            if (conn_buf_grow(conn) == -1) {
                 syslog_conn_del(conn);
                 return -1;
             }
+        }
 
-            size = conn->buf_size + ctx->buffer_chunk_size;
-            tmp = flb_realloc(conn->buf_data, size);
-            if (!tmp) {
-                flb_errno();
-                return -1;
-            }
-            flb_trace("[in_syslog] fd=%i buffer realloc %i -> %i",
-                      event->fd, conn->buf_size, size);
-
-            conn->buf_data = tmp;
-            conn->buf_size = size;
-            available = (conn->buf_size - conn->buf_len) - 1;
+        /* Read into the free space of the ring, up to two segments */
+        tail = (conn->buf_head + conn->buf_len) % conn->buf_size;
+        if (tail >= conn->buf_head) {
+            iov[0].iov_base = conn->buf_data + tail;
+            iov[0].iov_len  = conn->buf_size - tail;
+            iov[1].iov_base = conn->buf_data;
+            iov[1].iov_len  = conn->buf_head;
+            iovcnt = (conn->buf_head > 0) ? 2 : 1;
+        }
+        else {
+            iov[0].iov_base = conn->buf_data + tail;
+            iov[0].iov_len  = conn->buf_head - tail;
+            iovcnt = 1;
         }
 
-        bytes = read(conn->fd,
-                     conn->buf_data + conn->buf_len, available);
+        bytes = readv(conn->fd, iov, iovcnt);
         if (bytes > 0) {
-            flb_trace("[in_syslog] read()=%i pre_len=%i now_len=%i",
+            flb_trace("[in_syslog] read()=%zi pre_len=%lu now_len=%lu",
                       bytes, conn->buf_len, conn->buf_len + bytes);
             conn->buf_len += bytes;
-            conn->buf_data[conn->buf_len] = '\0';
             ret = syslog_prot_process(conn);
             if (ret == -1) {
+                syslog_conn_del(conn);
                 return -1;
             }
             return bytes;
         }
+        else if (bytes == -1 && (errno == EAGAIN || errno == EINTR)) {
+            return 0;
+        }
         else {
             flb_trace("[in_syslog] fd=%i closed connection", event->fd);
             syslog_conn_del(conn);
@@ -112,16 +158,19 @@ struct syslog_conn *syslog_conn_add(int fd, struct flb_syslog *ctx)
     event->handler      = syslog_conn_event;
 
     /* Connection info */
-    conn->fd      = fd;
-    conn->ctx     = ctx;
-    conn->buf_len = 0;
-    conn->buf_parsed = 0;
-    conn->in      = ctx->i_ins;
+    conn->fd       = fd;
+    conn->ctx      = ctx;
+    conn->buf_head = 0;
+    conn->buf_len  = 0;
+    conn->buf_scan = 0;
+    conn->msg_buf  = NULL;
+    conn->msg_size = 0;
+    conn->in       = ctx->i_ins;
 
     /* Allocate read buffer */
-    conn->buf_data = flb_malloc(ctx->buffer_chunk_size);
+    conn->buf_data = flb_bufpool_get(ctx->pool, ctx->buffer_chunk_size);
     if (!conn->buf_data) {
-        flb_errno();
+        flb_error("[in_syslog] could not allocate new connection");
         close(fd);
         flb_free(conn);
         return NULL;
@@ -133,7 +182,7 @@ struct syslog_conn *syslog_conn_add(int fd, struct flb_syslog *ctx)
     if (ret == -1) {
         flb_error("[in_fw] could not register new connection");
         close(fd);
-        flb_free(conn->buf_data);
+        flb_bufpool_put(ctx->pool, conn->buf_data, conn->buf_size);
         flb_free(conn);
         return NULL;
     }
@@ -151,7 +200,8 @@ int syslog_conn_del(struct syslog_conn *conn)
     /* Release resources */
     mk_list_del(&conn->_head);
     close(conn->fd);
-    flb_free(conn->buf_data);
+    flb_bufpool_put(conn->ctx->pool, conn->buf_data, conn->buf_size);
+    flb_bufpool_put(conn->ctx->pool, conn->msg_buf, conn->msg_size);
     flb_free(conn);
 
     return 0;
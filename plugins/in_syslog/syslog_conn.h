@@ -31,11 +31,21 @@ struct syslog_conn {
     int fd;                          /* Socket file descriptor            */
     int status;                      /* Connection status                 */
 
-    /* Buffer */
+    /*
+     * Ring buffer: 'buf_len' bytes starting at 'buf_head' (wrapping at
+     * 'buf_size'), consumed messages just move the head. 'buf_scan' is the
+     * number of bytes already scanned for the end of the current message.
+     */
     char *buf_data;                  /* Buffer data                       */
     size_t buf_size;                 /* Buffer size                       */
+    size_t buf_head;                 /* Offset of the first byte          */
     size_t buf_len;                  /* Buffer length                     */
-    size_t buf_parsed;               /* Parsed buffer (offset)            */
+    size_t buf_scan;                 /* Scanned bytes of current message  */
+
+    /* Contiguous copy of a message wrapping around the ring */
+    char *msg_buf;
+    size_t msg_size;
+
     struct flb_input_instance *in;   /* Parent plugin instance            */
     struct flb_syslog *ctx;          /* Plugin configuration context      */
 
@@ -18,137 +18,313 @@
  */
 
 #include <string.h>
+#include <arpa/inet.h>
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_parser.h>
+#include <fluent-bit/flb_time.h>
 
 #include "syslog.h"
 #include "syslog_conn.h"
 
-static inline void consume_bytes(char *buf, int bytes, int length)
+/* Maximum number of digits of an octet counting MSG-LEN */
+#define SYSLOG_OCTET_DIGITS  9
+
+/* octet_frame() results */
+#define SYSLOG_FRAME_INVALID   -1
+#define SYSLOG_FRAME_AGAIN      0
+#define SYSLOG_FRAME_OK         1
+#define SYSLOG_FRAME_NONE       2
+
+/*
+ * Parse a message and pack the [time, map] record straight into the
+ * instance buffer. The record time is only known once the message is
+ * parsed: a fixed size EventTime (fixext8) is packed first and its value
+ * updated after. If the message cannot be parsed nothing is left in the
+ * buffer and -1 is returned.
+ */
+static int pack_message(struct flb_syslog *ctx, char *data, size_t len,
+                        struct flb_time *now)
 {
-    memmove(buf, buf + bytes, length - bytes);
+    int ret;
+    char *p;
+    size_t off;
+    uint32_t tmp;
+    struct flb_time out_time;
+    msgpack_sbuffer *out_sbuf = &ctx->i_ins->mp_sbuf;
+    msgpack_packer *out_pck = &ctx->i_ins->mp_pck;
+
+    off = out_sbuf->size;
+    flb_time_zero(&out_time);
+
+    msgpack_pack_array(out_pck, 2);
+    flb_time_append_to_msgpack(&out_time, out_pck, FLB_TIME_ETFMT_V1_FIXEXT);
+
+    ret = flb_parser_do_pack(ctx->parser, data, len, out_pck, 0, &out_time);
+    if (ret < 0) {
+        out_sbuf->size = off;
+        return -1;
+    }
+
+    if (flb_time_to_double(&out_time) == 0) {
+        if (flb_time_to_double(now) == 0) {
+            flb_time_get(now);
+        }
+        flb_time_copy(&out_time, now);
+    }
+
+    /* Skip the array (1 byte) and the fixext8 header (2 bytes) */
+    p = out_sbuf->data + off + 3;
+    tmp = htonl((uint32_t) out_time.tm.tv_sec);
+    memcpy(p, &tmp, 4);
+    tmp = htonl((uint32_t) out_time.tm.tv_nsec);
+    memcpy(p + 4, &tmp, 4);
+
+    return 0;
 }
 
-static inline int pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
-                            struct flb_time *time, char *data, size_t data_size)
+static inline char ring_byte(struct syslog_conn *conn, size_t i)
 {
-    msgpack_pack_array(mp_pck, 2);
-    flb_time_append_to_msgpack(time, mp_pck, 0);
-    msgpack_sbuffer_write(mp_sbuf, data, data_size);
-    return 0;
+    return conn->buf_data[(conn->buf_head + i) % conn->buf_size];
 }
 
-int syslog_prot_process(struct syslog_conn *conn)
+static inline void ring_consume(struct syslog_conn *conn, size_t bytes)
 {
-    int len;
-    int ret;
-    char *p;
-    char *eof;
-    char *end;
-    void *out_buf;
-    size_t out_size;
-    struct flb_time out_time;
-    struct flb_syslog *ctx = conn->ctx;
+    conn->buf_len -= bytes;
+    conn->buf_scan = 0;
+    if (conn->buf_len == 0) {
+        conn->buf_head = 0;
+    }
+    else {
+        conn->buf_head = (conn->buf_head + bytes) % conn->buf_size;
+    }
+}
 
-    msgpack_sbuffer *out_sbuf;
-    msgpack_packer *out_pck;
+/*
+ * Return a contiguous view of 'len' bytes at offset 'off' of the ring, the
+ * bytes are only copied if they wrap around the end of the buffer.
+ */
+static char *ring_msg(struct syslog_conn *conn, size_t off, size_t len)
+{
+    size_t pos;
+    size_t first;
+    char *tmp;
 
-    out_sbuf = &conn->in->mp_sbuf;
-    out_pck  = &conn->in->mp_pck;
+    pos = (conn->buf_head + off) % conn->buf_size;
+    if (pos + len <= conn->buf_size) {
+        return conn->buf_data + pos;
+    }
 
-    flb_input_buf_write_start(conn->in);
+    if (conn->msg_size < len) {
+        tmp = flb_bufpool_get(conn->ctx->pool, len);
+        if (!tmp) {
+            return NULL;
+        }
+        flb_bufpool_put(conn->ctx->pool, conn->msg_buf, conn->msg_size);
+        conn->msg_buf = tmp;
+        conn->msg_size = flb_bufpool_size(conn->ctx->pool, len);
+    }
 
-    eof = p = conn->buf_data;
-    end = conn->buf_data + conn->buf_len;
+    first = conn->buf_size - pos;
+    memcpy(conn->msg_buf, conn->buf_data + pos, first);
+    memcpy(conn->msg_buf + first, conn->buf_data, len - first);
 
-    /* Always parse while some remaining bytes exists */
-    while (eof < end) {
+    return conn->msg_buf;
+}
 
-        /* Lookup the ending byte */
-        eof = conn->buf_data + conn->buf_parsed;
-        while (*eof != '\n' && *eof != '\0' && eof < end) {
-            eof++;
+/*
+ * Non-transparent framing: find the end of the message (a line break or a
+ * NULL byte), returns its offset or -1 if it's not in the buffer yet.
+ */
+static ssize_t ring_find_eol(struct syslog_conn *conn)
+{
+    size_t i;
+    size_t pos;
+    size_t seg;
+    char *p;
+    char *nul;
+
+    i = conn->buf_scan;
+    while (i < conn->buf_len) {
+        pos = (conn->buf_head + i) % conn->buf_size;
+        seg = conn->buf_size - pos;
+        if (seg > conn->buf_len - i) {
+            seg = conn->buf_len - i;
         }
 
-        /* Incomplete message */
-        if (eof == end || (*eof != '\n' && *eof != '\0')) {
-            return 0;
+        p = memchr(conn->buf_data + pos, '\n', seg);
+        nul = memchr(conn->buf_data + pos, '\0',
+                     p ? (size_t) (p - (conn->buf_data + pos)) : seg);
+        if (nul) {
+            p = nul;
         }
+        if (p) {
+            return i + (p - (conn->buf_data + pos));
+        }
+        i += seg;
+    }
 
-        /* No data ? */
-        len = (eof - p);
-        if (len == 0) {
-            consume_bytes(conn->buf_data, 1, conn->buf_len);
-            conn->buf_len--;
-            conn->buf_parsed = 0;
-            conn->buf_data[conn->buf_len] = '\0';
-            end = conn->buf_data + conn->buf_len;
-
-            if (conn->buf_len == 0) {
-                return 0;
-            }
+    conn->buf_scan = i;
+    return -1;
+}
 
-            continue;
-        }
+/*
+ * Octet counting framing (RFC 6587): 'MSG-LEN SP SYSLOG-MSG'. Set the
+ * header and message lengths when the frame is complete. Data that does not
+ * look like a frame header (SYSLOG_FRAME_NONE) is handled as a line.
+ */
+static int octet_frame(struct syslog_conn *conn, size_t *hdr_len,
+                       size_t *msg_len)
+{
+    char c;
+    size_t i;
+    size_t len = 0;
+    struct flb_syslog *ctx = conn->ctx;
 
-        /* Process the string */
-        ret = flb_parser_do(ctx->parser, p, len,
-                            &out_buf, &out_size, &out_time);
-        if (ret >= 0) {
-            pack_line(out_sbuf, out_pck, &out_time,
-                      out_buf, out_size);
-            flb_free(out_buf);
+    for (i = 0; i < conn->buf_len; i++) {
+        c = ring_byte(conn, i);
+        if (c == ' ') {
+            break;
         }
-        else {
-            flb_warn("[in_syslog] error parsing log message");
+        if (c < '0' || c > '9' || i == SYSLOG_OCTET_DIGITS) {
+            return SYSLOG_FRAME_NONE;
         }
+        len = (len * 10) + (c - '0');
+    }
 
-        conn->buf_parsed += len + 1;
-        end = conn->buf_data + conn->buf_len;
-        eof = p = conn->buf_data + conn->buf_parsed;
+    if (i == conn->buf_len) {
+        return SYSLOG_FRAME_AGAIN;
     }
 
-    consume_bytes(conn->buf_data, conn->buf_parsed, conn->buf_len);
-    conn->buf_len -= conn->buf_parsed;
-    conn->buf_parsed = 0;
-    conn->buf_data[conn->buf_len] = '\0';
+    if (i + 1 + len > ctx->buffer_max_size) {
+        flb_warn("[in_syslog] fd=%i message of %lu bytes exceeds "
+                 "buffer_max_size", conn->fd, len);
+        return SYSLOG_FRAME_INVALID;
+    }
 
-    flb_input_buf_write_end(conn->in);
+    *hdr_len = i + 1;
+    *msg_len = len;
 
-    return 0;
+    if (conn->buf_len < *hdr_len + len) {
+        return SYSLOG_FRAME_AGAIN;
+    }
+    return SYSLOG_FRAME_OK;
 }
 
-int syslog_prot_process_udp(char *buf, size_t size, struct flb_syslog *ctx)
+/*
+ * Process the messages available on a TCP connection. The framing is
+ * detected per message: octet counting if it starts with a digit,
+ * otherwise the message ends with a line break. Returns -1 if the stream
+ * is not valid and the connection must be closed.
+ */
+int syslog_prot_process(struct syslog_conn *conn)
 {
     int ret;
-    void *out_buf;
-    size_t out_size;
-    struct flb_time out_time = {0};
-    msgpack_sbuffer *out_sbuf;
-    msgpack_packer *out_pck;
+    int errors = 0;
+    int status = 0;
+    char c;
+    char *msg;
+    ssize_t eol;
+    size_t len;
+    size_t hdr_len;
+    size_t frame_len;
+    struct flb_time now;
+    struct flb_syslog *ctx = conn->ctx;
 
-    out_sbuf = &ctx->i_ins->mp_sbuf;
-    out_pck  = &ctx->i_ins->mp_pck;
+    flb_time_zero(&now);
+    flb_input_buf_write_start(conn->in);
 
-    flb_input_buf_write_start(ctx->i_ins);
+    while (conn->buf_len > 0) {
+        c = ring_byte(conn, 0);
+
+        /* Separators and trailers between messages */
+        if (c == '\n' || c == '\r' || c == '\0' || c == ' ') {
+            ring_consume(conn, 1);
+            continue;
+        }
+
+        ret = SYSLOG_FRAME_NONE;
+        if (c >= '1' && c <= '9') {
+            ret = octet_frame(conn, &hdr_len, &len);
+            if (ret == SYSLOG_FRAME_INVALID) {
+                status = -1;
+                break;
+            }
+            else if (ret == SYSLOG_FRAME_AGAIN) {
+                break;
+            }
+            frame_len = hdr_len + len;
+        }
+
+        if (ret == SYSLOG_FRAME_NONE) {
+            eol = ring_find_eol(conn);
+            if (eol == -1) {
+                break;
+            }
+            hdr_len = 0;
+            len = eol;
+            frame_len = eol + 1;
+        }
+
+        /* Drop the line ending of the message */
+        while (len > 0 && (ring_byte(conn, hdr_len + len - 1) == '\n' ||
+                           ring_byte(conn, hdr_len + len - 1) == '\r')) {
+            len--;
+        }
 
-    ret = flb_parser_do(ctx->parser, buf, size,
-                        &out_buf, &out_size, &out_time);
-    if (ret >= 0) {
-        if (flb_time_to_double(&out_time) == 0) {
-            flb_time_get(&out_time);
+        if (len > 0) {
+            msg = ring_msg(conn, hdr_len, len);
+            if (!msg) {
+                status = -1;
+                break;
+            }
+            if (pack_message(ctx, msg, len, &now) == -1) {
+                errors++;
+            }
         }
-        pack_line(out_sbuf, out_pck, &out_time,
-                  out_buf, out_size);
-        flb_free(out_buf);
+        ring_consume(conn, frame_len);
     }
-    else {
-        flb_warn("[in_syslog] error parsing log message");
-        return -1;
+
+    flb_input_buf_write_end(conn->in);
+
+    if (errors > 0) {
+        flb_warn("[in_syslog] error parsing %i log message(s)", errors);
+    }
+
+    return status;
+}
+
+/*
+ * Parse a batch of datagrams, per Syslog specification a datagram contains
+ * only one message. The records are appended to the instance buffer at
+ * once, filters run a single time for the whole batch.
+ */
+int syslog_prot_process_udp(struct iovec *msgs, int count,
+                            struct flb_syslog *ctx)
+{
+    int i;
+    int errors = 0;
+    struct flb_time now;
+
+    flb_time_zero(&now);
+    flb_input_buf_write_start(ctx->i_ins);
+
+    for (i = 0; i < count; i++) {
+        if (msgs[i].iov_len == 0) {
+            continue;
+        }
+
+        if (pack_message(ctx, msgs[i].iov_base, msgs[i].iov_len, &now) == -1) {
+            errors++;
+        }
     }
 
     flb_input_buf_write_end(ctx->i_ins);
 
+    if (errors > 0) {
+        flb_warn("[in_syslog] error parsing %i log message(s)", errors);
+        return -1;
+    }
+
     return 0;
 }
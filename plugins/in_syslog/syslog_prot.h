@@ -20,11 +20,14 @@
 #ifndef FLB_IN_SYSLOG_PROT_H
 #define FLB_IN_SYSLOG_PROT_H
 
+#include <sys/uio.h>
 #include <fluent-bit/flb_info.h>
 
 #include "syslog.h"
+#include "syslog_conn.h"
 
 int syslog_prot_process(struct syslog_conn *conn);
-int syslog_prot_process_udp(char *buf, size_t size, struct flb_syslog *ctx);
+int syslog_prot_process_udp(struct iovec *msgs, int count,
+                            struct flb_syslog *ctx);
 
 #endif
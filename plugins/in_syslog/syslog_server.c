@@ -91,6 +91,57 @@ static int syslog_server_net_create(struct flb_syslog *ctx)
     return 0;
 }
 
+/* Set the receive buffer of a datagram socket */
+static int syslog_server_rcvbuf(struct flb_syslog *ctx, int fd)
+{
+    int size;
+
+    if (ctx->receive_buffer_size == 0) {
+        return 0;
+    }
+
+    size = ctx->receive_buffer_size;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0) {
+        flb_errno();
+        flb_warn("[in_syslog] could not set receive buffer size to %i bytes",
+                 size);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * UDP: one or many sockets bound to the same port, when many of them are
+ * requested the Kernel distributes the datagrams by using SO_REUSEPORT.
+ */
+static int syslog_server_udp_create(struct flb_syslog *ctx)
+{
+    int i;
+    int fd;
+    int reuse_port;
+
+    reuse_port = (ctx->udp_sockets > 1) ? FLB_TRUE : FLB_FALSE;
+    for (i = 0; i < ctx->udp_sockets; i++) {
+        fd = flb_net_server_udp(ctx->tcp_port, ctx->listen, reuse_port);
+        if (fd == -1) {
+            flb_error("[in_syslog] could not bind address %s:%s. Aborting",
+                      ctx->listen, ctx->tcp_port);
+            return -1;
+        }
+        ctx->udp_fds[i] = fd;
+        if (i == 0) {
+            ctx->server_fd = fd;
+        }
+        syslog_server_rcvbuf(ctx, fd);
+    }
+
+    flb_info("[in_syslog] UDP server binding %s:%s (%i socket%s)",
+             ctx->listen, ctx->tcp_port, ctx->udp_sockets,
+             ctx->udp_sockets > 1 ? "s" : "");
+    return 0;
+}
+
 int syslog_server_create(struct flb_syslog *ctx)
 {
     int ret;
@@ -98,8 +149,16 @@ int syslog_server_create(struct flb_syslog *ctx)
     if (ctx->mode == FLB_SYSLOG_TCP) {
         ret = syslog_server_net_create(ctx);
     }
+    else if (ctx->mode == FLB_SYSLOG_UDP) {
+        ret = syslog_server_udp_create(ctx);
+    }
     else {
         ret = syslog_server_unix_create(ctx);
+        if (ret == 0 && ctx->mode == FLB_SYSLOG_UNIX_UDP) {
+            ctx->udp_sockets = 1;
+            ctx->udp_fds[0] = ctx->server_fd;
+            syslog_server_rcvbuf(ctx, ctx->server_fd);
+        }
     }
 
     if (ret != 0) {
@@ -111,6 +170,8 @@ int syslog_server_create(struct flb_syslog *ctx)
 
 int syslog_server_destroy(struct flb_syslog *ctx)
 {
+    int i;
+
     if (ctx->mode == FLB_SYSLOG_UNIX_TCP || ctx->mode == FLB_SYSLOG_UNIX_UDP) {
         if (ctx->unix_path) {
             unlink(ctx->unix_path);
@@ -122,7 +183,18 @@ int syslog_server_destroy(struct flb_syslog *ctx)
         flb_free(ctx->tcp_port);
     }
 
-    close(ctx->server_fd);
+    /* The first UDP socket is the server one */
+    for (i = 1; i < FLB_SYSLOG_UDP_SOCKETS; i++) {
+        if (ctx->udp_fds[i] != -1) {
+            close(ctx->udp_fds[i]);
+            ctx->udp_fds[i] = -1;
+        }
+    }
+
+    if (ctx->server_fd != -1) {
+        close(ctx->server_fd);
+        ctx->server_fd = -1;
+    }
 
     return 0;
 }
@@ -0,0 +1,208 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_utils.h>
+
+#include "syslog.h"
+#include "syslog_prot.h"
+#include "syslog_udp.h"
+
+/*
+ * Upper limit of batches read from a socket on every event, so a flood of
+ * datagrams does not stall the rest of the event loop.
+ */
+#define SYSLOG_UDP_ROUNDS  16
+
+/* Receive buffers for a batch of datagrams */
+struct syslog_udp {
+    int size;                        /* Datagrams per batch               */
+    char *buf;                       /* A slot of FLB_SYSLOG_UDP_MSG_SIZE
+                                        bytes per datagram                */
+    struct iovec *iov;               /* Slots given to the Kernel         */
+    struct iovec *msgs;              /* Received datagrams                */
+#ifdef FLB_HAVE_RECVMMSG
+    struct mmsghdr *hdrs;
+#endif
+};
+
+int syslog_udp_create(struct flb_syslog *ctx)
+{
+    int i;
+    struct syslog_udp *udp;
+
+    udp = flb_calloc(1, sizeof(struct syslog_udp));
+    if (!udp) {
+        flb_errno();
+        return -1;
+    }
+    udp->size = ctx->receive_batch;
+
+    udp->buf  = flb_malloc(udp->size * FLB_SYSLOG_UDP_MSG_SIZE);
+    udp->iov  = flb_calloc(udp->size, sizeof(struct iovec));
+    udp->msgs = flb_calloc(udp->size, sizeof(struct iovec));
+#ifdef FLB_HAVE_RECVMMSG
+    udp->hdrs = flb_calloc(udp->size, sizeof(struct mmsghdr));
+    if (!udp->hdrs) {
+        flb_errno();
+        ctx->udp = udp;
+        syslog_udp_destroy(ctx);
+        return -1;
+    }
+#endif
+    ctx->udp = udp;
+
+    if (!udp->buf || !udp->iov || !udp->msgs) {
+        flb_errno();
+        syslog_udp_destroy(ctx);
+        return -1;
+    }
+
+    for (i = 0; i < udp->size; i++) {
+        udp->iov[i].iov_base = udp->buf + (i * FLB_SYSLOG_UDP_MSG_SIZE);
+        udp->iov[i].iov_len  = FLB_SYSLOG_UDP_MSG_SIZE - 1;
+#ifdef FLB_HAVE_RECVMMSG
+        udp->hdrs[i].msg_hdr.msg_iov    = &udp->iov[i];
+        udp->hdrs[i].msg_hdr.msg_iovlen = 1;
+#endif
+    }
+
+    return 0;
+}
+
+int syslog_udp_destroy(struct flb_syslog *ctx)
+{
+    struct syslog_udp *udp = ctx->udp;
+
+    if (!udp) {
+        return 0;
+    }
+
+    flb_free(udp->buf);
+    flb_free(udp->iov);
+    flb_free(udp->msgs);
+#ifdef FLB_HAVE_RECVMMSG
+    flb_free(udp->hdrs);
+#endif
+    flb_free(udp);
+    ctx->udp = NULL;
+
+    return 0;
+}
+
+/*
+ * Receive up to a batch of datagrams without blocking, returns the number
+ * of datagrams or -1 if nothing is available.
+ */
+static int udp_receive(struct syslog_udp *udp, int fd)
+{
+    int i;
+    int n;
+    char *p;
+    ssize_t bytes;
+
+#ifdef FLB_HAVE_RECVMMSG
+    n = recvmmsg(fd, udp->hdrs, udp->size, MSG_DONTWAIT, NULL);
+    if (n <= 0) {
+        if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            flb_errno();
+        }
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        udp->msgs[i].iov_base = udp->iov[i].iov_base;
+        udp->msgs[i].iov_len  = udp->hdrs[i].msg_len;
+    }
+#else
+    for (n = 0; n < udp->size; n++) {
+        bytes = recvfrom(fd, udp->iov[n].iov_base, udp->iov[n].iov_len,
+                         MSG_DONTWAIT, NULL, NULL);
+        if (bytes == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                flb_errno();
+            }
+            break;
+        }
+        udp->msgs[n].iov_base = udp->iov[n].iov_base;
+        udp->msgs[n].iov_len  = bytes;
+    }
+
+    if (n == 0) {
+        return -1;
+    }
+#endif
+
+    /*
+     * Drop the trailing line break or NULL byte sent by many devices, the
+     * parser gets a NULL terminated message.
+     */
+    for (i = 0; i < n; i++) {
+        p = udp->msgs[i].iov_base;
+        bytes = udp->msgs[i].iov_len;
+        while (bytes > 0 && (p[bytes - 1] == '\n' || p[bytes - 1] == '\0')) {
+            bytes--;
+        }
+        p[bytes] = '\0';
+        udp->msgs[i].iov_len = bytes;
+    }
+
+    return n;
+}
+
+/*
+ * Drain the UDP sockets: every socket bound to the port is read since the
+ * collector callback does not tell which one triggered the event. Each
+ * batch is parsed and appended to the instance buffer at once.
+ */
+int syslog_udp_collect(struct flb_syslog *ctx)
+{
+    int i;
+    int n;
+    int round;
+    int total = 0;
+    struct syslog_udp *udp = ctx->udp;
+
+    for (i = 0; i < ctx->udp_sockets; i++) {
+        for (round = 0; round < SYSLOG_UDP_ROUNDS; round++) {
+            n = udp_receive(udp, ctx->udp_fds[i]);
+            if (n <= 0) {
+                break;
+            }
+
+            syslog_prot_process_udp(udp->msgs, n, ctx);
+            total += n;
+
+            if (n < udp->size) {
+                break;
+            }
+        }
+    }
+
+    return total;
+}
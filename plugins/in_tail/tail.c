@@ -248,6 +248,18 @@ static int in_tail_init(struct flb_input_instance *in,
     }
     ctx->coll_fd_pending = ret;
 
+    /* Register callback to checkpoint file offsets into the database */
+    if (ctx->db) {
+        ret = flb_input_set_collector_time(in, flb_tail_db_checkpoint_callback,
+                                           ctx->db_checkpoint, 0,
+                                           config);
+        if (ret == -1) {
+            flb_tail_config_destroy(ctx);
+            return -1;
+        }
+        ctx->coll_fd_db = ret;
+    }
+
     /* Register callback to process multiline queued buffer */
     if (ctx->multiline == FLB_TRUE) {
         ret = flb_input_set_collector_time(in, flb_tail_mult_pending_flush,
@@ -283,6 +295,8 @@ static int in_tail_exit(void *data, struct flb_config *config)
         flb_utils_split_free(ctx->exclude_list);
     }
 
+    /* Write pending offsets in one transaction before removing the files */
+    flb_tail_db_checkpoint(ctx);
     flb_tail_file_remove_all(ctx);
     flb_tail_config_destroy(ctx);
 
@@ -38,7 +38,9 @@
 #define FLB_TAIL_REFRESH      60      /* refresh every 60 seconds       */
 #define FLB_TAIL_ROTATE_WAIT  5       /* time to monitor after rotation */
 
-#define FLB_TAIL_DB_COUNT     50      /* offset刷新到db的频率，单位次数*/
+#define FLB_TAIL_MMAP_WINDOW  8*1024*1024 /* mmap read mode window = 8MB */
+#define FLB_TAIL_MMAP_CHUNK   1024*1024   /* bytes parsed per mmap round */
+#define FLB_TAIL_DB_CHECKPOINT 1      /* write offsets every second     */
 
 int in_tail_collect_event(void *file, struct flb_config *config);
 
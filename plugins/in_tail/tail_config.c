@@ -22,12 +22,14 @@
 #include <fluent-bit/flb_input.h>
 
 #include <stdlib.h>
+#include <strings.h>
 #include <fcntl.h>
 
 #include "tail_fs.h"
 #include "tail_db.h"
 #include "tail_config.h"
 #include "tail_scan.h"
+#include "tail_file.h"
 #include "tail_multiline.h"
 
 struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
@@ -49,7 +51,10 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
     ctx->dynamic_tag = FLB_FALSE;
     ctx->ignore_older = 0;
     ctx->skip_long_lines = FLB_FALSE;
+    ctx->read_mmap = FLB_FALSE;
     ctx->db_sync = -1;
+    msgpack_sbuffer_init(&ctx->rec_sbuf);
+    msgpack_packer_init(&ctx->rec_pck, &ctx->rec_sbuf, msgpack_sbuffer_write);
 
     /* Create the channel manager */
     ret = pipe(ctx->ch_manager);
@@ -190,28 +195,6 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
         ctx->buf_chunk_size = FLB_TAIL_CHUNK;
     }
 
-
-
-	/* 获取offset刷新频率次数 */
-	tmp = flb_input_get_property("db_count",i_ins);
-	if (tmp) {
-		bytes = flb_utils_size_to_bytes(tmp);
-		if (bytes > 0) {
-			ctx->db_count = (size_t) bytes;
-		}
-		else {
-			ctx->db_count = FLB_TAIL_DB_COUNT;
-		}
-	}
-	else {
-		ctx->db_count = FLB_TAIL_DB_COUNT;
-	}
-
-
-
-
-
-
     /* Config: buffer maximum size */
     tmp = flb_input_get_property("buffer_max_size", i_ins);
     if (tmp) {
@@ -233,6 +216,23 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
         ctx->skip_long_lines = flb_utils_bool(tmp);
     }
 
+    /*
+     * Config: read mode, 'read' (default) or 'mmap'. With mmap a file
+     * truncated while a chunk is read loses the records of that chunk, see
+     * file_chunk_mmap().
+     */
+    tmp = flb_input_get_property("read_mode", i_ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "mmap") == 0) {
+            ctx->read_mmap = FLB_TRUE;
+        }
+        else if (strcasecmp(tmp, "read") != 0) {
+            flb_error("[in_tail] invalid read_mode '%s'", tmp);
+            flb_free(ctx);
+            return NULL;
+        }
+    }
+
     /* Validate buffer limit */
     if (ctx->buf_chunk_size > ctx->buf_max_size) {
         flb_error("[in_tail] buffer_max_size must be >= buffer_chunk");
@@ -254,7 +254,9 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
     mk_list_init(&ctx->files_static);
     mk_list_init(&ctx->files_event);
     mk_list_init(&ctx->files_rotated);
+    mk_list_init(&ctx->files_dirty);
     ctx->db = NULL;
+    ctx->stmt_offset = NULL;
 
     /* Check if it should use dynamic tags */
     tmp = strchr(i_ins->tag, '*');
@@ -283,6 +285,24 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
         }
     }
 
+    /* Config: 'db_count' was replaced by the checkpoint interval */
+    tmp = flb_input_get_property("db_count", i_ins);
+    if (tmp) {
+        flb_warn("[in_tail] 'db_count' is deprecated and ignored, "
+                 "use 'db.checkpoint_interval'");
+    }
+
+    tmp = flb_input_get_property("db.checkpoint_interval", i_ins);
+    if (tmp) {
+        ctx->db_checkpoint = atoi(tmp);
+        if (ctx->db_checkpoint <= 0) {
+            ctx->db_checkpoint = FLB_TAIL_DB_CHECKPOINT;
+        }
+    }
+    else {
+        ctx->db_checkpoint = FLB_TAIL_DB_CHECKPOINT;
+    }
+
     /* Initialize database */
     tmp = flb_input_get_property("db", i_ins);
     if (tmp) {
@@ -292,6 +312,12 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *i_ins,
         }
     }
 
+    /* Mapped files are read under a SIGBUS guard */
+    if (ctx->read_mmap == FLB_TRUE && flb_tail_file_mmap_guard_init() == -1) {
+        flb_warn("[in_tail] could not set the mmap guard, using read mode");
+        ctx->read_mmap = FLB_FALSE;
+    }
+
     return ctx;
 }
 
@@ -306,12 +332,16 @@ int flb_tail_config_destroy(struct flb_tail_config *config)
     close(config->ch_pending[1]);
 
     if (config->db != NULL) {
-        flb_tail_db_close(config->db);
+        flb_tail_db_close(config);
     }
 
     if (config->key != NULL) {
         flb_free(config->key);
     }
+    if (config->read_mmap == FLB_TRUE) {
+        flb_tail_file_mmap_guard_exit();
+    }
+    msgpack_sbuffer_destroy(&config->rec_sbuf);
     flb_free(config);
     return 0;
 }
@@ -24,6 +24,8 @@
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_parser.h>
 #include <fluent-bit/flb_macros.h>
+#include <fluent-bit/flb_lines.h>
+#include <fluent-bit/flb_sqldb.h>
 
 struct flb_tail_config {
     int fd_notify;             /* inotify fd               */
@@ -34,8 +36,6 @@ struct flb_tail_config {
     size_t buf_chunk_size;     /* allocation chunks        */
     size_t buf_max_size;       /* max size of a buffer     */
 
-	size_t db_count;              /* offset 刷新频率次数 */
-
     /* Collectors */
     int coll_fd_static;
     int coll_fd_scan;
@@ -61,14 +61,24 @@ struct flb_tail_config {
     char *key;                 /* key for unstructured record  */
     int   key_len;             /* length of key ^              */
     int   skip_long_lines;     /* skip long lines              */
+    int   read_mmap;           /* read large backlogs w/ mmap  */
 
     /* Database */
     struct flb_sqldb *db;
     int db_sync;
+    int db_checkpoint;         /* seconds between offset checkpoints */
+    sqlite3_stmt *stmt_offset; /* prepared offset update             */
+    struct mk_list files_dirty;/* files with offsets to checkpoint   */
+    int coll_fd_db;
 
     /* Parser / Format */
     struct flb_parser *parser;
 
+    /* Line breaks found in a chunk and scratch buffer for parsed records */
+    size_t lines[FLB_LINES_BATCH];
+    msgpack_sbuffer rec_sbuf;
+    msgpack_packer rec_pck;
+
     /* Multiline */
     int multiline;             /* multiline enabled ?  */
     int multiline_flush;       /* multiline flush/wait */
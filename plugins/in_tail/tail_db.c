@@ -67,12 +67,38 @@ struct flb_sqldb *flb_tail_db_open(char *path,
         }
     }
 
+    /*
+     * Offsets are written often by many files, the write-ahead log avoids
+     * rewriting the database pages (and the fsync of the rollback journal)
+     * on every checkpoint.
+     */
+    ret = flb_sqldb_query(db, SQL_PRAGMA_JOURNAL_MODE, NULL, NULL);
+    if (ret != FLB_OK) {
+        flb_warn("[in_tail:db] could not set pragma 'journal_mode'");
+    }
+
+    /* Offset updates are the hot path, prepare the statement once */
+    ret = sqlite3_prepare_v2(db->handler, SQL_UPDATE_OFFSET, -1,
+                             &ctx->stmt_offset, NULL);
+    if (ret != SQLITE_OK) {
+        flb_error("[in_tail:db] could not prepare offset update: %s",
+                  sqlite3_errmsg(db->handler));
+        flb_sqldb_close(db);
+        return NULL;
+    }
+
     return db;
 }
 
-int flb_tail_db_close(struct flb_sqldb *db)
+int flb_tail_db_close(struct flb_tail_config *ctx)
 {
-    flb_sqldb_close(db);
+    if (ctx->stmt_offset) {
+        sqlite3_finalize(ctx->stmt_offset);
+        ctx->stmt_offset = NULL;
+    }
+
+    flb_sqldb_close(ctx->db);
+    ctx->db = NULL;
     return 0;
 }
 
@@ -124,23 +150,118 @@ int flb_tail_db_file_set(struct flb_tail_file *file,
     return 0;
 }
 
-/* Update offset */
+/* Run the prepared offset update for a file */
+static int db_offset_update(struct flb_tail_file *file,
+                            struct flb_tail_config *ctx)
+{
+    int ret;
+
+    sqlite3_bind_int64(ctx->stmt_offset, 1, file->offset);
+    sqlite3_bind_int64(ctx->stmt_offset, 2, file->db_id);
+
+    ret = sqlite3_step(ctx->stmt_offset);
+    sqlite3_clear_bindings(ctx->stmt_offset);
+    sqlite3_reset(ctx->stmt_offset);
+
+    if (ret != SQLITE_DONE) {
+        flb_error("[in_tail:db] could not update offset of %s: %s",
+                  file->name, sqlite3_errmsg(ctx->db->handler));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Update offset now, out of the regular checkpoint */
 int flb_tail_db_file_offset(struct flb_tail_file *file,
                             struct flb_tail_config *ctx)
+{
+    /*
+     * Leave the checkpoint queue even if the write fails (it's logged by
+     * db_offset_update()): the file may be released right after this call.
+     */
+    if (file->db_dirty == FLB_TRUE) {
+        mk_list_del(&file->_db_head);
+        file->db_dirty = FLB_FALSE;
+    }
+
+    return db_offset_update(file, ctx);
+}
+
+/* Queue the file offset for the next checkpoint */
+int flb_tail_db_file_dirty(struct flb_tail_file *file,
+                           struct flb_tail_config *ctx)
+{
+    if (file->db_dirty == FLB_FALSE) {
+        mk_list_add(&file->_db_head, &ctx->files_dirty);
+        file->db_dirty = FLB_TRUE;
+    }
+
+    return 0;
+}
+
+/*
+ * Write the offsets of all the files that moved since the last checkpoint
+ * in a single transaction.
+ */
+int flb_tail_db_checkpoint(struct flb_tail_config *ctx)
 {
     int ret;
-    char query[PATH_MAX];
+    int count = 0;
+    struct mk_list *head;
+    struct mk_list *tmp;
+    struct mk_list done;
+    struct flb_tail_file *file;
 
-    snprintf(query, sizeof(query) - 1,
-             SQL_UPDATE_OFFSET,
-             file->offset, file->db_id);
+    if (!ctx->db || mk_list_is_empty(&ctx->files_dirty) == 0) {
+        return 0;
+    }
 
-    ret = flb_sqldb_query(ctx->db,
-                          query, NULL, NULL);
-    if (ret == FLB_ERROR) {
+    ret = flb_sqldb_query(ctx->db, SQL_BEGIN, NULL, NULL);
+    if (ret != FLB_OK) {
+        return -1;
+    }
+
+    /* Files which offset failed to update stay queued for the next round */
+    mk_list_init(&done);
+    mk_list_foreach_safe(head, tmp, &ctx->files_dirty) {
+        file = mk_list_entry(head, struct flb_tail_file, _db_head);
+        ret = db_offset_update(file, ctx);
+        if (ret == 0) {
+            mk_list_del(&file->_db_head);
+            mk_list_add(&file->_db_head, &done);
+            count++;
+        }
+    }
+
+    ret = flb_sqldb_query(ctx->db, SQL_COMMIT, NULL, NULL);
+    if (ret != FLB_OK) {
+        /* Queue the files again, they are retried on the next round */
+        flb_sqldb_query(ctx->db, SQL_ROLLBACK, NULL, NULL);
+        mk_list_foreach_safe(head, tmp, &done) {
+            file = mk_list_entry(head, struct flb_tail_file, _db_head);
+            mk_list_del(&file->_db_head);
+            mk_list_add(&file->_db_head, &ctx->files_dirty);
+        }
         return -1;
     }
 
+    mk_list_foreach_safe(head, tmp, &done) {
+        file = mk_list_entry(head, struct flb_tail_file, _db_head);
+        mk_list_del(&file->_db_head);
+        file->db_dirty = FLB_FALSE;
+    }
+
+    flb_trace("[in_tail:db] checkpoint: %i offsets", count);
+    return count;
+}
+
+int flb_tail_db_checkpoint_callback(struct flb_input_instance *i_ins,
+                                    struct flb_config *config, void *context)
+{
+    struct flb_tail_config *ctx = context;
+
+    flb_tail_db_checkpoint(ctx);
     return 0;
 }
 
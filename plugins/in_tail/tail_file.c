@@ -19,13 +19,17 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
+#include <setjmp.h>
+#include <signal.h>
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_parser.h>
+#include <fluent-bit/flb_thread_storage.h>
 
 #include "tail.h"
 #include "tail_file.h"
@@ -40,98 +44,6 @@ static inline void consume_bytes(char *buf, int bytes, int length)
     memmove(buf, buf + bytes, length - bytes);
 }
 
-static int unpack_and_pack(msgpack_packer *pck, msgpack_object *root,
-                           char *key, size_t key_len,
-                           char *val, size_t val_len)
-{
-    int i;
-    int size = root->via.map.size;
-
-    msgpack_pack_map(pck, size + 1);
-
-    /* Append new k/v */
-    msgpack_pack_str(pck, key_len);
-    msgpack_pack_str_body(pck, key, key_len);
-    msgpack_pack_str(pck, val_len);
-    msgpack_pack_str_body(pck, val, val_len);
-
-    for (i = 0; i < size; i++) {
-        msgpack_object k = root->via.map.ptr[i].key;
-        msgpack_object v = root->via.map.ptr[i].val;;
-
-        msgpack_pack_object(pck, k);
-        msgpack_pack_object(pck, v);
-    }
-
-    return 0;
-}
-
-static int append_record_to_map(char **data, size_t *data_size,
-                                char *key,  size_t key_len,
-                                char *val,  size_t val_len)
-{
-    int ret;
-    msgpack_unpacked result;
-    msgpack_object   root;
-    msgpack_sbuffer sbuf;
-    msgpack_packer  pck;
-    size_t off = 0;
-
-    msgpack_sbuffer_init(&sbuf);
-    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
-    msgpack_unpacked_init(&result);
-
-    ret = msgpack_unpack_next(&result, *data, *data_size, &off);
-    if (ret != MSGPACK_UNPACK_SUCCESS) {
-        msgpack_unpacked_destroy(&result);
-        msgpack_sbuffer_destroy(&sbuf);
-        return -1;
-    }
-
-    root = result.data;
-    ret = unpack_and_pack(&pck, &root,
-                          key, key_len, val, val_len);
-    if (ret < 0) {
-        /* fail! */
-        msgpack_unpacked_destroy(&result);
-        msgpack_sbuffer_destroy(&sbuf);
-        return -1;
-    }
-    else {
-        /* success !*/
-        flb_free(*data);
-        *data      = sbuf.data;
-        *data_size = sbuf.size;
-    }
-
-    msgpack_unpacked_destroy(&result);
-    return 0;
-}
-
-static inline int pack_line_map(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
-                                struct flb_time *time, char **data,
-                                size_t *data_size, struct flb_tail_file *file)
-{
-    int map_num = 1;
-
-    if (file->config->path_key != NULL) {
-        map_num++; /* to append path_key */
-    }
-
-    if (file->config->path_key != NULL) {
-        append_record_to_map(data, data_size,
-                             file->config->path_key,
-                             file->config->path_key_len,
-                             file->name, file->name_len);
-    }
-
-    msgpack_pack_array(mp_pck, 2);
-    flb_time_append_to_msgpack(time, mp_pck, 0);
-    msgpack_sbuffer_write(mp_sbuf, *data, *data_size);
-
-    return 0;
-}
-
 int flb_tail_file_pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
                             struct flb_time *time, char *data, size_t data_size,
                             struct flb_tail_file *file)
@@ -163,136 +75,181 @@ int flb_tail_file_pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
     return 0;
 }
 
-static int process_content(struct flb_tail_file *file, off_t *bytes)
+#ifdef FLB_HAVE_REGEX
+/*
+ * Parse a line with the configured parser and pack the record. The parser
+ * packs the map into the reusable ctx->rec_sbuf buffer (the record time is
+ * only known once the line is parsed), then it's appended to the output.
+ * Returns -1 if the line could not be parsed.
+ */
+static int pack_parsed_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
+                            time_t now, char *data, size_t len,
+                            struct flb_tail_file *file)
+{
+    int ret;
+    int extra_keys = 0;
+    struct flb_time out_time;
+    struct flb_tail_config *ctx = file->config;
+
+    if (ctx->path_key != NULL) {
+        extra_keys++; /* to append path_key */
+    }
+
+    ctx->rec_sbuf.size = 0;
+    flb_time_zero(&out_time);
+    ret = flb_parser_do_pack(ctx->parser, data, len, &ctx->rec_pck,
+                             extra_keys, &out_time);
+    if (ret < 0) {
+        return -1;
+    }
+
+    if (ctx->path_key != NULL) {
+        msgpack_pack_str(&ctx->rec_pck, ctx->path_key_len);
+        msgpack_pack_str_body(&ctx->rec_pck, ctx->path_key, ctx->path_key_len);
+        msgpack_pack_str(&ctx->rec_pck, file->name_len);
+        msgpack_pack_str_body(&ctx->rec_pck, file->name, file->name_len);
+    }
+
+    if (flb_time_to_double(&out_time) == 0) {
+        flb_time_get(&out_time);
+    }
+
+    if (ctx->ignore_older > 0) {
+        if ((now - ctx->ignore_older) > out_time.tm.tv_sec) {
+            return 0;
+        }
+    }
+
+    /* If multiline is enabled, flush any buffered data */
+    if (ctx->multiline == FLB_TRUE) {
+        flb_tail_mult_flush(mp_sbuf, mp_pck, file, ctx);
+    }
+
+    msgpack_pack_array(mp_pck, 2);
+    flb_time_append_to_msgpack(&out_time, mp_pck, 0);
+    msgpack_sbuffer_write(mp_sbuf, ctx->rec_sbuf.data, ctx->rec_sbuf.size);
+
+    return 0;
+}
+#endif
+
+/*
+ * Cut the lines available in 'buf' (the file buffer or a mmap window) and
+ * pack them straight into the dyntag buffer of the file Tag. Line breaks
+ * are looked up in batches of FLB_LINES_BATCH by flb_lines_find().
+ */
+static int process_content(struct flb_tail_file *file,
+                           char *buf, size_t size, off_t *bytes)
 {
     int len;
     int lines = 0;
     int ret;
+    size_t i;
+    size_t n;
     off_t processed_bytes = 0;
+    char *base;
     char *data;
     char *end;
     char *p;
-    void *out_buf;
-    size_t out_size;
     time_t now = time(NULL);
     struct flb_time out_time = {};
-    msgpack_sbuffer mp_sbuf;
-    msgpack_packer mp_pck;
+    struct flb_input_dyntag *dt;
     msgpack_sbuffer *out_sbuf;
     msgpack_packer *out_pck;
     struct flb_tail_config *ctx = file->config;
 
-    /* Create a temporal msgpack buffer */
-    msgpack_sbuffer_init(&mp_sbuf);
-    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
-    out_sbuf = &mp_sbuf;
-    out_pck  = &mp_pck;
+    /* Records are packed directly into the dyntag buffer */
+    dt = flb_input_dyntag_write_start(ctx->i_ins,
+                                      file->tag_buf, file->tag_len);
+    if (!dt) {
+        return -1;
+    }
+    out_sbuf = &dt->mp_sbuf;
+    out_pck  = &dt->mp_pck;
 
     /* Parse the data content */
-    data = file->buf_data;
-    end = data + file->buf_len;
-    while ((p = memchr(data, '\n', end - data))) {
-        len = (p - data);
-
-        if (file->skip_next == FLB_TRUE) {
-            data += len + 1;
-            processed_bytes += len;
-            file->skip_next = FLB_FALSE;
-            continue;
+    data = buf;
+    end = data + size;
+    while (data < end) {
+        base = data;
+        n = flb_lines_find(base, end - base, '\n', ctx->lines, FLB_LINES_BATCH);
+        if (n == 0) {
+            break;
         }
 
-        /* Empty line (just \n) */
-        if (len == 0) {
-            data++;
-            processed_bytes++;
-            continue;
-        }
+        for (i = 0; i < n; i++) {
+            p = base + ctx->lines[i];
+            len = (p - data);
 
-        /* Reset time for each line */
-        flb_time_zero(&out_time);
+            if (file->skip_next == FLB_TRUE) {
+                data += len + 1;
+                processed_bytes += len;
+                file->skip_next = FLB_FALSE;
+                continue;
+            }
+
+            /* Empty line (just \n) */
+            if (len == 0) {
+                data++;
+                processed_bytes++;
+                continue;
+            }
 
 #ifdef FLB_HAVE_REGEX
-        if (ctx->parser) {
-            /* Common parser (non-multiline) */
-            ret = flb_parser_do(ctx->parser, data, len,
-                                &out_buf, &out_size, &out_time);
-            if (ret >= 0) {
-                if (flb_time_to_double(&out_time) == 0) {
+            if (ctx->parser) {
+                /* Common parser (non-multiline) */
+                ret = pack_parsed_line(out_sbuf, out_pck, now,
+                                       data, len, file);
+                if (ret == -1) {
+                    /* Parser failed, pack raw text */
                     flb_time_get(&out_time);
+                    flb_tail_file_pack_line(out_sbuf, out_pck, &out_time,
+                                            data, len, file);
                 }
+            }
+            else if (ctx->multiline == FLB_TRUE) {
+                ret = flb_tail_mult_process_content(out_sbuf, out_pck, now,
+                                                    data, len, file, ctx);
 
-                if (ctx->ignore_older > 0) {
-                    if ((now - ctx->ignore_older) > out_time.tm.tv_sec) {
-                        flb_free(out_buf);
-                        goto go_next;
-                    }
-                }
+                /* No multiline */
+                if (ret == FLB_TAIL_MULT_NA) {
 
-                /* If multiline is enabled, flush any buffered data */
-                if (ctx->multiline == FLB_TRUE) {
                     flb_tail_mult_flush(out_sbuf, out_pck, file, ctx);
-                }
 
-                pack_line_map(out_sbuf, out_pck, &out_time,
-                              (char**) &out_buf, &out_size, file);
-                flb_free(out_buf);
+                    flb_time_get(&out_time);
+                    flb_tail_file_pack_line(out_sbuf, out_pck, &out_time,
+                                            data, len, file);
+                }
+                else if (ret == FLB_TAIL_MULT_MORE) {
+                    /* we need more data, do nothing */
+                    goto go_next;
+                }
+                else if (ret == FLB_TAIL_MULT_DONE) {
+                    /* Finalized */
+                }
             }
             else {
-                /* Parser failed, pack raw text */
-                flb_time_get(&out_time);
-                flb_tail_file_pack_line(out_sbuf, out_pck, &out_time,
-                                        data, len, file);
-            }
-        }
-        else if (ctx->multiline == FLB_TRUE) {
-            ret = flb_tail_mult_process_content(now,
-                                                data, len, file, ctx);
-
-            /* No multiline */
-            if (ret == FLB_TAIL_MULT_NA) {
-
-                flb_tail_mult_flush(out_sbuf, out_pck, file, ctx);
-
                 flb_time_get(&out_time);
                 flb_tail_file_pack_line(out_sbuf, out_pck, &out_time,
                                         data, len, file);
             }
-            else if (ret == FLB_TAIL_MULT_MORE) {
-                /* we need more data, do nothing */
-                goto go_next;
-            }
-            else if (ret == FLB_TAIL_MULT_DONE) {
-                /* Finalized */
-            }
-        }
-        else {
+#else
             flb_time_get(&out_time);
             flb_tail_file_pack_line(out_sbuf, out_pck, &out_time,
                                     data, len, file);
-        }
-#else
-        flb_time_get(&out_time);
-        flb_tail_file_pack_line(out_sbuf, out_pck, &out_time,
-                                data, len, file);
 #endif
 
-    go_next:
-        /* Adjust counters */
-        data += len + 1;
-        processed_bytes += len + 1;
-        file->parsed = 0;
-        lines++;
+        go_next:
+            /* Adjust counters */
+            data += len + 1;
+            processed_bytes += len + 1;
+            lines++;
+        }
     }
-    file->parsed = file->buf_len;
     *bytes = processed_bytes;
 
-    /* Append the temporal buffer to a dyntag, then release it */
-    flb_input_dyntag_append_raw(ctx->i_ins,
-                                file->tag_buf,
-                                file->tag_len,
-                                out_sbuf->data,
-                                out_sbuf->size);
-    msgpack_sbuffer_destroy(out_sbuf);
+    /* Run filters and account the appended records */
+    flb_input_dyntag_write_end(dt);
     return lines;
 }
 
@@ -452,7 +409,9 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
     file->inode     = st->st_ino;
     file->size      = st->st_size;
     file->buf_len   = 0;
-    file->parsed    = 0;
+    file->map_data  = NULL;
+    file->map_len   = 0;
+    file->map_offset = 0;
     file->config    = ctx;
     file->tail_mode = mode;
     file->tag_len   = 0;
@@ -465,6 +424,7 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
     file->mult_skipping = FLB_FALSE;
     file->mult_sbuf.data = NULL;
     file->db_id     = 0;
+    file->db_dirty  = FLB_FALSE;
     file->skip_next = FLB_FALSE;
     file->skip_warn = FLB_FALSE;
 
@@ -545,10 +505,10 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
 
 void flb_tail_file_remove(struct flb_tail_file *file)
 {
-	//当fluent-bit宕掉时，将未写入db的offset写入db
-	if (file->config->db) {
-		flb_tail_db_file_offset(file, file->config);
-	}
+    /* Write the offset not yet checkpointed */
+    if (file->db_dirty == FLB_TRUE) {
+        flb_tail_db_file_offset(file, file->config);
+    }
 
     if (file->rotated > 0) {
         mk_list_del(&file->_rotate_head);
@@ -561,6 +521,10 @@ void flb_tail_file_remove(struct flb_tail_file *file)
         flb_free(file->tag_buf);
     }
 
+    if (file->map_data) {
+        munmap(file->map_data, file->map_len);
+    }
+
     flb_free(file->buf_data);
     flb_free(file->name);
     flb_free(file);
@@ -588,6 +552,207 @@ int flb_tail_file_remove_all(struct flb_tail_config *ctx)
     return count;
 }
 
+/*
+ * A mapped file truncated under us (e.g: copytruncate) raises SIGBUS when
+ * the pages past its new end are read. Reads of a mapping run under a
+ * guard: the handler jumps back to file_chunk_mmap(), which drops the
+ * records of the chunk and falls back to read(2) where the truncation is
+ * detected as usual. A fault out of a guarded read goes to the previous
+ * SIGBUS disposition.
+ */
+static FLB_TLS_DEFINE(sigjmp_buf, mmap_guard)
+static int mmap_guard_users = 0;
+static struct sigaction mmap_guard_prev;
+
+static void mmap_guard_handler(int sig, siginfo_t *info, void *context)
+{
+    sigjmp_buf *guard;
+
+    guard = (sigjmp_buf *) FLB_TLS_GET(mmap_guard);
+    if (guard) {
+        siglongjmp(*guard, 1);
+    }
+
+    /* Not ours, restore the previous disposition and fault again */
+    sigaction(SIGBUS, &mmap_guard_prev, NULL);
+}
+
+/* Install the SIGBUS guard, used by the instances with Read_Mode mmap */
+int flb_tail_file_mmap_guard_init()
+{
+    struct sigaction sa;
+
+    if (mmap_guard_users++ > 0) {
+        return 0;
+    }
+
+    FLB_TLS_INIT(mmap_guard);
+
+    memset(&sa, '\0', sizeof(sa));
+    sa.sa_sigaction = mmap_guard_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGBUS, &sa, &mmap_guard_prev) == -1) {
+        flb_errno();
+        mmap_guard_users--;
+        return -1;
+    }
+
+    return 0;
+}
+
+void flb_tail_file_mmap_guard_exit()
+{
+    if (mmap_guard_users == 0 || --mmap_guard_users > 0) {
+        return;
+    }
+
+    sigaction(SIGBUS, &mmap_guard_prev, NULL);
+}
+
+/*
+ * Drop the mmap window of the file (if any) and move the descriptor to the
+ * current offset so the read(2) path continues where the mapping stopped.
+ */
+static void file_unmap(struct flb_tail_file *file)
+{
+    if (!file->map_data) {
+        return;
+    }
+
+    munmap(file->map_data, file->map_len);
+    file->map_data = NULL;
+    file->map_len = 0;
+    file->map_offset = 0;
+    lseek(file->fd, file->offset, SEEK_SET);
+}
+
+/*
+ * Read_Mode mmap: when there is a large backlog after the current offset
+ * (catching up after a restart or reading a big static file), map a window
+ * of the file and cut the lines directly over the mapping, skipping the
+ * copy into the file buffer and the memmove() of the remaining bytes.
+ *
+ * The file size is checked before the mapping is read, but the file can
+ * still be truncated while the lines are cut: that case is caught by the
+ * SIGBUS guard (see above). The records packed from that chunk are dropped
+ * and, with a parser, the memory it was using may be leaked; files that
+ * are often truncated (copytruncate) are better read with Read_Mode read.
+ *
+ * It returns the number of bytes consumed, 0 if the read(2) path must be
+ * used instead or -1 on error.
+ */
+static off_t file_chunk_mmap(struct flb_tail_file *file)
+{
+    int ret;
+    char *map;
+    size_t len;
+    size_t chunk;
+    off_t start;
+    off_t processed_bytes;
+    sigjmp_buf guard;
+    struct stat st;
+    struct flb_input_dyntag *dt;
+    struct flb_tail_config *ctx = file->config;
+
+    /* Content already buffered by read(2) must be consumed first */
+    if (file->buf_len > 0 || file->skip_next == FLB_TRUE) {
+        return 0;
+    }
+
+    ret = fstat(file->fd, &st);
+    if (ret == -1) {
+        flb_errno();
+        file_unmap(file);
+        return 0;
+    }
+
+    chunk = FLB_TAIL_MMAP_CHUNK;
+    if (chunk < ctx->buf_max_size) {
+        chunk = ctx->buf_max_size;
+    }
+
+    /* Small backlog, the file buffer is good enough */
+    if (st.st_size - file->offset < (off_t) chunk) {
+        file_unmap(file);
+        return 0;
+    }
+
+    /*
+     * Map a new window if the next chunk is not inside the current one, or
+     * if the file was truncated under the mapping.
+     */
+    if (file->map_data &&
+        (file->offset < file->map_offset ||
+         file->offset + chunk > file->map_offset + file->map_len ||
+         st.st_size < file->map_offset + (off_t) file->map_len)) {
+        munmap(file->map_data, file->map_len);
+        file->map_data = NULL;
+    }
+
+    if (!file->map_data) {
+        start = file->offset - (file->offset % sysconf(_SC_PAGESIZE));
+        len = FLB_TAIL_MMAP_WINDOW;
+        if (len < chunk * 2) {
+            len = chunk * 2;
+        }
+        if (start + (off_t) len > st.st_size) {
+            len = st.st_size - start;
+        }
+
+        map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, file->fd, start);
+        if (map == MAP_FAILED) {
+            flb_errno();
+            file->map_len = 0;
+            lseek(file->fd, file->offset, SEEK_SET);
+            return 0;
+        }
+        madvise(map, len, MADV_SEQUENTIAL);
+
+        flb_trace("[in_tail] file=%s mmap window offset=%lu len=%lu",
+                  file->name, start, len);
+        file->map_data = map;
+        file->map_len = len;
+        file->map_offset = start;
+    }
+
+    /* Tag buffer the records are packed into, see process_content() */
+    dt = flb_input_dyntag_write_start(ctx->i_ins,
+                                      file->tag_buf, file->tag_len);
+    if (!dt) {
+        return -1;
+    }
+
+    if (sigsetjmp(guard, 1) != 0) {
+        FLB_TLS_SET(mmap_guard, NULL);
+        flb_debug("[in_tail] file=%s truncated while mapped", file->name);
+
+        /* Drop the records packed from the chunk */
+        dt->mp_sbuf.size = dt->mp_buf_write_size;
+        file_unmap(file);
+        return 0;
+    }
+
+    FLB_TLS_SET(mmap_guard, &guard);
+    ret = process_content(file,
+                          file->map_data + (file->offset - file->map_offset),
+                          chunk, &processed_bytes);
+    FLB_TLS_SET(mmap_guard, NULL);
+    if (ret < 0) {
+        return -1;
+    }
+
+    flb_debug("[in_tail] file=%s mmap=%lu lines=%i",
+              file->name, chunk, ret);
+
+    /* No full line in the chunk, let the read(2) path deal with it */
+    if (processed_bytes == 0) {
+        file_unmap(file);
+    }
+
+    return processed_bytes;
+}
+
 int flb_tail_file_chunk(struct flb_tail_file *file)
 {
     int ret;
@@ -597,8 +762,6 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
     off_t processed_bytes;
     ssize_t bytes;
     struct flb_tail_config *ctx;
-	static int count = 0; //记录写入chunk的次数
-	static time_t timer = 0; //记录写db的时间
 
     /* Check if we the engine issued a pause */
     ctx = file->config;
@@ -606,6 +769,18 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
         return FLB_TAIL_BUSY;
     }
 
+    if (ctx->read_mmap == FLB_TRUE) {
+        processed_bytes = file_chunk_mmap(file);
+        if (processed_bytes == -1) {
+            flb_debug("[in_tail] file=%s ERROR", file->name);
+            return FLB_TAIL_ERROR;
+        }
+        else if (processed_bytes > 0) {
+            file->offset += processed_bytes;
+            goto offset_update;
+        }
+    }
+
     capacity = (file->buf_size - file->buf_len) - 1;
     if (capacity < 1) {
         /*
@@ -667,7 +842,8 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
          * now. It may need to get back a few bytes at the beginning of a new
          * line.
          */
-        ret = process_content(file, &processed_bytes);
+        ret = process_content(file, file->buf_data, file->buf_len,
+                              &processed_bytes);
         if (ret >= 0) {
             flb_debug("[in_tail] file=%s read=%lu lines=%i",
                       file->name, bytes, ret);
@@ -684,15 +860,11 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
         file->buf_len -= processed_bytes;
         file->buf_data[file->buf_len] = '\0';
 
-		// 如果开启了db，将offset写入db
-		if (file->config->db) {
-			//当count达到配置的次数或者距离上次写入的时间超过1分钟，将offset写入到db
-			if (++count == file->config->db_count || time(NULL) - timer > 60) {
-				flb_tail_db_file_offset(file, file->config);
-				timer = time(NULL);
-				count = 0;
-			}
-		}
+    offset_update:
+        /* The offset is written by the next database checkpoint */
+        if (ctx->db) {
+            flb_tail_db_file_dirty(file, ctx);
+        }
 
         /* Data was consumed but likely some bytes still remain */
         return FLB_TAIL_OK;
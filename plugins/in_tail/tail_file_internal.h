@@ -54,11 +54,15 @@ struct flb_tail_file {
     struct flb_time mult_time;  /* multiline time parsed from first line */
 
     /* buffering */
-    off_t parsed;
     off_t buf_len;
     size_t buf_size;
     char *buf_data;
 
+    /* mmap read mode: current window of the file mapped in memory */
+    char *map_data;
+    size_t map_len;
+    off_t map_offset;
+
     /*
      * Long-lines handling: this flag is enabled when a previous line was
      * too long and the buffer did not contain a \n, so when reaching the
@@ -76,6 +80,8 @@ struct flb_tail_file {
 
     /* database reference */
     uint64_t db_id;
+    int db_dirty;               /* offset pending to be checkpointed */
+    struct mk_list _db_head;    /* link to config->files_dirty       */
 
     /* reference */
     int tail_mode;
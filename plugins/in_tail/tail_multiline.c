@@ -130,30 +130,22 @@ int flb_tail_mult_destroy(struct flb_tail_config *ctx)
  * Pack a line that did not matched a firstline and is not part of a multiline
  * message.
  */
-static int pack_line(char *data, size_t data_size, struct flb_tail_file *file,
-                     struct flb_tail_config *ctx)
+static int pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
+                     char *data, size_t data_size, struct flb_tail_file *file)
 {
-    msgpack_sbuffer mp_sbuf;
-    msgpack_packer mp_pck;
     struct flb_time out_time;
 
-    msgpack_sbuffer_init(&mp_sbuf);
-    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
     flb_time_get(&out_time);
+    flb_tail_file_pack_line(mp_sbuf, mp_pck, &out_time, data, data_size, file);
 
-    flb_tail_file_pack_line(&mp_sbuf, &mp_pck, &out_time, data, data_size, file);
-    flb_input_dyntag_append_raw(ctx->i_ins,
-                                file->tag_buf,
-                                file->tag_len,
-                                mp_sbuf.data,
-                                mp_sbuf.size);
-    msgpack_sbuffer_destroy(&mp_sbuf);
-
-    return 0;
+    /* We expect more data */
+    return FLB_TAIL_MULT_MORE;
 }
 
 /* Process the result of a firstline match */
-int flb_tail_mult_process_first(time_t now,
+int flb_tail_mult_process_first(msgpack_sbuffer *mp_sbuf,
+                                msgpack_packer *mp_pck,
+                                time_t now,
                                 char *buf, size_t size,
                                 struct flb_time *out_time,
                                 struct flb_tail_file *file,
@@ -161,23 +153,12 @@ int flb_tail_mult_process_first(time_t now,
 {
     int ret;
     size_t off;
-    msgpack_sbuffer mp_sbuf;
-    msgpack_packer mp_pck;
     msgpack_object map;
     msgpack_unpacked result;
 
     /* If a previous multiline context already exists, flush first */
     if (file->mult_firstline == FLB_TRUE && file->mult_skipping == FLB_FALSE) {
-        msgpack_sbuffer_init(&mp_sbuf);
-        msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
-
-        flb_tail_mult_flush(&mp_sbuf, &mp_pck, file, ctx);
-        flb_input_dyntag_append_raw(ctx->i_ins,
-                                    file->tag_buf,
-                                    file->tag_len,
-                                    mp_sbuf.data,
-                                    mp_sbuf.size);
-        msgpack_sbuffer_destroy(&mp_sbuf);
+        flb_tail_mult_flush(mp_sbuf, mp_pck, file, ctx);
     }
 
     /* Remark as first multiline message */
@@ -247,7 +228,9 @@ static inline void flb_tail_mult_append_raw(char *buf, int size,
     msgpack_pack_str_body(&file->mult_pck, buf, size);
 }
 
-int flb_tail_mult_process_content(time_t now,
+int flb_tail_mult_process_content(msgpack_sbuffer *mp_sbuf,
+                                  msgpack_packer *mp_pck,
+                                  time_t now,
                                   char *buf, int len,
                                   struct flb_tail_file *file,
                                   struct flb_tail_config *ctx)
@@ -267,8 +250,8 @@ int flb_tail_mult_process_content(time_t now,
                         buf, len,
                         &out_buf, &out_size, &out_time);
     if (ret >= 0) {
-        flb_tail_mult_process_first(now, out_buf, out_size, &out_time,
-                                    file, ctx);
+        flb_tail_mult_process_first(mp_sbuf, mp_pck, now, out_buf, out_size,
+                                    &out_time, file, ctx);
         return FLB_TAIL_MULT_MORE;
     }
 
@@ -308,7 +291,7 @@ int flb_tail_mult_process_content(time_t now,
             flb_tail_mult_append_raw(buf, len, file, ctx);
         }
         else {
-            pack_line(buf, len, file, ctx);
+            pack_line(mp_sbuf, mp_pck, buf, len, file);
         }
         return FLB_TAIL_MULT_MORE;
     }
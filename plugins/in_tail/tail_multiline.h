@@ -42,7 +42,9 @@ int flb_tail_mult_create(struct flb_tail_config *ctx,
 
 int flb_tail_mult_destroy(struct flb_tail_config *ctx);
 
-int flb_tail_mult_process_content(time_t now,
+int flb_tail_mult_process_content(msgpack_sbuffer *mp_sbuf,
+                                  msgpack_packer *mp_pck,
+                                  time_t now,
                                   char *buf, int len,
                                   struct flb_tail_file *file,
                                   struct flb_tail_config *ctx);
@@ -45,11 +45,18 @@
     "  VALUES ('%s', %lu, %lu, %lu);"
 
 #define SQL_UPDATE_OFFSET                               \
-    "UPDATE in_tail_files set offset=%lu WHERE id=%"PRId64";"
+    "UPDATE in_tail_files set offset=@offset WHERE id=@id;"
 
 #define SQL_ROTATE_FILE                         \
     "UPDATE in_tail_files set name='%s',rotated=1 WHERE id=%"PRId64";"
 
 #define SQL_PRAGMA_SYNC                         \
     "PRAGMA synchronous=%i;"
+
+#define SQL_PRAGMA_JOURNAL_MODE                 \
+    "PRAGMA journal_mode=WAL;"
+
+#define SQL_BEGIN   "BEGIN;"
+#define SQL_COMMIT  "COMMIT;"
+#define SQL_ROLLBACK "ROLLBACK;"
 #endif
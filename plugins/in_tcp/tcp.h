@@ -22,6 +22,7 @@
 
 #include <msgpack.h>
 #include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_bufpool.h>
 
 struct flb_in_tcp_config {
     int server_fd;                 /* TCP server file descriptor  */
@@ -29,6 +30,7 @@ struct flb_in_tcp_config {
     size_t chunk_size;             /* Chunk allocation size       */
     char *listen;                  /* Listen interface            */
     char *tcp_port;                /* TCP Port                    */
+    struct flb_bufpool *pool;      /* Connection buffers pool     */
     struct mk_list connections;    /* List of active connections  */
     struct mk_event_loop *evl;     /* Event loop file descriptor  */
     struct flb_input_instance *in; /* Input plugin instace        */
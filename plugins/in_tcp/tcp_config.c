@@ -30,6 +30,8 @@ struct flb_in_tcp_config *tcp_config_init(struct flb_input_instance *i_ins)
     char *listen;
     char *buffer_size;
     char *chunk_size;
+    char *pool_limit;
+    ssize_t limit = 0;
     struct flb_in_tcp_config *config;
 
     config = flb_malloc(sizeof(struct flb_in_tcp_config));
@@ -78,6 +80,22 @@ struct flb_in_tcp_config *tcp_config_init(struct flb_input_instance *i_ins)
         config->buffer_size  = (atoi(buffer_size) * 1024);
     }
 
+    /* Connection buffers: optional limit of bytes in use by all of them */
+    pool_limit = flb_input_get_property("buffer_pool_limit", i_ins);
+    if (pool_limit) {
+        limit = flb_utils_size_to_bytes(pool_limit);
+        if (limit < 0) {
+            flb_warn("[in_tcp] invalid buffer_pool_limit '%s'", pool_limit);
+            limit = 0;
+        }
+    }
+    config->pool = flb_bufpool_create(config->chunk_size, config->buffer_size,
+                                      limit);
+    if (!config->pool) {
+        tcp_config_destroy(config);
+        return NULL;
+    }
+
     flb_debug("[in_tcp] Listen='%s' TCP_Port=%s",
               config->listen, config->tcp_port);
 
@@ -86,6 +104,7 @@ struct flb_in_tcp_config *tcp_config_init(struct flb_input_instance *i_ins)
 
 int tcp_config_destroy(struct flb_in_tcp_config *config)
 {
+    flb_bufpool_destroy(config->pool);
     flb_free(config->listen);
     flb_free(config->tcp_port);
     flb_free(config);
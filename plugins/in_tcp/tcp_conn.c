@@ -80,7 +80,8 @@ int tcp_conn_event(void *data)
 
     event = &conn->event;
     if (event->mask & MK_EVENT_READ) {
-        available = (conn->buf_size - conn->buf_len);
+        /* Keep one byte for the NULL terminator */
+        available = (conn->buf_size - conn->buf_len) - 1;
         if (available < 1) {
             if (conn->buf_size + ctx->chunk_size > ctx->buffer_size) {
                 flb_trace("[in_tcp] fd=%i incoming data exceed limit (%i KB)",
@@ -90,9 +91,11 @@ int tcp_conn_event(void *data)
             }
 
             size = conn->buf_size + ctx->chunk_size;
-            tmp = flb_realloc(conn->buf_data, size);
+            tmp = flb_bufpool_realloc(ctx->pool, conn->buf_data,
+                                      conn->buf_size, size);
             if (!tmp) {
-                perror("realloc");
+                flb_warn("[in_tcp] fd=%i cannot grow buffer", event->fd);
+                tcp_conn_del(conn);
                 return -1;
             }
             flb_trace("[in_tcp] fd=%i buffer realloc %i -> %i",
@@ -100,7 +103,7 @@ int tcp_conn_event(void *data)
 
             conn->buf_data = tmp;
             conn->buf_size = size;
-            available = (conn->buf_size - conn->buf_len);
+            available = (conn->buf_size - conn->buf_len) - 1;
         }
 
         /* Read data */
@@ -117,15 +120,11 @@ int tcp_conn_event(void *data)
         conn->buf_len += bytes;
         conn->buf_data[conn->buf_len] = '\0';
 
-        /* Strip CR or LF if found at first byte */
-        if (conn->buf_data[0] == '\r' || conn->buf_data[0] == '\n') {
-            /* Skip message with one byte with CR or LF */
-            flb_trace("[in_tcp] skip one byte message with ASCII code=%i",
-                      conn->buf_data[0]);
-            consume_bytes(conn->buf_data, 1, conn->buf_len);
-            conn->buf_len--;
-        }
-
+        /*
+         * CR, LF and other blanks between messages are skipped by the
+         * parser and consumed with the next message, do not strip them
+         * here: the parser state keeps offsets into this buffer.
+         */
         /* JSON Format handler */
         char *pack;
         int out_size;
@@ -154,10 +153,6 @@ int tcp_conn_event(void *data)
         conn->buf_len -= conn->pack_state.last_byte;
         conn->buf_data[conn->buf_len] = '\0';
 
-        flb_pack_state_reset(&conn->pack_state);
-        flb_pack_state_init(&conn->pack_state);
-        conn->pack_state.multiple = FLB_TRUE;
-
         flb_free(pack);
         return bytes;
     }
@@ -196,9 +191,8 @@ struct tcp_conn *tcp_conn_add(int fd, struct flb_in_tcp_config *ctx)
     conn->rest    = 0;
     conn->status  = TCP_NEW;
 
-    conn->buf_data = flb_malloc(ctx->chunk_size);
+    conn->buf_data = flb_bufpool_get(ctx->pool, ctx->chunk_size);
     if (!conn->buf_data) {
-        perror("malloc");
         close(fd);
         flb_error("[in_tcp] could not allocate new connection");
         flb_free(conn);
@@ -216,7 +210,7 @@ struct tcp_conn *tcp_conn_add(int fd, struct flb_in_tcp_config *ctx)
     if (ret == -1) {
         flb_error("[in_tcp] could not register new connection");
         close(fd);
-        flb_free(conn->buf_data);
+        flb_bufpool_put(ctx->pool, conn->buf_data, conn->buf_size);
         flb_free(conn);
         return NULL;
     }
@@ -240,7 +234,7 @@ int tcp_conn_del(struct tcp_conn *conn)
     /* Release resources */
     mk_list_del(&conn->_head);
     close(conn->fd);
-    flb_free(conn->buf_data);
+    flb_bufpool_put(ctx->pool, conn->buf_data, conn->buf_size);
     flb_free(conn);
 
     return 0;
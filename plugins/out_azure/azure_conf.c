@@ -178,6 +178,7 @@ struct flb_azure *flb_azure_conf_create(struct flb_output_instance *ins,
         flb_azure_conf_destroy(ctx);
         return NULL;
     }
+    flb_output_upstream_set(upstream, ins);
     ctx->u = upstream;
 
     /* Compose uri */
@@ -85,6 +85,8 @@ struct flb_elasticsearch *flb_es_conf_create(struct flb_output_instance *ins,
         return NULL;
     }
 
+    flb_output_upstream_set(upstream, ins);
+
     /* Set manual Index and Type */
     ctx->u = upstream;
     if (f_index) {
@@ -173,13 +173,15 @@ static void cb_file_flush(void *data, size_t bytes,
                           void *out_context,
                           struct flb_config *config)
 {
+    int ret;
+    int len;
     FILE * fp;
     msgpack_unpacked result;
     size_t off = 0;
-    size_t last_off = 0;
-    size_t alloc_size = 0;
     char *out_file;
-    char *buf;
+    char tmp[64];
+    flb_sds_t json = NULL;
+    flb_sds_t sds;
     msgpack_object *obj;
     struct flb_file_conf *ctx = out_context;
     struct flb_time tm;
@@ -201,32 +203,49 @@ static void cb_file_flush(void *data, size_t bytes,
         FLB_OUTPUT_RETURN(FLB_ERROR);
     }
 
+    /* JSON records of the chunk are encoded into a single buffer */
+    if (ctx->format == FLB_OUT_FILE_FMT_JSON) {
+        json = flb_sds_create_size(bytes + (bytes / 2));
+        if (!json) {
+            fclose(fp);
+            FLB_OUTPUT_RETURN(FLB_RETRY);
+        }
+    }
+
     /*
      * Upon flush, for each array, lookup the time and the first field
      * of the map to use as a data point.
      */
     msgpack_unpacked_init(&result);
     while (msgpack_unpack_next(&result, data, bytes, &off)) {
-        alloc_size = (off - last_off) + 128; /* JSON is larger than msgpack */
-        last_off = off;
-
         flb_time_pop_from_msgpack(&tm, &result, &obj);
 
         switch (ctx->format){
         case FLB_OUT_FILE_FMT_JSON:
-            buf = flb_msgpack_to_json_str(alloc_size, obj);
-            if (buf) {
-                fprintf(fp, "%s: [%f, %s]\n",
-                        tag,
-                        flb_time_to_double(&tm),
-                        buf);
-                flb_free(buf);
+            sds = flb_sds_cat(json, tag, tag_len);
+            if (!sds) {
+                goto error;
+            }
+            json = sds;
+
+            len = snprintf(tmp, sizeof(tmp) - 1, ": [%f, ",
+                           flb_time_to_double(&tm));
+            sds = flb_sds_cat(json, tmp, len);
+            if (!sds) {
+                goto error;
+            }
+            json = sds;
+
+            ret = flb_msgpack_to_json_sds(&json, obj);
+            if (ret == -1) {
+                goto error;
             }
-            else {
-                msgpack_unpacked_destroy(&result);
-                fclose(fp);
-                FLB_OUTPUT_RETURN(FLB_RETRY);
+
+            sds = flb_sds_cat(json, "]\n", 2);
+            if (!sds) {
+                goto error;
             }
+            json = sds;
             break;
         case FLB_OUT_FILE_FMT_CSV:
             csv_output(fp, &tm, obj, ctx);
@@ -236,10 +255,21 @@ static void cb_file_flush(void *data, size_t bytes,
             break;
         }
     }
+
+    if (json) {
+        fwrite(json, flb_sds_len(json), 1, fp);
+        flb_sds_destroy(json);
+    }
     msgpack_unpacked_destroy(&result);
     fclose(fp);
 
     FLB_OUTPUT_RETURN(FLB_OK);
+
+ error:
+    msgpack_unpacked_destroy(&result);
+    flb_sds_destroy(json);
+    fclose(fp);
+    FLB_OUTPUT_RETURN(FLB_RETRY);
 }
 
 static int cb_file_exit(void *data, struct flb_config *config)
@@ -22,6 +22,10 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_network.h>
 #include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_mp.h>
+#include <fluent-bit/flb_gzip.h>
+#include <fluent-bit/flb_upstream_group.h>
 #include <msgpack.h>
 
 #include "forward.h"
@@ -367,14 +371,97 @@ static int secure_forward_init(struct flb_out_forward_config *ctx)
 }
 #endif
 
+/* Create the upstream of a node and add it to the group */
+static int forward_node_add(struct flb_out_forward_config *ctx,
+                            struct flb_config *config,
+                            struct flb_output_instance *ins, int io_flags,
+                            char *host, int port, int weight, int backup)
+{
+    struct flb_upstream *u;
+    struct flb_upstream_node *node;
+
+    u = flb_upstream_create(config, host, port, io_flags, (void *) &ins->tls);
+    if (!u) {
+        return -1;
+    }
+    flb_output_upstream_set(u, ins);
+
+    node = flb_upstream_group_add(ctx->group, u, weight, backup);
+    if (!node) {
+        flb_upstream_destroy(u);
+        return -1;
+    }
+
+    flb_debug("[out_fw] upstream node %s:%i weight=%i%s",
+              host, port, node->weight, backup ? " (backup)" : "");
+    return 0;
+}
+
+/* Parse a node definition: 'host:port[:weight]', IPv6 hosts use brackets */
+static int forward_node_parse(struct flb_out_forward_config *ctx,
+                              struct flb_config *config,
+                              struct flb_output_instance *ins, int io_flags,
+                              char *str)
+{
+    int ret;
+    int port;
+    int weight = 1;
+    char *p;
+    char *end;
+    char *host;
+
+    host = flb_strdup(str);
+    if (!host) {
+        return -1;
+    }
+
+    p = host;
+    if (*p == '[') {
+        end = strchr(p, ']');
+        if (!end || end[1] != ':') {
+            flb_free(host);
+            return -1;
+        }
+        *end = '\0';
+        p = end + 1;
+    }
+    else {
+        p = strchr(p, ':');
+        if (!p) {
+            flb_free(host);
+            return -1;
+        }
+        *p = '\0';
+    }
+
+    port = strtol(p + 1, &end, 10);
+    if (*end == ':') {
+        weight = strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' || port <= 0 || port > 65535 || weight <= 0) {
+        flb_free(host);
+        return -1;
+    }
+
+    ret = forward_node_add(ctx, config, ins, io_flags,
+                           (host[0] == '[') ? host + 1 : host, port,
+                           weight, FLB_FALSE);
+    flb_free(host);
+    return ret;
+}
+
 int cb_forward_init(struct flb_output_instance *ins, struct flb_config *config,
                     void *data)
 {
+    int ret;
+    int weight;
     int io_flags;
+    int balance;
     char *tmp;
+    struct mk_list *list;
+    struct mk_list *head;
+    struct flb_split_entry *entry;
     struct flb_out_forward_config *ctx;
-    struct flb_upstream *upstream;
-	struct flb_upstream *upstreamStandby;
     (void) data;
 
     ctx = flb_calloc(1, sizeof(struct flb_out_forward_config));
@@ -410,28 +497,70 @@ int cb_forward_init(struct flb_output_instance *ins, struct flb_config *config,
         io_flags |= FLB_IO_IPV6;
     }
 
-    /* Prepare an upstream handler */
-    upstream = flb_upstream_create(config,
-                                   ins->host.name,
-                                   ins->host.port,
-                                   io_flags, (void *) &ins->tls);
-    if (!upstream) {
+    /* Balancing mode of the upstream nodes */
+    balance = FLB_UPSTREAM_GROUP_RR;
+    tmp = flb_output_get_property("balance", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "least_outstanding") == 0) {
+            balance = FLB_UPSTREAM_GROUP_LEAST;
+        }
+        else if (strcasecmp(tmp, "round_robin") != 0) {
+            flb_error("[out_fw] invalid balance '%s'", tmp);
+            flb_free(ctx);
+            return -1;
+        }
+    }
+
+    ctx->group = flb_upstream_group_create(balance);
+    if (!ctx->group) {
         flb_free(ctx);
         return -1;
     }
-    ctx->u = upstream;
 
-	/*create backup upstream handler*/
+    /* Main node */
+    weight = 1;
+    tmp = flb_output_get_property("weight", ins);
+    if (tmp) {
+        weight = atoi(tmp);
+    }
+    ret = forward_node_add(ctx, config, ins, io_flags,
+                           ins->host.name, ins->host.port, weight, FLB_FALSE);
+    if (ret == -1) {
+        goto error;
+    }
 
-	upstreamStandby = flb_upstream_create(config,
-										  ins->host_standby.name,
-										  ins->host_standby.port,
-										  io_flags, (void *)&ins->tls);
-	if (!upstreamStandby) {
-		flb_free(ctx);
-		return -1;
-	}
-	ctx->u_standby = upstreamStandby;
+    /* Extra nodes: 'host:port[:weight] ...' */
+    tmp = flb_output_get_property("upstream_nodes", ins);
+    if (tmp) {
+        list = flb_utils_split(tmp, ' ', -1);
+        if (!list) {
+            goto error;
+        }
+        mk_list_foreach(head, list) {
+            entry = mk_list_entry(head, struct flb_split_entry, _head);
+            ret = forward_node_parse(ctx, config, ins, io_flags,
+                                     entry->value);
+            if (ret == -1) {
+                flb_error("[out_fw] invalid upstream node '%s'", entry->value);
+                flb_utils_split_free(list);
+                goto error;
+            }
+        }
+        flb_utils_split_free(list);
+    }
+
+    /* The standby host only receives data if the other nodes are down */
+    if (ins->host_standby.name) {
+        if (ins->host_standby.port == 0) {
+            ins->host_standby.port = 24224;
+        }
+        ret = forward_node_add(ctx, config, ins, io_flags,
+                               ins->host_standby.name, ins->host_standby.port,
+                               1, FLB_TRUE);
+        if (ret == -1) {
+            goto error;
+        }
+    }
 
     if (ctx->secured == FLB_TRUE) {
         /* Shared Key */
@@ -449,6 +578,36 @@ int cb_forward_init(struct flb_output_instance *ins, struct flb_config *config,
         }
     }
 
+    /* Message mode: records as an array or as a single binary blob */
+    ctx->mode = FW_MODE_PACKED;
+    tmp = flb_output_get_property("forward_mode", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "forward") == 0) {
+            ctx->mode = FW_MODE_FORWARD;
+        }
+        else if (strcasecmp(tmp, "packed") != 0) {
+            flb_error("[out_fw] invalid forward_mode '%s'", tmp);
+            goto error;
+        }
+    }
+
+    /* CompressedPackedForward */
+    ctx->compress = FW_COMPRESS_NONE;
+    tmp = flb_output_get_property("compress", ins);
+    if (tmp) {
+        if (strcasecmp(tmp, "gzip") == 0) {
+            ctx->compress = FW_COMPRESS_GZIP;
+        }
+        else if (strcasecmp(tmp, "none") != 0) {
+            flb_error("[out_fw] invalid compress '%s'", tmp);
+            goto error;
+        }
+    }
+    if (ctx->compress != FW_COMPRESS_NONE && ctx->mode != FW_MODE_PACKED) {
+        flb_error("[out_fw] compression requires forward_mode packed");
+        goto error;
+    }
+
     /* Backward compatible timing mode */
     ctx->time_as_integer = FLB_FALSE;
     tmp = flb_output_get_property("time_as_integer", ins);
@@ -468,62 +627,72 @@ int cb_forward_init(struct flb_output_instance *ins, struct flb_config *config,
 #endif
 
     return 0;
+
+ error:
+    flb_upstream_group_destroy(ctx->group);
+    flb_free(ctx);
+    return -1;
 }
 
-static int data_compose(void *data, size_t bytes,
-                        void **out_buf, size_t *out_size,
-                        struct flb_out_forward_config *ctx)
+/*
+ * Compose a new outgoing buffer where the records use an integer timestamp,
+ * this is the backward compatible mode for servers with the old timestamp
+ * format (e.g: Fluentd <= v0.12). It returns the number of records.
+ */
+static int data_compose_compat(void *data, size_t bytes,
+                               void **out_buf, size_t *out_size)
 {
+    int ret;
     int entries = 0;
     size_t off = 0;
+    size_t prev = 0;
+    size_t t_off;
     msgpack_object   *mp_obj;
     msgpack_packer   mp_pck;
     msgpack_sbuffer  mp_sbuf;
     msgpack_unpacked result;
+    msgpack_unpacked tm_result;
     struct flb_time tm;
 
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
 
-    /*
-     * time_as_integer means we are using backward compatible mode for
-     * servers with old timestamp mode in uint64_t (e.g: Fluentd <= v0.12).
-     */
     msgpack_unpacked_init(&result);
-    if (ctx->time_as_integer == FLB_TRUE) {
-        /*
-         * if the case, we need to compose a new outgoing buffer instead
-         * of use the original one.
-         */
-        msgpack_sbuffer_init(&mp_sbuf);
-        msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    msgpack_unpacked_init(&tm_result);
+    while (msgpack_unpack_next(&result, data, bytes, &off) ==
+           MSGPACK_UNPACK_SUCCESS) {
+        /* Gather time */
+        flb_time_pop_from_msgpack(&tm, &result, &mp_obj);
 
-        while (msgpack_unpack_next(&result, data, bytes, &off)) {
-            /* Gather time */
-            flb_time_pop_from_msgpack(&tm, &result, &mp_obj);
+        msgpack_pack_array(&mp_pck, 2);
+        msgpack_pack_uint64(&mp_pck, tm.tm.tv_sec);
 
-            /* Append data */
-            msgpack_pack_array(&mp_pck, 2);
-            msgpack_pack_uint64(&mp_pck, tm.tm.tv_sec);
-            msgpack_pack_object(&mp_pck, *mp_obj);
-            entries++;
+        /*
+         * Records are a fixarray [time, map]: skip the timestamp and copy
+         * the map as it is instead of packing the object again.
+         */
+        ret = MSGPACK_UNPACK_PARSE_ERROR;
+        if (*((unsigned char *) data + prev) == 0x92) {
+            t_off = prev + 1;
+            ret = msgpack_unpack_next(&tm_result, data, off, &t_off);
         }
-    }
-    else {
-        while (msgpack_unpack_next(&result, data, bytes, &off)) {
-            entries++;
+        if (ret == MSGPACK_UNPACK_SUCCESS) {
+            msgpack_sbuffer_write(&mp_sbuf, (char *) data + t_off,
+                                  off - t_off);
+        }
+        else {
+            msgpack_pack_object(&mp_pck, *mp_obj);
         }
-    }
 
-    /* cleanup */
-    if (ctx->time_as_integer == FLB_TRUE) {
-        *out_buf  = mp_sbuf.data;
-        *out_size = mp_sbuf.size;
-    }
-    else {
-        *out_buf  = NULL;
-        *out_size = 0;
+        prev = off;
+        entries++;
     }
+    msgpack_unpacked_destroy(&tm_result);
     msgpack_unpacked_destroy(&result);
 
+    *out_buf  = mp_sbuf.data;
+    *out_size = mp_sbuf.size;
+
     return entries;
 }
 
@@ -544,141 +713,201 @@ int cb_forward_exit(void *data, struct flb_config *config)
         flb_free(ctx->self_hostname);
     }
 
-    flb_upstream_destroy(ctx->u);
+    flb_upstream_group_destroy(ctx->group);
     flb_free(ctx);
 
     return 0;
 }
 
+/* Write a message through a new connection of the upstream */
+static int forward_send(struct flb_out_forward_config *ctx,
+                        struct flb_upstream *u,
+                        struct iovec *iov, int iovcnt, size_t *bytes_sent)
+{
+    int ret;
+    struct flb_upstream_conn *u_conn;
+
+    u_conn = flb_upstream_conn_get(u);
+    if (!u_conn) {
+        flb_debug("[out_fw] %s:%i connection failed", u->tcp_host, u->tcp_port);
+        return -1;
+    }
+
+    /*
+     * Secure Forward ? The server sends HELO once per connection, a
+     * re-used keepalive connection is already authenticated.
+     */
+#ifdef FLB_HAVE_TLS
+    if (ctx->secured == FLB_TRUE && u_conn->ka_count == 0) {
+        ret = secure_forward_handshake(u_conn, ctx);
+        flb_debug("[out_fw] handshake status = %i", ret);
+        if (ret == -1) {
+            u_conn->recycle = FLB_FALSE;
+            flb_upstream_conn_release(u_conn);
+            return -1;
+        }
+    }
+#endif
+
+    /* Write the message with a single call */
+    ret = flb_io_net_writev(u_conn, iov, iovcnt, bytes_sent);
+    if (ret == -1) {
+        /* The stream state is unknown, do not hand it to the next flush */
+        u_conn->recycle = FLB_FALSE;
+    }
+    flb_upstream_conn_release(u_conn);
+    if (ret == -1) {
+        flb_error("[out_fw] %s:%i could not write chunk",
+                  u->tcp_host, u->tcp_port);
+        return -1;
+    }
+
+    return 0;
+}
+
 void cb_forward_flush(void *data, size_t bytes,
                       char *tag, int tag_len,
                       struct flb_input_instance *i_ins, void *out_context,
                       struct flb_config *config)
 {
     int ret = -1;
-    int entries = 0;
+    int entries;
+    int iovcnt;
+    int options;
+    int attempts;
     size_t total;
-    size_t bytes_sent;
+    size_t header_size;
+    size_t gz_size;
+    size_t bytes_sent = 0;
     msgpack_packer   mp_pck;
     msgpack_sbuffer  mp_sbuf;
-    void *out_buf = NULL;
-    size_t out_size = 0;
+    void *gz_buf;
+    void *out_buf = data;
+    size_t out_size = bytes;
+    struct iovec iov[3];
     struct flb_out_forward_config *ctx = out_context;
-    struct flb_upstream_conn *u_conn;
-	static int flag = 0;
+    struct flb_upstream_node *node = NULL;
     (void) i_ins;
     (void) config;
 
     flb_debug("[out_forward] request %lu bytes to flush", bytes);
 
-    /* Initialize packager */
-    msgpack_sbuffer_init(&mp_sbuf);
-    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    /* The input already counted the records */
+    entries = flb_output_flush_records();
 
-    /* Count number of entries, is there a better way to do this ? */
-    entries = data_compose(data, bytes, &out_buf, &out_size, ctx);
-    if (out_buf == NULL && ctx->time_as_integer == FLB_FALSE) {
-        out_buf = data;
-        out_size = bytes;
+    if (ctx->time_as_integer == FLB_TRUE) {
+        entries = data_compose_compat(data, bytes, &out_buf, &out_size);
+    }
+    else if (entries < 0 && ctx->mode == FW_MODE_FORWARD) {
+        entries = flb_mp_count(data, bytes);
     }
 
     flb_debug("[out_fw] %i entries tag='%s' tag_len=%i",
               entries, tag, tag_len);
 
-    /* Output: root array */
-    msgpack_pack_array(&mp_pck, 2);
-    msgpack_pack_str(&mp_pck, tag_len);
-    msgpack_pack_str_body(&mp_pck, tag, tag_len);
-    msgpack_pack_array(&mp_pck, entries);
-
-    /* Get a TCP connection instance */
-	if (flag == 0) {
-
-		u_conn = flb_upstream_conn_get(ctx->u);
-		if (!u_conn) {
-			flb_debug("[out_fw] %s:%d TCP fail,try hoststandby", ctx->u->tcp_host, ctx->u->tcp_port);
-
-			/*TCP standby*/
-			u_conn = flb_upstream_conn_get(ctx->u_standby);
-			flag = 1;
-			if (!u_conn) {
-				flb_error("[out_fw] no upstream connections available");
-				msgpack_sbuffer_destroy(&mp_sbuf);
-				if (ctx->time_as_integer == FLB_TRUE) {
-					flb_free(out_buf);
-				}
-				FLB_OUTPUT_RETURN(FLB_RETRY);
-			}
-		}
-	}
-	else
-	{
-		u_conn = flb_upstream_conn_get(ctx->u_standby);
-		if (!u_conn) {
-			flb_debug("[out_fw] %s:%d TCP fail,try mainhost", ctx->u_standby->tcp_host, ctx->u_standby->tcp_port);
-			/*TCP standby*/
-			u_conn = flb_upstream_conn_get(ctx->u);
-			flag = 0;
-			if (!u_conn) {
-				flb_error("[out_fw] no upstream connections available");
-				msgpack_sbuffer_destroy(&mp_sbuf);
-				if (ctx->time_as_integer == FLB_TRUE) {
-					flb_free(out_buf);
-				}
-				FLB_OUTPUT_RETURN(FLB_RETRY);
-			}
-		}
-	}
-    /* Secure Forward ? */
-#ifdef FLB_HAVE_TLS
-    if (ctx->secured == FLB_TRUE) {
-        ret = secure_forward_handshake(u_conn, ctx);
-        flb_debug("[out_fw] handshake status = %i", ret);
+    /* CompressedPackedForward: the entries are a GZip stream */
+    if (ctx->compress == FW_COMPRESS_GZIP) {
+        ret = flb_gzip_compress(out_buf, out_size, &gz_buf, &gz_size);
+        if (out_buf != data) {
+            flb_free(out_buf);
+        }
         if (ret == -1) {
-            flb_upstream_conn_release(u_conn);
-            msgpack_sbuffer_destroy(&mp_sbuf);
-            if (ctx->time_as_integer == FLB_TRUE) {
-                flb_free(out_buf);
-            }
+            flb_error("[out_fw] could not compress chunk");
             FLB_OUTPUT_RETURN(FLB_RETRY);
         }
+        out_buf  = gz_buf;
+        out_size = gz_size;
     }
-#endif
 
-    /* Write message header */
-    ret = flb_io_net_write(u_conn, mp_sbuf.data, mp_sbuf.size, &bytes_sent);
-    if (ret == -1) {
-        flb_error("[out_fw] could not write chunk header");
-        msgpack_sbuffer_destroy(&mp_sbuf);
-        flb_upstream_conn_release(u_conn);
-        if (ctx->time_as_integer == FLB_TRUE) {
-            flb_free(out_buf);
+    /* Initialize packager */
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+
+    if (ctx->mode == FW_MODE_PACKED) {
+        /*
+         * PackedForward: [tag, entries, option], the records are sent as
+         * they are in a single binary entry.
+         */
+        options = 0;
+        if (entries >= 0) {
+            options++;
+        }
+        if (ctx->compress == FW_COMPRESS_GZIP) {
+            options++;
         }
-        FLB_OUTPUT_RETURN(FLB_RETRY);
-    }
 
-    msgpack_sbuffer_destroy(&mp_sbuf);
-    total = ret;
+        msgpack_pack_array(&mp_pck, options > 0 ? 3 : 2);
+        msgpack_pack_str(&mp_pck, tag_len);
+        msgpack_pack_str_body(&mp_pck, tag, tag_len);
+        msgpack_pack_bin(&mp_pck, out_size);
+        header_size = mp_sbuf.size;
 
-    /* Write body (records) */
-    ret = flb_io_net_write(u_conn, out_buf, out_size, &bytes_sent);
-    if (ret == -1) {
-        flb_error("[out_fw] error writing content body");
-        if (ctx->time_as_integer == FLB_TRUE) {
-            flb_free(out_buf);
+        if (options > 0) {
+            msgpack_pack_map(&mp_pck, options);
         }
-        flb_upstream_conn_release(u_conn);
-        FLB_OUTPUT_RETURN(FLB_RETRY);
+        if (entries >= 0) {
+            msgpack_pack_str(&mp_pck, 4);
+            msgpack_pack_str_body(&mp_pck, "size", 4);
+            msgpack_pack_int(&mp_pck, entries);
+        }
+        if (ctx->compress == FW_COMPRESS_GZIP) {
+            msgpack_pack_str(&mp_pck, 10);
+            msgpack_pack_str_body(&mp_pck, "compressed", 10);
+            msgpack_pack_str(&mp_pck, 4);
+            msgpack_pack_str_body(&mp_pck, "gzip", 4);
+        }
+    }
+    else {
+        /* Forward: [tag, [[time, record], ...]] */
+        msgpack_pack_array(&mp_pck, 2);
+        msgpack_pack_str(&mp_pck, tag_len);
+        msgpack_pack_str_body(&mp_pck, tag, tag_len);
+        msgpack_pack_array(&mp_pck, entries);
+        header_size = mp_sbuf.size;
     }
 
-    total += bytes_sent;
-    flb_upstream_conn_release(u_conn);
+    /*
+     * Send the message through the selected node, if it fails the node
+     * is taken out of the selection and the next one is tried.
+     */
+    total = mp_sbuf.size + out_size;
+    for (attempts = 0; attempts < ctx->group->n_nodes; attempts++) {
+        node = flb_upstream_group_next(ctx->group, total);
+        if (!node) {
+            break;
+        }
 
-    if (ctx->time_as_integer == FLB_TRUE) {
+        /*
+         * Header, records and option (if any). A partial write advances
+         * the vector in place, so it's set up again on every attempt.
+         */
+        iov[0].iov_base = mp_sbuf.data;
+        iov[0].iov_len  = header_size;
+        iov[1].iov_base = out_buf;
+        iov[1].iov_len  = out_size;
+        iov[2].iov_base = mp_sbuf.data + header_size;
+        iov[2].iov_len  = mp_sbuf.size - header_size;
+        iovcnt = (iov[2].iov_len > 0) ? 3 : 2;
+
+        ret = forward_send(ctx, node->u, iov, iovcnt, &bytes_sent);
+        flb_upstream_group_done(ctx->group, node, total,
+                                ret == 0 ? FLB_TRUE : FLB_FALSE);
+        if (ret == 0) {
+            break;
+        }
+    }
+
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    if (out_buf != data) {
         flb_free(out_buf);
     }
 
-    flb_trace("[out_fw] ended write()=%d bytes", total);
+    if (!node || ret == -1) {
+        flb_error("[out_fw] no upstream node available");
+        FLB_OUTPUT_RETURN(FLB_RETRY);
+    }
+
+    flb_trace("[out_fw] ended write()=%lu bytes", bytes_sent);
     FLB_OUTPUT_RETURN(FLB_OK);
 }
 
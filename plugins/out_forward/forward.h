@@ -28,9 +28,19 @@
 #include <mbedtls/ctr_drbg.h>
 #endif
 
+/* Message modes */
+#define FW_MODE_FORWARD   0   /* [tag, [[time, record], ...]]            */
+#define FW_MODE_PACKED    1   /* [tag, bin(entries), {"size": records}]  */
+
+/* Compression of PackedForward entries */
+#define FW_COMPRESS_NONE  0
+#define FW_COMPRESS_GZIP  1
+
 struct flb_out_forward_config {
     int secured;              /* Using Secure Forward mode ?  */
     int time_as_integer;      /* Use backward compatible timestamp ? */
+    int mode;                 /* Forward or PackedForward     */
+    int compress;             /* Compress the entries ?       */
 
     /* config */
     int shared_key_len;       /* shared key length            */
@@ -45,9 +55,8 @@ struct flb_out_forward_config {
     mbedtls_ctr_drbg_context tls_ctr_drbg;
 #endif
 
-    /* Upstream handler */
-    struct flb_upstream *u;
-	struct flb_upstream *u_standby;
+    /* Upstream nodes */
+    struct flb_upstream_group *group;
 };
 
 #endif
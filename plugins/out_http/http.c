@@ -247,6 +247,7 @@ int cb_http_init(struct flb_output_instance *ins, struct flb_config *config,
         flb_free(ctx);
         return -1;
     }
+    flb_output_upstream_set(upstream, ins);
 
     if (ins->host.uri) {
         uri = flb_strdup(ins->host.uri->full);
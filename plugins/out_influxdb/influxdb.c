@@ -406,6 +406,7 @@ int cb_influxdb_init(struct flb_output_instance *ins, struct flb_config *config,
         flb_free(ctx);
         return -1;
     }
+    flb_output_upstream_set(upstream, ins);
     ctx->u   = upstream;
     ctx->seq = 0;
 
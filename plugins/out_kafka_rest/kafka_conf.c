@@ -74,6 +74,7 @@ struct flb_kafka_rest *flb_kafka_conf_create(struct flb_output_instance *ins,
         flb_kafka_conf_destroy(ctx);
         return NULL;
     }
+    flb_output_upstream_set(upstream, ins);
     ctx->u = upstream;
 
     /* HTTP Auth */
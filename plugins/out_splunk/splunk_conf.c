@@ -68,6 +68,8 @@ struct flb_splunk *flb_splunk_conf_create(struct flb_output_instance *ins,
         return NULL;
     }
 
+    flb_output_upstream_set(upstream, ins);
+
     /* Set manual Index and Type */
     ctx->u = upstream;
 
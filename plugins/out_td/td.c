@@ -165,6 +165,7 @@ int cb_td_init(struct flb_output_instance *ins, struct flb_config *config,
         flb_free(ctx);
         return -1;
     }
+    flb_output_upstream_set(upstream, ins);
     ctx->u = upstream;
 
     flb_output_set_context(ins, ctx);
@@ -0,0 +1,202 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_bufpool.h>
+
+/* Return the class serving 'size', or NULL if it's bigger than all of them */
+static inline struct flb_bufpool_class *pool_class(struct flb_bufpool *pool,
+                                                   size_t size)
+{
+    int i;
+
+    for (i = 0; i < pool->classes; i++) {
+        if (size <= pool->class[i].size) {
+            return &pool->class[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Create a buffer pool. Size classes go from 'min_size' doubling up to the
+ * first one holding 'max_size', bigger requests are served by the allocator
+ * directly. If 'limit' is set, the pool refuses to hand out more than
+ * 'limit' bytes at the same time.
+ */
+struct flb_bufpool *flb_bufpool_create(size_t min_size, size_t max_size,
+                                       size_t limit)
+{
+    size_t size;
+    struct flb_bufpool *pool;
+
+    if (min_size < sizeof(void *)) {
+        min_size = sizeof(void *);
+    }
+
+    pool = flb_calloc(1, sizeof(struct flb_bufpool));
+    if (!pool) {
+        flb_errno();
+        return NULL;
+    }
+
+    pool->min_size = min_size;
+    pool->limit = limit;
+    pool->cache_limit = FLB_BUFPOOL_CACHE_SIZE;
+    if (limit > 0 && limit < pool->cache_limit) {
+        pool->cache_limit = limit;
+    }
+
+    size = min_size;
+    while (pool->classes < FLB_BUFPOOL_CLASSES) {
+        pool->class[pool->classes].size = size;
+        pool->classes++;
+        if (size >= max_size) {
+            break;
+        }
+        size <<= 1;
+    }
+
+    return pool;
+}
+
+void flb_bufpool_destroy(struct flb_bufpool *pool)
+{
+    int i;
+    void *buf;
+    struct flb_bufpool_class *c;
+
+    if (!pool) {
+        return;
+    }
+
+    if (pool->in_use > 0) {
+        flb_debug("[bufpool] destroying pool with %lu bytes in use",
+                  pool->in_use);
+    }
+
+    for (i = 0; i < pool->classes; i++) {
+        c = &pool->class[i];
+        while (c->free) {
+            buf = c->free;
+            c->free = *(void **) buf;
+            flb_free(buf);
+        }
+    }
+    flb_free(pool);
+}
+
+/* Number of bytes really available in a buffer requested with 'size' */
+size_t flb_bufpool_size(struct flb_bufpool *pool, size_t size)
+{
+    struct flb_bufpool_class *c;
+
+    c = pool_class(pool, size);
+    if (!c) {
+        return size;
+    }
+    return c->size;
+}
+
+void *flb_bufpool_get(struct flb_bufpool *pool, size_t size)
+{
+    size_t real;
+    void *buf;
+    struct flb_bufpool_class *c;
+
+    c = pool_class(pool, size);
+    real = c ? c->size : size;
+
+    if (pool->limit > 0 && pool->in_use + real > pool->limit) {
+        flb_debug("[bufpool] limit reached (%lu bytes in use)", pool->in_use);
+        return NULL;
+    }
+
+    if (c && c->free) {
+        buf = c->free;
+        c->free = *(void **) buf;
+        c->count--;
+        pool->cached -= real;
+    }
+    else {
+        buf = flb_malloc(real);
+        if (!buf) {
+            flb_errno();
+            return NULL;
+        }
+    }
+
+    pool->in_use += real;
+    return buf;
+}
+
+/*
+ * Move 'buf' to a buffer able to hold 'new_size' bytes, keeping its content.
+ * If the class already covers 'new_size' the same buffer is returned. On
+ * failure the original buffer is untouched and still owned by the caller.
+ */
+void *flb_bufpool_realloc(struct flb_bufpool *pool, void *buf,
+                          size_t size, size_t new_size)
+{
+    void *tmp;
+
+    if (flb_bufpool_size(pool, size) == flb_bufpool_size(pool, new_size)) {
+        return buf;
+    }
+
+    tmp = flb_bufpool_get(pool, new_size);
+    if (!tmp) {
+        return NULL;
+    }
+
+    memcpy(tmp, buf, size < new_size ? size : new_size);
+    flb_bufpool_put(pool, buf, size);
+
+    return tmp;
+}
+
+/* Give back a buffer, 'size' is the size it was requested with */
+void flb_bufpool_put(struct flb_bufpool *pool, void *buf, size_t size)
+{
+    size_t real;
+    struct flb_bufpool_class *c;
+
+    if (!buf) {
+        return;
+    }
+
+    c = pool_class(pool, size);
+    real = c ? c->size : size;
+    pool->in_use -= real;
+
+    if (!c || pool->cached + real > pool->cache_limit) {
+        flb_free(buf);
+        return;
+    }
+
+    *(void **) buf = c->free;
+    c->free = buf;
+    c->count++;
+    pool->cached += real;
+}
@@ -34,6 +34,8 @@
 #include <fluent-bit/flb_io_tls.h>
 #include <fluent-bit/flb_kernel.h>
 #include <fluent-bit/flb_worker.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_engine_bus.h>
 #include <fluent-bit/flb_scheduler.h>
 #include <fluent-bit/flb_http_server.h>
 #include <fluent-bit/flb_plugin_proxy.h>
@@ -61,6 +63,10 @@ struct flb_service_config service_configs[] = {
      FLB_CONF_TYPE_STR,
      offsetof(struct flb_config, plugins_file)},
 
+    {FLB_CONF_STR_WORKERS,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, engine_workers)},
+
     {FLB_CONF_STR_LOGLEVEL,
      FLB_CONF_TYPE_STR,
      offsetof(struct flb_config, log)},
@@ -140,9 +146,11 @@ struct flb_config *flb_config_init()
     mk_list_init(&config->inputs);
     mk_list_init(&config->parsers);
     mk_list_init(&config->filters);
+    config->route_cache = NULL;
     mk_list_init(&config->outputs);
     mk_list_init(&config->proxies);
     mk_list_init(&config->workers);
+    mk_list_init(&config->engine_workers_list);
 
     memset(&config->tasks_map, '\0', sizeof(config->tasks_map));
 
@@ -160,6 +168,7 @@ struct flb_config *flb_config_init()
 
     /* Prepare worker interface */
     flb_worker_init(config);
+    flb_engine_evl_init();
 
 #ifdef FLB_HAVE_REGEX
     /* Regex support */
@@ -215,6 +224,11 @@ void flb_config_exit(struct flb_config *config)
         }
     }
 
+    /* Completions bus */
+    if (config->ch_bus) {
+        flb_engine_bus_destroy(config->ch_bus);
+    }
+
     /* Channel notifications */
     if (config->ch_notif[0] > 0) {
         close(config->ch_notif[0]);
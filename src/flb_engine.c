@@ -42,6 +42,8 @@
 #include <fluent-bit/flb_parser.h>
 #include <fluent-bit/flb_sosreport.h>
 #include <fluent-bit/flb_http_server.h>
+#include <fluent-bit/flb_engine_bus.h>
+#include <fluent-bit/flb_engine_worker.h>
 
 #ifdef FLB_HAVE_METRICS
 #include <fluent-bit/flb_metrics_exporter.h>
@@ -55,6 +57,23 @@
 #include <fluent-bit/flb_stats.h>
 #endif
 
+FLB_TLS_DEFINE(struct mk_event_loop, flb_engine_evl);
+
+void flb_engine_evl_init()
+{
+    FLB_TLS_INIT(flb_engine_evl);
+}
+
+struct mk_event_loop *flb_engine_evl_get()
+{
+    return FLB_TLS_GET(flb_engine_evl);
+}
+
+void flb_engine_evl_set(struct mk_event_loop *evl)
+{
+    FLB_TLS_SET(flb_engine_evl, evl);
+}
+
 int flb_engine_destroy_tasks(struct mk_list *tasks)
 {
     int c = 0;
@@ -91,18 +110,116 @@ int flb_engine_flush(struct flb_config *config,
     return 0;
 }
 
+/*
+ * An output thread of a task has finished: release it and depending on the
+ * return value create a retry or destroy the task once it has no users.
+ */
+static int engine_task_done(struct flb_task *task, int thread_id, int ret,
+                            struct flb_config *config)
+{
+    int retry_seconds;
+    struct flb_output_thread *out_th;
+
+    out_th = flb_output_thread_get(thread_id, task);
+
+    /* A thread has finished, delete it */
+    if (ret == FLB_OK) {
+#ifdef FLB_HAVE_BUFFERING
+        if (config->buffer_path) {
+            flb_buffer_chunk_pop(config->buffer_ctx, thread_id, task);
+        }
+#endif
+        flb_task_retry_clean(task, out_th->parent);
+        flb_output_thread_destroy_id(thread_id, task);
+        if (task->users == 0 && mk_list_size(&task->retries) == 0) {
+            flb_task_destroy(task);
+        }
+    }
+    else if (ret == FLB_RETRY) {
+        /* Create a Task-Retry */
+        struct flb_task_retry *retry;
+
+        retry = flb_task_retry_create(task, out_th);
+        if (!retry) {
+            /*
+             * It can fail in two situations:
+             *
+             * - No enough memory (unlikely)
+             * - It reached the maximum number of re-tries
+             */
+#ifdef FLB_HAVE_BUFFERING
+            if (config->buffer_path) {
+                flb_buffer_chunk_pop(config->buffer_ctx, thread_id, task);
+            }
+#endif
+
+#ifdef FLB_HAVE_METRICS
+            flb_metrics_sum(FLB_METRIC_OUT_RETRY_FAILED, 1,
+                            out_th->o_ins->metrics);
+#endif
+            /* Notify about this failed retry */
+            flb_warn("[engine] Task cannot be retried: "
+                     "task_id=%i thread_id=%i output=%s",
+                     task->id, out_th->id, out_th->o_ins->name);
+
+            flb_output_thread_destroy_id(thread_id, task);
+            if (task->users == 0 && mk_list_size(&task->retries) == 0) {
+                flb_task_destroy(task);
+            }
+
+            return 0;
+        }
+
+#ifdef FLB_HAVE_METRICS
+        flb_metrics_sum(FLB_METRIC_OUT_RETRY, 1, out_th->o_ins->metrics);
+#endif
+
+        /* Always destroy the old thread */
+        flb_output_thread_destroy_id(thread_id, task);
+
+        /* Let the scheduler to retry the failed task/thread */
+        retry_seconds = flb_sched_request_create(config,
+                                                 retry, retry->attemps);
+
+        /*
+         * If for some reason the Scheduler could not include this retry,
+         * we need to get rid of it, likely this is because of not enough
+         * memory available or we ran out of file descriptors.
+         */
+        if (retry_seconds == -1) {
+            flb_warn("[sched] retry for task %i could not be scheduled",
+                     task->id);
+            flb_task_retry_destroy(retry);
+            if (task->users == 0 && mk_list_size(&task->retries) == 0) {
+                flb_task_destroy(task);
+            }
+        }
+        else {
+            flb_debug("[sched] retry=%p %i in %i seconds",
+                      retry, task->id, retry_seconds);
+#ifdef FLB_HAVE_METRICS
+            flb_metrics_observe(FLB_METRIC_OUT_RETRY_DELAY,
+                                (uint64_t) retry_seconds * 1000000,
+                                retry->o_ins->metrics);
+#endif
+        }
+    }
+    else if (ret == FLB_ERROR) {
+        flb_output_thread_destroy_id(thread_id, task);
+        if (task->users == 0 && mk_list_size(&task->retries) == 0) {
+            flb_task_destroy(task);
+        }
+    }
+
+    return 0;
+}
+
 static inline int flb_engine_manager(flb_pipefd_t fd, struct flb_config *config)
 {
-    int ret;
     int bytes;
-    int task_id;
-    int thread_id;
-    int retry_seconds;
     uint32_t type;
     uint32_t key;
     uint64_t val;
-    struct flb_task *task;
-    struct flb_output_thread *out_th;
 
     bytes = flb_pipe_r(fd, &val, sizeof(val));
     if (bytes == -1) {
@@ -127,137 +244,98 @@ static inline int flb_engine_manager(flb_pipefd_t fd, struct flb_config *config)
             return FLB_ENGINE_STOP;
         }
     }
-    else if (type == FLB_ENGINE_IN_THREAD) {
-        /* Event coming from an input thread */
-        flb_input_thread_destroy_id(key, config);
+#ifdef FLB_HAVE_BUFFERING
+    else if (type == FLB_ENGINE_BUFFER) {
+        flb_buffer_engine_event(config->buffer_ctx, val);
+        /* CONTINUE:
+         *
+         * - create messages types for buffering interface
+         * - let qchunk ingest data here
+         */
     }
-    else if (type == FLB_ENGINE_TASK) {
+#endif
+
+    return 0;
+}
+
+/* Drain the completions reported by input and output threads */
+static inline int flb_engine_bus_drain(struct flb_config *config)
+{
+    struct flb_task *task;
+    struct flb_engine_bus_event ev;
+
+    flb_engine_bus_consume(config->ch_bus);
+
+    while (flb_engine_bus_pop(config->ch_bus, &ev) == 0) {
+        if (ev.type == FLB_ENGINE_IN_THREAD) {
+            /* Event coming from an input thread */
+            flb_input_thread_destroy_id(ev.id, config);
+            continue;
+        }
+        else if (ev.type != FLB_ENGINE_TASK) {
+            continue;
+        }
+
         /*
          * The notion of ENGINE_TASK is associated to outputs. All thread
          * references below belongs to flb_output_thread's.
          */
-        ret       = FLB_TASK_RET(key);
-        task_id   = FLB_TASK_ID(key);
-        thread_id = FLB_TASK_TH(key);
-
 #ifdef FLB_HAVE_TRACE
         char *trace_st = NULL;
 
-        if (ret == FLB_OK) {
+        if (ev.ret == FLB_OK) {
             trace_st = "OK";
         }
-        else if (ret == FLB_ERROR) {
+        else if (ev.ret == FLB_ERROR) {
             trace_st = "ERROR";
         }
-        else if (ret == FLB_RETRY) {
+        else if (ev.ret == FLB_RETRY) {
             trace_st = "RETRY";
         }
 
-        flb_trace("%s[engine] [task event]%s task_id=%i thread_id=%i return=%s",
+        flb_trace("%s[engine] [task event]%s task_id=%u thread_id=%u return=%s",
                   ANSI_YELLOW, ANSI_RESET,
-                  task_id, thread_id, trace_st);
+                  ev.id, ev.thread_id, trace_st);
 #endif
 
-        task   = config->tasks_map[task_id].task;
-        out_th = flb_output_thread_get(thread_id, task);
-
-        /* A thread has finished, delete it */
-        if (ret == FLB_OK) {
-#ifdef FLB_HAVE_BUFFERING
-            if (config->buffer_path) {
-                flb_buffer_chunk_pop(config->buffer_ctx, thread_id, task);
-            }
-#endif
-            flb_task_retry_clean(task, out_th->parent);
-            flb_output_thread_destroy_id(thread_id, task);
-            if (task->users == 0 && mk_list_size(&task->retries) == 0) {
-                flb_task_destroy(task);
-            }
-        }
-        else if (ret == FLB_RETRY) {
-            /* Create a Task-Retry */
-            struct flb_task_retry *retry;
-
-            retry = flb_task_retry_create(task, out_th);
-            if (!retry) {
-                /*
-                 * It can fail in two situations:
-                 *
-                 * - No enough memory (unlikely)
-                 * - It reached the maximum number of re-tries
-                 */
-#ifdef FLB_HAVE_BUFFERING
-                if (config->buffer_path) {
-                    flb_buffer_chunk_pop(config->buffer_ctx, thread_id, task);
-                }
-#endif
-
-#ifdef FLB_HAVE_METRICS
-                flb_metrics_sum(FLB_METRIC_OUT_RETRY_FAILED, 1,
-                                out_th->o_ins->metrics);
-#endif
-                /* Notify about this failed retry */
-                flb_warn("[engine] Task cannot be retried: "
-                         "task_id=%i thread_id=%i output=%s",
-                         task->id, out_th->id, out_th->o_ins->name);
-
-                flb_output_thread_destroy_id(thread_id, task);
-                if (task->users == 0 && mk_list_size(&task->retries) == 0) {
-                    flb_task_destroy(task);
-                }
-
-                return 0;
-            }
-
-#ifdef FLB_HAVE_METRICS
-            flb_metrics_sum(FLB_METRIC_OUT_RETRY, 1, out_th->o_ins->metrics);
-#endif
-
-            /* Always destroy the old thread */
-            flb_output_thread_destroy_id(thread_id, task);
+        task = config->tasks_map[ev.id].task;
+        engine_task_done(task, ev.thread_id, ev.ret, config);
+    }
 
-            /* Let the scheduler to retry the failed task/thread */
-            retry_seconds = flb_sched_request_create(config,
-                                                     retry, retry->attemps);
+    return 0;
+}
 
-            /*
-             * If for some reason the Scheduler could not include this retry,
-             * we need to get rid of it, likely this is because of not enough
-             * memory available or we ran out of file descriptors.
-             */
-            if (retry_seconds == -1) {
-                flb_warn("[sched] retry for task %i could not be scheduled",
-                         task->id);
-                flb_task_retry_destroy(retry);
-                if (task->users == 0 && mk_list_size(&task->retries) == 0) {
-                    flb_task_destroy(task);
-                }
-            }
-            else {
-                flb_debug("[sched] retry=%p %i in %i seconds",
-                          retry, task->id, retry_seconds);
-            }
-        }
-        else if (ret == FLB_ERROR) {
-            flb_output_thread_destroy_id(thread_id, task);
+#ifdef FLB_HAVE_FLUSH_LIBCO
+/* Process the flush results reported by an engine worker */
+static void engine_worker_done(struct flb_engine_worker *w,
+                               struct flb_config *config)
+{
+    struct flb_task *task;
+    struct flb_output_thread *out_th;
+    struct flb_engine_worker_done done;
+
+    while (flb_engine_worker_done_pop(w, &done) == 0) {
+        task = done.task;
+        if (!done.th) {
+            flb_error("[engine] worker #%i could not flush task_id=%i",
+                      w->id, task->id);
+            task->users--;
             if (task->users == 0 && mk_list_size(&task->retries) == 0) {
                 flb_task_destroy(task);
             }
+            continue;
         }
+
+        /* Link the output thread to its task and handle the result */
+        out_th = (struct flb_output_thread *) FLB_THREAD_DATA(done.th);
+        mk_list_add(&out_th->_head, &task->threads);
+        engine_task_done(task, done.thread_id, done.ret, config);
     }
-#ifdef FLB_HAVE_BUFFERING
-    else if (type == FLB_ENGINE_BUFFER) {
-        flb_buffer_engine_event(config->buffer_ctx, val);
-        /* CONTINUE:
-         *
-         * - create messages types for buffering interface
-         * - let qchunk ingest data here
-         */
-    }
-#endif
 
-    return 0;
+    /* The worker made room in its ring */
+    flb_engine_worker_pending_flush(w);
 }
+#endif
 
 static FLB_INLINE int flb_engine_handle_event(flb_pipefd_t fd, int mask,
                                               struct flb_config *config)
@@ -291,6 +369,20 @@ static FLB_INLINE int flb_engine_handle_event(flb_pipefd_t fd, int mask,
                 return FLB_ENGINE_STOP;
             }
         }
+        else if (config->ch_bus->fd[0] == fd) {
+            return flb_engine_bus_drain(config);
+        }
+#ifdef FLB_HAVE_FLUSH_LIBCO
+        else if (mk_list_is_empty(&config->engine_workers_list) != 0) {
+            struct flb_engine_worker *w;
+
+            w = flb_engine_worker_done_fd(fd, config);
+            if (w) {
+                engine_worker_done(w, config);
+                return 0;
+            }
+        }
+#endif
 
         /* Try to match the file descriptor with a collector event */
         ret = flb_input_collector_fd(fd, config);
@@ -398,6 +490,7 @@ int flb_engine_start(struct flb_config *config)
         return -1;
     }
     config->evl = evl;
+    flb_engine_evl_set(evl);
 
     /*
      * Create a communication channel: this routine creates a channel to
@@ -413,6 +506,13 @@ int flb_engine_start(struct flb_config *config)
         return -1;
     }
 
+    /* Bus to receive the completions of input and output threads */
+    config->ch_bus = flb_engine_bus_create(config->evl, FLB_ENGINE_EV_CORE);
+    if (!config->ch_bus) {
+        flb_error("[engine] could not create completions bus");
+        return -1;
+    }
+
     /* Initialize input plugins */
     flb_input_initialize_all(config);
 
@@ -461,6 +561,26 @@ int flb_engine_start(struct flb_config *config)
         return -1;
     }
 
+    /*
+     * Engine workers to run the output flushes.
+     *
+     * FIXME: collection, filtering and task creation still run on this
+     * event loop, giving each worker its own input instances and tasks is
+     * left as a follow-up.
+     */
+    if (config->engine_workers > 0) {
+#ifdef FLB_HAVE_FLUSH_LIBCO
+        ret = flb_engine_workers_start(config);
+        if (ret == -1) {
+            flb_error("[engine] workers could not start");
+            return -1;
+        }
+#else
+        flb_warn("[engine] workers are only supported with libco flush, "
+                 "ignoring");
+#endif
+    }
+
     /* Enable Buffering Support */
 #ifdef FLB_HAVE_BUFFERING
     struct flb_buffer *buf_ctx;
@@ -574,6 +694,11 @@ int flb_engine_shutdown(struct flb_config *config)
     }
 #endif
 
+#ifdef FLB_HAVE_FLUSH_LIBCO
+    /* no more flushes from the engine workers */
+    flb_engine_workers_stop(config);
+#endif
+
     /* router */
     flb_router_exit(config);
 
@@ -586,6 +711,9 @@ int flb_engine_shutdown(struct flb_config *config)
     flb_filter_exit(config);
     flb_input_exit_all(config);
     flb_output_exit(config);
+#ifdef FLB_HAVE_FLUSH_LIBCO
+    flb_engine_workers_destroy(config);
+#endif
 
     /* metrics */
 #ifdef FLB_HAVE_METRICS
@@ -0,0 +1,235 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <errno.h>
+
+#ifdef FLB_HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_ring.h>
+#include <fluent-bit/flb_engine_bus.h>
+
+static int bus_doorbell_create(struct flb_engine_bus *bus)
+{
+    int ret;
+
+#ifdef FLB_HAVE_EVENTFD
+    ret = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ret != -1) {
+        bus->fd[0] = ret;
+        bus->fd[1] = ret;
+        return 0;
+    }
+    flb_errno();
+#endif
+
+    ret = flb_pipe_create(bus->fd);
+    if (ret == -1) {
+        flb_errno();
+        return -1;
+    }
+
+#ifndef _WIN32
+    fcntl(bus->fd[0], F_SETFL, fcntl(bus->fd[0], F_GETFL) | O_NONBLOCK);
+#endif
+
+    return 0;
+}
+
+static void bus_doorbell_destroy(struct flb_engine_bus *bus)
+{
+    if (bus->fd[0] == -1) {
+        return;
+    }
+
+    flb_pipe_close(bus->fd[0]);
+    if (bus->fd[1] != bus->fd[0]) {
+        flb_pipe_close(bus->fd[1]);
+    }
+    bus->fd[0] = -1;
+    bus->fd[1] = -1;
+}
+
+struct flb_engine_bus *flb_engine_bus_create(struct mk_event_loop *evl,
+                                             int event_type)
+{
+    int ret;
+    struct flb_engine_bus *bus;
+
+    bus = flb_calloc(1, sizeof(struct flb_engine_bus));
+    if (!bus) {
+        flb_errno();
+        return NULL;
+    }
+    bus->fd[0] = -1;
+    bus->fd[1] = -1;
+    mk_list_init(&bus->overflow);
+    pthread_mutex_init(&bus->lock, NULL);
+
+    bus->ring = flb_ring_create(sizeof(struct flb_engine_bus_event),
+                                FLB_ENGINE_BUS_SIZE);
+    if (!bus->ring) {
+        flb_engine_bus_destroy(bus);
+        return NULL;
+    }
+
+    ret = bus_doorbell_create(bus);
+    if (ret == -1) {
+        flb_engine_bus_destroy(bus);
+        return NULL;
+    }
+
+    if (evl) {
+        MK_EVENT_NEW(&bus->event);
+        ret = mk_event_add(evl, bus->fd[0], event_type, MK_EVENT_READ,
+                           &bus->event);
+        if (ret == -1) {
+            flb_error("[engine bus] could not register doorbell");
+            flb_engine_bus_destroy(bus);
+            return NULL;
+        }
+    }
+
+    return bus;
+}
+
+void flb_engine_bus_destroy(struct flb_engine_bus *bus)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_engine_bus_overflow *o;
+
+    if (!bus) {
+        return;
+    }
+
+    mk_list_foreach_safe(head, tmp, &bus->overflow) {
+        o = mk_list_entry(head, struct flb_engine_bus_overflow, _head);
+        mk_list_del(&o->_head);
+        flb_free(o);
+    }
+
+    bus_doorbell_destroy(bus);
+    flb_ring_destroy(bus->ring);
+    pthread_mutex_destroy(&bus->lock);
+    flb_free(bus);
+}
+
+/*
+ * Push a completion record. If the ring is full the record is queued in the
+ * overflow list: the engine may be the producer itself (a co-routine that
+ * finished) so waiting for room is not an option.
+ */
+int flb_engine_bus_push(struct flb_engine_bus *bus,
+                        struct flb_engine_bus_event *ev)
+{
+    int ret;
+    uint64_t val = 1;
+    struct flb_engine_bus_overflow *o;
+
+    pthread_mutex_lock(&bus->lock);
+    if (bus->overflowed == FLB_FALSE) {
+        ret = flb_ring_push(bus->ring, ev);
+    }
+    else {
+        /* keep ordering once the overflow list is in use */
+        ret = -1;
+    }
+
+    if (ret == -1) {
+        o = flb_malloc(sizeof(struct flb_engine_bus_overflow));
+        if (!o) {
+            flb_errno();
+            pthread_mutex_unlock(&bus->lock);
+            return -1;
+        }
+        o->ev = *ev;
+        mk_list_add(&o->_head, &bus->overflow);
+        __atomic_store_n(&bus->overflowed, FLB_TRUE, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&bus->lock);
+
+    /* Ring the doorbell only if the engine has not been notified yet */
+    if (__atomic_exchange_n(&bus->notified, 1, __ATOMIC_SEQ_CST) == 0) {
+        ret = flb_pipe_w(bus->fd[1], &val, sizeof(val));
+        if (ret == -1) {
+            flb_errno();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Consume the doorbell (engine side). It must be called before draining the
+ * bus with flb_engine_bus_pop() so records pushed meanwhile ring it again.
+ */
+void flb_engine_bus_consume(struct flb_engine_bus *bus)
+{
+    int ret;
+    uint64_t val;
+
+    ret = flb_pipe_r(bus->fd[0], &val, sizeof(val));
+    if (ret == -1 && errno != EAGAIN) {
+        flb_errno();
+    }
+    __atomic_store_n(&bus->notified, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Pop the next completion record (engine side), returns -1 if empty */
+int flb_engine_bus_pop(struct flb_engine_bus *bus,
+                       struct flb_engine_bus_event *ev)
+{
+    struct flb_engine_bus_overflow *o;
+
+    if (flb_ring_pop(bus->ring, ev) == 0) {
+        return 0;
+    }
+
+    if (__atomic_load_n(&bus->overflowed, __ATOMIC_ACQUIRE) == FLB_FALSE) {
+        return -1;
+    }
+
+    /* The ring is empty, continue with the records that did not fit */
+    pthread_mutex_lock(&bus->lock);
+    if (mk_list_is_empty(&bus->overflow) == 0) {
+        pthread_mutex_unlock(&bus->lock);
+        return -1;
+    }
+
+    o = mk_list_entry_first(&bus->overflow,
+                            struct flb_engine_bus_overflow, _head);
+    *ev = o->ev;
+    mk_list_del(&o->_head);
+    if (mk_list_is_empty(&bus->overflow) == 0) {
+        __atomic_store_n(&bus->overflowed, FLB_FALSE, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&bus->lock);
+    flb_free(o);
+
+    return 0;
+}
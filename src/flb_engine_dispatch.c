@@ -27,6 +27,7 @@
 #include <fluent-bit/flb_thread.h>
 #include <fluent-bit/flb_engine.h>
 #include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_engine_worker.h>
 
 void flb_task_add_thread(struct flb_thread *thread,
                                 struct flb_task *task);
@@ -44,6 +45,11 @@ int flb_engine_dispatch_retry(struct flb_task_retry *retry,
     task = retry->parent;
     i_ins = task->i_ins;
 
+    /* The output instance is flushed by an engine worker */
+    if (retry->o_ins->worker) {
+        return flb_engine_worker_flush(task, retry->o_ins, config);
+    }
+
     th = flb_output_thread(task,
                            i_ins,
                            retry->o_ins,
@@ -85,6 +91,12 @@ static int tasks_start(struct flb_input_instance *in,
         mk_list_foreach(r_head, &task->routes) {
             route = mk_list_entry(r_head, struct flb_task_route, _head);
 
+            /* The output instance is flushed by an engine worker */
+            if (route->out->worker) {
+                flb_engine_worker_flush(task, route->out, config);
+                continue;
+            }
+
             /*
              * We have the Task and the Route, created a thread context for the
              * data handling.
@@ -114,6 +126,7 @@ static int tasks_start(struct flb_input_instance *in,
 int flb_engine_dispatch(uint64_t id, struct flb_input_instance *in,
                         struct flb_config *config)
 {
+    int records;
     char *buf;
     size_t size;
     struct flb_input_plugin *p;
@@ -139,9 +152,10 @@ int flb_engine_dispatch(uint64_t id, struct flb_input_instance *in,
             buf = flb_input_dyntag_flush(dt, &size);
             if (size == 0) {
                 /*
-                 * Do not release the buffer since if allocated, it will be
-                 * released upon input_dyntag context destroy.
+                 * The dyntag have no data (e.g: records were dropped
+                 * because the instance was paused), release the node.
                  */
+                flb_input_dyntag_destroy(dt);
                 continue;
             }
             if (!buf) {
@@ -149,7 +163,8 @@ int flb_engine_dispatch(uint64_t id, struct flb_input_instance *in,
             }
 
             flb_trace("[dyntag %s] %p tag=%s", dt->in->name, dt, dt->tag);
-            task = flb_task_create(id, buf, size, dt->in, dt, dt->tag, config);
+            task = flb_task_create(id, buf, size, dt->mp_records,
+                                   dt->in, dt, dt->tag, config);
             if (!task) {
                 /* Do not release the buffer, will happen on dyntag destroy */
                 continue;
@@ -157,7 +172,8 @@ int flb_engine_dispatch(uint64_t id, struct flb_input_instance *in,
         }
     }
     else {
-        /* Get data from instance buffers */
+        /* Get data from instance buffers, the flush resets the counter */
+        records = in->mp_records;
         buf = flb_input_flush(in, &size);
         if (!buf || size == 0) {
             if (buf) {
@@ -171,7 +187,8 @@ int flb_engine_dispatch(uint64_t id, struct flb_input_instance *in,
          * and the co-routines associated to the output instance plugins
          * that needs to handle the data.
          */
-        task = flb_task_create(id, buf, size, in, NULL, in->tag, config);
+        task = flb_task_create(id, buf, size, records,
+                               in, NULL, in->tag, config);
         if (!task) {
             flb_free(buf);
             return -1;
@@ -0,0 +1,421 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <sched.h>
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_ring.h>
+#include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_worker.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_engine_worker.h>
+
+#ifdef FLB_HAVE_FLUSH_LIBCO
+
+/* Wake up the other side, unless it was already notified */
+static inline void doorbell(flb_pipefd_t fd, int *notified)
+{
+    int ret;
+    uint64_t val = 1;
+
+    if (__atomic_exchange_n(notified, 1, __ATOMIC_SEQ_CST) == 0) {
+        ret = flb_pipe_w(fd, &val, sizeof(val));
+        if (ret == -1) {
+            flb_errno();
+        }
+    }
+}
+
+/* Consume a doorbell, further pushes will ring it again */
+static inline void doorbell_consume(flb_pipefd_t fd, int *notified)
+{
+    int ret;
+    uint64_t val;
+
+    ret = flb_pipe_r(fd, &val, sizeof(val));
+    if (ret == -1) {
+        flb_errno();
+    }
+    __atomic_store_n(notified, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Report a flush result to the engine */
+static void worker_done(struct flb_engine_worker *w,
+                        struct flb_engine_worker_done *done)
+{
+    while (flb_ring_push(w->r_done, done) == -1) {
+        /* The engine is behind, make sure it's awake and wait for room */
+        doorbell(w->ch_done[1], &w->done_notified);
+        sched_yield();
+    }
+    doorbell(w->ch_done[1], &w->done_notified);
+}
+
+/* Resume a flush co-routine, report it if it has finished */
+static void worker_resume(struct flb_engine_worker *w, struct flb_thread *th)
+{
+    struct flb_output_thread *out_th;
+    struct flb_engine_worker_done done;
+
+    flb_thread_resume(th);
+
+    out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
+    if (out_th->done == FLB_TRUE) {
+        done.ret       = out_th->ret;
+        done.thread_id = out_th->id;
+        done.task      = out_th->task;
+        done.th        = th;
+        worker_done(w, &done);
+    }
+}
+
+/* Start the flush co-routines requested by the engine */
+static void worker_flush_requests(struct flb_engine_worker *w)
+{
+    struct flb_task *task;
+    struct flb_thread *th;
+    struct flb_output_thread *out_th;
+    struct flb_engine_worker_flush req;
+    struct flb_engine_worker_done done;
+
+    while (flb_ring_pop(w->r_flush, &req) == 0) {
+        task = req.task;
+        th = flb_output_thread(task,
+                               task->i_ins,
+                               req.o_ins,
+                               w->config,
+                               task->buf, task->size,
+                               task->tag,
+                               strlen(task->tag));
+        if (!th) {
+            done.ret       = FLB_ERROR;
+            done.thread_id = req.thread_id;
+            done.task      = task;
+            done.th        = NULL;
+            worker_done(w, &done);
+            continue;
+        }
+
+        out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
+        out_th->id     = req.thread_id;
+        out_th->worker = w;
+        worker_resume(w, th);
+    }
+}
+
+/* Worker event loop */
+static void worker_run(void *data)
+{
+    struct mk_event *event;
+    struct flb_upstream_conn *u_conn;
+    struct flb_engine_worker *w = data;
+
+    /* Connections created by the co-routines are registered here */
+    flb_engine_evl_set(w->evl);
+    flb_debug("[engine] worker #%i started", w->id);
+
+    while (__atomic_load_n(&w->running, __ATOMIC_ACQUIRE) == FLB_TRUE) {
+        mk_event_wait(w->evl);
+        mk_event_foreach(event, w->evl) {
+            if (event->type == FLB_ENGINE_EV_CORE) {
+                if (event->fd == w->ch_flush[0]) {
+                    doorbell_consume(event->fd, &w->flush_notified);
+                    worker_flush_requests(w);
+                }
+            }
+            else if (event->type == FLB_ENGINE_EV_THREAD) {
+                u_conn = (struct flb_upstream_conn *) event;
+                worker_resume(w, u_conn->thread);
+            }
+        }
+    }
+
+    flb_debug("[engine] worker #%i stopped", w->id);
+}
+
+static void worker_destroy(struct flb_engine_worker *w)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_engine_worker_pending *p;
+
+    mk_list_foreach_safe(head, tmp, &w->pending) {
+        p = mk_list_entry(head, struct flb_engine_worker_pending, _head);
+        mk_list_del(&p->_head);
+        flb_free(p);
+    }
+
+    if (w->ch_done[0] > 0) {
+        mk_event_del(w->config->evl, &w->ev_done);
+        flb_pipe_close(w->ch_done[0]);
+        flb_pipe_close(w->ch_done[1]);
+    }
+
+    if (w->evl) {
+        if (w->ch_flush[0] > 0) {
+            mk_event_del(w->evl, &w->ev_flush);
+            flb_pipe_close(w->ch_flush[0]);
+            flb_pipe_close(w->ch_flush[1]);
+        }
+        mk_event_loop_destroy(w->evl);
+    }
+
+    flb_ring_destroy(w->r_flush);
+    flb_ring_destroy(w->r_done);
+    flb_free(w);
+}
+
+static struct flb_engine_worker *worker_create(int id,
+                                               struct flb_config *config)
+{
+    int ret;
+    struct flb_engine_worker *w;
+
+    w = flb_calloc(1, sizeof(struct flb_engine_worker));
+    if (!w) {
+        flb_errno();
+        return NULL;
+    }
+    w->id = id;
+    w->running = FLB_TRUE;
+    w->config = config;
+    w->ch_flush[0] = -1;
+    w->ch_done[0] = -1;
+    mk_list_init(&w->pending);
+
+    w->r_flush = flb_ring_create(sizeof(struct flb_engine_worker_flush),
+                                 FLB_ENGINE_WORKER_RING);
+    w->r_done = flb_ring_create(sizeof(struct flb_engine_worker_done),
+                                FLB_ENGINE_WORKER_RING);
+    w->evl = mk_event_loop_create(256);
+    if (!w->r_flush || !w->r_done || !w->evl) {
+        worker_destroy(w);
+        return NULL;
+    }
+
+    /* Doorbell to notify flush requests, registered in the worker loop */
+    ret = mk_event_channel_create(w->evl,
+                                  &w->ch_flush[0], &w->ch_flush[1],
+                                  &w->ev_flush);
+    if (ret != 0) {
+        w->ch_flush[0] = -1;
+        worker_destroy(w);
+        return NULL;
+    }
+
+    /* Doorbell to notify flush results, registered in the engine loop */
+    ret = mk_event_channel_create(config->evl,
+                                  &w->ch_done[0], &w->ch_done[1],
+                                  &w->ev_done);
+    if (ret != 0) {
+        w->ch_done[0] = -1;
+        worker_destroy(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+/*
+ * Create the engine workers and assign the output instances to them in a
+ * round-robin fashion. Collectors, filters and task creation keeps running
+ * in the engine event loop; each output instance is flushed always by the
+ * same worker, so the plugin context and its upstream connections are never
+ * accessed by two threads.
+ */
+int flb_engine_workers_start(struct flb_config *config)
+{
+    int i;
+    int ret;
+    struct mk_list *head;
+    struct flb_engine_worker *w;
+    struct flb_output_instance *o_ins;
+
+    for (i = 0; i < config->engine_workers; i++) {
+        w = worker_create(i, config);
+        if (!w) {
+            flb_error("[engine] could not create worker #%i", i);
+            return -1;
+        }
+        mk_list_add(&w->_head, &config->engine_workers_list);
+    }
+
+    i = 0;
+    mk_list_foreach(head, &config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        w = mk_list_entry_first(&config->engine_workers_list,
+                                struct flb_engine_worker, _head);
+        ret = i % config->engine_workers;
+        while (ret-- > 0) {
+            w = mk_list_entry_next(&w->_head, struct flb_engine_worker,
+                                   _head, &config->engine_workers_list);
+        }
+        o_ins->worker = w;
+        flb_debug("[engine] output %s assigned to worker #%i",
+                  o_ins->name, w->id);
+        i++;
+    }
+
+    mk_list_foreach(head, &config->engine_workers_list) {
+        w = mk_list_entry(head, struct flb_engine_worker, _head);
+        ret = flb_worker_create(worker_run, w, &w->tid, config);
+        if (ret == -1) {
+            flb_error("[engine] could not spawn worker #%i", w->id);
+            w->running = FLB_FALSE;
+            return -1;
+        }
+    }
+
+    flb_info("[engine] started %i workers", config->engine_workers);
+    return 0;
+}
+
+/* Stop the workers and wait for them, in-flight flushes are discarded */
+void flb_engine_workers_stop(struct flb_config *config)
+{
+    int ret;
+    uint64_t val = 1;
+    struct mk_list *head;
+    struct flb_engine_worker *w;
+
+    mk_list_foreach(head, &config->engine_workers_list) {
+        w = mk_list_entry(head, struct flb_engine_worker, _head);
+        if (__atomic_exchange_n(&w->running, FLB_FALSE,
+                                __ATOMIC_SEQ_CST) == FLB_FALSE) {
+            continue;
+        }
+
+        ret = flb_pipe_w(w->ch_flush[1], &val, sizeof(val));
+        if (ret == -1) {
+            flb_errno();
+        }
+        pthread_join(w->tid, NULL);
+    }
+}
+
+/* Release the workers, upstream connections must be gone at this point */
+void flb_engine_workers_destroy(struct flb_config *config)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_engine_worker *w;
+
+    flb_engine_workers_stop(config);
+
+    mk_list_foreach_safe(head, tmp, &config->engine_workers_list) {
+        w = mk_list_entry(head, struct flb_engine_worker, _head);
+        mk_list_del(&w->_head);
+        worker_destroy(w);
+    }
+}
+
+/* Push the flush requests that did not fit in the ring */
+void flb_engine_worker_pending_flush(struct flb_engine_worker *w)
+{
+    int n = 0;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_engine_worker_pending *p;
+
+    mk_list_foreach_safe(head, tmp, &w->pending) {
+        p = mk_list_entry(head, struct flb_engine_worker_pending, _head);
+        if (flb_ring_push(w->r_flush, &p->req) == -1) {
+            break;
+        }
+        mk_list_del(&p->_head);
+        flb_free(p);
+        n++;
+    }
+
+    if (n > 0) {
+        doorbell(w->ch_flush[1], &w->flush_notified);
+    }
+}
+
+/*
+ * Request the worker assigned to the output instance to flush the task
+ * data. The output thread ID and the task users are set here so the engine
+ * keeps the task alive until the worker reports back.
+ */
+int flb_engine_worker_flush(struct flb_task *task,
+                            struct flb_output_instance *o_ins,
+                            struct flb_config *config)
+{
+    struct flb_engine_worker *w = o_ins->worker;
+    struct flb_engine_worker_flush req;
+    struct flb_engine_worker_pending *p;
+
+    req.thread_id = task->n_threads;
+    req.task      = task;
+    req.o_ins     = o_ins;
+
+    /* Keep order: if there are pending requests, queue after them */
+    if (mk_list_is_empty(&w->pending) != 0 ||
+        flb_ring_push(w->r_flush, &req) == -1) {
+        p = flb_malloc(sizeof(struct flb_engine_worker_pending));
+        if (!p) {
+            flb_errno();
+            return -1;
+        }
+        p->req = req;
+        mk_list_add(&p->_head, &w->pending);
+        flb_debug("[engine] worker #%i ring is full, request queued",
+                  w->id);
+    }
+    else {
+        doorbell(w->ch_flush[1], &w->flush_notified);
+    }
+
+    task->n_threads++;
+    task->users++;
+
+    return 0;
+}
+
+/* Check if the given fd is the results doorbell of a worker */
+struct flb_engine_worker *flb_engine_worker_done_fd(flb_pipefd_t fd,
+                                                    struct flb_config *config)
+{
+    struct mk_list *head;
+    struct flb_engine_worker *w;
+
+    mk_list_foreach(head, &config->engine_workers_list) {
+        w = mk_list_entry(head, struct flb_engine_worker, _head);
+        if (w->ch_done[0] == fd) {
+            doorbell_consume(fd, &w->done_notified);
+            return w;
+        }
+    }
+
+    return NULL;
+}
+
+int flb_engine_worker_done_pop(struct flb_engine_worker *w,
+                               struct flb_engine_worker_done *done)
+{
+    return flb_ring_pop(w->r_done, done);
+}
+
+#endif /* FLB_HAVE_FLUSH_LIBCO */
@@ -23,6 +23,12 @@
 #include <fluent-bit/flb_env.h>
 #include <fluent-bit/flb_router.h>
 
+/* Filters of a record chain whose processing time is kept on the stack */
+#define FLB_FILTER_CHAIN_TIMES  16
+
+/* One in this many records of a chain is timed */
+#define FLB_FILTER_CHAIN_SAMPLE 64
+
 static inline int instance_id(struct flb_filter_plugin *p,
                               struct flb_config *config)
 {
@@ -64,47 +70,286 @@ static void flb_filter_replace(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
     msgpack_sbuffer_write(mp_sbuf, new_buf, new_size);
 }
 
-void flb_filter_do(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
+/*
+ * Run a chain of 'n' filters that implements the record callback over a
+ * msgpack buffer. Each record is unpacked once and handed through all the
+ * filters of the chain, then it's packed once if some filter changed it.
+ * Untouched records are copied as raw bytes and if no record is modified or
+ * dropped no new buffer is created at all.
+ */
+static int filter_chain_records(void **chain, int n,
+                                void *data, size_t bytes,
+                                char *tag, int tag_len,
+                                void **out_buf, size_t *out_size,
+                                struct flb_config *config)
+{
+    int i;
+    int ret;
+    int status;
+    int modified = FLB_FALSE;
+    size_t off = 0;
+    size_t prev = 0;
+    msgpack_zone zone;
+    msgpack_object root;
+    msgpack_object map;
+    msgpack_sbuffer tmp_sbuf;
+    msgpack_packer tmp_pck;
+    struct flb_filter_instance *f_ins;
+#ifdef FLB_HAVE_METRICS
+    int timed = FLB_FALSE;
+    uint64_t t = 0;
+    uint64_t now;
+    size_t records = 0;
+    size_t sampled = 0;
+    uint64_t times_buf[FLB_FILTER_CHAIN_TIMES];
+    uint64_t *times = times_buf;
+
+    /*
+     * Records go through all the filters of the chain one by one. Reading
+     * the clock around every filter call costs as much as a cheap filter,
+     * so only one in FLB_FILTER_CHAIN_SAMPLE records (and always the first
+     * one) is timed. The time spent by each filter on those is added up,
+     * scaled to the whole chunk and observed once.
+     */
+    if (n > FLB_FILTER_CHAIN_TIMES) {
+        times = flb_calloc(n, sizeof(uint64_t));
+        if (!times) {
+            /* Run the chain anyway, just without timing it */
+            flb_errno();
+        }
+    }
+    else {
+        memset(times, '\0', sizeof(uint64_t) * n);
+    }
+#endif
+
+    if (!msgpack_zone_init(&zone, MSGPACK_ZONE_CHUNK_SIZE)) {
+        flb_errno();
+#ifdef FLB_HAVE_METRICS
+        if (times != times_buf) {
+            flb_free(times);
+        }
+#endif
+        return FLB_FILTER_NOTOUCH;
+    }
+
+    while (1) {
+        ret = msgpack_unpack(data, bytes, &off, &zone, &root);
+        if (ret != MSGPACK_UNPACK_SUCCESS &&
+            ret != MSGPACK_UNPACK_EXTRA_BYTES) {
+            break;
+        }
+
+        status = FLB_FILTER_NOTOUCH;
+        if (root.type == MSGPACK_OBJECT_ARRAY && root.via.array.size == 2) {
+            map = root.via.array.ptr[1];
+#ifdef FLB_HAVE_METRICS
+            timed = (times && records++ % FLB_FILTER_CHAIN_SAMPLE == 0);
+            if (timed) {
+                sampled++;
+                t = flb_metrics_time();
+            }
+#endif
+            for (i = 0; i < n; i++) {
+                f_ins = chain[i];
+                ret = f_ins->p->cb_filter_record(&map, &zone,
+                                                 tag, tag_len,
+                                                 f_ins, f_ins->context,
+                                                 config);
+#ifdef FLB_HAVE_METRICS
+                if (timed) {
+                    now = flb_metrics_time();
+                    times[i] += now - t;
+                    t = now;
+                }
+#endif
+                if (ret == FLB_FILTER_DROP) {
+                    status = FLB_FILTER_DROP;
+                    break;
+                }
+                else if (ret == FLB_FILTER_MODIFIED) {
+                    status = FLB_FILTER_MODIFIED;
+                }
+            }
+        }
+
+        /* On the first change keep the previous untouched records */
+        if (status != FLB_FILTER_NOTOUCH && modified == FLB_FALSE) {
+            msgpack_sbuffer_init(&tmp_sbuf);
+            msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
+            msgpack_sbuffer_write(&tmp_sbuf, data, prev);
+            modified = FLB_TRUE;
+        }
+
+        if (modified == FLB_TRUE) {
+            if (status == FLB_FILTER_NOTOUCH) {
+                msgpack_sbuffer_write(&tmp_sbuf,
+                                      (char *) data + prev, off - prev);
+            }
+            else if (status == FLB_FILTER_MODIFIED) {
+                msgpack_pack_array(&tmp_pck, 2);
+                msgpack_pack_object(&tmp_pck, root.via.array.ptr[0]);
+                msgpack_pack_object(&tmp_pck, map);
+            }
+        }
+
+        prev = off;
+        msgpack_zone_clear(&zone);
+    }
+    msgpack_zone_destroy(&zone);
+
+#ifdef FLB_HAVE_METRICS
+    for (i = 0; i < n && sampled > 0; i++) {
+        f_ins = chain[i];
+        if (f_ins->metrics) {
+            flb_metrics_observe(FLB_METRIC_FILTER_TIME,
+                                times[i] * records / sampled,
+                                f_ins->metrics);
+        }
+    }
+    if (times != times_buf) {
+        flb_free(times);
+    }
+#endif
+
+    if (modified == FLB_FALSE) {
+        return FLB_FILTER_NOTOUCH;
+    }
+
+    *out_buf  = tmp_sbuf.data;
+    *out_size = tmp_sbuf.size;
+
+    return FLB_FILTER_MODIFIED;
+}
+
+/*
+ * Run a single filter, or a chain of 'n' record filters, over the buffer
+ * at the end of mp_sbuf. Returns FLB_TRUE if the data was replaced.
+ */
+static int filter_apply(void **chain, int n,
+                        msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
+                        void **data, size_t *bytes,
+                        char *tag, int tag_len,
+                        struct flb_config *config)
+{
+    int ret;
+    void *out_buf = NULL;
+    size_t out_size = 0;
+    struct flb_filter_instance *f_ins = chain[0];
+#ifdef FLB_HAVE_METRICS
+    uint64_t t;
+#endif
+
+    if (f_ins->p->cb_filter_record) {
+        ret = filter_chain_records(chain, n,
+                                   *data, *bytes,
+                                   tag, tag_len,
+                                   &out_buf, &out_size,
+                                   config);
+    }
+    else {
+#ifdef FLB_HAVE_METRICS
+        t = flb_metrics_time();
+#endif
+        /* Invoke the filter callback */
+        ret = f_ins->p->cb_filter(*data, *bytes,  /* msgpack raw data */
+                                  tag, tag_len,   /* input tag        */
+                                  &out_buf,       /* new data         */
+                                  &out_size,      /* new data size    */
+                                  f_ins,          /* filter instance  */
+                                  f_ins->context, /* filter priv data */
+                                  config);
+#ifdef FLB_HAVE_METRICS
+        if (f_ins->metrics) {
+            flb_metrics_observe(FLB_METRIC_FILTER_TIME,
+                                flb_metrics_time() - t, f_ins->metrics);
+        }
+#endif
+    }
+
+    /* Override buffer just if it was modified */
+    if (ret != FLB_FILTER_MODIFIED) {
+        return FLB_FALSE;
+    }
+
+    flb_filter_replace(mp_sbuf, mp_pck,    /* msgpack        */
+                       *bytes,             /* passed data    */
+                       out_buf, out_size); /* new data       */
+    /* Release new temporal buffer */
+    flb_free(out_buf);
+
+    /* Point back the 'data' pointer to the new address */
+    *bytes = out_size;
+    *data  = mp_sbuf->data + (mp_sbuf->size - out_size);
+
+    return FLB_TRUE;
+}
+
+/* Run the filters matching the Tag, returns FLB_TRUE if data was modified */
+int flb_filter_do(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
                    void *data, size_t bytes,
                    char *tag, int tag_len,
                    struct flb_config *config)
 {
-    int ret;
-    void *out_buf;
-    size_t out_size;
+    int i;
+    int end;
+    int modified = FLB_FALSE;
+    void *ins;
+    void **filters;
     struct mk_list *head;
     struct flb_filter_instance *f_ins;
+    struct flb_router_routes *routes;
 
-    mk_list_foreach(head, &config->filters) {
-        f_ins = mk_list_entry(head, struct flb_filter_instance, _head);
-        if (flb_router_match(tag, f_ins->match)) {
-            /* Reset filtered buffer */
-            out_buf = NULL;
-            out_size = 0;
-
-            /* Invoke the filter callback */
-            ret = f_ins->p->cb_filter(data, bytes,    /* msgpack raw data */
-                                      tag, tag_len,   /* input tag        */
-                                      &out_buf,       /* new data         */
-                                      &out_size,      /* new data size    */
-                                      f_ins,          /* filter instance  */
-                                      f_ins->context, /* filter priv data */
-                                      config);
-
-            /* Override buffer just if it was modified */
-            if (ret == FLB_FILTER_MODIFIED) {
-                flb_filter_replace(mp_sbuf, mp_pck,    /* msgpack        */
-                                   bytes,              /* passed data    */
-                                   out_buf, out_size); /* new data       */
-                /* Release new temporal buffer */
-                flb_free(out_buf);
-
-                /* Point back the 'data' pointer to the new address */
-                bytes = out_size;
-                data  = mp_sbuf->data + (mp_sbuf->size - out_size);
+    if (mk_list_is_empty(&config->filters) == 0) {
+        return FLB_FALSE;
+    }
+
+    /* Filters matching the Tag, resolved once per Tag */
+    routes = flb_router_routes_get(config, tag, tag_len);
+    if (!routes) {
+        /*
+         * The routes could not be resolved or cached (out of memory), match
+         * the filters one by one: skipping them would let through records
+         * that a filter should drop.
+         */
+        mk_list_foreach(head, &config->filters) {
+            f_ins = mk_list_entry(head, struct flb_filter_instance, _head);
+            if (!flb_router_filter_match(f_ins, tag, tag_len)) {
+                continue;
+            }
+
+            ins = f_ins;
+            if (filter_apply(&ins, 1, mp_sbuf, mp_pck, &data, &bytes,
+                             tag, tag_len, config) == FLB_TRUE) {
+                modified = FLB_TRUE;
+            }
+        }
+        return modified;
+    }
+
+    filters = &routes->ins[routes->n_outputs];
+
+    i = 0;
+    while (i < routes->n_filters) {
+        f_ins = filters[i];
+
+        /* Chain consecutive filters with record callback */
+        end = i + 1;
+        if (f_ins->p->cb_filter_record) {
+            while (end < routes->n_filters &&
+                   flb_router_routes_filter(routes, end)->p->cb_filter_record) {
+                end++;
             }
         }
+
+        if (filter_apply(&filters[i], end - i, mp_sbuf, mp_pck, &data, &bytes,
+                         tag, tag_len, config) == FLB_TRUE) {
+            modified = FLB_TRUE;
+        }
+        i = end;
     }
+
+    return modified;
 }
 
 int flb_filter_set_property(struct flb_filter_instance *filter, char *k, char *v)
@@ -122,6 +367,11 @@ int flb_filter_set_property(struct flb_filter_instance *filter, char *k, char *v
     /* Check if the key is a known/shared property */
     if (prop_key_check("match", k, len) == 0) {
         filter->match = tmp;
+
+        /* Drop any previously compiled rule and resolved routes */
+        flb_router_rule_destroy(filter->match_rule);
+        filter->match_rule = NULL;
+        flb_router_cache_invalidate(filter->config);
     }
     else {
         /* Append any remaining configuration key to prop list */
@@ -144,14 +394,43 @@ char *flb_filter_get_property(char *key, struct flb_filter_instance *i)
     return flb_config_prop_get(key, &i->properties);
 }
 
+/* Release an instance and its properties */
+static void filter_instance_destroy(struct flb_filter_instance *ins)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_config_prop *prop;
+
+    /* release properties */
+    mk_list_foreach_safe(head, tmp, &ins->properties) {
+        prop = mk_list_entry(head, struct flb_config_prop, _head);
+
+        flb_free(prop->key);
+        flb_free(prop->val);
+
+        mk_list_del(&prop->_head);
+        flb_free(prop);
+    }
+
+    if (ins->match != NULL) {
+        flb_free(ins->match);
+    }
+
+#ifdef FLB_HAVE_METRICS
+    if (ins->metrics) {
+        flb_metrics_destroy(ins->metrics);
+    }
+#endif
+
+    mk_list_del(&ins->_head);
+    flb_free(ins);
+}
+
 /* Invoke exit call for the filter plugin */
 void flb_filter_exit(struct flb_config *config)
 {
     struct mk_list *tmp;
     struct mk_list *head;
-    struct mk_list *tmp_prop;
-    struct mk_list *head_prop;
-    struct flb_config_prop *prop;
     struct flb_filter_instance *ins;
     struct flb_filter_plugin *p;
 
@@ -164,23 +443,7 @@ void flb_filter_exit(struct flb_config *config)
             p->cb_exit(ins->context, config);
         }
 
-        /* release properties */
-        mk_list_foreach_safe(head_prop, tmp_prop, &ins->properties) {
-            prop = mk_list_entry(head_prop, struct flb_config_prop, _head);
-
-            flb_free(prop->key);
-            flb_free(prop->val);
-
-            mk_list_del(&prop->_head);
-            flb_free(prop);
-        }
-
-        if (ins->match != NULL) {
-            flb_free(ins->match);
-        }
-
-        mk_list_del(&ins->_head);
-        flb_free(ins);
+        filter_instance_destroy(ins);
     }
 }
 
@@ -226,6 +489,14 @@ struct flb_filter_instance *flb_filter_new(struct flb_config *config,
     instance->p     = plugin;
     instance->data  = data;
     instance->match = NULL;
+    instance->match_rule = NULL;
+#ifdef FLB_HAVE_METRICS
+    instance->metrics = flb_metrics_create(instance->name);
+    if (instance->metrics) {
+        flb_metrics_add_histogram(FLB_METRIC_FILTER_TIME, "proc_time_seconds",
+                                  instance->metrics);
+    }
+#endif
     mk_list_init(&instance->properties);
     mk_list_add(&instance->_head, &config->filters);
 
@@ -238,9 +509,6 @@ void flb_filter_initialize_all(struct flb_config *config)
     int ret;
     struct mk_list *tmp;
     struct mk_list *head;
-    struct mk_list *tmp_prop;
-    struct mk_list *head_prop;
-    struct flb_config_prop *prop;
     struct flb_filter_plugin *p;
     struct flb_filter_instance *in;
 
@@ -251,8 +519,7 @@ void flb_filter_initialize_all(struct flb_config *config)
         if (!in->match) {
             flb_warn("[filter] NO match rule for %s filter instance, unloading.",
                      in->name);
-            mk_list_del(&in->_head);
-            flb_free(in);
+            filter_instance_destroy(in);
             continue;
         }
 
@@ -264,22 +531,7 @@ void flb_filter_initialize_all(struct flb_config *config)
             ret = p->cb_init(in, config, in->data);
             if (ret != 0) {
                 flb_error("Failed initialize filter %s", in->name);
-
-                /* release properties */
-                mk_list_foreach_safe(head_prop, tmp_prop, &in->properties) {
-                    prop = mk_list_entry(head_prop, struct flb_config_prop, _head);
-                    flb_free(prop->key);
-                    flb_free(prop->val);
-                    mk_list_del(&prop->_head);
-                    flb_free(prop);
-                }
-
-                if (in->match != NULL) {
-                    flb_free(in->match);
-                }
-
-                mk_list_del(&in->_head);
-                flb_free(in);
+                filter_instance_destroy(in);
             }
         }
     }
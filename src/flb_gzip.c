@@ -0,0 +1,286 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_gzip.h>
+
+#include "miniz/miniz.h"
+
+#define FLB_GZIP_HEADER_SIZE   10
+#define FLB_GZIP_FOOTER_SIZE    8
+
+/* Header flags (RFC 1952) */
+#define FLB_GZIP_FHCRC      0x02
+#define FLB_GZIP_FEXTRA     0x04
+#define FLB_GZIP_FNAME      0x08
+#define FLB_GZIP_FCOMMENT   0x10
+
+static inline void gzip_put32(uint8_t *p, uint32_t val)
+{
+    p[0] = val & 0xFF;
+    p[1] = (val >> 8) & 0xFF;
+    p[2] = (val >> 16) & 0xFF;
+    p[3] = (val >> 24) & 0xFF;
+}
+
+static inline uint32_t gzip_get32(uint8_t *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+        ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Validate a member header, returns its length or -1 */
+static int gzip_header_size(uint8_t *p, size_t len)
+{
+    int flags;
+    size_t off = FLB_GZIP_HEADER_SIZE;
+
+    if (len < FLB_GZIP_HEADER_SIZE + FLB_GZIP_FOOTER_SIZE ||
+        p[0] != 0x1F || p[1] != 0x8B || p[2] != 8) {
+        return -1;
+    }
+
+    flags = p[3];
+    if (flags & FLB_GZIP_FEXTRA) {
+        if (off + 2 > len) {
+            return -1;
+        }
+        off += 2 + (p[off] | (p[off + 1] << 8));
+    }
+    if (flags & FLB_GZIP_FNAME) {
+        while (off < len && p[off] != '\0') {
+            off++;
+        }
+        off++;
+    }
+    if (flags & FLB_GZIP_FCOMMENT) {
+        while (off < len && p[off] != '\0') {
+            off++;
+        }
+        off++;
+    }
+    if (flags & FLB_GZIP_FHCRC) {
+        off += 2;
+    }
+
+    if (off > len) {
+        return -1;
+    }
+    return off;
+}
+
+/*
+ * Compress the buffer in GZip format. Miniz don't support GZip directly,
+ * instead we write the header, deflate the raw content and append the
+ * CRC32 footer. The output buffer starts at a fraction of the input size
+ * and grows while deflating, so a full size copy is only allocated when
+ * the data does not compress.
+ */
+int flb_gzip_compress(void *in_data, size_t in_len,
+                      void **out_data, size_t *out_len)
+{
+    int ret;
+    size_t size;
+    uint8_t *buf;
+    uint8_t *tmp;
+    z_stream strm;
+
+    size = FLB_GZIP_HEADER_SIZE + FLB_GZIP_FOOTER_SIZE + (in_len / 4) + 64;
+    buf = flb_malloc(size);
+    if (!buf) {
+        flb_errno();
+        return -1;
+    }
+
+    /* GZip magic bytes, deflate, no flags, unknown OS */
+    memset(buf, '\0', FLB_GZIP_HEADER_SIZE);
+    buf[0] = 0x1F;
+    buf[1] = 0x8B;
+    buf[2] = 8;
+    buf[9] = 0xFF;
+
+    memset(&strm, '\0', sizeof(strm));
+    strm.next_in  = in_data;
+    strm.avail_in = in_len;
+
+    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION,
+                       Z_DEFLATED, -Z_DEFAULT_WINDOW_BITS, 9,
+                       Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        flb_free(buf);
+        return -1;
+    }
+
+    while (1) {
+        strm.next_out  = buf + FLB_GZIP_HEADER_SIZE + strm.total_out;
+        strm.avail_out = size - FLB_GZIP_HEADER_SIZE - FLB_GZIP_FOOTER_SIZE -
+            strm.total_out;
+
+        ret = deflate(&strm, Z_FINISH);
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            deflateEnd(&strm);
+            flb_free(buf);
+            return -1;
+        }
+
+        /* The output buffer is full */
+        size *= 2;
+        tmp = flb_realloc(buf, size);
+        if (!tmp) {
+            flb_errno();
+            deflateEnd(&strm);
+            flb_free(buf);
+            return -1;
+        }
+        buf = tmp;
+    }
+
+    if (deflateEnd(&strm) != Z_OK) {
+        flb_free(buf);
+        return -1;
+    }
+
+    /* GZip footer: CRC32 and size of the original data */
+    tmp = buf + FLB_GZIP_HEADER_SIZE + strm.total_out;
+    gzip_put32(tmp, mz_crc32(MZ_CRC32_INIT, in_data, in_len));
+    gzip_put32(tmp + 4, in_len);
+
+    *out_data = buf;
+    *out_len  = FLB_GZIP_HEADER_SIZE + strm.total_out + FLB_GZIP_FOOTER_SIZE;
+
+    return 0;
+}
+
+/*
+ * Decompress a GZip buffer, it can contain many concatenated members (as
+ * written by Fluentd compressed buffers), the content of all of them is
+ * returned in a single buffer.
+ */
+int flb_gzip_uncompress(void *in_data, size_t in_len,
+                        void **out_data, size_t *out_len)
+{
+    int hdr;
+    size_t size;
+    size_t total = 0;
+    size_t start;
+    size_t in_bytes;
+    size_t out_bytes;
+    uint8_t *p = in_data;
+    uint8_t *end = p + in_len;
+    uint8_t *buf;
+    uint8_t *tmp;
+    tinfl_status status;
+    tinfl_decompressor *inflator;
+
+    if (in_len < FLB_GZIP_HEADER_SIZE + FLB_GZIP_FOOTER_SIZE) {
+        return -1;
+    }
+
+    /*
+     * The footer of the last member tells the size of its content, it's
+     * only a hint: the peer controls it.
+     */
+    size = gzip_get32(end - 4);
+    if (size < in_len || size / 32 > in_len) {
+        size = in_len * 2;
+    }
+    if (size > FLB_GZIP_MAX_SIZE) {
+        size = FLB_GZIP_MAX_SIZE;
+    }
+
+    buf = flb_malloc(size);
+    if (!buf) {
+        flb_errno();
+        return -1;
+    }
+
+    inflator = flb_malloc(sizeof(tinfl_decompressor));
+    if (!inflator) {
+        flb_errno();
+        flb_free(buf);
+        return -1;
+    }
+
+    while (p < end) {
+        hdr = gzip_header_size(p, end - p);
+        if (hdr == -1) {
+            goto error;
+        }
+        p += hdr;
+
+        start = total;
+        tinfl_init(inflator);
+        while (1) {
+            in_bytes  = end - p;
+            out_bytes = size - total;
+            status = tinfl_decompress(inflator, p, &in_bytes,
+                                      buf + start, buf + total, &out_bytes,
+                                      TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+            p += in_bytes;
+            total += out_bytes;
+
+            if (status == TINFL_STATUS_DONE) {
+                break;
+            }
+            else if (status != TINFL_STATUS_HAS_MORE_OUTPUT ||
+                     size >= FLB_GZIP_MAX_SIZE) {
+                goto error;
+            }
+
+            size *= 2;
+            if (size > FLB_GZIP_MAX_SIZE) {
+                size = FLB_GZIP_MAX_SIZE;
+            }
+            tmp = flb_realloc(buf, size);
+            if (!tmp) {
+                flb_errno();
+                goto error;
+            }
+            buf = tmp;
+        }
+
+        /* Footer */
+        if (end - p < FLB_GZIP_FOOTER_SIZE ||
+            gzip_get32(p) != mz_crc32(MZ_CRC32_INIT, buf + start,
+                                      total - start) ||
+            gzip_get32(p + 4) != (uint32_t) (total - start)) {
+            goto error;
+        }
+        p += FLB_GZIP_FOOTER_SIZE;
+    }
+
+    flb_free(inflator);
+    *out_data = buf;
+    *out_len  = total;
+
+    return 0;
+
+ error:
+    flb_free(inflator);
+    flb_free(buf);
+    return -1;
+}
@@ -219,7 +219,7 @@ int flb_hash_add(struct flb_hash *ht, char *key, int key_len,
     entry->hits = 0;
 
     /* Store the key and value as a new memory region */
-    entry->key = flb_strdup(key);
+    entry->key = flb_strndup(key, key_len);
     entry->key_len = key_len;
     entry->val = flb_malloc(val_size + 1);
     if (!entry->val) {
@@ -249,7 +249,8 @@ int flb_hash_add(struct flb_hash *ht, char *key, int key_len,
     else {
         mk_list_foreach_safe(head, tmp, &table->chains) {
             old = mk_list_entry(head, struct flb_hash_entry, _head);
-            if (strcmp(old->key, entry->key) == 0) {
+            if (old->key_len == key_len &&
+                memcmp(old->key, entry->key, key_len) == 0) {
                 flb_hash_entry_free(ht, old);
                 break;
             }
@@ -290,7 +291,8 @@ int flb_hash_get(struct flb_hash *ht, char *key, int key_len,
                                     struct flb_hash_entry,
                                     _head);
 
-        if (strcmp(entry->key, key) != 0) {
+        if (entry->key_len != key_len ||
+            memcmp(entry->key, key, key_len) != 0) {
             entry = NULL;
         }
     }
@@ -303,7 +305,7 @@ int flb_hash_get(struct flb_hash *ht, char *key, int key_len,
                 continue;
             }
 
-            if (strcmp(entry->key, key) == 0) {
+            if (memcmp(entry->key, key, key_len) == 0) {
                 break;
             }
 
@@ -392,6 +394,9 @@ int flb_hash_del(struct flb_hash *ht, char *key)
         entry = mk_list_entry_first(&table->chains,
                                     struct flb_hash_entry,
                                     _head);
+        if (strcmp(entry->key, key) != 0) {
+            entry = NULL;
+        }
     }
     else {
         mk_list_foreach(head, &table->chains) {
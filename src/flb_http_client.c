@@ -145,6 +145,71 @@ static int check_content_length(struct flb_http_client *c)
     return FLB_HTTP_OK;
 }
 
+/*
+ * Once a response has been fully received, check if the connection can be
+ * re-used by the upstream keepalive mode. A connection is only recycled if
+ * the whole response body was consumed and the server did not ask to close
+ * the connection.
+ */
+static void check_connection(struct flb_http_client *c)
+{
+    int len;
+    int keepalive = FLB_FALSE;
+    char *p;
+    char *end;
+    struct flb_http_response *r = &c->resp;
+
+    c->u_conn->recycle = FLB_FALSE;
+
+    if ((c->u_conn->u->flags & FLB_IO_TCP_KA) == 0 || !r->headers_end) {
+        return;
+    }
+
+    /* We must know where the body ends, otherwise the server will close */
+    if (r->content_length == -1 && r->chunked_encoding == FLB_FALSE &&
+        r->status != 204 && c->method != FLB_HTTP_HEAD) {
+        return;
+    }
+
+    /* Unexpected bytes after the response body */
+    if (r->content_length >= 0 && r->payload_size > r->content_length) {
+        return;
+    }
+
+    /* HTTP/1.1 connections are persistent by default */
+    if (strncmp(r->data, "HTTP/1.1", 8) == 0) {
+        keepalive = FLB_TRUE;
+    }
+
+    /* Lookup the 'Connection' header only in the headers section */
+    p = r->data;
+    end = r->headers_end;
+    while (p < end) {
+        p = strstr(p, "\r\n");
+        if (!p || p >= end) {
+            break;
+        }
+        p += 2;
+
+        if (end - p > 11 && strncasecmp(p, "Connection:", 11) == 0) {
+            p += 11;
+            while (*p == ' ') {
+                p++;
+            }
+            len = end - p;
+            if (len >= 5 && strncasecmp(p, "close", 5) == 0) {
+                keepalive = FLB_FALSE;
+            }
+            else if (len >= 10 && strncasecmp(p, "keep-alive", 10) == 0) {
+                keepalive = FLB_TRUE;
+            }
+            break;
+        }
+    }
+
+    c->u_conn->recycle = keepalive;
+}
+
 static inline void consume_bytes(char *buf, int bytes, int length)
 {
     memmove(buf, buf + bytes, length - bytes);
@@ -518,6 +583,11 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
         c->body_len = body_len;
     }
 
+    /* Let the server know we want to keep the connection open */
+    if (u->flags & FLB_IO_TCP_KA) {
+        flb_http_add_header(c, "Connection", 10, "keep-alive", 10);
+    }
+
     /* Check proxy data */
     if (proxy) {
         ret = proxy_parse(proxy, c);
@@ -763,6 +833,12 @@ int flb_http_do(struct flb_http_client *c, size_t *bytes)
     size_t bytes_body = 0;
     char *tmp;
 
+    /*
+     * Until a complete response is received, the connection cannot be
+     * re-used by the upstream keepalive mode.
+     */
+    c->u_conn->recycle = FLB_FALSE;
+
     /* check enough space for the ending CRLF */
     if (header_available(c, crlf) != 0) {
         new_size = c->header_size + 2;
@@ -830,8 +906,11 @@ int flb_http_do(struct flb_http_client *c, size_t *bytes)
             }
         }
 
-        /* Always append a NULL byte */
-        if (r_bytes >= 0) {
+        /*
+         * Always append a NULL byte. If the peer closed the connection
+         * before a complete response, fail instead of reading again.
+         */
+        if (r_bytes > 0) {
             c->resp.data_len += r_bytes;
             c->resp.data[c->resp.data_len] = '\0';
 
@@ -840,6 +919,7 @@ int flb_http_do(struct flb_http_client *c, size_t *bytes)
                 return -1;
             }
             else if (ret == FLB_HTTP_OK) {
+                check_connection(c);
                 break;
             }
             else if (ret == FLB_HTTP_MORE) {
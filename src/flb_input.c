@@ -167,6 +167,8 @@ struct flb_input_instance *flb_input_new(struct flb_config *config,
         }
 
         instance->mp_total_buf_size = 0;
+        instance->dyntags_ht = NULL;
+        instance->dyntags_buf_size = 0;
         instance->mp_buf_limit = 0;
         instance->mp_buf_status = FLB_INPUT_RUNNING;
 
@@ -738,6 +740,7 @@ int flb_input_set_collector_socket(struct flb_input_instance *in,
     struct flb_input_collector *collector;
 
     collector = flb_malloc(sizeof(struct flb_input_collector));
+    collector->id          = collector_id(in);
     collector->type        = FLB_COLLECT_FD_SERVER;
     collector->cb_collect  = cb_new_connection;
     collector->fd_event    = fd;
@@ -750,19 +753,57 @@ int flb_input_set_collector_socket(struct flb_input_instance *in,
     mk_list_add(&collector->_head, &config->collectors);
     mk_list_add(&collector->_head_ins, &in->collectors);
 
-    return 0;
+    return collector->id;
+}
+
+/*
+ * Remove a dyntag node from the tag index: it happens when the node cannot
+ * receive more data (busy or locked) or when it's being destroyed.
+ */
+static void dyntag_unindex(struct flb_input_dyntag *dt)
+{
+    int ret;
+    char *out_buf;
+    size_t out_size;
+    struct flb_input_dyntag *entry;
+    struct flb_input_instance *in = dt->in;
+
+    if (!in->dyntags_ht) {
+        return;
+    }
+
+    ret = flb_hash_get(in->dyntags_ht, dt->tag, dt->tag_len,
+                       &out_buf, &out_size);
+    if (ret == -1) {
+        return;
+    }
+
+    memcpy(&entry, out_buf, sizeof(entry));
+    if (entry == dt) {
+        flb_hash_del(in->dyntags_ht, dt->tag);
+    }
 }
 
 /* Creates a new dyntag node for the input_instance in question */
 struct flb_input_dyntag *flb_input_dyntag_create(struct flb_input_instance *in,
                                                  char *tag, int tag_len)
 {
+    int ret;
     struct flb_input_dyntag *dt;
 
     if (tag_len < 1) {
         return NULL;
     }
 
+    /* The tag index is created on demand */
+    if (!in->dyntags_ht) {
+        in->dyntags_ht = flb_hash_create(FLB_HASH_EVICT_NONE,
+                                         FLB_INPUT_DYNTAGS_HT, -1);
+        if (!in->dyntags_ht) {
+            return NULL;
+        }
+    }
+
     /* Allocate node and reset fields */
     dt = flb_malloc(sizeof(struct flb_input_dyntag));
     if (!dt) {
@@ -777,9 +818,19 @@ struct flb_input_dyntag *flb_input_dyntag_create(struct flb_input_instance *in,
     dt->tag_len = tag_len;
 
     /* Initialize MessagePack fields */
+    dt->mp_records = 0;
     msgpack_sbuffer_init(&dt->mp_sbuf);
     msgpack_packer_init(&dt->mp_pck, &dt->mp_sbuf, msgpack_sbuffer_write);
 
+    /* Index the node by tag, the value is the node address */
+    ret = flb_hash_add(in->dyntags_ht, dt->tag, dt->tag_len,
+                       (char *) &dt, sizeof(dt));
+    if (ret == -1) {
+        flb_free(dt->tag);
+        flb_free(dt);
+        return NULL;
+    }
+
     /* Link to the list head */
     mk_list_add(&dt->_head, &in->dyntags);
     return dt;
@@ -791,6 +842,9 @@ int flb_input_dyntag_destroy(struct flb_input_dyntag *dt)
     flb_debug("[dyntag %s] %p destroy (tag=%s, bytes=%lu)",
               dt->in->name, dt, dt->tag, dt->mp_sbuf.size);
 
+    dyntag_unindex(dt);
+    dt->in->dyntags_buf_size -= dt->mp_sbuf.size;
+
     msgpack_sbuffer_destroy(&dt->mp_sbuf);
     mk_list_del(&dt->_head);
     flb_free(dt->tag);
@@ -809,33 +863,31 @@ void flb_input_dyntag_exit(struct flb_input_instance *in)
         dt = mk_list_entry(head, struct flb_input_dyntag, _head);
         flb_input_dyntag_destroy(dt);
     }
+
+    if (in->dyntags_ht) {
+        flb_hash_destroy(in->dyntags_ht);
+        in->dyntags_ht = NULL;
+    }
 }
 
 struct flb_input_dyntag *flb_input_dyntag_get(char *tag, size_t tag_len,
                                               struct flb_input_instance *in)
 
 {
-    struct mk_list *head;
+    int ret;
+    char *out_buf;
+    size_t out_size;
     struct flb_input_dyntag *dt = NULL;
 
-    /* Try to find a current dyntag node to append the data */
-    mk_list_foreach(head, &in->dyntags) {
-        dt = mk_list_entry(head, struct flb_input_dyntag, _head);
-        if (dt->busy == FLB_TRUE || dt->lock == FLB_TRUE) {
-            dt = NULL;
-            continue;
-        }
-
-        if (dt->tag_len != tag_len) {
-            dt = NULL;
-            continue;
-        }
-
-        if (strncmp(dt->tag, tag, tag_len) != 0) {
-            dt = NULL;
-            continue;
+    /*
+     * Try to find a current dyntag node to append the data, only nodes
+     * that are not busy or locked are indexed.
+     */
+    if (in->dyntags_ht) {
+        ret = flb_hash_get(in->dyntags_ht, tag, tag_len, &out_buf, &out_size);
+        if (ret >= 0) {
+            memcpy(&dt, out_buf, sizeof(dt));
         }
-        break;
     }
 
     /* No dyntag was found, we need to create a new one */
@@ -868,6 +920,7 @@ int flb_input_dyntag_append_obj(struct flb_input_instance *in,
     /* Lock buffers where size > 2MB */
     if (dt->mp_sbuf.size > 2048000) {
         dt->lock = FLB_TRUE;
+        dyntag_unindex(dt);
     }
 
     return 0;
@@ -896,6 +949,40 @@ int flb_input_dyntag_append_raw(struct flb_input_instance *in,
     /* Lock buffers where size > 2MB */
     if (dt->mp_sbuf.size > 2048000) {
         dt->lock = FLB_TRUE;
+        dyntag_unindex(dt);
+    }
+
+    return 0;
+}
+
+/*
+ * Start a direct write into the dyntag buffer of 'tag': the caller packs its
+ * records through dt->mp_pck instead of packing them in a temporary buffer
+ * that later needs to be copied with flb_input_dyntag_append_raw().
+ */
+struct flb_input_dyntag *flb_input_dyntag_write_start(struct flb_input_instance *in,
+                                                      char *tag, size_t tag_len)
+{
+    struct flb_input_dyntag *dt;
+
+    dt = flb_input_dyntag_get(tag, tag_len, in);
+    if (!dt) {
+        return NULL;
+    }
+
+    flb_input_dbuf_write_start(dt);
+    return dt;
+}
+
+/* Finish a direct write: run the filters and account the new bytes */
+int flb_input_dyntag_write_end(struct flb_input_dyntag *dt)
+{
+    flb_input_dbuf_write_end(dt);
+
+    /* Lock buffers where size > 2MB */
+    if (dt->mp_sbuf.size > 2048000) {
+        dt->lock = FLB_TRUE;
+        dyntag_unindex(dt);
     }
 
     return 0;
@@ -911,21 +998,18 @@ void *flb_input_flush(struct flb_input_instance *i_ins, size_t *size)
         return NULL;
     }
 
-    /* Allocate buffer */
-    buf = flb_malloc(i_ins->mp_sbuf.size);
-    if (!buf) {
-        flb_errno();
-        return NULL;
-    }
-
-    /* Copy original data to new buffer and update it size */
-    memcpy(buf, i_ins->mp_sbuf.data, i_ins->mp_sbuf.size);
+    /*
+     * Take the ownership of the msgpack buffer memory instead of copying
+     * it: the caller (a Task) becomes the owner of the data and it will
+     * release it when is done. The instance sbuffer is reset and will
+     * allocate fresh memory on the next write.
+     */
     *size = i_ins->mp_sbuf.size;
+    buf = msgpack_sbuffer_release(&i_ins->mp_sbuf);
 
     /* re-initialize msgpack buffers */
     i_ins->mp_records = 0;
-    msgpack_sbuffer_destroy(&i_ins->mp_sbuf);
-    msgpack_sbuffer_init(&i_ins->mp_sbuf);
+    i_ins->mp_buf_write_size = 0;
 
     return buf;
 }
@@ -938,7 +1022,9 @@ void *flb_input_dyntag_flush(struct flb_input_dyntag *dt, size_t *size)
     /*
      * msgpack-c internal use a raw buffer for it operations, since we
      * already appended data we just can take out the references to avoid
-     * a new memory allocation and skip a copy operation.
+     * a new memory allocation and skip a copy operation. The dyntag is
+     * marked as busy and it will be destroyed together with the Task, so
+     * the in-flight bytes are still accounted by flb_input_buf_size_set().
      */
 
     buf   = dt->mp_sbuf.data;
@@ -949,6 +1035,7 @@ void *flb_input_dyntag_flush(struct flb_input_dyntag *dt, size_t *size)
 
     /* Set it busy as it likely it's a reference for an outgoing task */
     dt->busy = FLB_TRUE;
+    dyntag_unindex(dt);
 
     //msgpack_sbuffer_init(&dt->mp_sbuf);
     //msgpack_packer_init(&dt->mp_pck, &dt->mp_sbuf, msgpack_sbuffer_write);
@@ -49,6 +49,7 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <assert.h>
+#include <sys/uio.h>
 
 #include <monkey/mk_core.h>
 #include <fluent-bit/flb_info.h>
@@ -125,7 +126,7 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
 
         MK_EVENT_NEW(&u_conn->event);
         u_conn->thread = th;
-        ret = mk_event_add(u->evl,
+        ret = mk_event_add(u_conn->evl,
                            fd,
                            FLB_ENGINE_EV_THREAD,
                            MK_EVENT_WRITE, &u_conn->event);
@@ -148,7 +149,7 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
         mask = u_conn->event.mask;
 
         /* We got a notification, remove the event registered */
-        ret = mk_event_del(u->evl, &u_conn->event);
+        ret = mk_event_del(u_conn->evl, &u_conn->event);
         if (ret == -1) {
             flb_error("[io] connect event handler error");
             flb_socket_close(fd);
@@ -198,11 +199,32 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
     return 0;
 }
 
-static int net_io_write(struct flb_upstream_conn *u_conn,
-                        void *data, size_t len, size_t *out_len)
+/* Skip the iovec entries covered by 'bytes', returns the entries left */
+static inline int iov_advance(struct iovec **iov, int *iovcnt, size_t bytes)
+{
+    struct iovec *v = *iov;
+
+    while (*iovcnt > 0 && bytes >= v->iov_len) {
+        bytes -= v->iov_len;
+        v++;
+        (*iovcnt)--;
+    }
+
+    if (*iovcnt > 0) {
+        v->iov_base = (char *) v->iov_base + bytes;
+        v->iov_len -= bytes;
+    }
+    *iov = v;
+
+    return *iovcnt;
+}
+
+static int net_io_writev(struct flb_upstream_conn *u_conn,
+                         struct iovec *iov, int iovcnt, size_t *out_len)
 {
     int ret;
     int tries = 0;
+    ssize_t bytes;
     size_t total = 0;
 
     if (u_conn->fd <= 0) {
@@ -214,9 +236,9 @@ static int net_io_write(struct flb_upstream_conn *u_conn,
         }
     }
 
-    while (total < len) {
-        ret = send(u_conn->fd, (char *) data + total, len - total, 0);
-        if (ret == -1) {
+    while (iovcnt > 0) {
+        bytes = writev(u_conn->fd, iov, iovcnt);
+        if (bytes == -1) {
             if (errno == EAGAIN) {
                 /*
                  * FIXME: for now we are handling this in a very lazy way,
@@ -233,7 +255,8 @@ static int net_io_write(struct flb_upstream_conn *u_conn,
             return -1;
         }
         tries = 0;
-        total += ret;
+        total += bytes;
+        iov_advance(&iov, &iovcnt, bytes);
     }
 
     *out_len = total;
@@ -241,23 +264,23 @@ static int net_io_write(struct flb_upstream_conn *u_conn,
 }
 
 /*
- * Perform Async socket write(2) operations. This function depends on a
+ * Perform Async socket writev(2) operations. This function depends on a
  * maine event-loop and the co-routines interface to yield/resume once
  * sockets are ready to continue.
  *
  * Intentionally we register/de-register the socket file descriptor from
  * the event loop each time when we require to do some work.
  */
-static FLB_INLINE int net_io_write_async(struct flb_thread *th,
-                                         struct flb_upstream_conn *u_conn,
-                                         void *data, size_t len, size_t *out_len)
+static FLB_INLINE int net_io_writev_async(struct flb_thread *th,
+                                          struct flb_upstream_conn *u_conn,
+                                          struct iovec *iov, int iovcnt,
+                                          size_t *out_len)
 {
     int ret = 0;
     int error;
     uint32_t mask;
     ssize_t bytes;
     size_t total = 0;
-    size_t to_send;
     socklen_t slen = sizeof(error);
     char so_error_buf[256];
     struct flb_upstream *u = u_conn->u;
@@ -265,29 +288,17 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
  retry:
     error = 0;
 
-    if (len - total > 524288) {
-        to_send = 524288;
-    }
-    else {
-        to_send = (len - total);
-    }
-    bytes = send(u_conn->fd, (char *) data + total, to_send, 0);
+    bytes = writev(u_conn->fd, iov, iovcnt);
 
 #ifdef FLB_HAVE_TRACE
-    if (bytes > 0) {
-        flb_trace("[io thread=%p] [fd %i] write_async(2)=%d (%lu/%lu)",
-                  th, u_conn->fd, bytes, total + bytes, len);
-    }
-    else {
-        flb_trace("[io thread=%p] [fd %i] write_async(2)=%d (%lu/%lu)",
-                  th, u_conn->fd, bytes, total, len);
-    }
+    flb_trace("[io thread=%p] [fd %i] writev_async(2)=%d (%lu)",
+              th, u_conn->fd, bytes, total + (bytes > 0 ? bytes : 0));
 #endif
 
     if (bytes == -1) {
         if (errno == EAGAIN) {
             u_conn->thread = th;
-            ret = mk_event_add(u->evl,
+            ret = mk_event_add(u_conn->evl,
                                u_conn->fd,
                                FLB_ENGINE_EV_THREAD,
                                MK_EVENT_WRITE, &u_conn->event);
@@ -309,7 +320,7 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
             mask = u_conn->event.mask;
 
             /* We got a notification, remove the event registered */
-            ret = mk_event_del(u->evl, &u_conn->event);
+            ret = mk_event_del(u_conn->evl, &u_conn->event);
             if (ret == -1) {
                 return -1;
             }
@@ -347,11 +358,11 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
 
     /* Update counters */
     total += bytes;
-    if (total < len) {
+    if (iov_advance(&iov, &iovcnt, bytes) > 0) {
         if (u_conn->event.status == MK_EVENT_NONE) {
             u_conn->event.mask = MK_EVENT_EMPTY;
             u_conn->thread = th;
-            ret = mk_event_add(u->evl,
+            ret = mk_event_add(u_conn->evl,
                                u_conn->fd,
                                FLB_ENGINE_EV_THREAD,
                                MK_EVENT_WRITE, &u_conn->event);
@@ -369,12 +380,12 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
 
     if (u_conn->event.status & MK_EVENT_REGISTERED) {
         /* We got a notification, remove the event registered */
-        ret = mk_event_del(u->evl, &u_conn->event);
+        ret = mk_event_del(u_conn->evl, &u_conn->event);
         assert(ret == 0);
     }
 
     *out_len = total;
-    return bytes;
+    return total;
 }
 
 static ssize_t net_io_read(struct flb_upstream_conn *u_conn,
@@ -395,7 +406,6 @@ static FLB_INLINE ssize_t net_io_read_async(struct flb_thread *th,
                                             void *buf, size_t len)
 {
     int ret;
-    struct flb_upstream *u = u_conn->u;
 
  retry_read:
 
@@ -403,7 +413,7 @@ static FLB_INLINE ssize_t net_io_read_async(struct flb_thread *th,
     if (ret == -1) {
         if (errno == EAGAIN) {
             u_conn->thread = th;
-            ret = mk_event_add(u->evl,
+            ret = mk_event_add(u_conn->evl,
                                u_conn->fd,
                                FLB_ENGINE_EV_THREAD,
                                MK_EVENT_READ, &u_conn->event);
@@ -427,32 +437,58 @@ static FLB_INLINE ssize_t net_io_read_async(struct flb_thread *th,
     return ret;
 }
 
-/* Write data to an upstream connection/server */
-int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
-                     size_t len, size_t *out_len)
+/*
+ * Write a set of buffers to an upstream connection/server, on plain TCP it
+ * takes a single writev(2) when the socket can take all the data. The iovec
+ * array is used as a cursor, the caller must not reuse it.
+ */
+int flb_io_net_writev(struct flb_upstream_conn *u_conn,
+                      struct iovec *iov, int iovcnt, size_t *out_len)
 {
+    int i;
     int ret = -1;
+    size_t total = 0;
+#ifdef FLB_HAVE_TLS
+    size_t bytes;
+#endif
     struct flb_upstream *u = u_conn->u;
 
 #if defined (FLB_HAVE_FLUSH_LIBCO)
     struct flb_thread *th = pthread_getspecific(flb_thread_key);
-    flb_trace("[io thread=%p] [net_write] trying %zd bytes",
-              th, len);
 #else
     void *th = NULL;
-    flb_trace("[io] [net_write] trying %zd bytes", len);
 #endif
+
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    flb_trace("[io thread=%p] [net_writev] trying %zd bytes in %i buffers",
+              th, total, iovcnt);
+
+    *out_len = 0;
     if (u->flags & FLB_IO_TCP) {
         if (u->flags & FLB_IO_ASYNC) {
-            ret = net_io_write_async(th, u_conn, data, len, out_len);
+            ret = net_io_writev_async(th, u_conn, iov, iovcnt, out_len);
         }
         else {
-            ret = net_io_write(u_conn, data, len, out_len);
+            ret = net_io_writev(u_conn, iov, iovcnt, out_len);
         }
     }
 #ifdef FLB_HAVE_TLS
     else if (u->flags & FLB_IO_TLS) {
-        ret = flb_io_tls_net_write(th, u_conn, data, len, out_len);
+        /* TLS records are built per buffer */
+        for (i = 0; i < iovcnt; i++) {
+            ret = flb_io_tls_net_write(th, u_conn,
+                                       iov[i].iov_base, iov[i].iov_len,
+                                       &bytes);
+            if (ret == -1) {
+                break;
+            }
+            *out_len += bytes;
+        }
+        if (ret != -1) {
+            ret = *out_len;
+        }
     }
 #endif
 
@@ -461,16 +497,23 @@ int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
         u_conn->fd = -1;
     }
 
-#if defined (FLB_HAVE_FLUSH_LIBCO)
-    flb_trace("[io thread=%p] [net_write] ret=%i total=%lu/%lu",
-              th, ret, *out_len, len);
-#else
-    flb_trace("[io] [net_write] ret=%i total=%i",
-              ret, *out_len);
-#endif
+    flb_trace("[io thread=%p] [net_writev] ret=%i total=%lu/%lu",
+              th, ret, *out_len, total);
     return ret;
 }
 
+/* Write data to an upstream connection/server */
+int flb_io_net_write(struct flb_upstream_conn *u_conn, void *data,
+                     size_t len, size_t *out_len)
+{
+    struct iovec iov;
+
+    iov.iov_base = data;
+    iov.iov_len = len;
+
+    return flb_io_net_writev(u_conn, &iov, 1, out_len);
+}
+
 ssize_t flb_io_net_read(struct flb_upstream_conn *u_conn, void *buf, size_t len)
 {
     int ret = -1;
@@ -54,11 +54,10 @@ static inline int io_tls_event_switch(struct flb_upstream_conn *u_conn,
 {
     int ret;
     struct mk_event *event;
-    struct flb_upstream *u = u_conn->u;
 
     event = &u_conn->event;
     if ((event->mask & mask) == 0) {
-        ret = mk_event_add(u->evl,
+        ret = mk_event_add(u_conn->evl,
                            event->fd,
                            FLB_ENGINE_EV_THREAD,
                            mask, &u_conn->event);
@@ -320,7 +319,7 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
          * FIXME: if we need multiple reads we are invoking the same
          * system call multiple times.
          */
-        ret = mk_event_add(u->evl,
+        ret = mk_event_add(u_conn->evl,
                            u_conn->event.fd,
                            FLB_ENGINE_EV_THREAD,
                            flag, &u_conn->event);
@@ -336,14 +335,14 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
     }
 
     if (u_conn->event.status & MK_EVENT_REGISTERED) {
-        mk_event_del(u->evl, &u_conn->event);
+        mk_event_del(u_conn->evl, &u_conn->event);
     }
     flb_trace("[io_tls] connection OK");
     return 0;
 
  error:
     if (u_conn->event.status & MK_EVENT_REGISTERED) {
-        mk_event_del(u->evl, &u_conn->event);
+        mk_event_del(u_conn->evl, &u_conn->event);
     }
     flb_tls_session_destroy(u_conn->tls_session);
     u_conn->tls_session = NULL;
@@ -383,7 +382,6 @@ int flb_io_tls_net_write(struct flb_thread *th, struct flb_upstream_conn *u_conn
 {
     int ret;
     size_t total = 0;
-    struct flb_upstream *u = u_conn->u;
 
     u_conn->thread = th;
 
@@ -417,6 +415,6 @@ int flb_io_tls_net_write(struct flb_thread *th, struct flb_upstream_conn *u_conn
     }
 
     *out_len = total;
-    mk_event_del(u->evl, &u_conn->event);
+    mk_event_del(u_conn->evl, &u_conn->event);
     return 0;
 }
@@ -0,0 +1,178 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_lines.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FLB_LINES_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Line breaks scanner: flb_lines_find() looks for every occurrence of the
+ * byte 'c' (usually '\n') in a buffer and stores their offsets in 'pos'
+ * until 'max' are found, so callers can cut all the lines of a chunk in
+ * one pass instead of calling memchr(3) once per line. On x86 the buffer
+ * is compared 16 (SSE2) or 32 (AVX2) bytes at a time, the AVX2 version is
+ * selected at runtime when the CPU supports it.
+ *
+ * Vector compares win on short lines. When no break shows up for
+ * FLB_LINES_LONG bytes, the rest of that line is left to memchr(3),
+ * which skips long runs faster.
+ */
+
+#define FLB_LINES_LONG   128
+
+static size_t find_generic(const char *buf, size_t len, char c,
+                           size_t *pos, size_t max, size_t i, size_t n)
+{
+    const char *p;
+
+    while (n < max && i < len) {
+        p = memchr(buf + i, c, len - i);
+        if (!p) {
+            break;
+        }
+        i = p - buf;
+        pos[n++] = i++;
+    }
+
+    return n;
+}
+
+#ifdef FLB_LINES_X86
+/* Store the offsets of the bits set in 'mask', returns -1 if 'pos' is full */
+static inline int mask_store(uint32_t mask, size_t base,
+                             size_t *pos, size_t max, size_t *n)
+{
+    while (mask) {
+        if (*n == max) {
+            return -1;
+        }
+        pos[(*n)++] = base + __builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+
+    return 0;
+}
+
+__attribute__((target("sse2")))
+static size_t find_sse2(const char *buf, size_t len, char c,
+                        size_t *pos, size_t max)
+{
+    size_t i = 0;
+    size_t n = 0;
+    size_t last = 0;
+    uint32_t mask;
+    const char *p;
+    __m128i v;
+    __m128i needle = _mm_set1_epi8(c);
+
+    while (i + 16 <= len) {
+        v = _mm_loadu_si128((const __m128i *) (buf + i));
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (mask == 0) {
+            i += 16;
+            if (i - last < FLB_LINES_LONG) {
+                continue;
+            }
+
+            /* Long line, skip to its end */
+            p = memchr(buf + i, c, len - i);
+            if (!p || n == max) {
+                return n;
+            }
+            i = p - buf;
+            pos[n++] = i++;
+            last = i;
+            continue;
+        }
+
+        if (mask_store(mask, i, pos, max, &n) == -1) {
+            return n;
+        }
+        last = pos[n - 1] + 1;
+        i += 16;
+    }
+
+    return find_generic(buf, len, c, pos, max, i, n);
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const char *buf, size_t len, char c,
+                        size_t *pos, size_t max)
+{
+    size_t i = 0;
+    size_t n = 0;
+    size_t last = 0;
+    uint32_t mask;
+    const char *p;
+    __m256i v;
+    __m256i needle = _mm256_set1_epi8(c);
+
+    while (i + 32 <= len) {
+        v = _mm256_loadu_si256((const __m256i *) (buf + i));
+        mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (mask == 0) {
+            i += 32;
+            if (i - last < FLB_LINES_LONG) {
+                continue;
+            }
+
+            /* Long line, skip to its end */
+            p = memchr(buf + i, c, len - i);
+            if (!p || n == max) {
+                return n;
+            }
+            i = p - buf;
+            pos[n++] = i++;
+            last = i;
+            continue;
+        }
+
+        if (mask_store(mask, i, pos, max, &n) == -1) {
+            return n;
+        }
+        last = pos[n - 1] + 1;
+        i += 32;
+    }
+
+    return find_generic(buf, len, c, pos, max, i, n);
+}
+#endif
+
+/* Returns the number of offsets stored in 'pos' */
+size_t flb_lines_find(const char *buf, size_t len, char c,
+                      size_t *pos, size_t max)
+{
+#ifdef FLB_LINES_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return find_avx2(buf, len, c, pos, max);
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return find_sse2(buf, len, c, pos, max);
+    }
+#endif
+
+    return find_generic(buf, len, c, pos, max, 0, 0);
+}
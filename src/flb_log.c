@@ -24,6 +24,8 @@
 #include <inttypes.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sched.h>
 #include <fcntl.h>
 
 #include <monkey/mk_core.h>
@@ -32,6 +34,7 @@
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_worker.h>
 #include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_ring.h>
 
 FLB_TLS_DEFINE(struct flb_log, flb_log_ctx)
 
@@ -40,19 +43,26 @@ static int pth_init;
 static pthread_cond_t  pth_cond;
 static pthread_mutex_t pth_mutex;
 
-/* Simple structure to dispatch messages to the log collector */
+/* Set while the collector takes messages from the rings */
+static int log_running;
+
+/*
+ * Simple structure to dispatch messages to the log collector, each thread
+ * formats its messages in place on the slots of its own ring.
+ */
 struct log_message {
-    size_t size;
-    char   msg[1024 - sizeof(size_t)];
+    uint16_t type;
+    uint16_t header;         /* size of the time and type prefix */
+    uint32_t size;
+    char     msg[FLB_LOG_MSG_SIZE - 8];
 };
 
-static inline int consume_byte(flb_pipefd_t fd)
+static inline int consume_byte(flb_pipefd_t fd, uint64_t *val)
 {
     int ret;
-    uint64_t val;
 
     /* We need to consume the byte */
-    ret = flb_pipe_r(fd, &val, sizeof(val));
+    ret = flb_pipe_r(fd, val, sizeof(uint64_t));
     if (ret <= 0) {
         flb_errno();
         return -1;
@@ -61,59 +71,341 @@ static inline int consume_byte(flb_pipefd_t fd)
     return 0;
 }
 
-static inline int log_push(struct log_message *msg, struct flb_log *log)
+/* Wake up the collector, unless it was already notified */
+static inline void log_notify(struct flb_worker *w)
+{
+    int ret;
+    uint64_t val = 1;
+
+    if (__atomic_exchange_n(&w->log_notified, 1, __ATOMIC_SEQ_CST) == 0) {
+        ret = flb_pipe_w(w->log[1], &val, sizeof(val));
+        if (ret == -1) {
+            perror("write");
+        }
+    }
+}
+
+/* Consume a notification, further messages will send a new one */
+static inline void log_notify_consume(struct flb_worker *w)
+{
+    uint64_t val;
+
+    consume_byte(w->log[0], &val);
+    __atomic_store_n(&w->log_notified, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Compose the time and type prefix of a message */
+static int log_header(char *buf, size_t size, int type)
+{
+    int len;
+    time_t now;
+    const char *header_color = NULL;
+    const char *header_title = NULL;
+    const char *bold_color = ANSI_BOLD;
+    const char *reset_color = ANSI_RESET;
+    struct tm result;
+    struct tm *current;
+
+    switch (type) {
+    case FLB_LOG_INFO:
+        header_title = "info";
+        header_color = ANSI_GREEN;
+        break;
+    case FLB_LOG_WARN:
+        header_title = "warn";
+        header_color = ANSI_YELLOW;
+        break;
+    case FLB_LOG_ERROR:
+        header_title = "error";
+        header_color = ANSI_RED;
+        break;
+    case FLB_LOG_DEBUG:
+        header_title = "debug";
+        header_color = ANSI_YELLOW;
+        break;
+    case FLB_LOG_TRACE:
+        header_title = "trace";
+        header_color = ANSI_BLUE;
+        break;
+    }
+
+    /* Only print colors to a terminal */
+    if (!isatty(STDOUT_FILENO)) {
+        header_color = "";
+        bold_color = "";
+        reset_color = "";
+    }
+
+    now = time(NULL);
+    current = localtime_r(&now, &result);
+
+    len = snprintf(buf, size,
+                   "%s[%s%i/%02i/%02i %02i:%02i:%02i%s]%s [%s%5s%s] ",
+                   /*      time     */                    /* type */
+
+                   /* time variables */
+                   bold_color, reset_color,
+                   current->tm_year + 1900,
+                   current->tm_mon + 1,
+                   current->tm_mday,
+                   current->tm_hour,
+                   current->tm_min,
+                   current->tm_sec,
+                   bold_color, reset_color,
+
+                   /* type format */
+                   header_color, header_title, reset_color);
+    if (len >= size) {
+        len = size - 1;
+    }
+
+    return len;
+}
+
+/* Open the log file, it's kept open until it's rotated or reopened */
+static void log_open(struct flb_log *log)
+{
+    if (log->fd != -1) {
+        close(log->fd);
+        log->fd = -1;
+    }
+
+    if (log->type != FLB_LOG_FILE) {
+        return;
+    }
+
+    log->fd = open(log->out, O_CREAT | O_WRONLY | O_APPEND, 0666);
+    if (log->fd == -1) {
+        fprintf(stderr, "[log] error opening log file %s. Using stderr.\n",
+                log->out);
+    }
+}
+
+/* Reopen the log file if it was moved or removed */
+static void log_check_rotation(struct flb_log *log)
+{
+    int ret;
+    struct stat st_fd;
+    struct stat st_path;
+
+    if (log->type != FLB_LOG_FILE) {
+        return;
+    }
+
+    if (log->fd == -1) {
+        log_open(log);
+        return;
+    }
+
+    ret = stat(log->out, &st_path);
+    if (ret == -1 || fstat(log->fd, &st_fd) == -1 ||
+        st_path.st_ino != st_fd.st_ino || st_path.st_dev != st_fd.st_dev) {
+        log_open(log);
+    }
+}
+
+/* Write a batch of messages */
+static void log_write(struct flb_log *log, struct iovec *iov, int count)
 {
     int fd;
-    int ret = -1;
+    ssize_t bytes;
 
-    if (log->type == FLB_LOG_STDERR) {
-        return write(STDERR_FILENO, msg->msg, msg->size);
+    if (log->type == FLB_LOG_FILE && log->fd != -1) {
+        fd = log->fd;
+    }
+    else {
+        fd = STDERR_FILENO;
     }
-    else if (log->type == FLB_LOG_FILE) {
-        fd = open(log->out, O_CREAT | O_WRONLY | O_APPEND, 0666);
-        if (fd == -1) {
-            fprintf(stderr, "[log] error opening log file %s. Using stderr.\n",
-                    log->out);
-            return write(STDERR_FILENO, msg->msg, msg->size);
+
+    while (count > 0) {
+        bytes = writev(fd, iov, count);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        /* Skip what was written, if the write was short try again */
+        while (count > 0 && bytes >= iov->iov_len) {
+            bytes -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + bytes;
+            iov->iov_len -= bytes;
         }
-        ret = write(fd, msg->msg, msg->size);
-        close(fd);
     }
+}
+
+/* Check if the message repeats the last one, otherwise remember it */
+static int log_repeated(struct flb_log *log, struct log_message *msg)
+{
+    size_t size = msg->size - msg->header;
 
-    return ret;
+    if (msg->type == log->last_type && size == log->last_size &&
+        memcmp(msg->msg + msg->header, log->last, size) == 0) {
+        log->repeated++;
+        return FLB_TRUE;
+    }
+
+    memcpy(log->last, msg->msg + msg->header, size);
+    log->last_size = size;
+    log->last_type = msg->type;
+
+    return FLB_FALSE;
 }
 
-static inline int log_read(flb_pipefd_t fd, struct flb_log *log)
+/* Compose the notice for the repeated messages skipped */
+static int log_repeated_notice(struct flb_log *log)
 {
-    int bytes;
-    struct log_message msg;
+    int len;
+    size_t size = sizeof(log->notice);
 
-    /*
-     * Since write operations to the pipe are always atomic 'if' they are
-     * under the PIPE_BUF limit (4KB on Linux) and our messages are always 1KB,
-     * we can trust we will always get a full message on each read(2).
-     */
-    bytes = flb_pipe_r(fd, &msg, sizeof(struct log_message));
-    if (bytes <= 0) {
-        perror("bytes");
-        return -1;
+    len = log_header(log->notice, size, FLB_LOG_INFO);
+    len += snprintf(log->notice + len, size - len,
+                    "[log] last message repeated %i times\n", log->repeated);
+    if (len >= size) {
+        len = size - 1;
+    }
+    log->repeated = 0;
+
+    return len;
+}
+
+/*
+ * Write the messages queued by a thread. They are written straight from
+ * the ring slots with one writev(2) every FLB_LOG_IOV messages, repeated
+ * messages are replaced by a notice.
+ */
+static void log_drain(struct flb_log *log, struct flb_worker *w)
+{
+    int len;
+    int count = 0;
+    int notice = FLB_FALSE;
+    uint64_t n = 0;
+    uint64_t dropped;
+    char buf[256];
+    struct iovec iov[FLB_LOG_IOV];
+    struct iovec drop;
+    struct log_message *msg;
+
+    while ((msg = flb_ring_peek(w->log_ring, n)) != NULL) {
+        /* Make room for the notice and the message */
+        if (count + 2 > FLB_LOG_IOV) {
+            log_write(log, iov, count);
+            flb_ring_release(w->log_ring, n);
+            n = 0;
+            count = 0;
+            notice = FLB_FALSE;
+        }
+
+        if (log_repeated(log, msg) == FLB_TRUE) {
+            n++;
+            continue;
+        }
+
+        if (log->repeated > 0) {
+            /* The notice buffer can be referenced once per batch */
+            if (notice == FLB_TRUE) {
+                log_write(log, iov, count);
+                flb_ring_release(w->log_ring, n);
+                n = 0;
+                count = 0;
+            }
+            iov[count].iov_base = log->notice;
+            iov[count].iov_len = log_repeated_notice(log);
+            count++;
+            notice = FLB_TRUE;
+        }
+
+        iov[count].iov_base = msg->msg;
+        iov[count].iov_len = msg->size;
+        count++;
+        n++;
+    }
+
+    if (count > 0) {
+        log_write(log, iov, count);
+    }
+    if (n > 0) {
+        flb_ring_release(w->log_ring, n);
     }
-    log_push(&msg, log);
 
-    return bytes;
+    /* Messages that did not fit in the ring */
+    dropped = __atomic_exchange_n(&w->log_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        len = log_header(buf, sizeof(buf), FLB_LOG_WARN);
+        len += snprintf(buf + len, sizeof(buf) - len,
+                        "[log] %" PRIu64 " messages dropped\n", dropped);
+        if (len >= sizeof(buf)) {
+            len = sizeof(buf) - 1;
+        }
+        drop.iov_base = buf;
+        drop.iov_len = len;
+        log_write(log, &drop, 1);
+    }
+}
+
+/* Write everything queued by all threads */
+static void log_drain_all(struct flb_log *log)
+{
+    struct mk_list *head;
+    struct flb_worker *w;
+    struct flb_config *config = log->worker->config;
+
+    log_drain(log, log->worker);
+    mk_list_foreach(head, &config->workers) {
+        w = mk_list_entry(head, struct flb_worker, _head);
+        if (w->log_ring) {
+            log_drain(log, w);
+        }
+    }
+}
+
+/* Periodic tasks: flush the repeated messages notice, detect rotation */
+static void log_timer(struct flb_log *log)
+{
+    struct iovec iov;
+
+    if (log->repeated > 0) {
+        iov.iov_base = log->notice;
+        iov.iov_len = log_repeated_notice(log);
+        log_write(log, &iov, 1);
+
+        /* The next message starts a new sequence */
+        log->last_size = 0;
+        log->last_type = -1;
+    }
+
+    log_check_rotation(log);
 }
 
 /* Central collector of messages */
 static void log_worker_collector(void *data)
 {
     int run = FLB_TRUE;
+    int fd;
+    uint64_t val;
     struct mk_event *event;
     struct flb_log *log = data;
 
     FLB_TLS_SET(flb_log_ctx, log);
 
+    log_open(log);
+
+    /* Timer for periodic tasks */
+    MK_EVENT_NEW(&log->event_timer);
+    fd = mk_event_timeout_create(log->evl, FLB_LOG_TIMER, 0,
+                                 &log->event_timer);
+    if (fd == -1) {
+        fprintf(stderr, "[log] could not create timer\n");
+    }
+
     /* Signal the caller */
     pthread_mutex_lock(&pth_mutex);
+    __atomic_store_n(&log_running, FLB_TRUE, __ATOMIC_RELEASE);
     pth_init = FLB_TRUE;
     pthread_cond_signal(&pth_cond);
     pthread_mutex_unlock(&pth_mutex);
@@ -121,16 +413,43 @@ static void log_worker_collector(void *data)
     while (run) {
         mk_event_wait(log->evl);
         mk_event_foreach(event, log->evl) {
-            if (event->type == FLB_LOG_EVENT) {
-                log_read(event->fd, log);
+            if (event == &log->event_timer) {
+                consume_byte(event->fd, &val);
+                log_timer(log);
+            }
+            else if (event->type == FLB_LOG_EVENT) {
+                /* The event is the first member of the worker */
+                log_notify_consume((struct flb_worker *) event);
+                log_drain(log, (struct flb_worker *) event);
             }
             else if (event->type == FLB_LOG_MNG) {
-                consume_byte(event->fd);
-                run = FLB_FALSE;
+                consume_byte(event->fd, &val);
+                if (val == FLB_LOG_MNG_REOPEN) {
+                    log_open(log);
+                }
+                else {
+                    run = FLB_FALSE;
+                }
             }
         }
     }
 
+    /* Write what is left, late messages are written by their threads */
+    __atomic_store_n(&log_running, FLB_FALSE, __ATOMIC_RELEASE);
+    log_drain_all(log);
+    if (log->repeated > 0) {
+        log_timer(log);
+    }
+
+    if (fd != -1) {
+        mk_event_timeout_destroy(log->evl, &log->event_timer);
+        close(fd);
+    }
+    if (log->fd != -1) {
+        close(log->fd);
+        log->fd = -1;
+    }
+
     pthread_exit(NULL);
 }
 
@@ -141,10 +460,21 @@ int flb_log_worker_init(void *data)
     struct flb_config *config = worker->config;
     struct flb_log *log = config->log;
 
-    /* Pipe to communicate Thread with worker log-collector */
+    /* Ring where the thread queues its messages */
+    worker->log_ring = flb_ring_create(sizeof(struct log_message),
+                                       FLB_LOG_RING_SIZE);
+    if (!worker->log_ring) {
+        return -1;
+    }
+    worker->log_notified = FLB_FALSE;
+    worker->log_dropped = 0;
+
+    /* Pipe to notify the worker log-collector */
     ret = flb_pipe_create(worker->log);
     if (ret == -1) {
         perror("pipe");
+        flb_ring_destroy(worker->log_ring);
+        worker->log_ring = NULL;
         return -1;
     }
 
@@ -155,12 +485,27 @@ int flb_log_worker_init(void *data)
     if (ret == -1) {
         close(worker->log[0]);
         close(worker->log[1]);
+        flb_ring_destroy(worker->log_ring);
+        worker->log_ring = NULL;
         return -1;
     }
 
     return 0;
 }
 
+void flb_log_worker_destroy(void *data)
+{
+    struct flb_worker *worker = data;
+
+    if (!worker->log_ring) {
+        return;
+    }
+
+    flb_pipe_destroy(worker->log);
+    flb_ring_destroy(worker->log_ring);
+    worker->log_ring = NULL;
+}
+
 int flb_log_set_level(struct flb_config *config, int level)
 {
     config->log->level = level;
@@ -180,6 +525,28 @@ int flb_log_set_file(struct flb_config *config, char *out)
         log->out = NULL;
     }
 
+    /* Let a running collector pick the new destination */
+    flb_log_reopen(config);
+
+    return 0;
+}
+
+/* Ask the collector to reopen the log file, safe from a signal handler */
+int flb_log_reopen(struct flb_config *config)
+{
+    int ret;
+    uint64_t val = FLB_LOG_MNG_REOPEN;
+    struct flb_log *log = config->log;
+
+    if (!log || log->tid == 0) {
+        return -1;
+    }
+
+    ret = flb_pipe_w(log->ch_mng[1], &val, sizeof(val));
+    if (ret == -1) {
+        return -1;
+    }
+
     return 0;
 }
 
@@ -213,6 +580,10 @@ struct flb_log *flb_log_init(struct flb_config *config, int type,
     log->out   = out;
     log->evl   = evl;
     log->tid   = 0;
+    log->fd    = -1;
+    log->repeated  = 0;
+    log->last_size = 0;
+    log->last_type = -1;
 
     ret = flb_pipe_create(log->ch_mng);
     if (ret == -1) {
@@ -296,96 +667,76 @@ struct flb_log *flb_log_init(struct flb_config *config, int type,
     return log;
 }
 
+/*
+ * Get a ring slot for a message. If the collector is behind the thread waits
+ * for room, except the collector itself which can only drop the message.
+ * Once the collector is gone nobody frees a slot: 'tmp' is returned and the
+ * message is written directly.
+ */
+static struct log_message *log_reserve(struct flb_worker *w,
+                                       struct log_message *tmp)
+{
+    struct log_message *msg;
+
+    while (!(msg = flb_ring_reserve(w->log_ring))) {
+        if (FLB_TLS_GET(flb_log_ctx)) {
+            __atomic_fetch_add(&w->log_dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+            return tmp;
+        }
+        log_notify(w);
+        sched_yield();
+    }
+
+    return msg;
+}
+
 void flb_log_print(int type, const char *file, int line, const char *fmt, ...)
 {
     int len;
     int total;
-    time_t now;
-    const char *header_color = NULL;
-    const char *header_title = NULL;
-    const char *bold_color = ANSI_BOLD;
-    const char *reset_color = ANSI_RESET;
-    struct tm result;
-    struct tm *current;
-    struct log_message msg = {0};
+    struct log_message tmp;
+    struct log_message *msg;
+    struct flb_worker *w;
     va_list args;
 
-    va_start(args, fmt);
-
-    switch (type) {
-    case FLB_LOG_INFO:
-        header_title = "info";
-        header_color = ANSI_GREEN;
-        break;
-    case FLB_LOG_WARN:
-        header_title = "warn";
-        header_color = ANSI_YELLOW;
-        break;
-    case FLB_LOG_ERROR:
-        header_title = "error";
-        header_color = ANSI_RED;
-        break;
-    case FLB_LOG_DEBUG:
-        header_title = "debug";
-        header_color = ANSI_YELLOW;
-        break;
-    case FLB_LOG_TRACE:
-        header_title = "trace";
-        header_color = ANSI_BLUE;
-        break;
+    w = flb_worker_get();
+    if (w && w->log_ring && __atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+        msg = log_reserve(w, &tmp);
+        if (!msg) {
+            return;
+        }
     }
-
-    /* Only print colors to a terminal */
-    if (!isatty(STDOUT_FILENO)) {
-        header_color = "";
-        bold_color = "";
-        reset_color = "";
+    else {
+        msg = &tmp;
     }
 
-    now = time(NULL);
-    current = localtime_r(&now, &result);
+    len = log_header(msg->msg, sizeof(msg->msg) - 1, type);
 
-    len = snprintf(msg.msg, sizeof(msg.msg) - 1,
-                   "%s[%s%i/%02i/%02i %02i:%02i:%02i%s]%s [%s%5s%s] ",
-                   /*      time     */                    /* type */
-
-                   /* time variables */
-                   bold_color, reset_color,
-                   current->tm_year + 1900,
-                   current->tm_mon + 1,
-                   current->tm_mday,
-                   current->tm_hour,
-                   current->tm_min,
-                   current->tm_sec,
-                   bold_color, reset_color,
-
-                   /* type format */
-                   header_color, header_title, reset_color);
-
-    total = vsnprintf(msg.msg + len,
-                      (sizeof(msg.msg) - 2) - len,
+    va_start(args, fmt);
+    total = vsnprintf(msg->msg + len,
+                      (sizeof(msg->msg) - 2) - len,
                       fmt, args);
+    va_end(args);
     if (total < 0) {
         return;
     }
 
-    total = strlen(msg.msg + len) + len;
-    msg.msg[total++] = '\n';
-    msg.msg[total]   = '\0';
-    msg.size = total;
-    va_end(args);
-
-    struct flb_worker *w;
+    total = strlen(msg->msg + len) + len;
+    msg->msg[total++] = '\n';
+    msg->msg[total]   = '\0';
+    msg->size = total;
+    msg->header = len;
+    msg->type = type;
 
-    w = flb_worker_get();
-    if (w) {
-        int n = flb_pipe_w(w->log[1], &msg, sizeof(msg));
-        if (n == -1) {
-            perror("write");
-        }
+    if (msg != &tmp) {
+        flb_ring_commit(w->log_ring);
+        log_notify(w);
     }
     else {
-        fprintf(stderr, "%s", (char *) msg.msg);
+        fprintf(stderr, "%s", (char *) msg->msg);
     }
 }
 
@@ -400,15 +751,31 @@ int flb_errno_print(int errnum, const char *file, int line)
 
 int flb_log_stop(struct flb_log *log, struct flb_config *config)
 {
-    uint64_t val = FLB_TRUE;
+    uint64_t val = FLB_LOG_MNG_STOP;
+    struct mk_list *head;
+    struct flb_worker *w;
 
     /* Signal the child worker, stop working */
     flb_pipe_w(log->ch_mng[1], &val, sizeof(val));
     pthread_join(log->tid, NULL);
 
+    /* Further messages from this thread go to stderr */
+    if (flb_worker_get() == log->worker) {
+        FLB_TLS_SET(flb_worker_ctx, NULL);
+    }
+
+    /* Threads still running must not look at the released context */
+    mk_list_foreach(head, &config->workers) {
+        w = mk_list_entry(head, struct flb_worker, _head);
+        if (w->log_ctx == log) {
+            __atomic_store_n(&w->log_ctx, NULL, __ATOMIC_RELEASE);
+        }
+    }
+
     /* Release resources */
     mk_event_loop_destroy(log->evl);
     flb_pipe_destroy(log->ch_mng);
+    flb_log_worker_destroy(log->worker);
     flb_free(log->worker);
     flb_free(log);
 
@@ -25,19 +25,57 @@
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_thread_storage.h>
 #include <fluent-bit/flb_metrics.h>
 #include <msgpack.h>
 
-static int id_exists(int id, struct flb_metrics *metrics)
+#include <errno.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+/* Thread shard, stored as (shard + 1) so zero means 'not assigned yet' */
+FLB_TLS_DEFINE(char, flb_metrics_shard_key)
+
+static int shard_next = 0;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+
+static uint64_t hist_bounds[FLB_METRICS_HIST_BUCKETS] = {
+    100, 250, 500,
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 30000000, 60000000, 300000000
+};
+
+static char *hist_labels[FLB_METRICS_HIST_BUCKETS + 1] = {
+    "0.0001", "0.00025", "0.0005",
+    "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5",
+    "1", "2.5", "5", "10", "30", "60", "300", "+Inf"
+};
+
+static void shard_init()
 {
-    struct mk_list *head;
-    struct flb_metric *metric;
+    FLB_TLS_INIT(flb_metrics_shard_key);
+}
 
-    mk_list_foreach(head, &metrics->list) {
-        metric = mk_list_entry(head, struct flb_metric, _head);
-        if (metric->id == id) {
-            return FLB_TRUE;
-        }
+/* Shard of the calling thread, threads get one in a round robin fashion */
+static inline int shard_get()
+{
+    uintptr_t shard;
+
+    shard = (uintptr_t) FLB_TLS_GET(flb_metrics_shard_key);
+    if (shard == 0) {
+        shard = __atomic_fetch_add(&shard_next, 1, __ATOMIC_RELAXED);
+        shard = (shard % FLB_METRICS_SHARDS) + 1;
+        FLB_TLS_SET(flb_metrics_shard_key, (char *) shard);
+    }
+
+    return shard - 1;
+}
+
+static inline int id_exists(int id, struct flb_metrics *metrics)
+{
+    if (metrics->index[id]) {
+        return FLB_TRUE;
     }
 
     return FLB_FALSE;
@@ -46,31 +84,72 @@ static int id_exists(int id, struct flb_metrics *metrics)
 static int id_get(struct flb_metrics *metrics)
 {
     int id;
-    int ret = FLB_FALSE;
 
     /* Try to use 'count' as an id */
     id = metrics->count;
 
-    while ((ret = id_exists(id, metrics)) == FLB_TRUE) {
+    while (id < FLB_METRICS_MAX && id_exists(id, metrics) == FLB_TRUE) {
         id++;
     }
 
+    if (id >= FLB_METRICS_MAX) {
+        return -1;
+    }
     return id;
 }
 
+static inline struct flb_metric *metric_get(int id,
+                                            struct flb_metrics *metrics)
+{
+    if (id < 0 || id >= FLB_METRICS_MAX) {
+        return NULL;
+    }
+
+    return metrics->index[id];
+}
+
+/* Merge the counter shards */
+static uint64_t counter_value(int id, struct flb_metrics *metrics)
+{
+    int i;
+    uint64_t val = 0;
+
+    for (i = 0; i < FLB_METRICS_SHARDS; i++) {
+        val += __atomic_load_n(&metrics->shards[i].val[id], __ATOMIC_RELAXED);
+    }
+
+    return val;
+}
+
+/* Merge the histogram shards, bucket counts are not cumulative */
+static void hist_value(struct flb_metric *m, struct flb_metrics_hist *out)
+{
+    int i;
+    int b;
+    struct flb_metrics_hist *h;
+
+    memset(out, '\0', sizeof(struct flb_metrics_hist));
+    for (i = 0; i < FLB_METRICS_SHARDS; i++) {
+        h = &m->hist[i];
+        out->count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+        out->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+        for (b = 0; b <= FLB_METRICS_HIST_BUCKETS; b++) {
+            out->buckets[b] += __atomic_load_n(&h->buckets[b],
+                                               __ATOMIC_RELAXED);
+        }
+    }
+}
+
 struct flb_metric *flb_metrics_get_id(int id, struct flb_metrics *metrics)
 {
-    struct mk_list *head;
     struct flb_metric *m;
 
-    mk_list_foreach(head, &metrics->list) {
-        m = mk_list_entry(head, struct flb_metric, _head);
-        if (m->id == id) {
-            return m;
-        }
+    m = metric_get(id, metrics);
+    if (m && m->type == FLB_METRIC_COUNTER) {
+        m->val = counter_value(id, metrics);
     }
 
-    return NULL;
+    return m;
 }
 
 struct flb_metrics *flb_metrics_create(char *title)
@@ -78,11 +157,16 @@ struct flb_metrics *flb_metrics_create(char *title)
     int ret;
     struct flb_metrics *metrics;
 
-    metrics = flb_malloc(sizeof(struct flb_metrics));
-    if (!metrics) {
+    pthread_once(&shard_once, shard_init);
+
+    ret = posix_memalign((void **) &metrics, FLB_METRICS_CACHE_LINE,
+                         sizeof(struct flb_metrics));
+    if (ret != 0) {
+        errno = ret;
         flb_errno();
         return NULL;
     }
+    memset(metrics, '\0', sizeof(struct flb_metrics));
     metrics->count = 0;
 
     ret = snprintf(metrics->title, sizeof(metrics->title) - 1, "%s", title);
@@ -97,7 +181,8 @@ struct flb_metrics *flb_metrics_create(char *title)
     return metrics;
 }
 
-int flb_metrics_add(int id, char *title, struct flb_metrics *metrics)
+static int metric_add(int id, int type, char *title,
+                      struct flb_metrics *metrics)
 {
     int ret;
     struct flb_metric *m;
@@ -108,7 +193,9 @@ int flb_metrics_add(int id, char *title, struct flb_metrics *metrics)
         flb_errno();
         return -1;
     }
+    m->type = type;
     m->val = 0;
+    m->hist = NULL;
 
     /* Write title */
     ret = snprintf(m->title, sizeof(m->title) - 1, "%s", title);
@@ -120,7 +207,13 @@ int flb_metrics_add(int id, char *title, struct flb_metrics *metrics)
     m->title_len = strlen(m->title);
 
     /* Assign an ID */
-    if (id >= 0) {
+    if (id >= FLB_METRICS_MAX) {
+        flb_error("[metrics] id=%i is out of range for metric '%s'",
+                  id, metrics->title);
+        flb_free(m);
+        return -1;
+    }
+    else if (id >= 0) {
         /* Check this new ID is available */
         if (id_exists(id, metrics) == FLB_TRUE) {
             flb_error("[metrics] id=%i already exists for metric '%s'",
@@ -131,26 +224,88 @@ int flb_metrics_add(int id, char *title, struct flb_metrics *metrics)
     }
     else {
         id = id_get(metrics);
+        if (id == -1) {
+            flb_error("[metrics] no IDs available for metric '%s'",
+                      metrics->title);
+            flb_free(m);
+            return -1;
+        }
+    }
+
+    if (type == FLB_METRIC_HISTOGRAM) {
+        ret = posix_memalign((void **) &m->hist, FLB_METRICS_CACHE_LINE,
+                             sizeof(struct flb_metrics_hist) *
+                             FLB_METRICS_SHARDS);
+        if (ret != 0) {
+            errno = ret;
+            flb_errno();
+            flb_free(m);
+            return -1;
+        }
+        memset(m->hist, '\0',
+               sizeof(struct flb_metrics_hist) * FLB_METRICS_SHARDS);
     }
 
     /* Link to parent list */
     mk_list_add(&m->_head, &metrics->list);
     m->id = id;
+    metrics->index[id] = m;
     metrics->count++;
 
     return id;
 }
 
+int flb_metrics_add(int id, char *title, struct flb_metrics *metrics)
+{
+    return metric_add(id, FLB_METRIC_COUNTER, title, metrics);
+}
+
+/*
+ * Register a latency histogram. Values are observed in microseconds and
+ * reported in seconds, as Prometheus expects.
+ */
+int flb_metrics_add_histogram(int id, char *title,
+                              struct flb_metrics *metrics)
+{
+    return metric_add(id, FLB_METRIC_HISTOGRAM, title, metrics);
+}
+
 int flb_metrics_sum(int id, size_t val, struct flb_metrics *metrics)
 {
     struct flb_metric *m;
 
-    m = flb_metrics_get_id(id, metrics);
-    if (!m) {
+    m = metric_get(id, metrics);
+    if (!m || m->type != FLB_METRIC_COUNTER) {
+        return -1;
+    }
+
+    __atomic_fetch_add(&metrics->shards[shard_get()].val[id], val,
+                       __ATOMIC_RELAXED);
+    return 0;
+}
+
+int flb_metrics_observe(int id, uint64_t usec, struct flb_metrics *metrics)
+{
+    int b;
+    struct flb_metric *m;
+    struct flb_metrics_hist *h;
+
+    m = metric_get(id, metrics);
+    if (!m || m->type != FLB_METRIC_HISTOGRAM) {
         return -1;
     }
 
-    m->val += val;
+    for (b = 0; b < FLB_METRICS_HIST_BUCKETS; b++) {
+        if (usec <= hist_bounds[b]) {
+            break;
+        }
+    }
+
+    h = &m->hist[shard_get()];
+    __atomic_fetch_add(&h->buckets[b], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, usec, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
     return 0;
 }
 
@@ -164,6 +319,9 @@ int flb_metrics_destroy(struct flb_metrics *metrics)
     mk_list_foreach_safe(head, tmp, &metrics->list) {
         m = mk_list_entry(head, struct flb_metric, _head);
         mk_list_del(&m->_head);
+        if (m->hist) {
+            flb_free(m->hist);
+        }
         flb_free(m);
         count++;
     }
@@ -176,19 +334,64 @@ int flb_metrics_print(struct flb_metrics *metrics)
 {
     struct mk_list *head;
     struct flb_metric *m;
+    struct flb_metrics_hist h;
 
     printf("[metric dump] title => '%s'", metrics->title);
 
     mk_list_foreach(head, &metrics->list) {
         m = mk_list_entry(head, struct flb_metric, _head);
-        printf(", '%s' => %lu", m->title, m->val);
+        if (m->type == FLB_METRIC_HISTOGRAM) {
+            hist_value(m, &h);
+            printf(", '%s' => count=%" PRIu64 " sum=%" PRIu64 "us",
+                   m->title, h.count, h.sum);
+        }
+        else {
+            printf(", '%s' => %" PRIu64, m->title,
+                   counter_value(m->id, metrics));
+        }
     }
     printf("\n");
 
     return 0;
 }
 
-/* Write metrics in messagepack format */
+/*
+ * A histogram is packed as a map:
+ *
+ *   {"buckets": {"0.0001": N, ..., "+Inf": N}, "sum": S, "count": N}
+ *
+ * with cumulative bucket counts and the sum in seconds.
+ */
+static void hist_pack(msgpack_packer *mp_pck, struct flb_metric *m)
+{
+    int b;
+    int len;
+    uint64_t total = 0;
+    struct flb_metrics_hist h;
+
+    hist_value(m, &h);
+
+    msgpack_pack_map(mp_pck, 3);
+    msgpack_pack_str(mp_pck, 7);
+    msgpack_pack_str_body(mp_pck, "buckets", 7);
+    msgpack_pack_map(mp_pck, FLB_METRICS_HIST_BUCKETS + 1);
+    for (b = 0; b <= FLB_METRICS_HIST_BUCKETS; b++) {
+        total += h.buckets[b];
+        len = strlen(hist_labels[b]);
+        msgpack_pack_str(mp_pck, len);
+        msgpack_pack_str_body(mp_pck, hist_labels[b], len);
+        msgpack_pack_uint64(mp_pck, total);
+    }
+
+    msgpack_pack_str(mp_pck, 3);
+    msgpack_pack_str_body(mp_pck, "sum", 3);
+    msgpack_pack_double(mp_pck, h.sum / 1000000.0);
+    msgpack_pack_str(mp_pck, 5);
+    msgpack_pack_str_body(mp_pck, "count", 5);
+    msgpack_pack_uint64(mp_pck, h.count);
+}
+
+/* Write metrics in messagepack format, shards are merged here */
 int flb_metrics_dump_values(char **out_buf, size_t *out_size,
                             struct flb_metrics *me)
 {
@@ -207,7 +410,12 @@ int flb_metrics_dump_values(char **out_buf, size_t *out_size,
         m = mk_list_entry(head, struct flb_metric, _head);
         msgpack_pack_str(&mp_pck, m->title_len);
         msgpack_pack_str_body(&mp_pck, m->title, m->title_len);
-        msgpack_pack_uint64(&mp_pck, m->val);
+        if (m->type == FLB_METRIC_HISTOGRAM) {
+            hist_pack(&mp_pck, m);
+        }
+        else {
+            msgpack_pack_uint64(&mp_pck, counter_value(m->id, me));
+        }
     }
 
     *out_buf  = mp_sbuf.data;
@@ -129,6 +129,26 @@ int flb_net_socket_reset(flb_sockfd_t fd)
     return 0;
 }
 
+/*
+ * Let many sockets bind the same address and port, the Kernel distributes
+ * the incoming datagrams (or connections) among them.
+ */
+int flb_net_socket_reuseport(flb_sockfd_t fd)
+{
+#ifdef SO_REUSEPORT
+    int on = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        flb_errno();
+        return -1;
+    }
+    return 0;
+#else
+    flb_error("[network] SO_REUSEPORT is not supported");
+    return -1;
+#endif
+}
+
 int flb_net_socket_tcp_nodelay(flb_sockfd_t fd)
 {
     int on = 1;
@@ -323,6 +343,56 @@ flb_sockfd_t flb_net_server(char *port, char *listen_addr)
     return fd;
 }
 
+/* Create a non-blocking UDP socket bound to the given address */
+flb_sockfd_t flb_net_server_udp(char *port, char *listen_addr, int reuse_port)
+{
+    flb_sockfd_t fd = -1;
+    int ret;
+    struct addrinfo hints;
+    struct addrinfo *res, *rp;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    ret = getaddrinfo(listen_addr, port, &hints, &res);
+    if (ret != 0) {
+        flb_warn("net_server_udp: getaddrinfo(listen='%s:%s'): %s",
+                 listen_addr, port, gai_strerror(ret));
+        return -1;
+    }
+
+    for (rp = res; rp != NULL; rp = rp->ai_next) {
+        fd = flb_net_socket_create_udp(rp->ai_family, 1);
+        if (fd == -1) {
+            flb_error("Error creating server socket, retrying");
+            continue;
+        }
+
+        flb_net_socket_reset(fd);
+        if (reuse_port == FLB_TRUE && flb_net_socket_reuseport(fd) == -1) {
+            flb_socket_close(fd);
+            continue;
+        }
+
+        ret = bind(fd, rp->ai_addr, rp->ai_addrlen);
+        if (ret == -1) {
+            flb_warn("Cannot bind to %s port %s", listen_addr, port);
+            flb_socket_close(fd);
+            continue;
+        }
+        break;
+    }
+    freeaddrinfo(res);
+
+    if (rp == NULL) {
+        return -1;
+    }
+
+    return fd;
+}
+
 int flb_net_bind(flb_sockfd_t fd, const struct sockaddr *addr,
                  socklen_t addrlen, int backlog)
 {
@@ -30,14 +30,20 @@
 #include <fluent-bit/flb_output.h>
 
 #include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_upstream.h>
 #include <fluent-bit/flb_uri.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_macros.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_plugin_proxy.h>
+#include <fluent-bit/flb_router.h>
 
 #define protcmp(a, b)  strncasecmp(a, b, strlen(a))
 
+#ifdef FLB_HAVE_FLUSH_LIBCO
+FLB_TLS_DEFINE(struct flb_libco_out_params, libco_param_ctx);
+#endif
+
 /* Validate the the output address protocol */
 static int check_protocol(char *prot, char *output)
 {
@@ -261,7 +267,12 @@ struct flb_output_instance *flb_output_new(struct flb_config *config,
     instance->data        = data;
     instance->upstream    = NULL;
     instance->match       = NULL;
+    instance->match_rule  = NULL;
+    instance->worker      = NULL;
     instance->retry_limit = 1;
+    instance->net_keepalive = FLB_FALSE;
+    instance->net_keepalive_idle_timeout = FLB_UPSTREAM_KA_IDLE_TIMEOUT;
+    instance->net_keepalive_max_recycle = FLB_UPSTREAM_KA_MAX_RECYCLE;
     instance->host.name   = NULL;
     instance->host_standby.name = NULL;
 	
@@ -310,6 +321,12 @@ struct flb_output_instance *flb_output_new(struct flb_config *config,
         flb_metrics_add(FLB_METRIC_OUT_RETRY, "retries", instance->metrics);
         flb_metrics_add(FLB_METRIC_OUT_RETRY_FAILED,
                         "retries_failed", instance->metrics);
+        flb_metrics_add_histogram(FLB_METRIC_OUT_FLUSH_TIME,
+                                  "flush_latency_seconds", instance->metrics);
+        flb_metrics_add_histogram(FLB_METRIC_OUT_TASK_AGE,
+                                  "task_age_seconds", instance->metrics);
+        flb_metrics_add_histogram(FLB_METRIC_OUT_RETRY_DELAY,
+                                  "retry_delay_seconds", instance->metrics);
     }
 #endif
 
@@ -347,6 +364,11 @@ int flb_output_set_property(struct flb_output_instance *out, char *k, char *v)
     /* Check if the key is a known/shared property */
     if (prop_key_check("match", k, len) == 0) {
         out->match = tmp;
+
+        /* Drop any previously compiled rule and resolved routes */
+        flb_router_rule_destroy(out->match_rule);
+        out->match_rule = NULL;
+        flb_router_cache_invalidate(out->config);
     }
     else if (prop_key_check("host", k, len) == 0) {
         out->host.name = tmp;
@@ -376,6 +398,18 @@ int flb_output_set_property(struct flb_output_instance *out, char *k, char *v)
         out->host.ipv6 = flb_utils_bool(tmp);
         flb_free(tmp);
     }
+    else if (prop_key_check("net.keepalive", k, len) == 0 && tmp) {
+        out->net_keepalive = flb_utils_bool(tmp);
+        flb_free(tmp);
+    }
+    else if (prop_key_check("net.keepalive_idle_timeout", k, len) == 0 && tmp) {
+        out->net_keepalive_idle_timeout = atoi(tmp);
+        flb_free(tmp);
+    }
+    else if (prop_key_check("net.keepalive_max_recycle", k, len) == 0 && tmp) {
+        out->net_keepalive_max_recycle = atoi(tmp);
+        flb_free(tmp);
+    }
     else if (prop_key_check("retry_limit", k, len) == 0) {
         if (tmp) {
             if (strcasecmp(tmp, "false") == 0 ||
@@ -460,6 +494,18 @@ char *flb_output_get_property(char *key, struct flb_output_instance *o_ins)
     return flb_config_prop_get(key, &o_ins->properties);
 }
 
+/*
+ * Apply the network settings of an output instance to an upstream context
+ * created by the plugin, e.g: keepalive mode.
+ */
+void flb_output_upstream_set(struct flb_upstream *u,
+                             struct flb_output_instance *ins)
+{
+    flb_upstream_keepalive(u, ins->net_keepalive,
+                           ins->net_keepalive_idle_timeout,
+                           ins->net_keepalive_max_recycle);
+}
+
 /* Trigger the output plugins setup callbacks to prepare them. */
 int flb_output_init(struct flb_config *config)
 {
@@ -469,6 +515,10 @@ int flb_output_init(struct flb_config *config)
     struct flb_output_instance *ins = NULL;
     struct flb_output_plugin *p;
 
+#ifdef FLB_HAVE_FLUSH_LIBCO
+    FLB_TLS_INIT(libco_param_ctx);
+#endif
+
     /* We need at least one output */
     if (mk_list_is_empty(&config->outputs) == 0) {
         return -1;
@@ -31,184 +31,441 @@
 #include <msgpack.h>
 #include <jsmn/jsmn.h>
 
-#define try_to_write_str  flb_utils_write_str
+/*
+ * JSON to msgpack streaming packer
+ * --------------------------------
+ * The packer keeps its state across calls: the caller appends data to its
+ * buffer and invokes flb_pack_json_state() again, scanning continues from
+ * the last position and msgpack is emitted while the bytes are consumed.
+ *
+ * Maps and arrays are emitted with a 32 bit header since the number of
+ * entries is unknown when the container is opened. Every header is
+ * registered as a 'fixup' and once a top-level message is complete, the
+ * message is compacted in one pass writing the smallest header for each
+ * container.
+ */
+
+/* Next token expected by the parser */
+#define JSON_EXP_VALUE           0   /* top-level, after ':' or ',' in array */
+#define JSON_EXP_VALUE_OR_CLOSE  1   /* after '['                            */
+#define JSON_EXP_KEY             2   /* after ',' in an object               */
+#define JSON_EXP_KEY_OR_CLOSE    3   /* after '{'                            */
+#define JSON_EXP_COLON           4   /* after a key                          */
+#define JSON_EXP_NEXT            5   /* ',' or the container end             */
+
+/* Token in progress when the buffer ended */
+#define JSON_TOKEN_NONE          0
+#define JSON_TOKEN_STRING        1
+#define JSON_TOKEN_PRIMITIVE     2
+
+/* Size of the placeholder header of maps and arrays */
+#define JSON_HEADER_SIZE         5
 
-static int json_tokenise(char *js, size_t len,
-                         struct flb_pack_state *state)
+static inline int is_float(char *buf, int len)
 {
-    int ret;
-    int n;
-    void *tmp;
+    char *end = buf + len;
+    char *p = buf;
+
+    while (p < end) {
+        if (*p == '.') {
+            return 1;
+        }
+        p++;
+    }
+    return 0;
+}
+
+/* Write the smallest msgpack header for a map or array, returns its size */
+static inline int json_header(char *buf, int type, uint32_t count)
+{
+    unsigned char *p = (unsigned char *) buf;
+
+    if (count < 16) {
+        p[0] = (type == JSMN_OBJECT ? 0x80 : 0x90) | count;
+        return 1;
+    }
+    else if (count < 65536) {
+        p[0] = (type == JSMN_OBJECT ? 0xde : 0xdc);
+        p[1] = count >> 8;
+        p[2] = count;
+        return 3;
+    }
+
+    p[0] = (type == JSMN_OBJECT ? 0xdf : 0xdd);
+    p[1] = count >> 24;
+    p[2] = count >> 16;
+    p[3] = count >> 8;
+    p[4] = count;
+    return 5;
+}
+
+/* Rewrite the container headers of the message that just completed */
+static void json_compact(struct flb_pack_state *s)
+{
+    int i;
+    size_t len;
+    size_t src;
+    size_t dst;
+    char *buf = s->sbuf.data;
+    struct flb_pack_fixup *f;
+
+    if (s->fixups_count == 0) {
+        return;
+    }
+
+    src = dst = s->fixups[0].offset;
+    for (i = 0; i < s->fixups_count; i++) {
+        f = &s->fixups[i];
+        len = f->offset - src;
+        if (len > 0) {
+            memmove(buf + dst, buf + src, len);
+            dst += len;
+        }
+        dst += json_header(buf + dst, f->type, f->count);
+        src = f->offset + JSON_HEADER_SIZE;
+    }
 
-    ret = jsmn_parse(&state->parser, js, len,
-                     state->tokens, state->tokens_size);
+    len = s->sbuf.size - src;
+    memmove(buf + dst, buf + src, len);
+    s->sbuf.size = dst + len;
+    s->fixups_count = 0;
+}
+
+/* Open a map or array */
+static int json_open(struct flb_pack_state *s, int type)
+{
+    int size;
+    char header[JSON_HEADER_SIZE] = {0};
+    void *tmp;
+    struct flb_pack_fixup *f;
 
-    while (ret == JSMN_ERROR_NOMEM) {
-        n = state->tokens_size += 256;
-        tmp = flb_realloc(state->tokens, sizeof(jsmntok_t) * n);
+    if (s->fixups_count == s->fixups_size) {
+        size = s->fixups_size ? s->fixups_size * 2 : 16;
+        tmp = flb_realloc(s->fixups, sizeof(struct flb_pack_fixup) * size);
         if (!tmp) {
-            perror("realloc");
+            flb_errno();
             return -1;
         }
-        state->tokens = tmp;
-        state->tokens_size = n;
-        ret = jsmn_parse(&state->parser, js, len,
-                         state->tokens, state->tokens_size);
+        s->fixups = tmp;
+        s->fixups_size = size;
     }
 
-    if (ret == JSMN_ERROR_INVAL) {
-        return FLB_ERR_JSON_INVAL;
+    if (s->depth == s->levels_size) {
+        size = s->levels_size ? s->levels_size * 2 : 16;
+        tmp = flb_realloc(s->levels, sizeof(int) * size);
+        if (!tmp) {
+            flb_errno();
+            return -1;
+        }
+        s->levels = tmp;
+        s->levels_size = size;
     }
 
-    if (ret == JSMN_ERROR_PART) {
-        /* This is a partial JSON message, just stop */
-        flb_trace("[json tokenise] incomplete");
-        return FLB_ERR_JSON_PART;
+    f = &s->fixups[s->fixups_count];
+    f->type = type;
+    f->count = 0;
+    f->offset = s->sbuf.size;
+    s->levels[s->depth++] = s->fixups_count++;
+
+    header[0] = (type == JSMN_OBJECT ? 0xdf : 0xdd);
+    return msgpack_sbuffer_write(&s->sbuf, header, JSON_HEADER_SIZE);
+}
+
+/* A value ended at input offset 'end' */
+static void json_value_end(struct flb_pack_state *s, size_t end)
+{
+    if (s->depth > 0) {
+        s->fixups[s->levels[s->depth - 1]].count++;
+        s->expect = JSON_EXP_NEXT;
+        return;
     }
 
-    state->tokens_count += ret;
-    return 0;
+    /* Top-level message complete */
+    json_compact(s);
+    s->msg_start = s->sbuf.size;
+    s->last_byte = end;
+    s->expect = JSON_EXP_VALUE;
 }
 
-static inline int is_float(char *buf, int len)
+/* Pack a primitive: true, false, null or a number */
+static void json_primitive_pack(struct flb_pack_state *s, char *p, int len)
 {
-    char *end = buf + len;
-    char *p = buf;
+    char tmp[64];
 
-    while (p <= end) {
-        if (*p == '.') {
-            return 1;
+    if (*p == 'f') {
+        msgpack_pack_false(&s->pck);
+    }
+    else if (*p == 't') {
+        msgpack_pack_true(&s->pck);
+    }
+    else if (*p == 'n') {
+        msgpack_pack_nil(&s->pck);
+    }
+    else {
+        if (len > sizeof(tmp) - 1) {
+            len = sizeof(tmp) - 1;
+        }
+        memcpy(tmp, p, len);
+        tmp[len] = '\0';
+
+        if (is_float(tmp, len)) {
+            msgpack_pack_double(&s->pck, atof(tmp));
+        }
+        else {
+            msgpack_pack_int64(&s->pck, atol(tmp));
         }
-        p++;
     }
-    return 0;
 }
 
-/* Receive a tokenized JSON message and convert it to MsgPack */
-static char *tokens_to_msgpack(char *js,
-                               jsmntok_t *tokens, int arr_size, int *out_size,
-                               int *last_byte)
+/* Continue scanning the string started at s->token_start */
+static int json_string(struct flb_pack_state *s, char *js, size_t len,
+                       size_t *pos)
 {
-    int i;
+    int key;
     int flen;
-    char *p;
-    char *buf;
-    jsmntok_t *t;
-    msgpack_packer pck;
-    msgpack_sbuffer sbuf;
+    char c;
+    size_t i = *pos;
 
-    if (arr_size == 0) {
-        return NULL;
+    for (; i < len; i++) {
+        c = js[i];
+
+        if (flb_likely(s->escape == 0)) {
+            if (c == '"') {
+                break;
+            }
+            else if (c == '\\') {
+                s->escape = 1;
+            }
+            continue;
+        }
+
+        if (s->escape == 1) {
+            /* Allowed escaped symbols */
+            switch (c) {
+            case '\"': case '/' : case '\\' : case 'b' :
+            case 'f' : case 'r' : case 'n'  : case 't' :
+                s->escape = 0;
+                break;
+            case 'u':
+                s->escape = -4;
+                break;
+            default:
+                return FLB_ERR_JSON_INVAL;
+            }
+            continue;
+        }
+
+        /* \uXXXX: hex digits */
+        if (!((c >= '0' && c <= '9') ||
+              (c >= 'A' && c <= 'F') ||
+              (c >= 'a' && c <= 'f'))) {
+            return FLB_ERR_JSON_INVAL;
+        }
+        s->escape++;
     }
 
-    /* initialize buffers */
-    msgpack_sbuffer_init(&sbuf);
-    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+    *pos = i;
+    if (i == len) {
+        return FLB_ERR_JSON_PART;
+    }
 
-    for (i = 0; i < arr_size ; i++) {
-        t = &tokens[i];
+    /* Strings are packed raw, escape sequences are not decoded */
+    flen = i - (s->token_start + 1);
+    msgpack_pack_str(&s->pck, flen);
+    msgpack_pack_str_body(&s->pck, js + s->token_start + 1, flen);
 
-        if (t->start == -1 || t->end == -1 || (t->start == 0 && t->end == 0)) {
+    s->token = JSON_TOKEN_NONE;
+    *pos = i + 1;
+
+    key = (s->expect == JSON_EXP_KEY || s->expect == JSON_EXP_KEY_OR_CLOSE);
+    if (key) {
+        s->expect = JSON_EXP_COLON;
+    }
+    else {
+        json_value_end(s, i + 1);
+    }
+
+    return 0;
+}
+
+/* Continue scanning the primitive started at s->token_start */
+static int json_primitive(struct flb_pack_state *s, char *js, size_t len,
+                          size_t *pos)
+{
+    char c;
+    size_t i = *pos;
+
+    for (; i < len; i++) {
+        c = js[i];
+        if (c == '\t' || c == '\r' || c == '\n' || c == ' ' ||
+            c == ',' || c == ']' || c == '}') {
             break;
         }
-
-        if (t->parent == -1) {
-            *last_byte = t->end;
+        if (c < 32 || c >= 127) {
+            return FLB_ERR_JSON_INVAL;
         }
+    }
 
-        flen = (t->end - t->start);
-        switch (t->type) {
-        case JSMN_OBJECT:
-            msgpack_pack_map(&pck, t->size);
-            break;
-        case JSMN_ARRAY:
-            msgpack_pack_array(&pck, t->size);
+    *pos = i;
+    if (i == len) {
+        /* A primitive must be followed by a delimiter */
+        return FLB_ERR_JSON_PART;
+    }
+
+    json_primitive_pack(s, js + s->token_start, i - s->token_start);
+    s->token = JSON_TOKEN_NONE;
+    json_value_end(s, i);
+
+    return 0;
+}
+
+/*
+ * Scan the input from the last position. It returns 0 when the input was
+ * consumed (a message may still be in progress), FLB_ERR_JSON_PART if the
+ * input ended inside a token and FLB_ERR_JSON_INVAL on errors.
+ */
+static int json_stream(struct flb_pack_state *s, char *js, size_t len)
+{
+    int ret = 0;
+    int type;
+    char c;
+    size_t i;
+    struct flb_pack_fixup *f;
+
+    /*
+     * If nothing is in progress only blanks were scanned, start over since
+     * the caller is allowed to drop them from its buffer.
+     */
+    i = s->pos;
+    if (s->depth == 0 && s->token == JSON_TOKEN_NONE) {
+        i = 0;
+    }
+
+    if (s->token == JSON_TOKEN_STRING) {
+        ret = json_string(s, js, len, &i);
+    }
+    else if (s->token == JSON_TOKEN_PRIMITIVE) {
+        ret = json_primitive(s, js, len, &i);
+    }
+
+    while (ret == 0 && i < len) {
+        c = js[i];
+        switch (c) {
+        case ' ': case '\t': case '\r': case '\n':
+            i++;
             break;
-        case JSMN_STRING:
-            msgpack_pack_str(&pck, flen);
-            msgpack_pack_str_body(&pck, js + t->start, flen);
+        case '{': case '[':
+            if (s->expect != JSON_EXP_VALUE &&
+                s->expect != JSON_EXP_VALUE_OR_CLOSE) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            type = (c == '{') ? JSMN_OBJECT : JSMN_ARRAY;
+            if (json_open(s, type) != 0) {
+                return -1;
+            }
+            s->expect = (c == '{') ?
+                JSON_EXP_KEY_OR_CLOSE : JSON_EXP_VALUE_OR_CLOSE;
+            i++;
             break;
-        case JSMN_PRIMITIVE:
-            p = js + t->start;
-            if (*p == 'f') {
-                msgpack_pack_false(&pck);
+        case '}': case ']':
+            if (s->depth == 0) {
+                return FLB_ERR_JSON_INVAL;
             }
-            else if (*p == 't') {
-                msgpack_pack_true(&pck);
+            f = &s->fixups[s->levels[s->depth - 1]];
+            type = (c == '}') ? JSMN_OBJECT : JSMN_ARRAY;
+            if (f->type != type) {
+                return FLB_ERR_JSON_INVAL;
             }
-            else if (*p == 'n') {
-                msgpack_pack_nil(&pck);
+            if (s->expect != JSON_EXP_NEXT &&
+                !(c == '}' && s->expect == JSON_EXP_KEY_OR_CLOSE) &&
+                !(c == ']' && s->expect == JSON_EXP_VALUE_OR_CLOSE)) {
+                return FLB_ERR_JSON_INVAL;
             }
-            else {
-                if (is_float(p, flen)) {
-                    msgpack_pack_double(&pck, atof(p));
-                }
-                else {
-                    msgpack_pack_int64(&pck, atol(p));
-                }
+            s->depth--;
+            i++;
+            json_value_end(s, i);
+            break;
+        case ':':
+            if (s->expect != JSON_EXP_COLON) {
+                return FLB_ERR_JSON_INVAL;
             }
+            s->expect = JSON_EXP_VALUE;
+            i++;
             break;
-        case JSMN_UNDEFINED:
-            msgpack_sbuffer_destroy(&sbuf);
-            return NULL;
+        case ',':
+            if (s->expect != JSON_EXP_NEXT) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            f = &s->fixups[s->levels[s->depth - 1]];
+            s->expect = (f->type == JSMN_OBJECT) ?
+                JSON_EXP_KEY : JSON_EXP_VALUE;
+            i++;
+            break;
+        case '"':
+            if (s->expect == JSON_EXP_COLON || s->expect == JSON_EXP_NEXT) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            s->token = JSON_TOKEN_STRING;
+            s->token_start = i;
+            s->escape = 0;
+            i++;
+            ret = json_string(s, js, len, &i);
+            break;
+        case '\0':
+            /* End of a NULL terminated input */
+            len = i;
+            break;
+        default:
+            if (s->expect != JSON_EXP_VALUE &&
+                s->expect != JSON_EXP_VALUE_OR_CLOSE) {
+                return FLB_ERR_JSON_INVAL;
+            }
+            if (c != '-' && !(c >= '0' && c <= '9') &&
+                c != 't' && c != 'f' && c != 'n') {
+                return FLB_ERR_JSON_INVAL;
+            }
+            s->token = JSON_TOKEN_PRIMITIVE;
+            s->token_start = i;
+            ret = json_primitive(s, js, len, &i);
         }
     }
 
-    /* dump data back to a new buffer */
-    *out_size = sbuf.size;
-    buf = flb_malloc(sbuf.size);
-    if (!buf) {
-        flb_errno();
-        msgpack_sbuffer_destroy(&sbuf);
-        return NULL;
+    s->pos = i;
+    if (ret == FLB_ERR_JSON_PART) {
+        return 0;
     }
-
-    memcpy(buf, sbuf.data, sbuf.size);
-    msgpack_sbuffer_destroy(&sbuf);
-
-    return buf;
+    return ret;
 }
 
 /*
  * It parse a JSON string and convert it to MessagePack format, this packer is
  * useful when a complete JSON message exists, otherwise it will fail until
  * the message is complete.
- *
- * This routine do not keep a state in the parser, do not use it for big
- * JSON messages.
  */
 int flb_pack_json(char *js, size_t len, char **buffer, size_t *size)
 {
-    int ret = -1;
-    int out;
-    char *buf = NULL;
+    int ret;
     struct flb_pack_state state;
 
     ret = flb_pack_state_init(&state);
     if (ret != 0) {
         return -1;
     }
-    ret = json_tokenise(js, len, &state);
-    if (ret != 0) {
-        ret = -1;
-        goto flb_pack_json_end;
-    }
 
-    int last;
-    buf = tokens_to_msgpack(js, state.tokens, state.tokens_count, &out, &last);
-    if (!buf) {
-        ret = -1;
-        goto flb_pack_json_end;
+    ret = json_stream(&state, js, len);
+    if (ret != 0 || state.msg_start == 0 ||
+        state.depth > 0 || state.token != JSON_TOKEN_NONE) {
+        flb_pack_state_reset(&state);
+        return -1;
     }
 
-    *size = out;
-    *buffer = buf;
+    /* Hand over the output buffer */
+    *buffer = state.sbuf.data;
+    *size = state.sbuf.size;
+    msgpack_sbuffer_init(&state.sbuf);
 
-    ret = 0;
-
- flb_pack_json_end:
     flb_pack_state_reset(&state);
-    return ret;
+    return 0;
 }
 
 int flb_pack_json_valid(char *json, size_t len)
@@ -228,95 +485,88 @@ int flb_pack_json_valid(char *json, size_t len)
 /* Initialize a JSON packer state */
 int flb_pack_state_init(struct flb_pack_state *s)
 {
-    int size = 256;
-
-    jsmn_init(&s->parser);
-    s->tokens = flb_calloc(1, sizeof(jsmntok_t) * size);
-    if (!s->tokens) {
-        flb_errno();
-        return -1;
-    }
-    s->tokens_size   = size;
-    s->tokens_count  = 0;
-    s->last_byte     = 0;
+    memset(s, '\0', sizeof(struct flb_pack_state));
+    s->multiple = FLB_TRUE;
+    s->expect = JSON_EXP_VALUE;
+    s->token = JSON_TOKEN_NONE;
+    msgpack_sbuffer_init(&s->sbuf);
+    msgpack_packer_init(&s->pck, &s->sbuf, msgpack_sbuffer_write);
 
     return 0;
 }
 
 void flb_pack_state_reset(struct flb_pack_state *s)
 {
-    flb_free(s->tokens);
-    s->tokens_size  = 0;
-    s->tokens_count = 0;
-    s->last_byte    = 0;
+    flb_free(s->levels);
+    flb_free(s->fixups);
+    msgpack_sbuffer_destroy(&s->sbuf);
+    memset(s, '\0', sizeof(struct flb_pack_state));
 }
 
-
 /*
  * It parse a JSON string and convert it to MessagePack format. The main
  * difference of this function and the previous flb_pack_json() is that it
- * keeps a parser and tokens state, allowing to process big messages and
- * resume the parsing process instead of start from zero.
+ * keeps a parser state, allowing to process big messages and resume the
+ * parsing process when more data arrives instead of start from zero.
+ *
+ * On success the complete messages found are returned in 'buffer' and
+ * state->last_byte is the number of input bytes they used: the caller
+ * must remove them from the beginning of its buffer. The state can be
+ * kept to continue with the next message, it's rebased to the new buffer
+ * start.
  */
 int flb_pack_json_state(char *js, size_t len,
                         char **buffer, int *size,
                         struct flb_pack_state *state)
 {
+    int i;
     int ret;
-    int out;
-    int delim = 0;
-    int last =  0;
+    size_t done;
+    size_t rest;
     char *buf;
-    jsmntok_t *t;
-
-    ret = json_tokenise(js, len, state);
-    state->multiple = FLB_TRUE;
-    if (ret == FLB_ERR_JSON_PART && state->multiple == FLB_TRUE) {
-        /*
-         * If the caller enabled 'multiple' flag, it means that the incoming
-         * JSON message may have multiple messages concatenated and likely
-         * the last one is only incomplete.
-         *
-         * The following routine aims to determinate how many JSON messages
-         * are OK in the array of tokens, if any, process them and adjust
-         * the JSMN context/buffers.
-         */
-        int i;
-        int found = 0;
-
-        for (i = 1; i < state->tokens_size; i++) {
-            t = &state->tokens[i];
-
-            if (t->start < (state->tokens[i - 1]).start) {
-                break;
-            }
 
-            if (t->parent == -1 && (t->end != 0)) {
-                found++;
-                delim = i;
-            }
+    state->last_byte = 0;
+    ret = json_stream(state, js, len);
+    if (ret != 0) {
+        return ret;
+    }
 
-        }
+    done = state->msg_start;
+    if (done == 0) {
+        return FLB_ERR_JSON_PART;
+    }
 
-        if (found > 0) {
-            state->tokens_count += delim;
+    /* Blanks after the last message are consumed too */
+    while (state->last_byte < state->pos &&
+           (js[state->last_byte] == ' ' || js[state->last_byte] == '\t' ||
+            js[state->last_byte] == '\r' || js[state->last_byte] == '\n')) {
+        state->last_byte++;
+    }
+
+    /* Hand over the output buffer */
+    buf = state->sbuf.data;
+    rest = state->sbuf.size - done;
+    msgpack_sbuffer_init(&state->sbuf);
+
+    if (rest > 0) {
+        /* Move the message in progress to a new buffer */
+        ret = msgpack_sbuffer_write(&state->sbuf, buf + done, rest);
+        if (ret != 0) {
+            flb_free(buf);
+            return -1;
         }
-        else {
-            return ret;
+        for (i = 0; i < state->fixups_count; i++) {
+            state->fixups[i].offset -= done;
         }
     }
-    else if (ret != 0) {
-        return ret;
-    }
+    state->msg_start = 0;
 
-    buf = tokens_to_msgpack(js, state->tokens, state->tokens_count, &out, &last);
-    if (!buf) {
-        return -1;
-    }
+    /* Rebase the input offsets */
+    state->pos -= state->last_byte;
+    state->token_start -= state->last_byte;
 
-    *size = out;
     *buffer = buf;
-    state->last_byte = last;
+    *size = done;
 
     return 0;
 }
@@ -336,161 +586,344 @@ void flb_pack_print(char *data, size_t bytes)
 }
 
 
-static inline int try_to_write(char *buf, int *off, size_t left,
-                               char *str, size_t str_len)
+/*
+ * msgpack to JSON encoder
+ * -----------------------
+ * The encoder appends the JSON representation of a msgpack object into a
+ * flb_sds_t in a single pass: the output buffer grows by doubling its size
+ * when more room is needed, so there is no need to guess the final size
+ * and nothing is encoded twice.
+ */
+
+/*
+ * JSON escaping of ASCII bytes: 0 means the byte is copied as is, 'u' that
+ * it's written as \u00XX and any other value is the character that follows
+ * the backslash.
+ */
+static const char json_escape[128] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'a',
+    'b', 't', 'n', 'v', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+      0,   0, '"',   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0, '\\',  0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0,   0,
+      0,   0,   0,   0,   0,   0,   0, 'u'
+};
+
+static const char json_hex[] = "0123456789abcdef";
+
+/* Make sure there are at least 'size' bytes available in the buffer */
+static inline int json_reserve(flb_sds_t *s, size_t size)
 {
-    if (str_len <= 0){
-        str_len = strlen(str);
+    size_t grow;
+    flb_sds_t tmp;
+
+    if (flb_likely(flb_sds_avail(*s) >= size)) {
+        return 0;
+    }
+
+    grow = flb_sds_alloc(*s);
+    if (grow < size) {
+        grow = size;
+    }
+
+    tmp = flb_sds_increase(*s, grow);
+    if (!tmp) {
+        return -1;
     }
-    if (left <= *off+str_len) {
-        return FLB_FALSE;
+    *s = tmp;
+    return 0;
+}
+
+static inline int json_cat(flb_sds_t *s, const char *buf, size_t size)
+{
+    if (json_reserve(s, size) == -1) {
+        return -1;
     }
-    memcpy(buf+*off, str, str_len);
-    *off += str_len;
-    return FLB_TRUE;
+
+    memcpy(*s + flb_sds_len(*s), buf, size);
+    flb_sds_len_set(*s, flb_sds_len(*s) + size);
+    return 0;
 }
 
+/*
+ * Length of the UTF-8 sequence starting with byte 'c', same rules than
+ * flb_utf8_len().
+ */
+static inline int json_utf8_len(unsigned char c)
+{
+    if (c < 0xc0) {
+        return 1;
+    }
+    else if (c < 0xe0) {
+        return 2;
+    }
+    else if (c < 0xf0) {
+        return 3;
+    }
+    else if (c < 0xf8) {
+        return 4;
+    }
+    else if (c < 0xfc) {
+        return 5;
+    }
+    return 6;
+}
+
+/*
+ * Write an escaped JSON string (without the quotes). Runs of bytes that
+ * don't need escaping are copied with memcpy(), ASCII escapes are resolved
+ * through a table and UTF-8 sequences are encoded by flb_utils_write_str()
+ * so the output is the same than the one of the previous encoder.
+ */
+static int json_str(flb_sds_t *s, const char *str, size_t size)
+{
+    int ret;
+    int off;
+    int len;
+    char esc;
+    char tmp[32];
+    unsigned char c;
+    const char *p = str;
+    const char *run = str;
+    const char *end = str + size;
+    char *out;
+
+    /* Optimistic: most strings don't need escaping at all */
+    if (json_reserve(s, size + 2) == -1) {
+        return -1;
+    }
+
+    while (p < end) {
+        c = (unsigned char) *p;
+        if (c < 128) {
+            esc = json_escape[c];
+            if (flb_likely(esc == 0)) {
+                p++;
+                continue;
+            }
+        }
+
+        /* Flush pending plain bytes */
+        if (p > run && json_cat(s, run, p - run) == -1) {
+            return -1;
+        }
+
+        if (c < 128) {
+            if (json_reserve(s, 6) == -1) {
+                return -1;
+            }
+            out = *s + flb_sds_len(*s);
+            *out++ = '\\';
+            if (esc == 'u') {
+                *out++ = 'u';
+                *out++ = '0';
+                *out++ = '0';
+                *out++ = json_hex[c >> 4];
+                *out++ = json_hex[c & 0xf];
+            }
+            else {
+                *out++ = esc;
+            }
+            flb_sds_len_set(*s, out - *s);
+            p++;
+        }
+        else {
+            len = json_utf8_len(c);
+            if (len > end - p) {
+                len = end - p;
+            }
+
+            off = 0;
+            ret = flb_utils_write_str(tmp, &off, sizeof(tmp), (char *) p, len);
+            if (ret == FLB_FALSE) {
+                return -1;
+            }
+
+            /* Invalid UTF-8, the rest of the string is skipped */
+            if (off == 0) {
+                return 0;
+            }
+
+            if (json_cat(s, tmp, off) == -1) {
+                return -1;
+            }
+            p += len;
+        }
+        run = p;
+    }
+
+    if (p > run && json_cat(s, run, p - run) == -1) {
+        return -1;
+    }
 
-static int msgpack2json(char *buf, int *off, size_t left, msgpack_object *o)
+    return 0;
+}
+
+static int msgpack2json(flb_sds_t *s, msgpack_object *o)
 {
-    int ret = FLB_FALSE;
     int i;
+    int len;
     int loop;
+    char temp[32];
+    msgpack_object *p;
+    msgpack_object_kv *kv;
 
     switch(o->type) {
     case MSGPACK_OBJECT_NIL:
-        ret = try_to_write(buf, off, left, "null", 4);
-        break;
+        return json_cat(s, "null", 4);
 
     case MSGPACK_OBJECT_BOOLEAN:
-        ret = try_to_write(buf, off, left,
-                           (o->via.boolean ? "true":"false"),0);
-
-        break;
+        if (o->via.boolean) {
+            return json_cat(s, "true", 4);
+        }
+        return json_cat(s, "false", 5);
 
     case MSGPACK_OBJECT_POSITIVE_INTEGER:
-        {
-            char temp[32] = {0};
-            i = snprintf(temp, sizeof(temp)-1, "%lu", (unsigned long)o->via.u64);
-            ret = try_to_write(buf, off, left, temp, i);
-        }
-        break;
+        len = snprintf(temp, sizeof(temp) - 1, "%lu",
+                       (unsigned long) o->via.u64);
+        return json_cat(s, temp, len);
 
     case MSGPACK_OBJECT_NEGATIVE_INTEGER:
-        {
-            char temp[32] = {0};
-            i = snprintf(temp, sizeof(temp)-1, "%ld", (signed long)o->via.i64);
-            ret = try_to_write(buf, off, left, temp, i);
-        }
-        break;
+        len = snprintf(temp, sizeof(temp) - 1, "%ld",
+                       (signed long) o->via.i64);
+        return json_cat(s, temp, len);
+
     case MSGPACK_OBJECT_FLOAT32:
     case MSGPACK_OBJECT_FLOAT64:
-        {
-            char temp[32] = {0};
-            i = snprintf(temp, sizeof(temp)-1, "%f", o->via.f64);
-            ret = try_to_write(buf, off, left, temp, i);
-        }
-        break;
+        len = snprintf(temp, sizeof(temp) - 1, "%f", o->via.f64);
+        return json_cat(s, temp, len);
 
     case MSGPACK_OBJECT_STR:
-        if (try_to_write(buf, off, left, "\"", 1) &&
-            (o->via.str.size > 0 ?
-             try_to_write_str(buf, off, left, (char*)o->via.str.ptr, o->via.str.size)
-             : 1/* nothing to do */) &&
-            try_to_write(buf, off, left, "\"", 1)) {
-            ret = FLB_TRUE;
+        if (json_cat(s, "\"", 1) == -1 ||
+            json_str(s, o->via.str.ptr, o->via.str.size) == -1) {
+            return -1;
         }
-        break;
+        return json_cat(s, "\"", 1);
 
     case MSGPACK_OBJECT_BIN:
-        if (try_to_write(buf, off, left, "\"", 1) &&
-            (o->via.bin.size > 0 ?
-             try_to_write_str(buf, off, left, (char*)o->via.bin.ptr, o->via.bin.size)
-              : 1 /* nothing to do */) &&
-            try_to_write(buf, off, left, "\"", 1)) {
-            ret = FLB_TRUE;
+        if (json_cat(s, "\"", 1) == -1 ||
+            json_str(s, o->via.bin.ptr, o->via.bin.size) == -1) {
+            return -1;
         }
-        break;
+        return json_cat(s, "\"", 1);
 
     case MSGPACK_OBJECT_EXT:
-        if (!try_to_write(buf, off, left, "\"", 1)) {
-            goto msg2json_end;
-        }
         /* ext body. fortmat is similar to printf(1) */
-        {
-            char temp[32] = {0};
-            int  len;
-            loop = o->via.ext.size;
-            for(i=0; i<loop; i++) {
-                len = snprintf(temp, sizeof(temp)-1, "\\x%02x", (char)o->via.ext.ptr[i]);
-                if (!try_to_write(buf, off, left, temp, len)) {
-                    goto msg2json_end;
-                }
-            }
+        if (json_cat(s, "\"", 1) == -1) {
+            return -1;
         }
-        if (!try_to_write(buf, off, left, "\"", 1)) {
-            goto msg2json_end;
+        for (i = 0; i < o->via.ext.size; i++) {
+            len = snprintf(temp, sizeof(temp) - 1, "\\x%02x",
+                           (char) o->via.ext.ptr[i]);
+            if (json_cat(s, temp, len) == -1) {
+                return -1;
+            }
         }
-        ret = FLB_TRUE;
-        break;
+        return json_cat(s, "\"", 1);
 
     case MSGPACK_OBJECT_ARRAY:
         loop = o->via.array.size;
+        p = o->via.array.ptr;
 
-        if (!try_to_write(buf, off, left, "[", 1)) {
-            goto msg2json_end;
+        if (json_cat(s, "[", 1) == -1) {
+            return -1;
         }
-        if (loop != 0) {
-            msgpack_object* p = o->via.array.ptr;
-            if (!msgpack2json(buf, off, left, p)) {
-                goto msg2json_end;
+        for (i = 0; i < loop; i++) {
+            if (i > 0 && json_cat(s, ", ", 2) == -1) {
+                return -1;
             }
-            for (i=1; i<loop; i++) {
-                if (!try_to_write(buf, off, left, ", ", 2) ||
-                    !msgpack2json(buf, off, left, p+i)) {
-                    goto msg2json_end;
-                }
+            if (msgpack2json(s, p + i) == -1) {
+                return -1;
             }
         }
-
-        ret = try_to_write(buf, off, left, "]", 1);
-        break;
+        return json_cat(s, "]", 1);
 
     case MSGPACK_OBJECT_MAP:
         loop = o->via.map.size;
-        if (!try_to_write(buf, off, left, "{", 1)) {
-            goto msg2json_end;
+        kv = o->via.map.ptr;
+
+        if (json_cat(s, "{", 1) == -1) {
+            return -1;
         }
-        if (loop != 0) {
-            msgpack_object_kv *p = o->via.map.ptr;
-            if (!msgpack2json(buf, off, left, &p->key) ||
-                !try_to_write(buf, off, left, ":", 1)  ||
-                !msgpack2json(buf, off, left, &p->val)) {
-                goto msg2json_end;
+        for (i = 0; i < loop; i++) {
+            if (i > 0 && json_cat(s, ", ", 2) == -1) {
+                return -1;
             }
-            for (i = 1; i < loop; i++) {
-                if (
-                    !try_to_write(buf, off, left, ", ", 2) ||
-                    !msgpack2json(buf, off, left, &(p+i)->key) ||
-                    !try_to_write(buf, off, left, ":", 1)  ||
-                    !msgpack2json(buf, off, left, &(p+i)->val) ) {
-                    goto msg2json_end;
-
-                }
+            if (msgpack2json(s, &kv[i].key) == -1 ||
+                json_cat(s, ":", 1) == -1 ||
+                msgpack2json(s, &kv[i].val) == -1) {
+                return -1;
             }
         }
-
-        ret = try_to_write(buf, off, left, "}", 1);
-        break;
+        return json_cat(s, "}", 1);
 
     default:
         flb_warn("[%s] unknown msgpack type %i", __FUNCTION__, o->type);
     }
 
- msg2json_end:
+    return -1;
+}
+
+/**
+ *  append the JSON representation of a msgpack object to a SDS buffer.
+ *
+ *  @param  s         The SDS buffer, it's updated if it needs to grow.
+ *  @param  obj       The msgpack object.
+ *  @return success   ? 0 : -1, on error the buffer is still valid.
+ */
+int flb_msgpack_to_json_sds(flb_sds_t *s, msgpack_object *obj)
+{
+    int ret;
+
+    ret = msgpack2json(s, obj);
+    (*s)[flb_sds_len(*s)] = '\0';
     return ret;
 }
 
+/**
+ *  convert all the msgpack objects of a buffer to JSON, one per line.
+ *
+ *  @param  in_buf    The msgpack buffer.
+ *  @param  in_size   The size of in_buf.
+ *  @return success   ? the new SDS buffer : NULL
+ */
+flb_sds_t flb_msgpack_raw_to_json_lines(void *in_buf, size_t in_size)
+{
+    int ret;
+    size_t off = 0;
+    flb_sds_t out_buf;
+    msgpack_unpacked result;
+
+    out_buf = flb_sds_create_size(in_size + (in_size / 2));
+    if (!out_buf) {
+        return NULL;
+    }
+
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, in_buf, in_size, &off)) {
+        ret = msgpack2json(&out_buf, &result.data);
+        if (ret == -1 || json_cat(&out_buf, "\n", 1) == -1) {
+            msgpack_unpacked_destroy(&result);
+            flb_sds_destroy(out_buf);
+            return NULL;
+        }
+    }
+    msgpack_unpacked_destroy(&result);
+    out_buf[flb_sds_len(out_buf)] = '\0';
+
+    return out_buf;
+}
+
 /**
  *  convert msgpack to JSON string.
  *  This API is similar to snprintf.
@@ -503,30 +936,41 @@ static int msgpack2json(char *buf, int *off, size_t left, msgpack_object *o)
 int flb_msgpack_to_json(char *json_str, size_t json_size,
                         msgpack_object *obj)
 {
-    int ret = -1;
-    int off = 0;
+    int ret;
+    size_t len;
+    flb_sds_t s;
 
     if (json_str == NULL || obj == NULL) {
         return -1;
     }
 
-    ret = msgpack2json(json_str, &off, json_size, obj);
-    json_str[off] = '\0';
-    return ret ? off: ret;
+    s = flb_sds_create_size(json_size);
+    if (!s) {
+        return -1;
+    }
+
+    ret = msgpack2json(&s, obj);
+    len = flb_sds_len(s);
+    if (ret == -1 || len >= json_size) {
+        flb_sds_destroy(s);
+        return -1;
+    }
+
+    memcpy(json_str, s, len);
+    json_str[len] = '\0';
+    flb_sds_destroy(s);
+
+    return len;
 }
 
 flb_sds_t flb_msgpack_raw_to_json_sds(void *in_buf, size_t in_size)
 {
     int ret;
     size_t off = 0;
-    size_t out_size;
     msgpack_unpacked result;
-    msgpack_object *root;
     flb_sds_t out_buf;
-    flb_sds_t tmp_buf;
 
-    out_size = in_size * 1.5;
-    out_buf = flb_sds_create_size(out_size);
+    out_buf = flb_sds_create_size(in_size + (in_size / 2));
     if (!out_buf) {
         flb_errno();
         return NULL;
@@ -534,34 +978,37 @@ flb_sds_t flb_msgpack_raw_to_json_sds(void *in_buf, size_t in_size)
 
     msgpack_unpacked_init(&result);
     msgpack_unpack_next(&result, in_buf, in_size, &off);
-    root = &result.data;
-
-    while (1) {
-        ret = flb_msgpack_to_json(out_buf, out_size, root);
-        if (ret <= 0) {
-            tmp_buf = flb_sds_increase(out_buf, 256);
-            if (tmp_buf) {
-                out_buf = tmp_buf;
-                out_size += 256;
-            }
-            else {
-                flb_errno();
-                flb_sds_destroy(out_buf);
-                msgpack_unpacked_destroy(&result);
-                return NULL;
-            }
-        }
-        else {
-            break;
-        }
-    }
 
+    ret = flb_msgpack_to_json_sds(&out_buf, &result.data);
     msgpack_unpacked_destroy(&result);
-    flb_sds_len_set(out_buf, ret);
+    if (ret == -1) {
+        flb_sds_destroy(out_buf);
+        return NULL;
+    }
 
     return out_buf;
 }
 
+/* Copy the content of a SDS buffer into a regular heap buffer */
+static char *json_sds_to_str(flb_sds_t s, size_t *out_size)
+{
+    size_t len;
+    char *buf;
+
+    len = flb_sds_len(s);
+    buf = flb_malloc(len + 1);
+    if (!buf) {
+        flb_errno();
+        return NULL;
+    }
+    memcpy(buf, s, len + 1);
+
+    if (out_size) {
+        *out_size = len;
+    }
+    return buf;
+}
+
 /**
  *  convert msgpack to JSON string.
  *  This API is similar to snprintf.
@@ -572,8 +1019,8 @@ flb_sds_t flb_msgpack_raw_to_json_sds(void *in_buf, size_t in_size)
 char *flb_msgpack_to_json_str(size_t size, msgpack_object *obj)
 {
     int ret;
-    char *buf = NULL;
-    char *tmp;
+    char *buf;
+    flb_sds_t s;
 
     if (obj == NULL) {
         return NULL;
@@ -583,32 +1030,19 @@ char *flb_msgpack_to_json_str(size_t size, msgpack_object *obj)
         size = 128;
     }
 
-    buf = flb_malloc(size);
-    if (!buf) {
-        flb_errno();
+    s = flb_sds_create_size(size);
+    if (!s) {
         return NULL;
     }
 
-    while (1) {
-        ret = flb_msgpack_to_json(buf, size, obj);
-        if (ret <= 0) {
-            /* buffer is small. retry.*/
-            size += 128;
-            tmp = flb_realloc(buf, size);
-            if (tmp) {
-                buf = tmp;
-            }
-            else {
-                flb_free(buf);
-                flb_errno();
-                return NULL;
-            }
-        }
-        else {
-            break;
-        }
+    ret = flb_msgpack_to_json_sds(&s, obj);
+    if (ret == -1) {
+        flb_sds_destroy(s);
+        return NULL;
     }
 
+    buf = json_sds_to_str(s, NULL);
+    flb_sds_destroy(s);
     return buf;
 }
 
@@ -617,9 +1051,8 @@ int flb_msgpack_raw_to_json_str(char *buf, size_t buf_size,
 {
     int ret;
     size_t off = 0;
-    size_t json_size;
     char *json_buf;
-    char *tmp;
+    flb_sds_t s;
     msgpack_unpacked result;
 
     if (!buf || buf_size <= 0) {
@@ -632,35 +1065,26 @@ int flb_msgpack_raw_to_json_str(char *buf, size_t buf_size,
         return -1;
     }
 
-    json_size = (buf_size * 1.2);
-    json_buf = flb_calloc(1, json_size);
-    if (!json_buf) {
-        flb_errno();
+    s = flb_sds_create_size(buf_size + (buf_size / 2));
+    if (!s) {
         msgpack_unpacked_destroy(&result);
         return -1;
     }
 
-    while (1) {
-        ret = flb_msgpack_to_json(json_buf, json_size, &result.data);
-        if (ret <= 0) {
-            json_size += 128;
-            tmp = flb_realloc(json_buf, json_size);
-            if (!tmp) {
-                flb_errno();
-                flb_free(json_buf);
-                msgpack_unpacked_destroy(&result);
-                return -1;
-            }
-            json_buf = tmp;
-            continue;
-        }
-        break;
+    ret = flb_msgpack_to_json_sds(&s, &result.data);
+    msgpack_unpacked_destroy(&result);
+    if (ret == -1) {
+        flb_sds_destroy(s);
+        return -1;
     }
 
-    *out_buf = json_buf;
-    *out_size = ret;
+    json_buf = json_sds_to_str(s, out_size);
+    flb_sds_destroy(s);
+    if (!json_buf) {
+        return -1;
+    }
 
-    msgpack_unpacked_destroy(&result);
+    *out_buf = json_buf;
     return 0;
 }
 
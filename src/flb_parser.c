@@ -87,6 +87,11 @@ int flb_parser_regex_do(struct flb_parser *parser,
                         void **out_buf, size_t *out_size,
                         struct flb_time *out_time);
 
+int flb_parser_regex_do_pack(struct flb_parser *parser,
+                             char *buf, size_t length,
+                             msgpack_packer *pck, int extra_keys,
+                             struct flb_time *out_time);
+
 int flb_parser_json_do(struct flb_parser *parser,
                        char *buf, size_t length,
                        void **out_buf, size_t *out_size,
@@ -164,6 +169,19 @@ struct flb_parser *flb_parser_create(char *name, char *format,
     if (time_fmt) {
         p->time_fmt = flb_strdup(time_fmt);
 
+        /* Compile the format before the fractional seconds fixup below */
+        p->time_parser = flb_parser_time_create(p->time_fmt);
+        if (!p->time_parser) {
+            flb_free(p->time_fmt);
+            flb_free(p->name);
+            if (p->type == FLB_PARSER_REGEX) {
+                flb_regex_destroy(p->regex);
+                flb_free(p->p_regex);
+            }
+            flb_free(p);
+            return NULL;
+        }
+
         /* Check if the format is considering the year */
         if (strstr(p->time_fmt, "%Y") || strstr(p->time_fmt, "%y")) {
             p->time_with_year = FLB_TRUE;
@@ -269,6 +287,9 @@ void flb_parser_destroy(struct flb_parser *parser)
     if (parser->time_fmt_year) {
         flb_free(parser->time_fmt_year);
     }
+    if (parser->time_parser) {
+        flb_parser_time_destroy(parser->time_parser);
+    }
     if (parser->time_key) {
         flb_free(parser->time_key);
     }
@@ -562,6 +583,62 @@ int flb_parser_do(struct flb_parser *parser, char *buf, size_t length,
     return -1;
 }
 
+/*
+ * Parse 'buf' and pack the resulting map through 'pck', so the caller can
+ * write it straight into its own buffer. The map is sized to hold
+ * 'extra_keys' more entries that the caller must pack right after. On
+ * error (-1) partial content might have been packed.
+ */
+int flb_parser_do_pack(struct flb_parser *parser, char *buf, size_t length,
+                       msgpack_packer *pck, int extra_keys,
+                       struct flb_time *out_time)
+{
+    int i;
+    int ret;
+    size_t off = 0;
+    size_t out_size;
+    void *out_buf;
+    msgpack_object map;
+    msgpack_unpacked result;
+
+    /* Regex results are packed as they are found */
+    if (parser->type == FLB_PARSER_REGEX && !parser->decoders) {
+        return flb_parser_regex_do_pack(parser, buf, length,
+                                        pck, extra_keys, out_time);
+    }
+
+    ret = flb_parser_do(parser, buf, length, &out_buf, &out_size, out_time);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (extra_keys == 0) {
+        pck->callback(pck->data, out_buf, out_size);
+        flb_free(out_buf);
+        return ret;
+    }
+
+    /* Re-pack the map header to make room for the extra keys */
+    msgpack_unpacked_init(&result);
+    if (msgpack_unpack_next(&result, out_buf, out_size, &off) !=
+        MSGPACK_UNPACK_SUCCESS || result.data.type != MSGPACK_OBJECT_MAP) {
+        msgpack_unpacked_destroy(&result);
+        flb_free(out_buf);
+        return -1;
+    }
+
+    map = result.data;
+    msgpack_pack_map(pck, map.via.map.size + extra_keys);
+    for (i = 0; i < map.via.map.size; i++) {
+        msgpack_pack_object(pck, map.via.map.ptr[i].key);
+        msgpack_pack_object(pck, map.via.map.ptr[i].val);
+    }
+
+    msgpack_unpacked_destroy(&result);
+    flb_free(out_buf);
+    return ret;
+}
+
 /* Given a timezone string, return it numeric offset */
 int flb_parser_tzone_offset(char *str, int len, int *tmdiff)
 {
@@ -34,7 +34,6 @@ int flb_parser_json_do(struct flb_parser *parser,
     int skip;
     int ret;
     int slen;
-    double tmfrac = 0;
     char *mp_buf = NULL;
     char *time_key;
     char *tmp_out_buf = NULL;
@@ -48,9 +47,7 @@ int flb_parser_json_do(struct flb_parser *parser,
     msgpack_object map;
     msgpack_object *k = NULL;
     msgpack_object *v = NULL;
-    time_t time_lookup;
-    struct tm tm = {0};
-    struct flb_time *t;
+    struct flb_time time_lookup;
 
     /* Convert incoming in_buf JSON message to message pack format */
     ret = flb_pack_json(in_buf, in_size, &mp_buf, &mp_size);
@@ -150,13 +147,12 @@ int flb_parser_json_do(struct flb_parser *parser,
     }
 
     /* Lookup time */
-    ret = flb_parser_time_lookup((char *) v->via.str.ptr, v->via.str.size,
-                                 0, parser, &tm, &tmfrac);
+    ret = flb_parser_time_parse((char *) v->via.str.ptr, v->via.str.size,
+                                0, parser, &time_lookup);
     if (ret == -1) {
         msgpack_unpacked_destroy(&result);
         return *out_size;
     }
-    time_lookup = flb_parser_tm2time(&tm);
 
     /* Compose a new map without the time_key field */
     msgpack_sbuffer_init(&mp_sbuf);
@@ -182,9 +178,7 @@ int flb_parser_json_do(struct flb_parser *parser,
     *out_buf = mp_sbuf.data;
     *out_size = mp_sbuf.size;
 
-    t = out_time;
-    t->tm.tv_sec  = time_lookup;
-    t->tm.tv_nsec = (tmfrac * 1000000000);
+    flb_time_copy(out_time, &time_lookup);
 
     msgpack_unpacked_destroy(&result);
     return *out_size;
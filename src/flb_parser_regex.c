@@ -28,9 +28,8 @@
 #include <msgpack.h>
 
 struct regex_cb_ctx {
-    time_t time_lookup;
+    struct flb_time time_lookup;
     time_t time_now;
-    double time_frac;
     struct flb_parser *parser;
     msgpack_packer *pck;
 };
@@ -40,11 +39,10 @@ static void cb_results(unsigned char *name, unsigned char *value,
 {
     int len;
     int ret;
-    double frac = 0;
     char *time_key;
     struct regex_cb_ctx *pcb = data;
     struct flb_parser *parser = pcb->parser;
-    struct tm tm = {0};
+    struct flb_time tm;
     (void) data;
 
     len = strlen((char *) name);
@@ -60,14 +58,13 @@ static void cb_results(unsigned char *name, unsigned char *value,
 
         if (strcmp((char *) name, time_key) == 0) {
             /* Lookup time */
-            ret = flb_parser_time_lookup((char *) value, vlen,
-                                         pcb->time_now, parser, &tm, &frac);
+            ret = flb_parser_time_parse((char *) value, vlen,
+                                        pcb->time_now, parser, &tm);
             if (ret == -1) {
                 flb_error("[parser:%s] Invalid time format %s.", parser->name, parser->time_fmt);
                 return;
             }
-            pcb->time_frac = frac;
-            pcb->time_lookup = flb_parser_tm2time(&tm);
+            pcb->time_lookup = tm;
 
             if (parser->time_keep == FLB_FALSE) {
                 return;
@@ -90,32 +87,28 @@ static void cb_results(unsigned char *name, unsigned char *value,
     }
 }
 
-int flb_parser_regex_do(struct flb_parser *parser,
-                        char *buf, size_t length,
-                        void **out_buf, size_t *out_size,
-                        struct flb_time *out_time)
+/*
+ * Run the regex over 'buf' and pack the resulting map through 'pck'. The map
+ * is sized to hold 'extra_keys' more entries that the caller packs right
+ * after. On error, partial content might have been packed.
+ */
+int flb_parser_regex_do_pack(struct flb_parser *parser,
+                             char *buf, size_t length,
+                             msgpack_packer *pck, int extra_keys,
+                             struct flb_time *out_time)
 {
-    int ret;
     int arr_size;
     int last_byte;
     ssize_t n;
-    size_t dec_out_size;
-    char *dec_out_buf;
     struct flb_regex_search result;
     struct regex_cb_ctx pcb;
     struct flb_time *t;
-    msgpack_sbuffer tmp_sbuf;
-    msgpack_packer tmp_pck;
 
     n = flb_regex_do(parser->regex, (unsigned char *) buf, length, &result);
     if (n <= 0) {
         return -1;
     }
 
-    /* Prepare new outgoing buffer */
-    msgpack_sbuffer_init(&tmp_sbuf);
-    msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
-
     if (parser->time_fmt && parser->time_keep == FLB_FALSE) {
         arr_size = (n - 1);
     }
@@ -123,17 +116,49 @@ int flb_parser_regex_do(struct flb_parser *parser,
         arr_size = n;
     }
 
-    msgpack_pack_map(&tmp_pck, arr_size);
+    msgpack_pack_map(pck, arr_size + extra_keys);
 
     /* Callback context */
-    pcb.pck = &tmp_pck;
+    pcb.pck = pck;
     pcb.parser = parser;
-    pcb.time_lookup = 0;
-    pcb.time_frac = 0;
+    flb_time_zero(&pcb.time_lookup);
     pcb.time_now = time(NULL);
 
     /* Iterate results and compose new buffer */
     last_byte = flb_regex_parse(parser->regex, &result, cb_results, &pcb);
+    if (last_byte == -1) {
+        return -1;
+    }
+
+    t = out_time;
+    flb_time_copy(t, &pcb.time_lookup);
+
+    /*
+     * The return the value >= 0, belongs to the LAST BYTE consumed by the
+     * regex engine. If the last byte is lower than string length, means
+     * there is more data to be processed (maybe it's a stream).
+     */
+    return last_byte;
+}
+
+int flb_parser_regex_do(struct flb_parser *parser,
+                        char *buf, size_t length,
+                        void **out_buf, size_t *out_size,
+                        struct flb_time *out_time)
+{
+    int ret;
+    int last_byte;
+    size_t dec_out_size;
+    char *dec_out_buf;
+    msgpack_sbuffer tmp_sbuf;
+    msgpack_packer tmp_pck;
+
+    /* Prepare new outgoing buffer */
+    msgpack_sbuffer_init(&tmp_sbuf);
+    msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
+
+    last_byte = flb_parser_regex_do_pack(parser, buf, length,
+                                         &tmp_pck, 0, out_time);
     if (last_byte == -1) {
         msgpack_sbuffer_destroy(&tmp_sbuf);
         return -1;
@@ -143,10 +168,6 @@ int flb_parser_regex_do(struct flb_parser *parser,
     *out_buf = tmp_sbuf.data;
     *out_size = tmp_sbuf.size;
 
-    t = out_time;
-    t->tm.tv_sec  = pcb.time_lookup;
-    t->tm.tv_nsec = (pcb.time_frac * 1000000000);
-
     /* Check if some decoder was specified */
     if (parser->decoders) {
         ret = flb_parser_decoder_do(parser->decoders,
@@ -159,10 +180,5 @@ int flb_parser_regex_do(struct flb_parser *parser,
         }
     }
 
-    /*
-     * The return the value >= 0, belongs to the LAST BYTE consumed by the
-     * regex engine. If the last byte is lower than string length, means
-     * there is more data to be processed (maybe it's a stream).
-     */
     return last_byte;
 }
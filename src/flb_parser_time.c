@@ -0,0 +1,601 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_parser.h>
+#include <fluent-bit/flb_parser_time.h>
+
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *month_names[] = {
+    "january", "february", "march", "april", "may", "june", "july",
+    "august", "september", "october", "november", "december"
+};
+
+/* Days since 1970-01-01 of a proleptic Gregorian date (month 1..12) */
+static inline time_t days_from_civil(int y, int m, int d)
+{
+    int era;
+    unsigned int yoe;
+    unsigned int doy;
+    unsigned int doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (unsigned int) (y - era * 400);
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return (time_t) era * 146097 + (time_t) doe - 719468;
+}
+
+/* Year of a given number of days since 1970-01-01 */
+static inline int year_from_days(time_t z)
+{
+    int y;
+    int m;
+    time_t era;
+    unsigned int doe;
+    unsigned int yoe;
+    unsigned int doy;
+    unsigned int mp;
+
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = (unsigned int) (z - era * 146097);
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    y = (int) yoe + era * 400;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    m = mp < 10 ? mp + 3 : mp - 9;
+
+    return y + (m <= 2);
+}
+
+/* Year-less formats get the current year (UTC), as the strptime(3) path */
+static inline int current_year(struct flb_parser_time *pt, time_t now)
+{
+    time_t days;
+
+    if (pt->year_end > pt->year_start &&
+        now >= pt->year_start && now < pt->year_end) {
+        return pt->year;
+    }
+
+    days = now / 86400;
+    if (now < 0 && now % 86400) {
+        days--;
+    }
+
+    pt->year = year_from_days(days);
+    pt->year_start = days_from_civil(pt->year, 1, 1) * 86400;
+    pt->year_end = days_from_civil(pt->year + 1, 1, 1) * 86400;
+
+    /* The year changed: cached year-less results are no longer valid */
+    pt->key_len = 0;
+
+    return pt->year;
+}
+
+static int add_op(struct flb_parser_time *pt, int type, char c)
+{
+    if (pt->n_ops >= FLB_PARSER_TIME_MAX_OPS) {
+        return -1;
+    }
+
+    pt->ops[pt->n_ops].type = type;
+    pt->ops[pt->n_ops].c = c;
+    pt->n_ops++;
+
+    return 0;
+}
+
+/*
+ * Translate a strptime(3) format into a list of operations. Returns -1 when
+ * the format uses a conversion without a hand-written parser.
+ */
+static int time_compile(struct flb_parser_time *pt, char *fmt)
+{
+    int i;
+    int ret = 0;
+    int fields = 0;
+    int type;
+    char *p = fmt;
+
+    pt->key_op = -1;
+
+    while (*p && ret == 0) {
+        if (isspace((unsigned char) *p)) {
+            while (isspace((unsigned char) *p)) {
+                p++;
+            }
+            ret = add_op(pt, FLB_PARSER_TIME_SPACE, ' ');
+            continue;
+        }
+
+        if (*p != '%') {
+            ret = add_op(pt, FLB_PARSER_TIME_LITERAL, *p++);
+            continue;
+        }
+
+        p++;
+        switch (*p) {
+        case 'Y':
+            type = FLB_PARSER_TIME_YEAR;
+            pt->with_year = FLB_TRUE;
+            break;
+        case 'y':
+            type = FLB_PARSER_TIME_YEAR2;
+            pt->with_year = FLB_TRUE;
+            break;
+        case 'm':
+            type = FLB_PARSER_TIME_MONTH;
+            fields |= 1 << type;
+            break;
+        case 'b':
+        case 'h':
+        case 'B':
+            type = FLB_PARSER_TIME_MONTH_NAME;
+            fields |= 1 << FLB_PARSER_TIME_MONTH;
+            break;
+        case 'd':
+        case 'e':
+            type = FLB_PARSER_TIME_DAY;
+            fields |= 1 << type;
+            break;
+        case 'H':
+            type = FLB_PARSER_TIME_HOUR;
+            fields |= 1 << type;
+            break;
+        case 'M':
+            type = FLB_PARSER_TIME_MINUTE;
+            fields |= 1 << type;
+            break;
+        case 'S':
+            type = FLB_PARSER_TIME_SECOND;
+            fields |= 1 << type;
+            break;
+        case 'T':
+            ret |= add_op(pt, FLB_PARSER_TIME_HOUR, 0);
+            ret |= add_op(pt, FLB_PARSER_TIME_LITERAL, ':');
+            ret |= add_op(pt, FLB_PARSER_TIME_MINUTE, 0);
+            ret |= add_op(pt, FLB_PARSER_TIME_LITERAL, ':');
+            type = FLB_PARSER_TIME_SECOND;
+            fields |= (1 << FLB_PARSER_TIME_HOUR) |
+                (1 << FLB_PARSER_TIME_MINUTE) | (1 << FLB_PARSER_TIME_SECOND);
+            break;
+        case 'L':
+            type = FLB_PARSER_TIME_FRAC;
+            break;
+        case 'z':
+            type = FLB_PARSER_TIME_TZ;
+            break;
+        case '%':
+            ret = add_op(pt, FLB_PARSER_TIME_LITERAL, '%');
+            p++;
+            continue;
+        default:
+            return -1;
+        }
+
+        ret |= add_op(pt, type, 0);
+        p++;
+    }
+
+    if (ret != 0) {
+        return -1;
+    }
+
+    /* Without a full date and time the result would depend on libc */
+    if (fields != ((1 << FLB_PARSER_TIME_MONTH) | (1 << FLB_PARSER_TIME_DAY) |
+                   (1 << FLB_PARSER_TIME_HOUR) | (1 << FLB_PARSER_TIME_MINUTE) |
+                   (1 << FLB_PARSER_TIME_SECOND))) {
+        return -1;
+    }
+
+    /*
+     * The cache key ends with the last date/time field. It must be numeric
+     * so the length of the key does not depend on what follows it.
+     */
+    for (i = 0; i < pt->n_ops; i++) {
+        type = pt->ops[i].type;
+        if (type >= FLB_PARSER_TIME_YEAR && type <= FLB_PARSER_TIME_SECOND) {
+            pt->key_op = i;
+        }
+    }
+    if (pt->ops[pt->key_op].type == FLB_PARSER_TIME_MONTH_NAME) {
+        pt->key_op = -1;
+    }
+
+    return 0;
+}
+
+struct flb_parser_time *flb_parser_time_create(char *time_fmt)
+{
+    struct flb_parser_time *pt;
+
+    pt = flb_calloc(1, sizeof(struct flb_parser_time));
+    if (!pt) {
+        flb_errno();
+        return NULL;
+    }
+
+    /* Unsupported formats keep the strptime(3) path (n_ops = 0) */
+    if (time_compile(pt, time_fmt) == -1) {
+        pt->n_ops = 0;
+        pt->key_op = -1;
+        pt->with_year = FLB_FALSE;
+    }
+
+    return pt;
+}
+
+void flb_parser_time_destroy(struct flb_parser_time *pt)
+{
+    flb_free(pt);
+}
+
+/* Parse up to 'max' digits, strptime(3) skips leading spaces */
+static inline int get_number(char **p, char *end, int max, int *out)
+{
+    int n = 0;
+    int v = 0;
+    char *s = *p;
+
+    while (s < end && *s == ' ') {
+        s++;
+    }
+
+    while (s < end && n < max && *s >= '0' && *s <= '9') {
+        v = (v * 10) + (*s - '0');
+        s++;
+        n++;
+    }
+
+    if (n == 0) {
+        return -1;
+    }
+
+    *p = s;
+    *out = v;
+    return 0;
+}
+
+static inline int get_month_name(char **p, char *end, int *out)
+{
+    int i;
+    int len;
+    char *s = *p;
+
+    if (end - s < 3) {
+        return -1;
+    }
+
+    for (i = 0; i < 12; i++) {
+        if (strncasecmp(s, month_names[i], 3) == 0) {
+            break;
+        }
+    }
+    if (i == 12) {
+        return -1;
+    }
+
+    /* Full month name ? */
+    len = strlen(month_names[i]);
+    if (end - s >= len && strncasecmp(s, month_names[i], len) == 0) {
+        s += len;
+    }
+    else {
+        s += 3;
+    }
+
+    *p = s;
+    *out = i + 1;
+    return 0;
+}
+
+/* Fractional seconds, the value matches strtod(3) on the same digits */
+static inline int get_frac(char **p, char *end, double *out)
+{
+    int n = 0;
+    uint64_t v = 0;
+    uint64_t div = 1;
+    char *s = *p;
+
+    while (s < end && *s >= '0' && *s <= '9') {
+        if (n == 15) {
+            return -1;
+        }
+        v = (v * 10) + (*s - '0');
+        div *= 10;
+        s++;
+        n++;
+    }
+
+    if (n == 0) {
+        return -1;
+    }
+
+    *p = s;
+    *out = (double) v / (double) div;
+    return 0;
+}
+
+/* Z, +hh, +hhmm and +hh:mm */
+static inline int get_tz(char **p, char *end, int *out)
+{
+    int neg;
+    int hour;
+    int min = 0;
+    char *s = *p;
+
+    if (s < end && *s == 'Z') {
+        *p = s + 1;
+        *out = 0;
+        return 0;
+    }
+
+    if (end - s < 3 || (*s != '+' && *s != '-')) {
+        return -1;
+    }
+    neg = (*s++ == '-');
+
+    if (!isdigit((unsigned char) s[0]) || !isdigit((unsigned char) s[1])) {
+        return -1;
+    }
+    hour = ((s[0] - '0') * 10) + (s[1] - '0');
+    s += 2;
+
+    if (s < end && *s == ':') {
+        s++;
+    }
+    if (end - s >= 2 &&
+        isdigit((unsigned char) s[0]) && isdigit((unsigned char) s[1])) {
+        min = ((s[0] - '0') * 10) + (s[1] - '0');
+        s += 2;
+    }
+
+    if (hour > 23 || min > 59) {
+        return -1;
+    }
+
+    *p = s;
+    *out = (hour * 3600) + (min * 60);
+    if (neg) {
+        *out = -*out;
+    }
+    return 0;
+}
+
+/*
+ * Run the operations in the [op, last) range. The date fields are only set
+ * by the operations found, the caller provides the defaults.
+ */
+static int time_run(struct flb_parser_time *pt, int op, int last,
+                    char **str, char *end, int *date, double *frac,
+                    int *gmtoff, int *with_tz)
+{
+    int ret = 0;
+    int val;
+    char *p = *str;
+    struct flb_parser_time_op *o;
+
+    for (; op < last && ret == 0; op++) {
+        o = &pt->ops[op];
+
+        switch (o->type) {
+        case FLB_PARSER_TIME_LITERAL:
+            if (p >= end || *p != o->c) {
+                return -1;
+            }
+            p++;
+            break;
+        case FLB_PARSER_TIME_SPACE:
+            while (p < end && isspace((unsigned char) *p)) {
+                p++;
+            }
+            break;
+        case FLB_PARSER_TIME_YEAR:
+            ret = get_number(&p, end, 4, &date[0]);
+            break;
+        case FLB_PARSER_TIME_YEAR2:
+            ret = get_number(&p, end, 2, &val);
+            date[0] = val < 69 ? 2000 + val : 1900 + val;
+            break;
+        case FLB_PARSER_TIME_MONTH:
+            ret = get_number(&p, end, 2, &date[1]);
+            break;
+        case FLB_PARSER_TIME_MONTH_NAME:
+            ret = get_month_name(&p, end, &date[1]);
+            break;
+        case FLB_PARSER_TIME_DAY:
+            ret = get_number(&p, end, 2, &date[2]);
+            break;
+        case FLB_PARSER_TIME_HOUR:
+            ret = get_number(&p, end, 2, &date[3]);
+            break;
+        case FLB_PARSER_TIME_MINUTE:
+            ret = get_number(&p, end, 2, &date[4]);
+            break;
+        case FLB_PARSER_TIME_SECOND:
+            ret = get_number(&p, end, 2, &date[5]);
+            break;
+        case FLB_PARSER_TIME_FRAC:
+            ret = get_frac(&p, end, frac);
+            break;
+        case FLB_PARSER_TIME_TZ:
+            ret = get_tz(&p, end, gmtoff);
+            *with_tz = FLB_TRUE;
+            break;
+        }
+    }
+
+    *str = p;
+    return ret;
+}
+
+/* Hand-written parser, returns -1 if the string needs strptime(3) */
+static int time_fast(struct flb_parser_time *pt, char *time_str, size_t tsize,
+                     time_t now, struct flb_parser *parser,
+                     struct flb_time *out)
+{
+    int ret;
+    int key_len;
+    int gmtoff = 0;
+    int with_tz = FLB_FALSE;
+    int date[6] = {1900, 1, 1, 0, 0, 0};
+    int split;
+    double frac = 0;
+    time_t epoch;
+    char *p = time_str;
+    char *end = time_str + tsize;
+
+    if (pt->with_year == FLB_FALSE) {
+        date[0] = current_year(pt, now);
+    }
+
+    split = pt->key_op >= 0 ? pt->key_op + 1 : pt->n_ops;
+
+    /* Same date and time than the last record ? */
+    if (pt->key_len > 0 && tsize >= pt->key_len &&
+        memcmp(pt->key, time_str, pt->key_len) == 0 &&
+        (tsize == pt->key_len || !isdigit((unsigned char) time_str[pt->key_len]))) {
+        epoch = pt->epoch;
+        p += pt->key_len;
+    }
+    else {
+        ret = time_run(pt, 0, split, &p, end, date, &frac, &gmtoff, &with_tz);
+        if (ret == -1) {
+            return -1;
+        }
+
+        if (date[1] < 1 || date[1] > 12 || date[2] < 1 || date[2] > 31 ||
+            date[3] > 23 || date[4] > 59 || date[5] > 60) {
+            return -1;
+        }
+
+        epoch = days_from_civil(date[0], date[1], date[2]) * 86400 +
+            (date[3] * 3600) + (date[4] * 60) + date[5];
+
+        /* Cache the key, unless the last field was cut by a digit limit */
+        key_len = p - time_str;
+        if (pt->key_op >= 0 && key_len <= FLB_PARSER_TIME_KEY_SIZE &&
+            (p == end || !isdigit((unsigned char) *p))) {
+            memcpy(pt->key, time_str, key_len);
+            pt->key_len = key_len;
+            pt->epoch = epoch;
+        }
+        else {
+            pt->key_len = 0;
+        }
+    }
+
+    /* Fractional seconds and timezone */
+    ret = time_run(pt, split, pt->n_ops, &p, end, date, &frac,
+                   &gmtoff, &with_tz);
+    if (ret == -1) {
+        return -1;
+    }
+
+    if (with_tz == FLB_FALSE) {
+        gmtoff = parser->time_with_tz == FLB_TRUE ? 0 : parser->time_offset;
+    }
+
+    out->tm.tv_sec = epoch - gmtoff;
+    out->tm.tv_nsec = (frac * 1000000000);
+    return 0;
+}
+
+/*
+ * strptime(3) path. For formats without a hand-written parser the last full
+ * string is cached, the result depends on the parser fixed UTC offset and,
+ * for year-less formats, on the year.
+ */
+static int time_slow(struct flb_parser_time *pt, char *time_str, size_t tsize,
+                     time_t now, struct flb_parser *parser,
+                     struct flb_time *out)
+{
+    int ret;
+    double frac;
+    struct tm tm = {0};
+
+    if (parser->time_with_year == FLB_FALSE) {
+        current_year(pt, now);
+    }
+
+    if (pt->n_ops == 0 && pt->key_len > 0 && pt->key_len == tsize &&
+        pt->time_offset == parser->time_offset &&
+        memcmp(pt->key, time_str, tsize) == 0) {
+        out->tm.tv_sec = pt->epoch;
+        out->tm.tv_nsec = (pt->frac * 1000000000);
+        return 0;
+    }
+
+    ret = flb_parser_time_lookup(time_str, tsize, now, parser, &tm, &frac);
+    if (ret == -1) {
+        return -1;
+    }
+
+    out->tm.tv_sec = flb_parser_tm2time(&tm);
+    out->tm.tv_nsec = (frac * 1000000000);
+
+    if (pt->n_ops == 0 && tsize <= FLB_PARSER_TIME_KEY_SIZE) {
+        memcpy(pt->key, time_str, tsize);
+        pt->key_len = tsize;
+        pt->epoch = out->tm.tv_sec;
+        pt->frac = frac;
+        pt->time_offset = parser->time_offset;
+    }
+    else {
+        pt->key_len = 0;
+    }
+
+    return 0;
+}
+
+/*
+ * Resolve a time string of the parser Time_Format into 'out'. It gives the
+ * same results than flb_parser_time_lookup() + flb_parser_tm2time().
+ */
+int flb_parser_time_parse(char *time_str, size_t tsize, time_t now,
+                          struct flb_parser *parser, struct flb_time *out)
+{
+    int ret;
+    struct flb_parser_time *pt = parser->time_parser;
+
+    if (now <= 0) {
+        now = time(NULL);
+    }
+
+    if (pt->n_ops > 0) {
+        ret = time_fast(pt, time_str, tsize, now, parser, out);
+        if (ret == 0) {
+            return 0;
+        }
+
+        /* Unexpected input for the format, let strptime(3) decide */
+        pt->key_len = 0;
+    }
+
+    return time_slow(pt, time_str, tsize, now, parser, out);
+}
@@ -17,13 +17,20 @@
  *  limitations under the License.
  */
 
+#define _GNU_SOURCE
+#include <string.h>
+#include <ctype.h>
+
 #include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_macros.h>
 #include <fluent-bit/flb_regex.h>
 #include <fluent-bit/flb_log.h>
 
-#include <string.h>
 #include <onigmo.h>
 
+/* Shortest literal worth a memmem(3) before the regex search */
+#define FLB_REGEX_LITERAL_MIN  2
+
 
 static int
 cb_onig_named(const UChar *name, const UChar *name_end,
@@ -57,7 +64,187 @@ cb_onig_named(const UChar *name, const UChar *name_end,
     return 0;
 }
 
-static int str_to_regex(unsigned char *pattern, OnigRegex *reg)
+/* Skip a character class, 'p' points to the opening bracket */
+static unsigned char *skip_class(unsigned char *p, unsigned char *end)
+{
+    int depth = 0;
+
+    while (p < end) {
+        if (*p == '\\') {
+            p += 2;
+            continue;
+        }
+        if (*p == '[') {
+            depth++;
+            /* a closing bracket right after the opening one is literal */
+            if (p + 1 < end && p[1] == '^') {
+                p++;
+            }
+            if (p + 1 < end && p[1] == ']') {
+                p++;
+            }
+        }
+        else if (*p == ']') {
+            if (--depth == 0) {
+                return p + 1;
+            }
+        }
+        p++;
+    }
+
+    return NULL;
+}
+
+/* Remove the last UTF-8 character of a run */
+static inline int utf8_drop_last(unsigned char *run, int len)
+{
+    while (len > 0 && (run[len - 1] & 0xc0) == 0x80) {
+        len--;
+    }
+    if (len > 0) {
+        len--;
+    }
+    return len;
+}
+
+/*
+ * Find the longest run of literal characters every match must contain. The
+ * scan is conservative: only characters outside groups are considered and
+ * any top level alternation or inline option disables the prefilter.
+ */
+static void regex_literal(struct flb_regex *r,
+                          unsigned char *start, unsigned char *end)
+{
+    int depth = 0;
+    int len = 0;
+    int best_len = 0;
+    unsigned char c;
+    unsigned char *p = start;
+    unsigned char *q = NULL;
+    unsigned char *best = NULL;
+    unsigned char buf[256];
+    unsigned char run[256];
+
+    while (p < end) {
+        c = *p;
+
+        if (c == '|' && depth == 0) {
+            return;
+        }
+
+        if (c == '(' && p + 2 < end && p[1] == '?' &&
+            (isalpha(p[2]) || p[2] == '-')) {
+            /* inline options such as (?i) or (?x) */
+            return;
+        }
+
+        if (c == '[') {
+            p = skip_class(p, end);
+            if (!p) {
+                return;
+            }
+            len = 0;
+            continue;
+        }
+
+        if (c == '(') {
+            depth++;
+            len = 0;
+            p++;
+            continue;
+        }
+        if (c == ')') {
+            if (--depth < 0) {
+                return;
+            }
+            len = 0;
+            p++;
+            continue;
+        }
+
+        /* Quantifiers make the previous character optional */
+        if (c == '?' || c == '*' || c == '{') {
+            /* skip the {n,m} body, otherwise the brace is a literal */
+            if (c == '{') {
+                q = p + 1;
+                while (q < end && (isdigit(*q) || *q == ',')) {
+                    q++;
+                }
+                if (q < end && *q == '}') {
+                    p = q;
+                }
+            }
+
+            len = utf8_drop_last(run, len);
+            if (len > best_len) {
+                best_len = len;
+                memcpy(buf, run, len);
+                best = buf;
+            }
+            len = 0;
+            p++;
+            continue;
+        }
+
+        if (c == '\\') {
+            if (p + 1 >= end) {
+                return;
+            }
+            c = p[1];
+            p += 2;
+            if (isalnum(c) || c >= 0x80) {
+                /* \d, \w, \x41, back references... */
+                len = 0;
+                continue;
+            }
+        }
+        else {
+            p++;
+            if (c == '.' || c == '^' || c == '$' || c == '+' ||
+                c == ']' || c == '}') {
+                /* 'x+' requires one 'x' but the run ends after it */
+                if (c == '+' && len > best_len && depth == 0) {
+                    best_len = len;
+                    memcpy(buf, run, len);
+                    best = buf;
+                }
+                len = 0;
+                continue;
+            }
+        }
+
+        if (depth > 0) {
+            continue;
+        }
+
+        if (len < sizeof(run)) {
+            run[len++] = c;
+        }
+
+        /* Check the run unless a quantifier or a UTF-8 continuation follows */
+        if (p >= end || (*p != '?' && *p != '*' && *p != '{' && *p != '+' &&
+                         (*p & 0xc0) != 0x80)) {
+            if (len > best_len) {
+                best_len = len;
+                memcpy(buf, run, len);
+                best = buf;
+            }
+        }
+    }
+
+    if (depth != 0 || !best || best_len < FLB_REGEX_LITERAL_MIN) {
+        return;
+    }
+
+    r->literal = malloc(best_len);
+    if (!r->literal) {
+        return;
+    }
+    memcpy(r->literal, best, best_len);
+    r->literal_len = best_len;
+}
+
+static int str_to_regex(unsigned char *pattern, struct flb_regex *r)
 {
     int ret;
     int len;
@@ -74,16 +261,32 @@ static int str_to_regex(unsigned char *pattern, OnigRegex *reg)
         end--;
     }
 
-    ret = onig_new(reg, start, end,
+    ret = onig_new(&r->regex, start, end,
                    ONIG_OPTION_DEFAULT,
                    ONIG_ENCODING_UTF8, ONIG_SYNTAX_RUBY, &einfo);
 
     if (ret != ONIG_NORMAL) {
         return -1;
     }
+
+    regex_literal(r, start, end);
     return 0;
 }
 
+/* Literal prefilter, returns FLB_FALSE if 'str' can not match */
+static inline int regex_prefilter(struct flb_regex *r,
+                                  unsigned char *str, size_t slen)
+{
+    if (!r->literal) {
+        return FLB_TRUE;
+    }
+
+    if (memmem(str, slen, r->literal, r->literal_len) == NULL) {
+        return FLB_FALSE;
+    }
+    return FLB_TRUE;
+}
+
 /* Initialize backend library */
 int flb_regex_init()
 {
@@ -96,18 +299,26 @@ struct flb_regex *flb_regex_create(unsigned char *pattern)
     struct flb_regex *r;
 
     /* Create context */
-    r = malloc(sizeof(struct flb_regex));
+    r = calloc(1, sizeof(struct flb_regex));
     if (!r) {
         return NULL;
     }
 
     /* Compile pattern */
-    ret = str_to_regex(pattern, &r->regex);
+    ret = str_to_regex(pattern, r);
     if (ret == -1) {
         free(r);
         return NULL;
     }
 
+    r->region = onig_region_new();
+    if (!r->region) {
+        onig_free(r->regex);
+        free(r->literal);
+        free(r);
+        return NULL;
+    }
+
     return r;
 }
 
@@ -118,10 +329,8 @@ ssize_t flb_regex_do(struct flb_regex *r, unsigned char *str, size_t slen,
     unsigned char *start;
     unsigned char *end;
     unsigned char *range;
-    OnigRegion *region;
 
-    region = onig_region_new();
-    if (!region) {
+    if (regex_prefilter(r, str, slen) == FLB_FALSE) {
         return -1;
     }
 
@@ -130,29 +339,52 @@ ssize_t flb_regex_do(struct flb_regex *r, unsigned char *str, size_t slen,
     end   = start + slen;
     range = end;
 
-    ret = onig_search(r->regex, str, end, start, range, region, ONIG_OPTION_NONE);
+    ret = onig_search(r->regex, str, end, start, range, r->region,
+                      ONIG_OPTION_NONE);
     if (ret == ONIG_MISMATCH) {
-        onig_region_free(region, 1);
         return -1;
     }
     else if (ret < 0) {
-        onig_region_free(region, 1);
         return -1;
     }
 
-    result->region   = region;
+    result->region   = r->region;
     result->str      = str;
 
-    ret = region->num_regs - 1;
+    ret = r->region->num_regs - 1;
 
     if (ret == 0) {
         result->region = NULL;
-        onig_region_free(region, 1);
     }
 
     return ret;
 }
 
+/*
+ * Check if 'str' matches without extracting the captured groups. Returns
+ * FLB_TRUE, FLB_FALSE or -1 on error.
+ */
+int flb_regex_match(struct flb_regex *r, unsigned char *str, size_t slen)
+{
+    int ret;
+    unsigned char *end;
+
+    if (regex_prefilter(r, str, slen) == FLB_FALSE) {
+        return FLB_FALSE;
+    }
+
+    end = str + slen;
+    ret = onig_search(r->regex, str, end, str, end, NULL, ONIG_OPTION_NONE);
+    if (ret == ONIG_MISMATCH) {
+        return FLB_FALSE;
+    }
+    else if (ret < 0) {
+        return -1;
+    }
+
+    return FLB_TRUE;
+}
+
 int flb_regex_parse(struct flb_regex *r, struct flb_regex_search *result,
                     void (*cb_match) (unsigned char *,          /* name  */
                                       unsigned char *, size_t,  /* value */
@@ -166,7 +398,6 @@ int flb_regex_parse(struct flb_regex *r, struct flb_regex_search *result,
     result->last_pos = -1;
 
     ret = onig_foreach_name(r->regex, cb_onig_named, result);
-    onig_region_free(result->region, 1);
 
     if (ret == 0) {
         return result->last_pos;
@@ -177,6 +408,8 @@ int flb_regex_parse(struct flb_regex *r, struct flb_regex_search *result,
 int flb_regex_destroy(struct flb_regex *r)
 {
     onig_free(r->regex);
+    onig_region_free(r->region, 1);
+    free(r->literal);
     free(r);
     return 0;
 }
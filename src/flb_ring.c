@@ -0,0 +1,65 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_ring.h>
+
+/* Create a ring, the number of entries is rounded up to a power of two */
+struct flb_ring *flb_ring_create(size_t entry_size, size_t entries)
+{
+    size_t size = 2;
+    struct flb_ring *r;
+
+    if (entry_size == 0 || entries == 0) {
+        return NULL;
+    }
+
+    while (size < entries) {
+        size <<= 1;
+    }
+
+    r = flb_calloc(1, sizeof(struct flb_ring));
+    if (!r) {
+        flb_errno();
+        return NULL;
+    }
+
+    r->data = flb_malloc(entry_size * size);
+    if (!r->data) {
+        flb_errno();
+        flb_free(r);
+        return NULL;
+    }
+    r->entry_size = entry_size;
+    r->mask = size - 1;
+
+    return r;
+}
+
+void flb_ring_destroy(struct flb_ring *r)
+{
+    if (!r) {
+        return;
+    }
+
+    flb_free(r->data);
+    flb_free(r);
+}
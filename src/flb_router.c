@@ -17,58 +17,365 @@
  *  limitations under the License.
  */
 
+#define _GNU_SOURCE
+#include <string.h>
+
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_str.h>
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_filter.h>
+#include <fluent-bit/flb_hash.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_router.h>
 
-#include <string.h>
-
-/* wildcard support */
-/* tag and match should be null terminated. */
+/*
+ * Wildcard support: tag and match should be null terminated. The '*'
+ * wildcard matches any sequence of characters (including an empty one).
+ *
+ * Matching is done in a single pass: when a mismatch is found after a
+ * wildcard, the pattern is rewound to the character that follows the last
+ * wildcard and the tag is advanced by one, so no recursion is needed.
+ */
 int flb_router_match(const char *tag, const char *match)
 {
-    int ret = 0;
-    char *pos = NULL;
+    const char *m_back = NULL;
+    const char *t_back = NULL;
 
-    while (1) {
+    while (*tag) {
         if (*match == '*') {
-            while (*++match == '*'){
+            while (*++match == '*') {
                 /* skip successive '*' */
             }
-            if(*match == '\0'){
-                /*  '*' is last of string */
-                ret = 1;
-                break;
+            if (*match == '\0') {
+                /* '*' is last of string */
+                return 1;
             }
+            m_back = match;
+            t_back = tag;
+        }
+        else if (*match == *tag) {
+            match++;
+            tag++;
+        }
+        else if (m_back) {
+            /* mismatch, retry from the last wildcard */
+            match = m_back;
+            tag = ++t_back;
+        }
+        else {
+            return 0;
+        }
+    }
+
+    /* end of tag, remaining pattern can only be wildcards */
+    while (*match == '*') {
+        match++;
+    }
+
+    return (*match == '\0');
+}
+
+/* Compile a match rule into literal parts */
+struct flb_router_rule *flb_router_rule_create(const char *match)
+{
+    int len;
+    int n = 0;
+    char *p;
+    char *start;
+    struct flb_router_rule *rule;
+
+    rule = flb_calloc(1, sizeof(struct flb_router_rule));
+    if (!rule) {
+        flb_errno();
+        return NULL;
+    }
+
+    len = strlen(match);
+    rule->buf = flb_strndup(match, len);
+    if (!rule->buf) {
+        flb_free(rule);
+        return NULL;
+    }
+
+    /* Count the maximum number of literal parts */
+    for (p = rule->buf; *p; p++) {
+        if (*p == '*') {
+            n++;
+        }
+    }
+
+    if (n == 0) {
+        rule->exact = FLB_TRUE;
+    }
+    else if (n == len) {
+        rule->match_all = FLB_TRUE;
+        return rule;
+    }
+
+    rule->anchor_start = (len == 0 || match[0] != '*');
+    rule->anchor_end   = (len == 0 || match[len - 1] != '*');
+
+    rule->parts = flb_malloc(sizeof(struct flb_router_part) * (n + 1));
+    if (!rule->parts) {
+        flb_errno();
+        flb_router_rule_destroy(rule);
+        return NULL;
+    }
 
-            /* FIXME: we need to avoid recursive calls here */
-            while ((pos = strchr(tag, (int) *match))) {
-                if (flb_router_match(pos, match) ){
-                    ret = 1;
-                    break;
-                }
-                tag = pos+1;
+    /* Split the pattern by '*', empty parts are discarded */
+    start = rule->buf;
+    for (p = rule->buf; ; p++) {
+        if (*p == '*' || *p == '\0') {
+            if (p > start || rule->exact) {
+                rule->parts[rule->n_parts].str = start;
+                rule->parts[rule->n_parts].len = p - start;
+                rule->n_parts++;
+            }
+            if (*p == '\0') {
+                break;
             }
-            break;
+            start = p + 1;
         }
-        else if (*tag != *match ) {
-            /* mismatch! */
-            break;
+    }
+
+    return rule;
+}
+
+void flb_router_rule_destroy(struct flb_router_rule *rule)
+{
+    if (!rule) {
+        return;
+    }
+
+    flb_free(rule->parts);
+    flb_free(rule->buf);
+    flb_free(rule);
+}
+
+/* Match a Tag against a compiled rule, the Tag don't need to be null
+ * terminated. */
+int flb_router_rule_match(struct flb_router_rule *rule,
+                          const char *tag, int tag_len)
+{
+    int i;
+    int last;
+    int pos = 0;
+    int end = tag_len;
+    char *found;
+    struct flb_router_part *part;
+
+    if (rule->match_all) {
+        return 1;
+    }
+
+    if (rule->exact) {
+        part = &rule->parts[0];
+        return (part->len == tag_len && memcmp(part->str, tag, tag_len) == 0);
+    }
+
+    i = 0;
+    last = rule->n_parts;
+
+    /* prefix */
+    if (rule->anchor_start) {
+        part = &rule->parts[0];
+        if (part->len > end || memcmp(tag, part->str, part->len) != 0) {
+            return 0;
         }
-        else if (*tag == '\0'){
-            /* end of tag. so matched! */
-            ret = 1;
-            break;
+        pos = part->len;
+        i++;
+    }
+
+    /* suffix */
+    if (rule->anchor_end) {
+        part = &rule->parts[last - 1];
+        if (part->len > end - pos ||
+            memcmp(tag + end - part->len, part->str, part->len) != 0) {
+            return 0;
         }
-        tag++;
-        match++;
+        end -= part->len;
+        last--;
+    }
+
+    /* floating parts, leftmost match is always the best choice */
+    for (; i < last; i++) {
+        part = &rule->parts[i];
+        found = memmem(tag + pos, end - pos, part->str, part->len);
+        if (!found) {
+            return 0;
+        }
+        pos = (found - tag) + part->len;
+    }
+
+    return 1;
+}
+
+static inline int rule_match(struct flb_router_rule *rule, char *match,
+                             const char *tag, int tag_len)
+{
+    if (rule) {
+        return flb_router_rule_match(rule, tag, tag_len);
     }
 
-    return ret;
+    return flb_router_match(tag, match);
+}
+
+/* Check if the match rule of an output instance accepts a Tag */
+int flb_router_output_match(struct flb_output_instance *o_ins,
+                            const char *tag, int tag_len)
+{
+    if (!o_ins->match) {
+        return FLB_FALSE;
+    }
+    return rule_match(o_ins->match_rule, o_ins->match, tag, tag_len);
+}
+
+/* Check if the match rule of a filter instance accepts a Tag */
+int flb_router_filter_match(struct flb_filter_instance *f_ins,
+                            const char *tag, int tag_len)
+{
+    if (!f_ins->match) {
+        return FLB_FALSE;
+    }
+    return rule_match(f_ins->match_rule, f_ins->match, tag, tag_len);
+}
+
+/* Resolve the outputs and filters that matches a Tag */
+static struct flb_router_routes *routes_resolve(struct flb_config *config,
+                                                const char *tag, int tag_len,
+                                                size_t *out_size)
+{
+    int n = 0;
+    int n_outputs = 0;
+    int n_filters = 0;
+    size_t size;
+    struct mk_list *head;
+    struct flb_output_instance *o_ins;
+    struct flb_filter_instance *f_ins;
+    struct flb_router_routes *routes;
+
+    mk_list_foreach(head, &config->outputs) {
+        n++;
+    }
+    mk_list_foreach(head, &config->filters) {
+        n++;
+    }
+
+    size = sizeof(struct flb_router_routes) + (sizeof(void *) * n);
+    routes = flb_malloc(size);
+    if (!routes) {
+        flb_errno();
+        return NULL;
+    }
+
+    mk_list_foreach(head, &config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        if (flb_router_output_match(o_ins, tag, tag_len)) {
+            routes->ins[n_outputs++] = o_ins;
+        }
+    }
+
+    mk_list_foreach(head, &config->filters) {
+        f_ins = mk_list_entry(head, struct flb_filter_instance, _head);
+        if (flb_router_filter_match(f_ins, tag, tag_len)) {
+            routes->ins[n_outputs + n_filters++] = f_ins;
+        }
+    }
+
+    routes->n_outputs = n_outputs;
+    routes->n_filters = n_filters;
+    *out_size = sizeof(struct flb_router_routes) +
+        (sizeof(void *) * (n_outputs + n_filters));
+
+    return routes;
+}
+
+/*
+ * Lookup the outputs and filters for a given Tag. Routes are resolved only
+ * the first time a Tag is seen, then they are served from the routes cache
+ * until the configuration changes. The returned pointer is owned by the
+ * cache and is valid until the next call.
+ */
+struct flb_router_routes *flb_router_routes_get(struct flb_config *config,
+                                                const char *tag, int tag_len)
+{
+    int ret;
+    char *out_buf;
+    size_t out_size;
+    struct flb_hash *ht;
+    struct flb_router_routes *routes;
+
+    ht = config->route_cache;
+    if (!ht) {
+        ht = flb_hash_create(FLB_HASH_EVICT_RANDOM, FLB_ROUTER_CACHE_SIZE,
+                             FLB_ROUTER_CACHE_MAX);
+        if (!ht) {
+            return NULL;
+        }
+        config->route_cache = ht;
+    }
+
+    ret = flb_hash_get(ht, (char *) tag, tag_len, &out_buf, &out_size);
+    if (ret >= 0) {
+        return (struct flb_router_routes *) out_buf;
+    }
+
+    routes = routes_resolve(config, tag, tag_len, &out_size);
+    if (!routes) {
+        return NULL;
+    }
+
+    ret = flb_hash_add(ht, (char *) tag, tag_len, (char *) routes, out_size);
+    flb_free(routes);
+    if (ret == -1) {
+        return NULL;
+    }
+
+    ret = flb_hash_get(ht, (char *) tag, tag_len, &out_buf, &out_size);
+    if (ret == -1) {
+        return NULL;
+    }
+
+    return (struct flb_router_routes *) out_buf;
+}
+
+/* Drop all cached routes, must be called when outputs or filters change */
+void flb_router_cache_invalidate(struct flb_config *config)
+{
+    if (config->route_cache) {
+        flb_hash_destroy(config->route_cache);
+        config->route_cache = NULL;
+    }
+}
+
+/* Compile the match rules of outputs and filters */
+static void router_rules_compile(struct flb_config *config)
+{
+    struct mk_list *head;
+    struct flb_output_instance *o_ins;
+    struct flb_filter_instance *f_ins;
+
+    mk_list_foreach(head, &config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        flb_router_rule_destroy(o_ins->match_rule);
+        o_ins->match_rule = NULL;
+        if (o_ins->match) {
+            o_ins->match_rule = flb_router_rule_create(o_ins->match);
+        }
+    }
+
+    mk_list_foreach(head, &config->filters) {
+        f_ins = mk_list_entry(head, struct flb_filter_instance, _head);
+        flb_router_rule_destroy(f_ins->match_rule);
+        f_ins->match_rule = NULL;
+        if (f_ins->match) {
+            f_ins->match_rule = flb_router_rule_create(f_ins->match);
+        }
+    }
+
+    flb_router_cache_invalidate(config);
 }
 
 /* Associate and input and output instances due to a previous match */
@@ -122,10 +429,13 @@ int flb_router_io_set(struct flb_config *config)
                       i_ins->name, o_ins->name);
             o_ins->match = flb_strdup("*");
             flb_router_connect(i_ins, o_ins);
+            router_rules_compile(config);
             return 0;
         }
     }
 
+    router_rules_compile(config);
+
     /* N:M case, iterate all input instances */
     mk_list_foreach(i_head, &config->inputs) {
         i_ins = mk_list_entry(i_head, struct flb_input_instance, _head);
@@ -160,7 +470,8 @@ int flb_router_io_set(struct flb_config *config)
                 continue;
             }
 
-            if (flb_router_match(i_ins->tag, o_ins->match)) {
+            if (rule_match(o_ins->match_rule, o_ins->match,
+                           i_ins->tag, strlen(i_ins->tag))) {
                 flb_debug("[router] match rule %s:%s",
                           i_ins->name, o_ins->name);
                 flb_router_connect(i_ins, o_ins);
@@ -179,6 +490,22 @@ void flb_router_exit(struct flb_config *config)
     struct mk_list *r_head;
     struct flb_input_instance *in;
     struct flb_router_path *r;
+    struct flb_output_instance *o_ins;
+    struct flb_filter_instance *f_ins;
+
+    flb_router_cache_invalidate(config);
+
+    /* Release compiled rules */
+    mk_list_foreach(head, &config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        flb_router_rule_destroy(o_ins->match_rule);
+        o_ins->match_rule = NULL;
+    }
+    mk_list_foreach(head, &config->filters) {
+        f_ins = mk_list_entry(head, struct flb_filter_instance, _head);
+        flb_router_rule_destroy(f_ins->match_rule);
+        f_ins->match_rule = NULL;
+    }
 
     /* Iterate input plugins */
     mk_list_foreach_safe(head, tmp, &config->inputs) {
@@ -191,6 +191,10 @@ static struct flb_task *task_alloc(struct flb_config *config)
     task->status    = FLB_TASK_NEW;
     task->n_threads = 0;
     task->users     = 0;
+    task->records   = -1;
+#ifdef FLB_HAVE_METRICS
+    task->created   = flb_metrics_time();
+#endif
     mk_list_init(&task->threads);
     mk_list_init(&task->routes);
     mk_list_init(&task->retries);
@@ -202,19 +206,21 @@ static struct flb_task *task_alloc(struct flb_config *config)
 struct flb_task *flb_task_create(uint64_t ref_id,
                                  char *buf,
                                  size_t size,
+                                 int records,
                                  struct flb_input_instance *i_ins,
                                  struct flb_input_dyntag *dt,
                                  char *tag,
                                  struct flb_config *config)
 {
+    int n;
     int count = 0;
     uint64_t routes_mask = 0;
     struct flb_task *task;
     struct flb_task_route *route;
     struct flb_output_instance *o_ins;
     struct flb_router_path *router_path;
+    struct flb_router_routes *routes;
     struct mk_list *head;
-    struct mk_list *o_head;
 
     task = task_alloc(config);
     if (!task) {
@@ -226,6 +232,7 @@ struct flb_task *flb_task_create(uint64_t ref_id,
     task->tag    = flb_strdup(tag);
     task->buf    = buf;
     task->size   = size;
+    task->records = records;
     task->i_ins  = i_ins;
     task->dt     = dt;
     task->destinations = 0;
@@ -253,14 +260,15 @@ struct flb_task *flb_task_create(uint64_t ref_id,
     }
     else {
         /* Find dynamic routes for the incoming tag */
-        mk_list_foreach(o_head, &config->outputs) {
-            o_ins = mk_list_entry(o_head,
-                                  struct flb_output_instance, _head);
-            if (!o_ins->match) {
-                continue;
-            }
+        routes = flb_router_routes_get(config, tag, strlen(tag));
+        if (!routes) {
+            /* Routes not available (out of memory), match the outputs */
+            mk_list_foreach(head, &config->outputs) {
+                o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+                if (!flb_router_output_match(o_ins, tag, strlen(tag))) {
+                    continue;
+                }
 
-            if (flb_router_match(tag, o_ins->match)) {
                 route = flb_malloc(sizeof(struct flb_task_route));
                 if (!route) {
                     flb_errno();
@@ -271,10 +279,26 @@ struct flb_task *flb_task_create(uint64_t ref_id,
                 mk_list_add(&route->_head, &task->routes);
                 count++;
 
-                /* set the routes as a mask */
                 routes_mask |= o_ins->mask_id;
             }
         }
+
+        for (n = 0; routes && n < routes->n_outputs; n++) {
+            o_ins = flb_router_routes_output(routes, n);
+
+            route = flb_malloc(sizeof(struct flb_task_route));
+            if (!route) {
+                flb_errno();
+                continue;
+            }
+
+            route->out = o_ins;
+            mk_list_add(&route->_head, &task->routes);
+            count++;
+
+            /* set the routes as a mask */
+            routes_mask |= o_ins->mask_id;
+        }
     }
 
     /* no destinations ?, useless task. */
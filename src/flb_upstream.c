@@ -17,6 +17,9 @@
  *  limitations under the License.
  */
 
+#include <time.h>
+#include <errno.h>
+
 #include <monkey/mk_core.h>
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_mem.h>
@@ -25,6 +28,7 @@
 #include <fluent-bit/flb_io.h>
 #include <fluent-bit/flb_io_tls.h>
 #include <fluent-bit/flb_tls.h>
+#include <fluent-bit/flb_engine.h>
 
 /* Creates a new upstream context */
 struct flb_upstream *flb_upstream_create(struct flb_config *config,
@@ -39,11 +43,13 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
         return NULL;
     }
 
-    u->tcp_host      = flb_strdup(host);
-    u->tcp_port      = port;
-    u->flags         = flags;
-    u->evl           = config->evl;
-    u->n_connections = 0;
+    u->tcp_host        = flb_strdup(host);
+    u->tcp_port        = port;
+    u->flags           = flags;
+    u->evl             = config->evl;
+    u->n_connections   = 0;
+    u->ka_idle_timeout = FLB_UPSTREAM_KA_IDLE_TIMEOUT;
+    u->ka_max_recycle  = FLB_UPSTREAM_KA_MAX_RECYCLE;
     mk_list_init(&u->av_queue);
     mk_list_init(&u->busy_queue);
 
@@ -72,6 +78,84 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
     return u;
 }
 
+/*
+ * Enable or disable keepalive mode for an upstream. When enabled, a
+ * connection released through flb_upstream_conn_release() is kept open
+ * in the 'av_queue' so the next flb_upstream_conn_get() call can re-use it
+ * without a new TCP connect (and TLS handshake).
+ */
+void flb_upstream_keepalive(struct flb_upstream *u, int enabled,
+                            int idle_timeout, int max_recycle)
+{
+    if (enabled == FLB_TRUE) {
+        u->flags |= FLB_IO_TCP_KA;
+    }
+    else {
+        u->flags &= ~(FLB_IO_TCP_KA);
+    }
+
+    if (idle_timeout > 0) {
+        u->ka_idle_timeout = idle_timeout;
+    }
+    u->ka_max_recycle = max_recycle;
+}
+
+/*
+ * Connections are registered in the event loop of the thread that runs the
+ * co-routine using them: the engine or an engine worker.
+ */
+static inline struct mk_event_loop *conn_evl(struct flb_upstream *u)
+{
+    struct mk_event_loop *evl;
+
+    evl = flb_engine_evl_get();
+    if (evl) {
+        return evl;
+    }
+
+    return u->evl;
+}
+
+/* Close the connection socket and release its resources */
+static int destroy_conn(struct flb_upstream_conn *u_conn)
+{
+    struct flb_upstream *u = u_conn->u;
+
+    flb_trace("[upstream] [fd=%i] releasing connection %p",
+              u_conn->fd, u_conn);
+
+    if (u->flags & FLB_IO_ASYNC) {
+        mk_event_del(u_conn->evl, &u_conn->event);
+    }
+
+    if (u_conn->fd > 0) {
+        flb_socket_close(u_conn->fd);
+    }
+
+#ifdef FLB_HAVE_TLS
+    if (u_conn->tls_session) {
+        flb_tls_session_destroy(u_conn->tls_session);
+        u_conn->tls_session = NULL;
+    }
+#endif
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_lock(&u->mutex_queue);
+#endif
+
+    /* remove connection from the queue */
+    mk_list_del(&u_conn->_head);
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_unlock(&u->mutex_queue);
+#endif
+
+    u->n_connections--;
+    flb_free(u_conn);
+
+    return 0;
+}
+
 int flb_upstream_destroy(struct flb_upstream *u)
 {
     struct mk_list *tmp;
@@ -80,12 +164,17 @@ int flb_upstream_destroy(struct flb_upstream *u)
 
     mk_list_foreach_safe(head, tmp, &u->av_queue) {
         u_conn = mk_list_entry(head, struct flb_upstream_conn, _head);
-        flb_upstream_conn_release(u_conn);
+        destroy_conn(u_conn);
     }
 
     mk_list_foreach_safe(head, tmp, &u->busy_queue) {
         u_conn = mk_list_entry(head, struct flb_upstream_conn, _head);
-        flb_upstream_conn_release(u_conn);
+        destroy_conn(u_conn);
+    }
+
+    if (u->flags & FLB_IO_TCP_KA) {
+        flb_debug("[upstream] %s:%i connections: new=%lu reused=%lu",
+                  u->tcp_host, u->tcp_port, u->n_conn_new, u->n_conn_reused);
     }
 
     flb_free(u->tcp_host);
@@ -112,6 +201,10 @@ static struct flb_upstream_conn *create_conn(struct flb_upstream *u)
     conn->u             = u;
     conn->fd            = -1;
     conn->connect_count = 0;
+    conn->ka_count      = 0;
+    conn->recycle       = FLB_TRUE;
+    conn->ts_available  = 0;
+    conn->evl           = conn_evl(u);
 #ifdef FLB_HAVE_TLS
     conn->tls_session   = NULL;
 #endif
@@ -137,21 +230,69 @@ static struct flb_upstream_conn *create_conn(struct flb_upstream *u)
 #endif
 
     u->n_connections++;
+    u->n_conn_new++;
 
     return conn;
 }
 
+/*
+ * Check if an idle keepalive connection is still usable: the remote end
+ * must not have closed the connection and no unexpected data must be
+ * waiting in the socket (e.g: a late response or a TLS close alert).
+ */
+static int conn_is_alive(struct flb_upstream_conn *u_conn, time_t now)
+{
+    int ret;
+    char tmp;
+    struct flb_upstream *u = u_conn->u;
+
+    if (u_conn->fd <= 0) {
+        return FLB_FALSE;
+    }
+
+    if (now - u_conn->ts_available > u->ka_idle_timeout) {
+        flb_debug("[upstream] [fd=%i] keepalive connection idle timeout",
+                  u_conn->fd);
+        return FLB_FALSE;
+    }
+
+    ret = recv(u_conn->fd, &tmp, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return FLB_TRUE;
+    }
+
+    flb_debug("[upstream] [fd=%i] keepalive connection is not longer valid",
+              u_conn->fd);
+    return FLB_FALSE;
+}
+
 static struct flb_upstream_conn *get_conn(struct flb_upstream *u)
 {
-    struct flb_upstream_conn *conn;
+    time_t now;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_upstream_conn *conn = NULL;
+    struct flb_upstream_conn *entry;
+
+    now = time(NULL);
+
+    mk_list_foreach_safe(head, tmp, &u->av_queue) {
+        entry = mk_list_entry(head, struct flb_upstream_conn, _head);
+        if (conn_is_alive(entry, now) == FLB_FALSE) {
+            destroy_conn(entry);
+            continue;
+        }
+        conn = entry;
+        break;
+    }
+
+    if (!conn) {
+        return NULL;
+    }
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_lock(&u->mutex_queue);
 #endif
-    /* Get the first available connection and increase the counter */
-    conn = mk_list_entry_first(&u->av_queue,
-                               struct flb_upstream_conn, _head);
-    u->n_connections++;
 
     /* Move it to the busy queue */
     mk_list_del(&conn->_head);
@@ -161,6 +302,14 @@ static struct flb_upstream_conn *get_conn(struct flb_upstream *u)
     pthread_mutex_unlock(&u->mutex_queue);
 #endif
 
+    conn->ka_count++;
+    conn->recycle = FLB_TRUE;
+    conn->evl = conn_evl(u);
+    u->n_conn_reused++;
+
+    flb_trace("[upstream] [fd=%i] re-using keepalive connection %p (%i)",
+              conn->fd, conn, conn->ka_count);
+
     return conn;
 }
 
@@ -168,29 +317,22 @@ struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u)
 {
     struct flb_upstream_conn *u_conn = NULL;
 
-    /*
-     * FIXME: for 0.9 series the keep alive mode will be enabled, useless
-     * check now as the available queue is always empty.
-     */
-    if (mk_list_is_empty(&u->av_queue) == 0) {
-
-
-	/*	flb_debug("flb_upstream_conn_get_create_conn");*/
-        if (u->max_connections <= 0) {
-            u_conn = create_conn(u);
-        }
-        else if (u->n_connections < u->max_connections) {
-            u_conn = create_conn(u);
-        }
-        else {
-            return NULL;
+    /* Try to re-use an available keepalive connection */
+    if (mk_list_is_empty(&u->av_queue) != 0) {
+        u_conn = get_conn(u);
+        if (u_conn) {
+            return u_conn;
         }
     }
-    else {
-        /* Get an available connection */
 
-		/*flb_debug("flb_upstream_conn_get_get_conn");*/
-        u_conn = get_conn(u);
+    if (u->max_connections <= 0) {
+        u_conn = create_conn(u);
+    }
+    else if (u->n_connections < u->max_connections) {
+        u_conn = create_conn(u);
+    }
+    else {
+        return NULL;
     }
 
     if (!u_conn) {
@@ -204,37 +346,42 @@ int flb_upstream_conn_release(struct flb_upstream_conn *u_conn)
 {
     struct flb_upstream *u = u_conn->u;
 
-    flb_trace("[upstream] [fd=%i] releasing connection %p",
-              u_conn->fd, u_conn);
-
-    if (u->flags & FLB_IO_ASYNC) {
-        mk_event_del(u->evl, &u_conn->event);
-    }
-
-    if (u_conn->fd > 0) {
-        flb_socket_close(u_conn->fd);
+    /*
+     * If keepalive is not enabled, the connection was flagged as not
+     * reusable or it reached the maximum number of recycles, just
+     * close it.
+     */
+    if ((u->flags & FLB_IO_TCP_KA) == 0 || u_conn->recycle == FLB_FALSE ||
+        u_conn->fd <= 0 ||
+        (u->ka_max_recycle > 0 && u_conn->ka_count >= u->ka_max_recycle)) {
+        return destroy_conn(u_conn);
     }
 
-#ifdef FLB_HAVE_TLS
-    if (u_conn->tls_session) {
-        flb_tls_session_destroy(u_conn->tls_session);
-        u_conn->tls_session = NULL;
+    /*
+     * Make sure no event is registered for this socket while the
+     * connection is idle, otherwise the event loop would try to resume
+     * a co-routine that does not longer exists.
+     */
+    if (u->flags & FLB_IO_ASYNC) {
+        mk_event_del(u_conn->evl, &u_conn->event);
     }
-#endif
+    u_conn->thread = NULL;
+    u_conn->ts_available = time(NULL);
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_lock(&u->mutex_queue);
 #endif
 
-    /* remove connection from the queue */
+    /* Move it to the available queue */
     mk_list_del(&u_conn->_head);
+    mk_list_add(&u_conn->_head, &u->av_queue);
 
 #ifdef FLB_HAVE_FLUSH_PTHREADS
     pthread_mutex_unlock(&u->mutex_queue);
 #endif
 
-    u->n_connections--;
-    flb_free(u_conn);
+    flb_trace("[upstream] [fd=%i] keepalive connection %p is available",
+              u_conn->fd, u_conn);
 
     return 0;
 }
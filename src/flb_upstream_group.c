@@ -0,0 +1,261 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <time.h>
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_upstream_group.h>
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+#define group_lock(g)     pthread_mutex_lock(&g->mutex)
+#define group_unlock(g)   pthread_mutex_unlock(&g->mutex)
+#else
+#define group_lock(g)     do {} while (0)
+#define group_unlock(g)   do {} while (0)
+#endif
+
+struct flb_upstream_group *flb_upstream_group_create(int balance)
+{
+    struct flb_upstream_group *g;
+
+    g = flb_calloc(1, sizeof(struct flb_upstream_group));
+    if (!g) {
+        flb_errno();
+        return NULL;
+    }
+    g->balance = balance;
+    mk_list_init(&g->nodes);
+
+#ifdef FLB_HAVE_FLUSH_PTHREADS
+    pthread_mutex_init(&g->mutex, NULL);
+#endif
+
+    return g;
+}
+
+/* Destroy the group and the upstreams of its nodes */
+void flb_upstream_group_destroy(struct flb_upstream_group *g)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_upstream_node *node;
+
+    if (!g) {
+        return;
+    }
+
+    mk_list_foreach_safe(head, tmp, &g->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        flb_debug("[upstream_group] %s:%i flushes: ok=%lu failed=%lu",
+                  node->u->tcp_host, node->u->tcp_port,
+                  node->n_ok, node->n_failed);
+        mk_list_del(&node->_head);
+        flb_upstream_destroy(node->u);
+        flb_free(node);
+    }
+
+    flb_free(g);
+}
+
+/* Register an upstream in the group, the group takes its ownership */
+struct flb_upstream_node *flb_upstream_group_add(struct flb_upstream_group *g,
+                                                 struct flb_upstream *u,
+                                                 int weight, int backup)
+{
+    struct flb_upstream_node *node;
+
+    node = flb_calloc(1, sizeof(struct flb_upstream_node));
+    if (!node) {
+        flb_errno();
+        return NULL;
+    }
+    node->weight = (weight > 0) ? weight : 1;
+    node->backup = backup;
+    node->u = u;
+
+    mk_list_add(&node->_head, &g->nodes);
+    g->n_nodes++;
+
+    return node;
+}
+
+/*
+ * Smooth weighted round-robin (as in Nginx): every candidate gains its
+ * weight, the one with the highest value is selected and loses the sum
+ * of the weights. Nodes are interleaved instead of sent in bursts.
+ */
+static struct flb_upstream_node *select_rr(struct flb_upstream_group *g,
+                                           int backup, time_t now)
+{
+    int total = 0;
+    struct mk_list *head;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *best = NULL;
+
+    mk_list_foreach(head, &g->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        if (node->backup != backup || node->retry_at > now) {
+            continue;
+        }
+
+        node->current_weight += node->weight;
+        total += node->weight;
+        if (!best || node->current_weight > best->current_weight) {
+            best = node;
+        }
+    }
+
+    if (best) {
+        best->current_weight -= total;
+    }
+    return best;
+}
+
+/*
+ * Least outstanding bytes relative to the weight of the node, ties are
+ * broken rotating the first node checked so idle nodes share the load.
+ */
+static struct flb_upstream_node *select_least(struct flb_upstream_group *g,
+                                              int backup, time_t now)
+{
+    int i = 0;
+    int order;
+    int best_order = 0;
+    size_t a;
+    size_t b;
+    struct mk_list *head;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *best = NULL;
+
+    mk_list_foreach(head, &g->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        order = (i - g->cursor + g->n_nodes) % g->n_nodes;
+        i++;
+
+        if (node->backup != backup || node->retry_at > now) {
+            continue;
+        }
+
+        if (!best) {
+            best = node;
+            best_order = order;
+            continue;
+        }
+
+        a = node->outstanding * best->weight;
+        b = best->outstanding * node->weight;
+        if (a < b || (a == b && order < best_order)) {
+            best = node;
+            best_order = order;
+        }
+    }
+
+    g->cursor = (g->cursor + 1) % g->n_nodes;
+    return best;
+}
+
+/*
+ * Select the node for a flush of 'bytes', primary nodes first and the
+ * backup ones if no primary node is healthy. Returns NULL if every node
+ * is waiting for its backoff to expire.
+ */
+struct flb_upstream_node *flb_upstream_group_next(struct flb_upstream_group *g,
+                                                  size_t bytes)
+{
+    time_t now;
+    struct flb_upstream_node *node;
+
+    if (g->n_nodes == 0) {
+        return NULL;
+    }
+
+    now = time(NULL);
+
+    group_lock(g);
+    if (g->balance == FLB_UPSTREAM_GROUP_LEAST) {
+        node = select_least(g, FLB_FALSE, now);
+        if (!node) {
+            node = select_least(g, FLB_TRUE, now);
+        }
+    }
+    else {
+        node = select_rr(g, FLB_FALSE, now);
+        if (!node) {
+            node = select_rr(g, FLB_TRUE, now);
+        }
+    }
+
+    if (node) {
+        node->in_flight++;
+        node->outstanding += bytes;
+    }
+    group_unlock(g);
+
+    return node;
+}
+
+/*
+ * Report the result of a flush through a node. A failure takes the node
+ * out of the selection for an exponential backoff, the first success
+ * after that brings it back.
+ */
+void flb_upstream_group_done(struct flb_upstream_group *g,
+                             struct flb_upstream_node *node,
+                             size_t bytes, int ok)
+{
+    int shift;
+    int backoff;
+
+    group_lock(g);
+    node->in_flight--;
+    node->outstanding -= bytes;
+
+    if (ok == FLB_TRUE) {
+        if (node->failures > 0) {
+            flb_info("[upstream_group] node %s:%i is up",
+                     node->u->tcp_host, node->u->tcp_port);
+        }
+        node->failures = 0;
+        node->retry_at = 0;
+        node->n_ok++;
+        group_unlock(g);
+        return;
+    }
+
+    node->failures++;
+    node->n_failed++;
+
+    shift = node->failures - 1;
+    if (shift > 6) {
+        shift = 6;
+    }
+    backoff = FLB_UPSTREAM_NODE_BACKOFF_BASE << shift;
+    if (backoff > FLB_UPSTREAM_NODE_BACKOFF_MAX) {
+        backoff = FLB_UPSTREAM_NODE_BACKOFF_MAX;
+    }
+    node->retry_at = time(NULL) + backoff;
+    group_unlock(g);
+
+    flb_warn("[upstream_group] node %s:%i is down, retry in %i seconds",
+             node->u->tcp_host, node->u->tcp_port, backoff);
+}
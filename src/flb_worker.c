@@ -34,18 +34,11 @@ FLB_TLS_DEFINE(struct flb_worker, flb_worker_ctx);
  */
 static void step_callback(void *data)
 {
-    int ret;
     struct flb_worker *worker = data;
 
-    /* Set the worker context global */
+    /* Set the worker context global, logging was set up by the creator */
     FLB_TLS_SET(flb_worker_ctx, worker);
 
-    /* Initialize worker-required data */
-    ret = flb_log_worker_init(worker);
-    if (ret == -1) {
-        fprintf(stderr, "[worker] error initializing log-worker context\n");
-    }
-
     /* not too scary :) */
     worker->func(worker->data);
 
@@ -88,6 +81,7 @@ int flb_worker_create(void (*func) (void *), void *arg, pthread_t *tid,
     /* Spawn the step_callback and the func() */
     ret = mk_utils_worker_spawn(step_callback, worker, &worker->tid);
     if (ret != 0) {
+        flb_log_worker_destroy(worker);
         flb_free(worker);
         return -1;
     }
@@ -139,6 +133,7 @@ int flb_worker_exit(struct flb_config *config)
     mk_list_foreach_safe(head, tmp, &config->workers) {
         worker = mk_list_entry(head, struct flb_worker, _head);
         mk_list_del(&worker->_head);
+        flb_log_worker_destroy(worker);
         flb_free(worker);
         c++;
     }
@@ -148,6 +143,12 @@ int flb_worker_exit(struct flb_config *config)
 
 int flb_worker_log_level(struct flb_worker *worker)
 {
-    struct flb_log *log = worker->log_ctx;
+    struct flb_log *log;
+
+    /* After flb_log_stop() the thread logs like one without a worker */
+    log = __atomic_load_n(&worker->log_ctx, __ATOMIC_ACQUIRE);
+    if (!log) {
+        return FLB_LOG_INFO;
+    }
     return log->level;
 };
@@ -218,10 +218,15 @@ static void flb_signal_handler(int signal)
 
     /* Signal handlers */
     switch (signal) {
+#ifndef _WIN32
+    case SIGHUP:
+        /* Reopen the log file, e.g: after it was rotated */
+        flb_log_reopen(config);
+        break;
+#endif
     case SIGINT:
 #ifndef _WIN32
     case SIGQUIT:
-    case SIGHUP:
 #endif
         flb_engine_shutdown(config);
 #ifdef FLB_HAVE_MTRACE
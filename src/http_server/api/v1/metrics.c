@@ -138,6 +138,97 @@ static void cb_mq_metrics(mk_mq_t *queue, void *data, size_t size)
     cleanup_metrics();
 }
 
+/*
+ * Histograms are exported as a map of cumulative buckets plus the sum and
+ * the count of the observed values:
+ *
+ * fluentbit_output_flush_latency_seconds_bucket{name="es.0",le="0.1"} N TS
+ * fluentbit_output_flush_latency_seconds_sum{name="es.0"} N TS
+ * fluentbit_output_flush_latency_seconds_count{name="es.0"} N TS
+ */
+static flb_sds_t metrics_prometheus_hist(flb_sds_t sds,
+                                         msgpack_object *section,
+                                         msgpack_object *name,
+                                         msgpack_object *title,
+                                         msgpack_object *hist,
+                                         char *time_str, int time_len)
+{
+    int i;
+    int b;
+    int len;
+    char tmp[64];
+    msgpack_object k;
+    msgpack_object v;
+    msgpack_object bk;
+    msgpack_object bv;
+
+    for (i = 0; i < hist->via.map.size; i++) {
+        k = hist->via.map.ptr[i].key;
+        v = hist->via.map.ptr[i].val;
+
+        if (k.type != MSGPACK_OBJECT_STR) {
+            continue;
+        }
+
+        if (k.via.str.size == 7 && strncmp(k.via.str.ptr, "buckets", 7) == 0 &&
+            v.type == MSGPACK_OBJECT_MAP) {
+            for (b = 0; b < v.via.map.size; b++) {
+                bk = v.via.map.ptr[b].key;
+                bv = v.via.map.ptr[b].val;
+
+                sds = flb_sds_cat(sds, "fluentbit_", 10);
+                sds = flb_sds_cat(sds, (char *) section->via.str.ptr,
+                                  section->via.str.size);
+                sds = flb_sds_cat(sds, "_", 1);
+                sds = flb_sds_cat(sds, (char *) title->via.str.ptr,
+                                  title->via.str.size);
+                sds = flb_sds_cat(sds, "_bucket{name=\"", 14);
+                sds = flb_sds_cat(sds, (char *) name->via.str.ptr,
+                                  name->via.str.size);
+                sds = flb_sds_cat(sds, "\",le=\"", 6);
+                sds = flb_sds_cat(sds, (char *) bk.via.str.ptr,
+                                  bk.via.str.size);
+                sds = flb_sds_cat(sds, "\"} ", 3);
+
+                len = snprintf(tmp, sizeof(tmp) - 1, "%lu ", bv.via.u64);
+                sds = flb_sds_cat(sds, tmp, len);
+                sds = flb_sds_cat(sds, time_str, time_len);
+                sds = flb_sds_cat(sds, "\n", 1);
+            }
+            continue;
+        }
+
+        if (v.type == MSGPACK_OBJECT_FLOAT) {
+            len = snprintf(tmp, sizeof(tmp) - 1, "%.6f ", v.via.f64);
+        }
+        else if (v.type == MSGPACK_OBJECT_POSITIVE_INTEGER) {
+            len = snprintf(tmp, sizeof(tmp) - 1, "%lu ", v.via.u64);
+        }
+        else {
+            continue;
+        }
+
+        /* _sum and _count */
+        sds = flb_sds_cat(sds, "fluentbit_", 10);
+        sds = flb_sds_cat(sds, (char *) section->via.str.ptr,
+                          section->via.str.size);
+        sds = flb_sds_cat(sds, "_", 1);
+        sds = flb_sds_cat(sds, (char *) title->via.str.ptr,
+                          title->via.str.size);
+        sds = flb_sds_cat(sds, "_", 1);
+        sds = flb_sds_cat(sds, (char *) k.via.str.ptr, k.via.str.size);
+        sds = flb_sds_cat(sds, "{name=\"", 7);
+        sds = flb_sds_cat(sds, (char *) name->via.str.ptr,
+                          name->via.str.size);
+        sds = flb_sds_cat(sds, "\"} ", 3);
+        sds = flb_sds_cat(sds, tmp, len);
+        sds = flb_sds_cat(sds, time_str, time_len);
+        sds = flb_sds_cat(sds, "\n", 1);
+    }
+
+    return sds;
+}
+
 /* API: expose metrics in Prometheus format /api/v1/metrics/prometheus */
 void cb_metrics_prometheus(mk_request_t *request, void *data)
 {
@@ -183,6 +274,8 @@ void cb_metrics_prometheus(mk_request_t *request, void *data)
     /*
      * fluentbit_input_records[name="cpu0", hostname="${HOSTNAME}"] NUM TIMESTAMP
      * fluentbit_input_bytes[name="cpu0", hostname="${HOSTNAME}"] NUM TIMESTAMP
+     *
+     * histograms are expanded by metrics_prometheus_hist().
      */
     msgpack_unpacked_init(&result);
     msgpack_unpack_next(&result, buf->raw_data, buf->raw_size, &off);
@@ -211,6 +304,12 @@ void cb_metrics_prometheus(mk_request_t *request, void *data)
                 mk = sv.via.map.ptr[m].key;
                 mv = sv.via.map.ptr[m].val;
 
+                if (mv.type == MSGPACK_OBJECT_MAP) {
+                    sds = metrics_prometheus_hist(sds, &k, &sk, &mk, &mv,
+                                                  time_str, time_len);
+                    continue;
+                }
+
                 sds = flb_sds_cat(sds, "fluentbit_", 10);
                 sds = flb_sds_cat(sds, (char *) k.via.str.ptr, k.via.str.size);
                 sds = flb_sds_cat(sds, "_", 1);
@@ -0,0 +1,153 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_bufpool.h>
+
+#include <string.h>
+#include "flb_tests_internal.h"
+
+static void test_classes()
+{
+    struct flb_bufpool *pool;
+
+    pool = flb_bufpool_create(1024, 8192, 0);
+    TEST_CHECK(pool != NULL);
+    TEST_CHECK(pool->classes == 4);
+
+    TEST_CHECK(flb_bufpool_size(pool, 1) == 1024);
+    TEST_CHECK(flb_bufpool_size(pool, 1024) == 1024);
+    TEST_CHECK(flb_bufpool_size(pool, 1025) == 2048);
+    TEST_CHECK(flb_bufpool_size(pool, 5000) == 8192);
+
+    /* Bigger than the last class: exact size */
+    TEST_CHECK(flb_bufpool_size(pool, 10000) == 10000);
+
+    flb_bufpool_destroy(pool);
+}
+
+static void test_reuse()
+{
+    char *a;
+    char *b;
+    char *c;
+    struct flb_bufpool *pool;
+
+    pool = flb_bufpool_create(1024, 4096, 0);
+    TEST_CHECK(pool != NULL);
+
+    a = flb_bufpool_get(pool, 1000);
+    TEST_CHECK(a != NULL);
+    TEST_CHECK(pool->in_use == 1024);
+    memset(a, 'a', 1024);
+
+    /* A released buffer is handed out again for the same class */
+    flb_bufpool_put(pool, a, 1000);
+    TEST_CHECK(pool->in_use == 0);
+    TEST_CHECK(pool->cached == 1024);
+
+    b = flb_bufpool_get(pool, 512);
+    TEST_CHECK(b == a);
+    TEST_CHECK(pool->cached == 0);
+
+    /* Other classes do not take it */
+    flb_bufpool_put(pool, b, 512);
+    c = flb_bufpool_get(pool, 2048);
+    TEST_CHECK(c != NULL && c != a);
+    TEST_CHECK(pool->in_use == 2048);
+    TEST_CHECK(pool->cached == 1024);
+
+    flb_bufpool_put(pool, c, 2048);
+    TEST_CHECK(pool->in_use == 0);
+    TEST_CHECK(pool->cached == 3072);
+
+    /* Oversized buffers are never cached */
+    a = flb_bufpool_get(pool, 10000);
+    TEST_CHECK(a != NULL);
+    TEST_CHECK(pool->in_use == 10000);
+    flb_bufpool_put(pool, a, 10000);
+    TEST_CHECK(pool->in_use == 0);
+    TEST_CHECK(pool->cached == 3072);
+
+    flb_bufpool_destroy(pool);
+}
+
+static void test_realloc()
+{
+    int i;
+    char *a;
+    char *b;
+    struct flb_bufpool *pool;
+
+    pool = flb_bufpool_create(1024, 8192, 0);
+    TEST_CHECK(pool != NULL);
+
+    a = flb_bufpool_get(pool, 1024);
+    for (i = 0; i < 1024; i++) {
+        a[i] = i % 256;
+    }
+
+    /* Same class: nothing moves */
+    b = flb_bufpool_realloc(pool, a, 512, 1024);
+    TEST_CHECK(b == a);
+
+    b = flb_bufpool_realloc(pool, a, 1024, 3000);
+    TEST_CHECK(b != NULL && b != a);
+    TEST_CHECK(pool->in_use == 4096);
+    for (i = 0; i < 1024; i++) {
+        if (b[i] != (char) (i % 256)) {
+            break;
+        }
+    }
+    TEST_CHECK(i == 1024);
+
+    /* The old buffer went back to the pool */
+    TEST_CHECK(pool->cached == 1024);
+
+    flb_bufpool_put(pool, b, 3000);
+    TEST_CHECK(pool->in_use == 0);
+
+    flb_bufpool_destroy(pool);
+}
+
+static void test_limit()
+{
+    char *a;
+    char *b;
+    char *c;
+    struct flb_bufpool *pool;
+
+    pool = flb_bufpool_create(1024, 4096, 4096);
+    TEST_CHECK(pool != NULL);
+
+    a = flb_bufpool_get(pool, 2048);
+    b = flb_bufpool_get(pool, 2048);
+    TEST_CHECK(a != NULL && b != NULL);
+
+    /* Limit reached */
+    c = flb_bufpool_get(pool, 1);
+    TEST_CHECK(c == NULL);
+    TEST_CHECK(flb_bufpool_realloc(pool, a, 2048, 4096) == NULL);
+    TEST_CHECK(pool->in_use == 4096);
+
+    flb_bufpool_put(pool, b, 2048);
+    c = flb_bufpool_get(pool, 1);
+    TEST_CHECK(c != NULL);
+
+    flb_bufpool_put(pool, a, 2048);
+    flb_bufpool_put(pool, c, 1);
+    TEST_CHECK(pool->in_use == 0);
+
+    /* The cache never keeps more than the limit */
+    TEST_CHECK(pool->cached <= 4096);
+
+    flb_bufpool_destroy(pool);
+}
+
+TEST_LIST = {
+    { "classes", test_classes },
+    { "reuse"  , test_reuse   },
+    { "realloc", test_realloc },
+    { "limit"  , test_limit   },
+    { 0 }
+};
@@ -0,0 +1,164 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_engine_bus.h>
+
+#include <pthread.h>
+#include <poll.h>
+#include "flb_tests_internal.h"
+
+#define BUS_PRODUCERS  4
+#define BUS_EVENTS     100000
+
+struct producer {
+    int id;
+    struct flb_engine_bus *bus;
+};
+
+static void *producer_run(void *data)
+{
+    int i;
+    struct producer *p = data;
+    struct flb_engine_bus_event ev;
+
+    for (i = 0; i < BUS_EVENTS; i++) {
+        ev.type = 2;
+        ev.ret = 0;
+        ev.id = p->id;
+        ev.thread_id = i;
+        flb_engine_bus_push(p->bus, &ev);
+    }
+
+    return NULL;
+}
+
+/* IDs wider than the old 14 bits packing are delivered untouched */
+void test_bus_full_width()
+{
+    int ret;
+    struct flb_engine_bus *bus;
+    struct flb_engine_bus_event ev;
+
+    bus = flb_engine_bus_create(NULL, 0);
+    TEST_CHECK(bus != NULL);
+
+    ev.type = 2;
+    ev.ret = 2;
+    ev.id = 70000;
+    ev.thread_id = 0x7fffffff;
+    ret = flb_engine_bus_push(bus, &ev);
+    TEST_CHECK(ret == 0);
+
+    memset(&ev, '\0', sizeof(ev));
+    flb_engine_bus_consume(bus);
+    ret = flb_engine_bus_pop(bus, &ev);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(ev.type == 2 && ev.ret == 2);
+    TEST_CHECK(ev.id == 70000);
+    TEST_CHECK(ev.thread_id == 0x7fffffff);
+
+    ret = flb_engine_bus_pop(bus, &ev);
+    TEST_CHECK(ret == -1);
+
+    flb_engine_bus_destroy(bus);
+}
+
+/* Push more records than the ring can hold without consuming them */
+void test_bus_overflow()
+{
+    int i;
+    int n = 0;
+    int total = FLB_ENGINE_BUS_SIZE * 2 + 10;
+    int ordered = FLB_TRUE;
+    struct flb_engine_bus *bus;
+    struct flb_engine_bus_event ev;
+
+    bus = flb_engine_bus_create(NULL, 0);
+    TEST_CHECK(bus != NULL);
+
+    for (i = 0; i < total; i++) {
+        ev.type = 3;
+        ev.ret = 0;
+        ev.id = i;
+        ev.thread_id = 0;
+        TEST_CHECK(flb_engine_bus_push(bus, &ev) == 0);
+    }
+
+    flb_engine_bus_consume(bus);
+    while (flb_engine_bus_pop(bus, &ev) == 0) {
+        if (ev.id != n) {
+            ordered = FLB_FALSE;
+        }
+        n++;
+    }
+    TEST_CHECK(n == total);
+    TEST_CHECK(ordered == FLB_TRUE);
+
+    flb_engine_bus_destroy(bus);
+}
+
+/* Several producer threads, one consumer woken up by the doorbell */
+void test_bus_producers()
+{
+    int i;
+    int ret;
+    int wakeups = 0;
+    int total = 0;
+    int last[BUS_PRODUCERS];
+    int ordered = FLB_TRUE;
+    pthread_t tid[BUS_PRODUCERS];
+    struct pollfd pfd;
+    struct producer p[BUS_PRODUCERS];
+    struct flb_engine_bus *bus;
+    struct flb_engine_bus_event ev;
+
+    bus = flb_engine_bus_create(NULL, 0);
+    TEST_CHECK(bus != NULL);
+
+    for (i = 0; i < BUS_PRODUCERS; i++) {
+        last[i] = -1;
+        p[i].id = i;
+        p[i].bus = bus;
+        pthread_create(&tid[i], NULL, producer_run, &p[i]);
+    }
+
+    pfd.fd = bus->fd[0];
+    pfd.events = POLLIN;
+    while (total < BUS_PRODUCERS * BUS_EVENTS) {
+        ret = poll(&pfd, 1, 5000);
+        TEST_CHECK(ret == 1);
+        if (ret != 1) {
+            break;
+        }
+
+        wakeups++;
+        flb_engine_bus_consume(bus);
+        while (flb_engine_bus_pop(bus, &ev) == 0) {
+            /* records from the same producer keep their order */
+            if ((int) ev.thread_id != last[ev.id] + 1) {
+                ordered = FLB_FALSE;
+            }
+            last[ev.id] = ev.thread_id;
+            total++;
+        }
+    }
+
+    for (i = 0; i < BUS_PRODUCERS; i++) {
+        pthread_join(tid[i], NULL);
+    }
+
+    TEST_CHECK(total == BUS_PRODUCERS * BUS_EVENTS);
+    TEST_CHECK(ordered == FLB_TRUE);
+
+    /* The doorbell is only rung when the consumer is not notified yet */
+    TEST_CHECK(wakeups >= 1 && wakeups <= total);
+
+    flb_engine_bus_destroy(bus);
+}
+
+TEST_LIST = {
+    { "full_width", test_bus_full_width },
+    { "overflow",   test_bus_overflow },
+    { "producers",  test_bus_producers },
+    { 0 }
+};
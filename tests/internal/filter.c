@@ -0,0 +1,199 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_filter.h>
+#include <fluent-bit/flb_router.h>
+#include <fluent-bit/flb_time.h>
+
+#include "flb_tests_internal.h"
+
+#define CHAIN_RECORDS  10000
+#define CHAIN_ROUNDS   50
+
+/* Pack 'n' records, one of each ten is a 'debug' record */
+static void pack_records(msgpack_sbuffer *mp_sbuf, int n)
+{
+    int i;
+    int len;
+    char buf[64];
+    char *level;
+    msgpack_packer mp_pck;
+
+    msgpack_packer_init(&mp_pck, mp_sbuf, msgpack_sbuffer_write);
+
+    for (i = 0; i < n; i++) {
+        len = snprintf(buf, sizeof(buf) - 1, "GET /index.html 200 %i", i);
+        level = (i % 10 == 0) ? "debug" : "info";
+
+        msgpack_pack_array(&mp_pck, 2);
+        msgpack_pack_uint64(&mp_pck, 1500000000 + i);
+        msgpack_pack_map(&mp_pck, 3);
+        msgpack_pack_str(&mp_pck, 3);
+        msgpack_pack_str_body(&mp_pck, "log", 3);
+        msgpack_pack_str(&mp_pck, len);
+        msgpack_pack_str_body(&mp_pck, buf, len);
+        msgpack_pack_str(&mp_pck, 5);
+        msgpack_pack_str_body(&mp_pck, "level", 5);
+        msgpack_pack_str(&mp_pck, strlen(level));
+        msgpack_pack_str_body(&mp_pck, level, strlen(level));
+        msgpack_pack_str(&mp_pck, 6);
+        msgpack_pack_str_body(&mp_pck, "stream", 6);
+        msgpack_pack_str(&mp_pck, 6);
+        msgpack_pack_str_body(&mp_pck, "stdout", 6);
+    }
+}
+
+/*
+ * Chain: grep (drop debug records) -> record_modifier (append 'host') ->
+ * record_modifier (remove 'stream').
+ */
+static struct flb_config *chain_create()
+{
+    struct flb_config *config;
+    struct flb_filter_instance *f;
+
+    config = flb_config_init();
+    TEST_CHECK(config != NULL);
+
+    f = flb_filter_new(config, "grep", NULL);
+    if (!f) {
+        flb_config_exit(config);
+        return NULL;
+    }
+    flb_filter_set_property(f, "match", "app.*");
+    flb_filter_set_property(f, "exclude", "level debug");
+
+    f = flb_filter_new(config, "record_modifier", NULL);
+    TEST_CHECK(f != NULL);
+    flb_filter_set_property(f, "match", "app.*");
+    flb_filter_set_property(f, "record", "host test");
+
+    f = flb_filter_new(config, "record_modifier", NULL);
+    TEST_CHECK(f != NULL);
+    flb_filter_set_property(f, "match", "app.*");
+    flb_filter_set_property(f, "remove_key", "stream");
+
+    flb_filter_initialize_all(config);
+    return config;
+}
+
+static void chain_destroy(struct flb_config *config)
+{
+    flb_router_exit(config);
+    flb_filter_exit(config);
+    flb_config_exit(config);
+}
+
+/* Run the chain over a buffer appended to mp_sbuf, like an input does */
+static void chain_run(struct flb_config *config, msgpack_sbuffer *mp_sbuf,
+                      msgpack_sbuffer *records, char *tag)
+{
+    msgpack_packer mp_pck;
+
+    msgpack_packer_init(&mp_pck, mp_sbuf, msgpack_sbuffer_write);
+    msgpack_sbuffer_write(mp_sbuf, records->data, records->size);
+    flb_filter_do(mp_sbuf, &mp_pck, mp_sbuf->data, mp_sbuf->size,
+                  tag, strlen(tag), config);
+}
+
+void test_chain()
+{
+    int count = 0;
+    size_t off = 0;
+    msgpack_unpacked result;
+    msgpack_object map;
+    msgpack_object_kv *kv;
+    msgpack_sbuffer records;
+    msgpack_sbuffer mp_sbuf;
+    struct flb_config *config;
+
+    config = chain_create();
+    if (!config) {
+        return;
+    }
+
+    msgpack_sbuffer_init(&records);
+    pack_records(&records, 100);
+
+    /* Tag not matching the chain: buffer is not touched */
+    msgpack_sbuffer_init(&mp_sbuf);
+    chain_run(config, &mp_sbuf, &records, "other");
+    TEST_CHECK(mp_sbuf.size == records.size);
+    TEST_CHECK(memcmp(mp_sbuf.data, records.data, records.size) == 0);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    chain_run(config, &mp_sbuf, &records, "app.web");
+
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, mp_sbuf.data, mp_sbuf.size, &off)) {
+        map = result.data.via.array.ptr[1];
+        TEST_CHECK(map.type == MSGPACK_OBJECT_MAP);
+        TEST_CHECK(map.via.map.size == 3);
+
+        kv = map.via.map.ptr;
+        TEST_CHECK(strncmp(kv[0].key.via.str.ptr, "log", 3) == 0);
+        TEST_CHECK(strncmp(kv[1].val.via.str.ptr, "info", 4) == 0);
+        TEST_CHECK(strncmp(kv[2].key.via.str.ptr, "host", 4) == 0);
+        TEST_CHECK(strncmp(kv[2].val.via.str.ptr, "test", 4) == 0);
+        count++;
+    }
+    msgpack_unpacked_destroy(&result);
+    TEST_CHECK(count == 90);
+
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    msgpack_sbuffer_destroy(&records);
+    chain_destroy(config);
+}
+
+/* Run a 3-filter chain and report the throughput */
+void test_chain_bench()
+{
+    int r;
+    double elapsed;
+    struct flb_time t0;
+    struct flb_time t1;
+    struct flb_time diff;
+    msgpack_sbuffer records;
+    msgpack_sbuffer mp_sbuf;
+    struct flb_config *config;
+
+    if (!flb_tests_bench()) {
+        return;
+    }
+
+    config = chain_create();
+    if (!config) {
+        return;
+    }
+
+    msgpack_sbuffer_init(&records);
+    pack_records(&records, CHAIN_RECORDS);
+
+    flb_time_get(&t0);
+    for (r = 0; r < CHAIN_ROUNDS; r++) {
+        msgpack_sbuffer_init(&mp_sbuf);
+        chain_run(config, &mp_sbuf, &records, "app.web");
+        TEST_CHECK(mp_sbuf.size > 0);
+        msgpack_sbuffer_destroy(&mp_sbuf);
+    }
+    flb_time_get(&t1);
+    flb_time_diff(&t1, &t0, &diff);
+    elapsed = flb_time_to_double(&diff);
+
+    printf("\n[filter chain bench] 3 filters, %i records: %.3f secs "
+           "(%.0f records/s)\n",
+           CHAIN_RECORDS * CHAIN_ROUNDS, elapsed,
+           (CHAIN_RECORDS * CHAIN_ROUNDS) / elapsed);
+
+    msgpack_sbuffer_destroy(&records);
+    chain_destroy(config);
+}
+
+TEST_LIST = {
+    { "chain",       test_chain },
+    { "chain_bench", test_chain_bench },
+    { 0 }
+};
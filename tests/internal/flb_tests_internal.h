@@ -0,0 +1,38 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2017 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_TEST_INTERNAL_H
+#define FLB_TEST_INTERNAL_H
+
+#include <stdlib.h>
+#include "../lib/acutest/acutest.h"
+#define FLB_TESTS_DATA_PATH "/root/repo/tests/internal/"
+
+/*
+ * Benchmarks are listed with the unit tests but they only run when the
+ * FLB_TESTS_BENCH environment variable is set, e.g:
+ *
+ *   FLB_TESTS_BENCH=1 bin/flb-it-input dyntag_bench
+ */
+static inline int flb_tests_bench()
+{
+    return getenv("FLB_TESTS_BENCH") != NULL;
+}
+
+#endif
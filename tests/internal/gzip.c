@@ -0,0 +1,153 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_gzip.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include "flb_tests_internal.h"
+
+/* 'fluent-bit gzip\n' compressed by gzip(1), it carries the file name */
+static unsigned char gzip_file[] = {
+    0x1f, 0x8b, 0x08, 0x08, 0x10, 0xfa, 0xd2, 0x6a, 0x00, 0x03, 0x67, 0x7a,
+    0x74, 0x2e, 0x74, 0x78, 0x74, 0x00, 0x4b, 0xcb, 0x29, 0x4d, 0xcd, 0x2b,
+    0xd1, 0x4d, 0xca, 0x2c, 0x51, 0x48, 0xaf, 0xca, 0x2c, 0xe0, 0x02, 0x00,
+    0x0d, 0x89, 0x4d, 0xcc, 0x10, 0x00, 0x00, 0x00
+};
+
+/* Log like content, or random bytes if 'random' is set */
+static char *gzip_buffer(size_t size, int random)
+{
+    size_t i;
+    char *buf;
+
+    buf = flb_malloc(size + 1);
+    if (!buf) {
+        return NULL;
+    }
+
+    srand(size);
+    for (i = 0; i < size; i++) {
+        if (random) {
+            buf[i] = rand() & 0xFF;
+        }
+        else {
+            buf[i] = "{\"log\": \"GET /index.html 200\"}\n"[i % 31];
+        }
+    }
+
+    return buf;
+}
+
+static void gzip_roundtrip(size_t size, int random)
+{
+    int ret;
+    char *buf;
+    void *gz;
+    void *out;
+    size_t gz_size;
+    size_t out_size;
+
+    buf = gzip_buffer(size, random);
+    TEST_CHECK(buf != NULL);
+
+    ret = flb_gzip_compress(buf, size, &gz, &gz_size);
+    TEST_CHECK(ret == 0);
+    if (!random && size > 1024) {
+        TEST_CHECK(gz_size < size / 4);
+    }
+
+    ret = flb_gzip_uncompress(gz, gz_size, &out, &out_size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(out_size == size);
+    TEST_CHECK(memcmp(out, buf, size) == 0);
+    TEST_MSG("size=%zu random=%i gz_size=%zu", size, random, gz_size);
+
+    flb_free(out);
+    flb_free(gz);
+    flb_free(buf);
+}
+
+void test_gzip_roundtrip()
+{
+    size_t sizes[] = {0, 1, 31, 4096, 100000, 4 * 1024 * 1024};
+    int i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(size_t); i++) {
+        gzip_roundtrip(sizes[i], FLB_FALSE);
+        gzip_roundtrip(sizes[i], FLB_TRUE);
+    }
+}
+
+/* Data compressed by gzip(1) and many concatenated members */
+void test_gzip_members()
+{
+    int i;
+    int ret;
+    char *in;
+    void *out;
+    size_t out_size;
+
+    ret = flb_gzip_uncompress(gzip_file, sizeof(gzip_file), &out, &out_size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(out_size == 16);
+    TEST_CHECK(memcmp(out, "fluent-bit gzip\n", 16) == 0);
+    flb_free(out);
+
+    in = flb_malloc(sizeof(gzip_file) * 3);
+    for (i = 0; i < 3; i++) {
+        memcpy(in + (sizeof(gzip_file) * i), gzip_file, sizeof(gzip_file));
+    }
+    ret = flb_gzip_uncompress(in, sizeof(gzip_file) * 3, &out, &out_size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(out_size == 48);
+    for (i = 0; i < 3 && out_size == 48; i++) {
+        TEST_CHECK(memcmp((char *) out + (16 * i), "fluent-bit gzip\n", 16) == 0);
+    }
+    flb_free(out);
+    flb_free(in);
+}
+
+void test_gzip_invalid()
+{
+    int ret;
+    unsigned char buf[sizeof(gzip_file)];
+    unsigned char garbage[sizeof(gzip_file) + 32];
+    void *out;
+    size_t out_size;
+
+    /* Truncated */
+    ret = flb_gzip_uncompress(gzip_file, sizeof(gzip_file) - 4,
+                              &out, &out_size);
+    TEST_CHECK(ret == -1);
+
+    /* Bad magic */
+    memcpy(buf, gzip_file, sizeof(buf));
+    buf[0] = 0x1e;
+    ret = flb_gzip_uncompress(buf, sizeof(buf), &out, &out_size);
+    TEST_CHECK(ret == -1);
+
+    /* Bad CRC */
+    memcpy(buf, gzip_file, sizeof(buf));
+    buf[sizeof(buf) - 8] ^= 0xFF;
+    ret = flb_gzip_uncompress(buf, sizeof(buf), &out, &out_size);
+    TEST_CHECK(ret == -1);
+
+    /* Truncated deflate stream */
+    ret = flb_gzip_uncompress(gzip_file, 20, &out, &out_size);
+    TEST_CHECK(ret == -1);
+
+    /* Trailing garbage */
+    memcpy(garbage, gzip_file, sizeof(gzip_file));
+    memset(garbage + sizeof(gzip_file), 'x', 32);
+    ret = flb_gzip_uncompress(garbage, sizeof(garbage), &out, &out_size);
+    TEST_CHECK(ret == -1);
+}
+
+TEST_LIST = {
+    { "roundtrip", test_gzip_roundtrip },
+    { "members",   test_gzip_members },
+    { "invalid",   test_gzip_invalid },
+    { 0 }
+};
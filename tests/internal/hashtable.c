@@ -241,6 +241,37 @@ void test_random_eviction()
     flb_hash_destroy(ht);
 }
 
+/* Keys are not required to be NULL terminated */
+void test_key_len()
+{
+    int ret;
+    char *out_buf;
+    size_t out_size;
+    struct flb_hash *ht;
+
+    ht = flb_hash_create(FLB_HASH_EVICT_NONE, 1, -1);
+    TEST_CHECK(ht != NULL);
+
+    ret = flb_hash_add(ht, "tag.abc.def", 7, "value", 5);
+    TEST_CHECK(ret != -1);
+
+    ret = flb_hash_get(ht, "tag.abc", 7, &out_buf, &out_size);
+    TEST_CHECK(ret >= 0);
+
+    ret = flb_hash_get(ht, "tag.abc.xyz", 7, &out_buf, &out_size);
+    TEST_CHECK(ret >= 0);
+
+    ret = flb_hash_get(ht, "tag.abc.def", 11, &out_buf, &out_size);
+    TEST_CHECK(ret == -1);
+
+    /* Deleting an unknown key must not remove other entries */
+    ret = flb_hash_del(ht, "tag.xyz");
+    TEST_CHECK(ret == -1);
+    TEST_CHECK(ht->total_count == 1);
+
+    flb_hash_destroy(ht);
+}
+
 TEST_LIST = {
     { "zero_size", test_create_zero },
     { "single",    test_single },
@@ -249,5 +280,6 @@ TEST_LIST = {
     { "chaining_count", test_chaining },
     { "delete_all", test_delete_all },
     { "random_eviction", test_random_eviction },
+    { "key_len", test_key_len },
     { 0 }
 };
@@ -6,8 +6,43 @@
 #include <fluent-bit/flb_socket.h>
 #include <fluent-bit/flb_http_client.h>
 
+#include <pthread.h>
+#include <arpa/inet.h>
+
 #include "flb_tests_internal.h"
 
+#define KA_RESPONSE                             \
+    "HTTP/1.1 200 OK\r\n"                       \
+    "Content-Length: 2\r\n"                     \
+    "\r\n"                                      \
+    "ok"
+
+/* Dummy HTTP server: reply N requests over the same connection */
+static void *ka_server(void *data)
+{
+    int i;
+    int fd;
+    int ret;
+    int *server = data;
+    char buf[4096];
+
+    fd = accept(server[0], NULL, NULL);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    for (i = 0; i < server[1]; i++) {
+        ret = recv(fd, buf, sizeof(buf), 0);
+        if (ret <= 0) {
+            break;
+        }
+        send(fd, KA_RESPONSE, sizeof(KA_RESPONSE) - 1, 0);
+    }
+
+    close(fd);
+    return NULL;
+}
+
 void test_http_buffer_increase()
 {
     int ret;
@@ -80,7 +115,86 @@ void test_http_buffer_increase()
     flb_free(config);
 }
 
+void test_http_keepalive()
+{
+    int i;
+    int ret;
+    int server[2];
+    size_t b_sent;
+    socklen_t len;
+    pthread_t tid;
+    struct sockaddr_in addr;
+    struct flb_http_client *c;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+    struct flb_upstream_conn *prev = NULL;
+    struct flb_config *config;
+
+    /* Listen on a random local port */
+    server[0] = socket(AF_INET, SOCK_STREAM, 0);
+    TEST_CHECK(server[0] != -1);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    ret = bind(server[0], (struct sockaddr *) &addr, sizeof(addr));
+    TEST_CHECK(ret == 0);
+    ret = listen(server[0], 1);
+    TEST_CHECK(ret == 0);
+
+    len = sizeof(addr);
+    getsockname(server[0], (struct sockaddr *) &addr, &len);
+
+    server[1] = 3;
+    pthread_create(&tid, NULL, ka_server, server);
+
+    /* Blocking mode upstream with keepalive enabled */
+    config = flb_calloc(1, sizeof(struct flb_config));
+    TEST_CHECK(config != NULL);
+    config->flush_method = FLB_FLUSH_PTHREADS;
+
+    u = flb_upstream_create(config, "127.0.0.1", ntohs(addr.sin_port),
+                            FLB_IO_TCP, NULL);
+    TEST_CHECK(u != NULL);
+    flb_upstream_keepalive(u, FLB_TRUE, 10, 0);
+
+    for (i = 0; i < server[1]; i++) {
+        u_conn = flb_upstream_conn_get(u);
+        TEST_CHECK(u_conn != NULL);
+        if (!u_conn) {
+            break;
+        }
+        if (prev) {
+            TEST_CHECK(u_conn == prev);
+        }
+
+        c = flb_http_client(u_conn, FLB_HTTP_GET, "/", NULL, 0,
+                            "127.0.0.1", ntohs(addr.sin_port), NULL, 0);
+        TEST_CHECK(c != NULL);
+
+        ret = flb_http_do(c, &b_sent);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(c->resp.status == 200);
+        TEST_CHECK(u_conn->recycle == FLB_TRUE);
+
+        flb_http_client_destroy(c);
+        flb_upstream_conn_release(u_conn);
+        prev = u_conn;
+    }
+
+    /* One TCP connection for all the requests */
+    TEST_CHECK(u->n_conn_new == 1);
+    TEST_CHECK(u->n_conn_reused == server[1] - 1);
+
+    pthread_join(tid, NULL);
+    flb_upstream_destroy(u);
+    flb_free(config);
+    close(server[0]);
+}
+
 TEST_LIST = {
     { "http_buffer_increase", test_http_buffer_increase},
+    { "http_keepalive"      , test_http_keepalive},
     { 0 }
 };
@@ -0,0 +1,179 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_time.h>
+#include <monkey/mk_core.h>
+
+#include <time.h>
+
+#include "flb_tests_internal.h"
+
+#define DYNTAGS_N       10000
+#define DYNTAGS_ROUNDS  20
+
+static struct flb_input_instance *input_create(struct flb_config *config)
+{
+    struct flb_input_instance *in;
+
+    in = flb_input_new(config, "dummy", NULL);
+    TEST_CHECK(in != NULL);
+
+    return in;
+}
+
+static void input_destroy(struct flb_input_instance *in)
+{
+    flb_input_dyntag_exit(in);
+    msgpack_sbuffer_destroy(&in->mp_sbuf);
+    msgpack_zone_free(in->mp_zone);
+#ifdef FLB_HAVE_METRICS
+    if (in->metrics) {
+        flb_metrics_destroy(in->metrics);
+    }
+#endif
+    mk_list_del(&in->_head);
+    flb_free(in);
+}
+
+/* Pack a simple record: [timestamp, {"key": "val"}] */
+static void pack_record(msgpack_sbuffer *mp_sbuf)
+{
+    msgpack_packer mp_pck;
+
+    msgpack_packer_init(&mp_pck, mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&mp_pck, 2);
+    msgpack_pack_uint64(&mp_pck, time(NULL));
+    msgpack_pack_map(&mp_pck, 1);
+    msgpack_pack_str(&mp_pck, 3);
+    msgpack_pack_str_body(&mp_pck, "key", 3);
+    msgpack_pack_str(&mp_pck, 3);
+    msgpack_pack_str_body(&mp_pck, "val", 3);
+}
+
+void test_dyntag_lookup()
+{
+    int i;
+    int ret;
+    int count = 0;
+    char tag[32];
+    size_t total = 0;
+    struct mk_list *head;
+    struct flb_input_dyntag *dt;
+    struct flb_input_instance *in;
+    struct flb_config *config;
+    msgpack_sbuffer mp_sbuf;
+
+    config = flb_config_init();
+    TEST_CHECK(config != NULL);
+    in = input_create(config);
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_record(&mp_sbuf);
+
+    /* Two records per tag, both must land in the same dyntag */
+    for (i = 0; i < 200; i++) {
+        snprintf(tag, sizeof(tag) - 1, "kube.var.log.containers.%i", i);
+        ret = flb_input_dyntag_append_raw(in, tag, strlen(tag),
+                                          mp_sbuf.data, mp_sbuf.size);
+        TEST_CHECK(ret == 0);
+        ret = flb_input_dyntag_append_raw(in, tag, strlen(tag),
+                                          mp_sbuf.data, mp_sbuf.size);
+        TEST_CHECK(ret == 0);
+    }
+
+    mk_list_foreach(head, &in->dyntags) {
+        dt = mk_list_entry(head, struct flb_input_dyntag, _head);
+        TEST_CHECK(dt->mp_sbuf.size == mp_sbuf.size * 2);
+        total += dt->mp_sbuf.size;
+        count++;
+    }
+    TEST_CHECK(count == 200);
+
+    /* The buffer size total is kept incrementally */
+    TEST_CHECK(in->mp_total_buf_size == total);
+    TEST_CHECK(in->dyntags_buf_size == total);
+
+    /* A busy dyntag cannot receive more data, a new one is created */
+    dt = mk_list_entry_last(&in->dyntags, struct flb_input_dyntag, _head);
+    flb_input_dyntag_flush(dt, &total);
+    TEST_CHECK(dt->busy == FLB_TRUE);
+    ret = flb_input_dyntag_append_raw(in, dt->tag, dt->tag_len,
+                                      mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(mk_list_size(&in->dyntags) == 201);
+
+    /* Destroying a node updates the total */
+    total = in->dyntags_buf_size - dt->mp_sbuf.size;
+    flb_input_dyntag_destroy(dt);
+    TEST_CHECK(in->dyntags_buf_size == total);
+
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    input_destroy(in);
+    flb_config_exit(config);
+}
+
+/* Append records to 10k different tags and report the throughput */
+void test_dyntag_bench()
+{
+    int i;
+    int r;
+    int ret;
+    int len;
+    double elapsed;
+    char tag[64];
+    struct flb_time t0;
+    struct flb_time t1;
+    struct flb_time diff;
+    struct flb_input_instance *in;
+    struct flb_config *config;
+    msgpack_sbuffer mp_sbuf;
+
+    if (!flb_tests_bench()) {
+        return;
+    }
+
+    config = flb_config_init();
+    TEST_CHECK(config != NULL);
+    in = input_create(config);
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_record(&mp_sbuf);
+
+    flb_time_get(&t0);
+    for (r = 0; r < DYNTAGS_ROUNDS; r++) {
+        for (i = 0; i < DYNTAGS_N; i++) {
+            len = snprintf(tag, sizeof(tag) - 1,
+                           "kube.var.log.containers.pod-%i", i);
+            ret = flb_input_dyntag_append_raw(in, tag, len,
+                                              mp_sbuf.data, mp_sbuf.size);
+            if (ret != 0) {
+                TEST_CHECK(ret == 0);
+                break;
+            }
+        }
+    }
+    flb_time_get(&t1);
+
+    TEST_CHECK(mk_list_size(&in->dyntags) == DYNTAGS_N);
+    TEST_CHECK(in->mp_total_buf_size ==
+               mp_sbuf.size * DYNTAGS_N * DYNTAGS_ROUNDS);
+
+    flb_time_diff(&t1, &t0, &diff);
+    elapsed = flb_time_to_double(&diff);
+    printf("\n[dyntag bench] tags=%i appends=%i time=%.3fs (%.0f appends/s)\n",
+           DYNTAGS_N, DYNTAGS_N * DYNTAGS_ROUNDS, elapsed,
+           (DYNTAGS_N * DYNTAGS_ROUNDS) / elapsed);
+
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    input_destroy(in);
+    flb_config_exit(config);
+}
+
+TEST_LIST = {
+    { "dyntag_lookup", test_dyntag_lookup },
+    { "dyntag_bench", test_dyntag_bench },
+    { 0 }
+};
@@ -0,0 +1,149 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_lines.h>
+
+#include <stdlib.h>
+#include "flb_tests_internal.h"
+
+#define LINES_BUF_SIZE   (256 * 1024)
+
+/* Fill a buffer with lines of random length, some of them empty */
+static char *lines_buffer(size_t size, int max_len)
+{
+    size_t i;
+    char *buf;
+
+    buf = flb_malloc(size);
+    if (!buf) {
+        return NULL;
+    }
+
+    srand(size);
+    for (i = 0; i < size; i++) {
+        buf[i] = 'a' + (i % 26);
+        if (rand() % max_len == 0) {
+            buf[i] = '\n';
+        }
+    }
+
+    return buf;
+}
+
+/* Reference implementation */
+static size_t lines_memchr(char *buf, size_t len, size_t *pos, size_t max)
+{
+    size_t n = 0;
+    char *p = buf;
+    char *end = buf + len;
+
+    while (n < max && (p = memchr(p, '\n', end - p))) {
+        pos[n++] = p - buf;
+        p++;
+    }
+
+    return n;
+}
+
+/* Compare against memchr(3) for every length and alignment */
+void test_lines_find()
+{
+    int off;
+    size_t len;
+    size_t n1;
+    size_t n2;
+    size_t pos1[256];
+    size_t pos2[256];
+    char *buf;
+
+    buf = lines_buffer(512, 8);
+    TEST_CHECK(buf != NULL);
+
+    for (off = 0; off < 64; off++) {
+        for (len = 0; len < 512 - 64; len++) {
+            n1 = flb_lines_find(buf + off, len, '\n', pos1, 256);
+            n2 = lines_memchr(buf + off, len, pos2, 256);
+            if (!TEST_CHECK(n1 == n2)) {
+                TEST_MSG("off=%i len=%zu found=%zu expected=%zu",
+                         off, len, n1, n2);
+                flb_free(buf);
+                return;
+            }
+            TEST_CHECK(memcmp(pos1, pos2, n1 * sizeof(size_t)) == 0);
+        }
+    }
+
+    flb_free(buf);
+}
+
+/* Scanning stops once 'max' line breaks are found */
+void test_lines_batch()
+{
+    int i;
+    size_t n;
+    size_t pos[4];
+    char buf[128];
+
+    memset(buf, '\n', sizeof(buf));
+    n = flb_lines_find(buf, sizeof(buf), '\n', pos, 4);
+    TEST_CHECK(n == 4);
+    for (i = 0; i < 4; i++) {
+        TEST_CHECK(pos[i] == i);
+    }
+
+    n = flb_lines_find(buf + 5, 100, '\n', pos, 4);
+    TEST_CHECK(n == 4 && pos[3] == 3);
+
+    memset(buf, 'x', sizeof(buf));
+    n = flb_lines_find(buf, sizeof(buf), '\n', pos, 4);
+    TEST_CHECK(n == 0);
+}
+
+/* Long lines are handed to memchr(3), results must not change */
+void test_lines_long()
+{
+    size_t n1;
+    size_t n2;
+    size_t off = 0;
+    size_t pos1[FLB_LINES_BATCH];
+    size_t pos2[FLB_LINES_BATCH];
+    char *buf;
+
+    buf = lines_buffer(LINES_BUF_SIZE, 1000);
+    TEST_CHECK(buf != NULL);
+
+    while (1) {
+        n1 = flb_lines_find(buf + off, LINES_BUF_SIZE - off, '\n',
+                            pos1, FLB_LINES_BATCH);
+        n2 = lines_memchr(buf + off, LINES_BUF_SIZE - off,
+                          pos2, FLB_LINES_BATCH);
+        if (!TEST_CHECK(n1 == n2)) {
+            TEST_MSG("off=%zu found=%zu expected=%zu", off, n1, n2);
+            break;
+        }
+        TEST_CHECK(memcmp(pos1, pos2, n1 * sizeof(size_t)) == 0);
+        if (n1 == 0) {
+            break;
+        }
+        off += pos1[n1 - 1] + 1;
+    }
+
+    /* Stop at 'max' when the last break is found by memchr(3) */
+    memset(buf, 'x', 1024);
+    buf[600] = '\n';
+    buf[900] = '\n';
+    n1 = flb_lines_find(buf, 1024, '\n', pos1, 1);
+    TEST_CHECK(n1 == 1 && pos1[0] == 600);
+    n1 = flb_lines_find(buf, 1024, '\n', pos1, 4);
+    TEST_CHECK(n1 == 2 && pos1[1] == 900);
+
+    flb_free(buf);
+}
+
+TEST_LIST = {
+    { "find",  test_lines_find },
+    { "batch", test_lines_batch },
+    { "long",  test_lines_long },
+    { 0 }
+};
@@ -0,0 +1,189 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_worker.h>
+
+#include <stdio.h>
+#include <unistd.h>
+#include "flb_tests_internal.h"
+
+#define LOG_FILE      "/tmp/flb-it-log.log"
+#define LOG_ROTATED   "/tmp/flb-it-log.log.1"
+#define LOG_MESSAGES  10000   /* many times FLB_LOG_RING_SIZE */
+
+/* Count the lines of a file containing 'str' */
+static int lines_count(char *path, char *str)
+{
+    int n = 0;
+    char line[1024];
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        if (strstr(line, str)) {
+            n++;
+        }
+    }
+    fclose(f);
+
+    return n;
+}
+
+static struct flb_config *log_create()
+{
+    struct flb_config *config;
+    struct flb_log *log;
+
+    unlink(LOG_FILE);
+    unlink(LOG_ROTATED);
+
+    config = flb_config_init();
+    if (!config) {
+        return NULL;
+    }
+
+    log = flb_log_init(config, FLB_LOG_FILE, FLB_LOG_INFO, LOG_FILE);
+    if (!log) {
+        flb_config_exit(config);
+        return NULL;
+    }
+
+    return config;
+}
+
+void test_log_file()
+{
+    int i;
+    struct flb_config *config;
+
+    config = log_create();
+    TEST_CHECK(config != NULL);
+    if (!config) {
+        return;
+    }
+
+    /* Producers wait for the collector when their ring is full */
+    for (i = 0; i < LOG_MESSAGES; i++) {
+        flb_info("[test] message number %i", i);
+    }
+
+    /* Repeated messages are written once plus a notice */
+    for (i = 0; i < 100; i++) {
+        flb_warn("[test] same message");
+    }
+    flb_info("[test] last message");
+
+    /* Stop the collector, pending messages are written */
+    flb_config_exit(config);
+
+    i = lines_count(LOG_FILE, "message number");
+    TEST_CHECK(i == LOG_MESSAGES);
+    TEST_MSG("messages written: %i", i);
+
+    TEST_CHECK(lines_count(LOG_FILE, "same message") == 1);
+    TEST_CHECK(lines_count(LOG_FILE, "last message repeated 99 times") == 1);
+    TEST_CHECK(lines_count(LOG_FILE, "last message\n") == 1);
+
+    unlink(LOG_FILE);
+}
+
+void test_log_rotate()
+{
+    int ret;
+    struct flb_config *config;
+
+    config = log_create();
+    TEST_CHECK(config != NULL);
+    if (!config) {
+        return;
+    }
+
+    flb_info("[test] before rotation");
+
+    /* Wait for the message to be written and move the file */
+    sleep(1);
+    ret = rename(LOG_FILE, LOG_ROTATED);
+    TEST_CHECK(ret == 0);
+
+    /* The collector notices it on the next periodic check */
+    sleep(FLB_LOG_TIMER + 1);
+    flb_info("[test] after rotation");
+
+    /* Reopen on demand, e.g: SIGHUP */
+    sleep(1);
+    ret = rename(LOG_FILE, LOG_ROTATED);
+    TEST_CHECK(ret == 0);
+    ret = flb_log_reopen(config);
+    TEST_CHECK(ret == 0);
+    usleep(100000);
+    flb_info("[test] after reopen");
+
+    flb_config_exit(config);
+
+    TEST_CHECK(lines_count(LOG_ROTATED, "after rotation") == 1);
+    TEST_CHECK(lines_count(LOG_FILE, "after reopen") == 1);
+
+    unlink(LOG_FILE);
+    unlink(LOG_ROTATED);
+}
+
+static int producer_stop;
+
+static void log_producer(void *data)
+{
+    int i = 0;
+
+    while (!__atomic_load_n(&producer_stop, __ATOMIC_ACQUIRE)) {
+        flb_info("[test] producer message %i", i++);
+    }
+}
+
+void test_log_stop()
+{
+    int ret;
+    pthread_t tid;
+    struct flb_config *config;
+
+    config = log_create();
+    TEST_CHECK(config != NULL);
+    if (!config) {
+        return;
+    }
+
+    producer_stop = FLB_FALSE;
+    ret = flb_worker_create(log_producer, NULL, &tid, config);
+    TEST_CHECK(ret == 0);
+    if (ret != 0) {
+        flb_config_exit(config);
+        return;
+    }
+
+    /* Stop the collector while the thread keeps its ring full */
+    usleep(100000);
+    flb_log_stop(config->log, config);
+    config->log = NULL;
+
+    /* The thread must not wait for a collector that is gone */
+    __atomic_store_n(&producer_stop, FLB_TRUE, __ATOMIC_RELEASE);
+    ret = pthread_join(tid, NULL);
+    TEST_CHECK(ret == 0);
+
+    flb_config_exit(config);
+    TEST_CHECK(lines_count(LOG_FILE, "producer message") > 0);
+
+    unlink(LOG_FILE);
+}
+
+TEST_LIST = {
+    { "log_file", test_log_file },
+    { "log_rotate", test_log_rotate },
+    { "log_stop", test_log_stop },
+    { 0 }
+};
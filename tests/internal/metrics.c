@@ -5,8 +5,14 @@
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_metrics.h>
 
+#include <pthread.h>
+#include <msgpack.h>
+
 #include "flb_tests_internal.h"
 
+#define SHARD_THREADS  6
+#define SHARD_SUMS     20000
+
 static void test_create_usage()
 {
     int ret;
@@ -77,7 +83,156 @@ static void test_create_usage()
     TEST_CHECK(ret == 3);
 }
 
+static void *shard_worker(void *data)
+{
+    int i;
+    struct flb_metrics *ctx = data;
+
+    for (i = 0; i < SHARD_SUMS; i++) {
+        flb_metrics_sum(0, 1, ctx);
+        flb_metrics_observe(1, 1000, ctx);
+    }
+
+    return NULL;
+}
+
+/* Values added from many threads are merged on read */
+static void test_shards()
+{
+    int i;
+    int ret;
+    pthread_t tid[SHARD_THREADS];
+    struct flb_metric *m;
+    struct flb_metrics *ctx;
+
+    ctx = flb_metrics_create("shards");
+    TEST_CHECK(ctx != NULL);
+    TEST_CHECK(((uintptr_t) ctx->shards % FLB_METRICS_CACHE_LINE) == 0);
+
+    ret = flb_metrics_add(0, "records", ctx);
+    TEST_CHECK(ret == 0);
+    ret = flb_metrics_add_histogram(1, "latency_seconds", ctx);
+    TEST_CHECK(ret == 1);
+
+    /* IDs index a fixed table */
+    ret = flb_metrics_add(FLB_METRICS_MAX, "out of range", ctx);
+    TEST_CHECK(ret == -1);
+    ret = flb_metrics_sum(-1, 1, ctx);
+    TEST_CHECK(ret == -1);
+
+    /* Counters and histograms are not interchangeable */
+    ret = flb_metrics_sum(1, 1, ctx);
+    TEST_CHECK(ret == -1);
+    ret = flb_metrics_observe(0, 1, ctx);
+    TEST_CHECK(ret == -1);
+
+    for (i = 0; i < SHARD_THREADS; i++) {
+        pthread_create(&tid[i], NULL, shard_worker, ctx);
+    }
+    for (i = 0; i < SHARD_THREADS; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    flb_metrics_sum(0, 5, ctx);
+
+    m = flb_metrics_get_id(0, ctx);
+    TEST_CHECK(m != NULL);
+    TEST_CHECK(m->val == SHARD_THREADS * SHARD_SUMS + 5);
+    TEST_MSG("val=%zu", m->val);
+
+    ret = flb_metrics_destroy(ctx);
+    TEST_CHECK(ret == 2);
+}
+
+static msgpack_object *map_get(msgpack_object *map, char *key)
+{
+    int i;
+    int len = strlen(key);
+    msgpack_object *k;
+
+    for (i = 0; i < map->via.map.size; i++) {
+        k = &map->via.map.ptr[i].key;
+        if (k->via.str.size == len && strncmp(k->via.str.ptr, key, len) == 0) {
+            return &map->via.map.ptr[i].val;
+        }
+    }
+
+    return NULL;
+}
+
+static void test_histogram()
+{
+    int ret;
+    size_t off = 0;
+    size_t size;
+    char *buf;
+    msgpack_unpacked result;
+    msgpack_object *hist;
+    msgpack_object *buckets;
+    msgpack_object *o;
+    struct flb_metrics *ctx;
+
+    ctx = flb_metrics_create("hist");
+    flb_metrics_add(-1, "records", ctx);
+    ret = flb_metrics_add_histogram(-1, "latency_seconds", ctx);
+    TEST_CHECK(ret == 1);
+
+    flb_metrics_sum(0, 3, ctx);
+    flb_metrics_observe(1, 50, ctx);          /* 0.0001 */
+    flb_metrics_observe(1, 100, ctx);         /* 0.0001, bound included */
+    flb_metrics_observe(1, 200, ctx);         /* 0.00025 */
+    flb_metrics_observe(1, 1500000, ctx);     /* 2.5 */
+    flb_metrics_observe(1, 400000000, ctx);   /* +Inf */
+
+    ret = flb_metrics_dump_values(&buf, &size, ctx);
+    TEST_CHECK(ret == 0);
+
+    msgpack_unpacked_init(&result);
+    ret = msgpack_unpack_next(&result, buf, size, &off);
+    TEST_CHECK(ret == MSGPACK_UNPACK_SUCCESS);
+    TEST_CHECK(result.data.type == MSGPACK_OBJECT_MAP);
+    TEST_CHECK(result.data.via.map.size == 2);
+
+    o = map_get(&result.data, "records");
+    TEST_CHECK(o != NULL && o->via.u64 == 3);
+
+    hist = map_get(&result.data, "latency_seconds");
+    TEST_CHECK(hist != NULL && hist->type == MSGPACK_OBJECT_MAP);
+    if (!hist || hist->type != MSGPACK_OBJECT_MAP) {
+        goto exit;
+    }
+
+    o = map_get(hist, "count");
+    TEST_CHECK(o != NULL && o->via.u64 == 5);
+    o = map_get(hist, "sum");
+    TEST_CHECK(o != NULL && o->type == MSGPACK_OBJECT_FLOAT);
+    TEST_CHECK(o != NULL && o->via.f64 > 401.5003 && o->via.f64 < 401.5004);
+
+    /* Buckets are cumulative */
+    buckets = map_get(hist, "buckets");
+    TEST_CHECK(buckets != NULL);
+    TEST_CHECK(buckets->via.map.size == FLB_METRICS_HIST_BUCKETS + 1);
+    o = map_get(buckets, "0.0001");
+    TEST_CHECK(o != NULL && o->via.u64 == 2);
+    o = map_get(buckets, "0.00025");
+    TEST_CHECK(o != NULL && o->via.u64 == 3);
+    o = map_get(buckets, "1");
+    TEST_CHECK(o != NULL && o->via.u64 == 3);
+    o = map_get(buckets, "2.5");
+    TEST_CHECK(o != NULL && o->via.u64 == 4);
+    o = map_get(buckets, "300");
+    TEST_CHECK(o != NULL && o->via.u64 == 4);
+    o = map_get(buckets, "+Inf");
+    TEST_CHECK(o != NULL && o->via.u64 == 5);
+
+ exit:
+    msgpack_unpacked_destroy(&result);
+    flb_free(buf);
+    flb_metrics_destroy(ctx);
+}
+
 TEST_LIST = {
     { "create_usage", test_create_usage},
+    { "shards"      , test_shards},
+    { "histogram"   , test_histogram},
     { 0 }
 };
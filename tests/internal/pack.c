@@ -5,6 +5,8 @@
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_str.h>
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_time.h>
 #include <monkey/mk_core.h>
 
 #include <sys/types.h>
@@ -29,6 +31,9 @@ struct pack_test {
     char *json;
 };
 
+/* Encoder benchmark */
+#define JSON_BENCH_BYTES   (64 * 1024 * 1024)
+
 /* If we get more than 256 tests, just update the size */
 struct pack_test pt[256];
 
@@ -463,6 +468,533 @@ void test_utf8_to_json()
     utf8_tests_destroy(n_tests);
 }
 
+/*
+ * Pack a record with a 'log' string of 'size' bytes, one of each 16 bytes
+ * needs to be escaped and there is some UTF-8 content.
+ */
+static void pack_log_record(msgpack_sbuffer *mp_sbuf, size_t size)
+{
+    size_t i;
+    char *log;
+    msgpack_packer mp_pck;
+
+    log = flb_malloc(size);
+    for (i = 0; i < size; i++) {
+        log[i] = 'a' + (i % 26);
+        if (i % 16 == 15) {
+            log[i] = '"';
+        }
+    }
+    if (size > 8) {
+        memcpy(log + size - 2, "\xc3\xb1", 2);
+    }
+
+    msgpack_packer_init(&mp_pck, mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_map(&mp_pck, 4);
+    msgpack_pack_str(&mp_pck, 3);
+    msgpack_pack_str_body(&mp_pck, "log", 3);
+    msgpack_pack_str(&mp_pck, size);
+    msgpack_pack_str_body(&mp_pck, log, size);
+    msgpack_pack_str(&mp_pck, 6);
+    msgpack_pack_str_body(&mp_pck, "stream", 6);
+    msgpack_pack_str(&mp_pck, 6);
+    msgpack_pack_str_body(&mp_pck, "stdout", 6);
+    msgpack_pack_str(&mp_pck, 4);
+    msgpack_pack_str_body(&mp_pck, "code", 4);
+    msgpack_pack_int(&mp_pck, -200);
+    msgpack_pack_str(&mp_pck, 4);
+    msgpack_pack_str_body(&mp_pck, "list", 4);
+    msgpack_pack_array(&mp_pck, 3);
+    msgpack_pack_nil(&mp_pck);
+    msgpack_pack_true(&mp_pck);
+    msgpack_pack_double(&mp_pck, 1.5);
+
+    flb_free(log);
+}
+
+/* Encode into a growable SDS and through the old interfaces */
+void test_json_encode_sds()
+{
+    int ret;
+    char *out_buf;
+    size_t out_size;
+    size_t off = 0;
+    flb_sds_t s;
+    flb_sds_t lines;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_unpacked result;
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    pack_log_record(&mp_sbuf, 70000);
+
+    ret = flb_msgpack_raw_to_json_str(mp_sbuf.data, mp_sbuf.size,
+                                      &out_buf, &out_size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(strlen(out_buf) == out_size);
+    TEST_CHECK(strncmp(out_buf, "{\"log\":\"abcdefghijklmno\\\"qrs", 28) == 0);
+    TEST_CHECK(strstr(out_buf, "\\u00f1\", \"stream\":\"stdout\", "
+                      "\"code\":-200, \"list\":[null, true, 1.500000]}")
+               == out_buf + out_size - 71);
+
+    /* Start from a tiny buffer so it needs to grow many times */
+    s = flb_sds_create_size(1);
+    msgpack_unpacked_init(&result);
+    msgpack_unpack_next(&result, mp_sbuf.data, mp_sbuf.size, &off);
+    ret = flb_msgpack_to_json_sds(&s, &result.data);
+    msgpack_unpacked_destroy(&result);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(flb_sds_len(s) == out_size);
+    TEST_CHECK(strcmp(s, out_buf) == 0);
+    flb_sds_destroy(s);
+
+    /* A whole chunk, one JSON per line */
+    pack_log_record(&mp_sbuf, 100);
+    lines = flb_msgpack_raw_to_json_lines(mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(lines != NULL);
+    TEST_CHECK(strncmp(lines, out_buf, out_size) == 0);
+    TEST_CHECK(lines[out_size] == '\n');
+    TEST_CHECK(lines[flb_sds_len(lines) - 1] == '\n');
+    TEST_CHECK(strchr(lines + out_size + 1, '\n') ==
+               lines + flb_sds_len(lines) - 1);
+
+    flb_sds_destroy(lines);
+    flb_free(out_buf);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+}
+
+/*
+ * Reference for the encoder benchmark: the encoder used before the single
+ * pass one. It writes into a fixed buffer, the caller grows the buffer by
+ * 128 bytes and encodes again from the start when it runs out of room.
+ */
+static int old_write(char *buf, int *off, size_t left, char *str, size_t len)
+{
+    if (left <= *off + len) {
+        return FLB_FALSE;
+    }
+    memcpy(buf + *off, str, len);
+    *off += len;
+    return FLB_TRUE;
+}
+
+static int old_msgpack2json(char *buf, int *off, size_t left,
+                            msgpack_object *o)
+{
+    int i;
+    int len;
+    char tmp[32];
+
+    switch (o->type) {
+    case MSGPACK_OBJECT_NIL:
+        return old_write(buf, off, left, "null", 4);
+    case MSGPACK_OBJECT_BOOLEAN:
+        return o->via.boolean ? old_write(buf, off, left, "true", 4) :
+            old_write(buf, off, left, "false", 5);
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+        len = snprintf(tmp, sizeof(tmp) - 1, "%lu",
+                       (unsigned long) o->via.u64);
+        return old_write(buf, off, left, tmp, len);
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+        len = snprintf(tmp, sizeof(tmp) - 1, "%ld", (signed long) o->via.i64);
+        return old_write(buf, off, left, tmp, len);
+    case MSGPACK_OBJECT_FLOAT32:
+    case MSGPACK_OBJECT_FLOAT64:
+        len = snprintf(tmp, sizeof(tmp) - 1, "%f", o->via.f64);
+        return old_write(buf, off, left, tmp, len);
+    case MSGPACK_OBJECT_STR:
+        return old_write(buf, off, left, "\"", 1) &&
+            (o->via.str.size == 0 ||
+             flb_utils_write_str(buf, off, left, (char *) o->via.str.ptr,
+                                 o->via.str.size)) &&
+            old_write(buf, off, left, "\"", 1);
+    case MSGPACK_OBJECT_ARRAY:
+        if (!old_write(buf, off, left, "[", 1)) {
+            return FLB_FALSE;
+        }
+        for (i = 0; i < o->via.array.size; i++) {
+            if ((i > 0 && !old_write(buf, off, left, ", ", 2)) ||
+                !old_msgpack2json(buf, off, left, &o->via.array.ptr[i])) {
+                return FLB_FALSE;
+            }
+        }
+        return old_write(buf, off, left, "]", 1);
+    case MSGPACK_OBJECT_MAP:
+        if (!old_write(buf, off, left, "{", 1)) {
+            return FLB_FALSE;
+        }
+        for (i = 0; i < o->via.map.size; i++) {
+            if ((i > 0 && !old_write(buf, off, left, ", ", 2)) ||
+                !old_msgpack2json(buf, off, left, &o->via.map.ptr[i].key) ||
+                !old_write(buf, off, left, ":", 1) ||
+                !old_msgpack2json(buf, off, left, &o->via.map.ptr[i].val)) {
+                return FLB_FALSE;
+            }
+        }
+        return old_write(buf, off, left, "}", 1);
+    default:
+        return FLB_FALSE;
+    }
+}
+
+static int old_raw_to_json_str(char *buf, size_t buf_size,
+                               char **out_buf, size_t *out_size)
+{
+    int ret;
+    int off;
+    size_t moff = 0;
+    size_t json_size;
+    char *json_buf;
+    char *tmp;
+    msgpack_unpacked result;
+
+    msgpack_unpacked_init(&result);
+    msgpack_unpack_next(&result, buf, buf_size, &moff);
+
+    json_size = (buf_size * 1.2);
+    json_buf = flb_malloc(json_size);
+    while (1) {
+        off = 0;
+        ret = old_msgpack2json(json_buf, &off, json_size, &result.data);
+        if (ret == FLB_TRUE) {
+            break;
+        }
+        json_size += 128;
+        tmp = flb_realloc(json_buf, json_size);
+        if (!tmp) {
+            flb_free(json_buf);
+            msgpack_unpacked_destroy(&result);
+            return -1;
+        }
+        json_buf = tmp;
+    }
+    json_buf[off] = '\0';
+
+    *out_buf = json_buf;
+    *out_size = off;
+    msgpack_unpacked_destroy(&result);
+    return 0;
+}
+
+/* Encode JSON_BENCH_BYTES worth of records of a given size */
+static double json_bench(msgpack_sbuffer *mp_sbuf, size_t size, int old)
+{
+    int i;
+    int n;
+    int ret;
+    char *out_buf = NULL;
+    size_t out_size;
+    struct flb_time t0;
+    struct flb_time t1;
+    struct flb_time diff;
+
+    n = JSON_BENCH_BYTES / size;
+    flb_time_get(&t0);
+    for (i = 0; i < n; i++) {
+        if (old) {
+            ret = old_raw_to_json_str(mp_sbuf->data, mp_sbuf->size,
+                                      &out_buf, &out_size);
+        }
+        else {
+            ret = flb_msgpack_raw_to_json_str(mp_sbuf->data, mp_sbuf->size,
+                                              &out_buf, &out_size);
+        }
+        TEST_CHECK(ret == 0);
+        flb_free(out_buf);
+    }
+    flb_time_get(&t1);
+    flb_time_diff(&t1, &t0, &diff);
+
+    return flb_time_to_double(&diff);
+}
+
+/* Encoder throughput against the previous encoder, 1KB and 64KB records */
+void test_json_encode_bench()
+{
+    int i;
+    size_t size;
+    size_t sizes[] = {1024, 64 * 1024};
+    double elapsed[2];
+    msgpack_sbuffer mp_sbuf;
+
+    if (!flb_tests_bench()) {
+        return;
+    }
+
+    for (i = 0; i < 2; i++) {
+        size = sizes[i];
+        msgpack_sbuffer_init(&mp_sbuf);
+        pack_log_record(&mp_sbuf, size);
+
+        elapsed[0] = json_bench(&mp_sbuf, size, FLB_TRUE);
+        elapsed[1] = json_bench(&mp_sbuf, size, FLB_FALSE);
+
+        printf("\n[json encode bench] %lu bytes records x %lu: "
+               "old %.3f secs (%.1f MB/s), new %.3f secs (%.1f MB/s)",
+               size, JSON_BENCH_BYTES / size,
+               elapsed[0], (JSON_BENCH_BYTES / elapsed[0]) / (1024 * 1024),
+               elapsed[1], (JSON_BENCH_BYTES / elapsed[1]) / (1024 * 1024));
+
+        msgpack_sbuffer_destroy(&mp_sbuf);
+    }
+    printf("\n");
+}
+
+/* Build a JSON map with a nested array and 'size' bytes approximately */
+static char *json_record(size_t size, size_t *out_len)
+{
+    int i;
+    int len;
+    size_t off;
+    size_t alloc = size + 256;
+    char *buf;
+
+    buf = flb_malloc(alloc);
+    if (!buf) {
+        return NULL;
+    }
+
+    len = snprintf(buf, alloc,
+                   "{\"date\": 1519818470.123, \"ok\": true, \"nil\": null, "
+                   "\"tags\": [1, -2, 3.5, \"a\\\"b\", {}, []], \"msg\": \"");
+    off = len;
+    for (i = 0; off < size; i++) {
+        buf[off++] = 'a' + (i % 26);
+    }
+    len = snprintf(buf + off, alloc - off, "\"}\n");
+    *out_len = off + len;
+
+    return buf;
+}
+
+/*
+ * Feed 'n' copies of 'rec' in chunks of 'chunk' bytes to the packer, the
+ * way a network input does: append, pack and consume what was used. It
+ * returns the number of records packed, 'ref' is the expected msgpack of
+ * one record (optional).
+ */
+static int json_stream_feed(char *rec, size_t len, int n, size_t chunk,
+                            char *ref, size_t ref_size)
+{
+    int ret;
+    int records = 0;
+    int out_size;
+    size_t c;
+    size_t size;
+    size_t in = 0;
+    size_t off;
+    size_t total = len * n;
+    size_t buf_len = 0;
+    char *buf;
+    char *out_buf;
+    struct flb_pack_state state;
+
+    buf = flb_malloc(total + 1);
+    if (!buf) {
+        return -1;
+    }
+
+    flb_pack_state_init(&state);
+    while (in < total) {
+        c = chunk;
+        if (in + c > total) {
+            c = total - in;
+        }
+
+        /* Append the chunk, the stream is the record repeated */
+        while (c > 0) {
+            off = in % len;
+            size = len - off;
+            if (size > c) {
+                size = c;
+            }
+            memcpy(buf + buf_len, rec + off, size);
+            buf_len += size;
+            in += size;
+            c -= size;
+        }
+        buf[buf_len] = '\0';
+
+        ret = flb_pack_json_state(buf, buf_len, &out_buf, &out_size, &state);
+        if (ret == FLB_ERR_JSON_PART) {
+            continue;
+        }
+        else if (ret != 0) {
+            break;
+        }
+
+        if (ref) {
+            for (off = 0; off < out_size; off += ref_size) {
+                if (out_size - off < ref_size ||
+                    memcmp(out_buf + off, ref, ref_size) != 0) {
+                    TEST_CHECK(0);
+                    break;
+                }
+                records++;
+            }
+        }
+        else {
+            records++;
+        }
+        flb_free(out_buf);
+
+        consume_bytes(buf, state.last_byte, buf_len);
+        buf_len -= state.last_byte;
+    }
+    flb_pack_state_reset(&state);
+
+    /* Everything must have been consumed, except trailing blanks */
+    for (off = 0; off < buf_len; off++) {
+        if (buf[off] != '\n') {
+            records = -1;
+            break;
+        }
+    }
+    flb_free(buf);
+
+    return records;
+}
+
+/* A read of a bare CR LF followed by the message in the next read */
+static int json_stream_blanks()
+{
+    int ret;
+    int out_size;
+    char buf[64];
+    char *out_buf;
+    struct flb_pack_state state;
+
+    flb_pack_state_init(&state);
+
+    strcpy(buf, "\r\n");
+    ret = flb_pack_json_state(buf, strlen(buf), &out_buf, &out_size, &state);
+    if (ret != FLB_ERR_JSON_PART) {
+        flb_pack_state_reset(&state);
+        return -1;
+    }
+
+    strcat(buf, "{\"a\": 1}\n");
+    ret = flb_pack_json_state(buf, strlen(buf), &out_buf, &out_size, &state);
+    if (ret != 0) {
+        flb_pack_state_reset(&state);
+        return -1;
+    }
+    flb_free(out_buf);
+
+    /* The message and the blanks around it are consumed */
+    ret = (state.last_byte == strlen(buf)) ? 0 : -1;
+    flb_pack_state_reset(&state);
+
+    return ret;
+}
+
+void test_json_pack_stream()
+{
+    int i;
+    int ret;
+    char *rec;
+    char *ref;
+    size_t len = 0;
+    size_t ref_size;
+    size_t off = 0;
+    size_t chunks[] = {1, 7, 64, 1000, 100000};
+    msgpack_unpacked result;
+    msgpack_object *arr;
+
+    rec = json_record(64, &len);
+    TEST_CHECK(rec != NULL);
+
+    /* Reference: the record packed on its own */
+    ret = flb_pack_json(rec, len, &ref, &ref_size);
+    TEST_CHECK(ret == 0);
+
+    /* Containers use the smallest header: fixmap with 5 entries */
+    TEST_CHECK((unsigned char) ref[0] == 0x85);
+
+    msgpack_unpacked_init(&result);
+    ret = msgpack_unpack_next(&result, ref, ref_size, &off);
+    TEST_CHECK(ret == MSGPACK_UNPACK_SUCCESS);
+    TEST_CHECK(off == ref_size);
+    TEST_CHECK(result.data.type == MSGPACK_OBJECT_MAP);
+    TEST_CHECK(result.data.via.map.size == 5);
+    TEST_CHECK(result.data.via.map.ptr[0].val.type == MSGPACK_OBJECT_FLOAT);
+    TEST_CHECK(result.data.via.map.ptr[1].val.type == MSGPACK_OBJECT_BOOLEAN);
+    TEST_CHECK(result.data.via.map.ptr[2].val.type == MSGPACK_OBJECT_NIL);
+
+    arr = &result.data.via.map.ptr[3].val;
+    TEST_CHECK(arr->type == MSGPACK_OBJECT_ARRAY);
+    TEST_CHECK(arr->via.array.size == 6);
+    TEST_CHECK(arr->via.array.ptr[1].via.i64 == -2);
+    TEST_CHECK(arr->via.array.ptr[3].via.str.size == 4);
+    TEST_CHECK(arr->via.array.ptr[4].type == MSGPACK_OBJECT_MAP);
+    TEST_CHECK(arr->via.array.ptr[4].via.map.size == 0);
+    TEST_CHECK(arr->via.array.ptr[5].type == MSGPACK_OBJECT_ARRAY);
+    msgpack_unpacked_destroy(&result);
+
+    /* The output must not depend on how the input is split */
+    for (i = 0; i < sizeof(chunks) / sizeof(size_t); i++) {
+        ret = json_stream_feed(rec, len, 100, chunks[i], ref, ref_size);
+        TEST_CHECK(ret == 100);
+        TEST_MSG("chunk=%lu records=%i", chunks[i], ret);
+    }
+
+    /* Blanks before a message are kept by the caller until it completes */
+    ret = json_stream_blanks();
+    TEST_CHECK(ret == 0);
+
+    /* Errors */
+    ret = flb_pack_json("{\"a\" 1}", 8, &ref, &ref_size);
+    TEST_CHECK(ret == -1);
+    ret = flb_pack_json("{\"a\": 1]", 8, &ref, &ref_size);
+    TEST_CHECK(ret == -1);
+    ret = flb_pack_json("[1, 2", 5, &ref, &ref_size);
+    TEST_CHECK(ret == -1);
+
+    flb_free(ref);
+    flb_free(rec);
+}
+
+/* Throughput of the streaming packer for records of 'size' bytes */
+static void json_pack_bench(size_t size, size_t chunk)
+{
+    int n;
+    int ret;
+    char *rec;
+    size_t len = 0;
+    double elapsed;
+    struct flb_time t0;
+    struct flb_time t1;
+    struct flb_time diff;
+
+    rec = json_record(size, &len);
+    TEST_CHECK(rec != NULL);
+
+    n = JSON_BENCH_BYTES / len;
+    flb_time_get(&t0);
+    ret = json_stream_feed(rec, len, n, chunk, NULL, 0);
+    flb_time_get(&t1);
+    TEST_CHECK(ret > 0);
+
+    flb_time_diff(&t1, &t0, &diff);
+    elapsed = flb_time_to_double(&diff);
+
+    printf("\n[json pack bench] %lu bytes records x %i, %lu bytes chunks: "
+           "%.3f secs (%.1f MB/s)", len, n, chunk, elapsed,
+           ((double) len * n / elapsed) / (1024 * 1024));
+
+    flb_free(rec);
+}
+
+void test_json_pack_bench()
+{
+    if (!flb_tests_bench()) {
+        return;
+    }
+
+    json_pack_bench(1024, 32768);
+    json_pack_bench(4 * 1024 * 1024, 32768);
+    printf("\n");
+}
+
 TEST_LIST = {
     /* JSON maps iteration */
     { "json_pack", test_json_pack },
@@ -473,5 +1005,11 @@ TEST_LIST = {
 
     /* Mixed bytes, check JSON encoding */
     { "utf8_to_json", test_utf8_to_json},
+
+    /* msgpack to JSON encoder */
+    { "json_encode_sds", test_json_encode_sds},
+    { "json_encode_bench", test_json_encode_bench},
+    { "json_pack_stream", test_json_pack_stream},
+    { "json_pack_bench", test_json_pack_bench},
     { 0 }
 };
@@ -4,6 +4,8 @@
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_parser.h>
 #include <fluent-bit/flb_error.h>
+#include <fluent-bit/flb_parser_time.h>
+#include <monkey/mk_core.h>
 
 #include <time.h>
 #include "flb_tests_internal.h"
@@ -12,6 +14,11 @@
 #define JSON_PARSERS  FLB_TESTS_DATA_PATH "/data/parser/json.conf"
 #define REGEX_PARSERS FLB_TESTS_DATA_PATH "/data/parser/regex.conf"
 
+/* Sample time strings: '<parser name> <time string>' per line */
+#define TIME_SAMPLES  FLB_TESTS_DATA_PATH "/data/parser/time_samples.log"
+#define TIME_SAMPLES_MAX    64
+#define TIME_BENCH_ROUNDS   20000
+
 /* Templates */
 #define JSON_FMT_01  "{\"key001\": 12345, \"key002\": 0.99, \"time\": \"%s\"}"
 #define REGEX_FMT_01 "12345 0.99 %s"
@@ -396,10 +403,202 @@ void test_regex_parser_time_lookup()
     flb_free(config);
 }
 
+struct time_sample {
+    struct flb_parser *parser;
+    char *str;
+    int len;
+};
+
+/* Load the sample time strings, returns the number of samples */
+static int load_time_samples(struct flb_config *config, char **data,
+                             struct time_sample *samples)
+{
+    int n = 0;
+    char *p;
+    char *sp;
+    char *eol;
+
+    *data = mk_file_to_buffer(TIME_SAMPLES);
+    TEST_CHECK(*data != NULL);
+    if (!*data) {
+        return 0;
+    }
+
+    p = *data;
+    while (*p && n < TIME_SAMPLES_MAX) {
+        eol = strchr(p, '\n');
+        if (eol) {
+            *eol = '\0';
+        }
+
+        sp = strchr(p, ' ');
+        if (sp) {
+            *sp = '\0';
+            samples[n].parser = flb_parser_get(p, config);
+            TEST_CHECK(samples[n].parser != NULL);
+            samples[n].str = sp + 1;
+            samples[n].len = strlen(sp + 1);
+            if (samples[n].parser) {
+                n++;
+            }
+        }
+
+        if (!eol) {
+            break;
+        }
+        p = eol + 1;
+    }
+
+    return n;
+}
+
+/* strptime(3) based lookup, the reference results */
+static int time_reference(struct time_sample *t, time_t now,
+                          struct flb_time *out)
+{
+    int ret;
+    double ns;
+    struct tm tm = {0};
+
+    ret = flb_parser_time_lookup(t->str, t->len, now, t->parser, &tm, &ns);
+    if (ret == -1) {
+        return -1;
+    }
+
+    out->tm.tv_sec = flb_parser_tm2time(&tm);
+    out->tm.tv_nsec = (ns * 1000000000);
+    return 0;
+}
+
+/* Hand-written parsers and cached results match strptime(3) */
+void test_parser_time_parse()
+{
+    int i;
+    int n;
+    int ret;
+    int round;
+    char *data;
+    time_t now;
+    struct flb_time t1;
+    struct flb_time t2;
+    struct flb_parser *p;
+    struct flb_config *config;
+    struct time_sample samples[TIME_SAMPLES_MAX];
+
+    config = flb_malloc(sizeof(struct flb_config));
+    mk_list_init(&config->parsers);
+    load_json_parsers(config);
+
+    n = load_time_samples(config, &data, samples);
+    TEST_CHECK(n > 0);
+
+    /* Common formats are compiled, exotic ones keep strptime(3) */
+    p = flb_parser_get("iso8601", config);
+    TEST_CHECK(p != NULL && p->time_parser->n_ops > 0);
+    p = flb_parser_get("apache_clf", config);
+    TEST_CHECK(p != NULL && p->time_parser->n_ops > 0);
+    p = flb_parser_get("syslog_rfc3164", config);
+    TEST_CHECK(p != NULL && p->time_parser->n_ops > 0);
+    p = flb_parser_get("weekday", config);
+    TEST_CHECK(p != NULL && p->time_parser->n_ops == 0);
+
+    /* Forward and backwards, so results come from the parsers and cache */
+    now = time(NULL);
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < n; i++) {
+            struct time_sample *t = &samples[round ? n - i - 1 : i];
+
+            ret = time_reference(t, now, &t1);
+            TEST_CHECK(ret == 0);
+
+            ret = flb_parser_time_parse(t->str, t->len, now, t->parser, &t2);
+            TEST_CHECK(ret == 0);
+            TEST_CHECK(t1.tm.tv_sec == t2.tm.tv_sec &&
+                       t1.tm.tv_nsec == t2.tm.tv_nsec);
+            TEST_MSG("%s: expected %lu.%09lu, got %lu.%09lu", t->str,
+                     t1.tm.tv_sec, t1.tm.tv_nsec,
+                     t2.tm.tv_sec, t2.tm.tv_nsec);
+        }
+    }
+
+    /* Unexpected input for the format falls back to strptime(3) */
+    p = flb_parser_get("iso8601", config);
+    ret = flb_parser_time_parse("2018-03-01T10:20:30+0000", 24, now, p, &t2);
+    TEST_CHECK(ret == 0 && t2.tm.tv_sec == 1519899630);
+    ret = flb_parser_time_parse("2018-03-01 10:20:30", 19, now, p, &t2);
+    TEST_CHECK(ret == -1);
+
+    flb_free(data);
+    flb_parser_exit(config);
+    flb_free(config);
+}
+
+/* Time lookups over the sample strings, strptime(3) vs time parsers */
+void test_parser_time_bench()
+{
+    int i;
+    int n;
+    int round;
+    char *data;
+    time_t now;
+    double elapsed[2];
+    struct flb_time out;
+    struct flb_time t0;
+    struct flb_time t1;
+    struct flb_time diff;
+    struct flb_config *config;
+    struct time_sample *t;
+    struct time_sample samples[TIME_SAMPLES_MAX];
+
+    if (!flb_tests_bench()) {
+        return;
+    }
+
+    config = flb_malloc(sizeof(struct flb_config));
+    mk_list_init(&config->parsers);
+    load_json_parsers(config);
+
+    n = load_time_samples(config, &data, samples);
+    TEST_CHECK(n > 0);
+
+    now = time(NULL);
+    flb_time_get(&t0);
+    for (round = 0; round < TIME_BENCH_ROUNDS; round++) {
+        for (i = 0; i < n; i++) {
+            t = &samples[i];
+            time_reference(t, now, &out);
+        }
+    }
+    flb_time_get(&t1);
+    flb_time_diff(&t1, &t0, &diff);
+    elapsed[0] = flb_time_to_double(&diff);
+
+    flb_time_get(&t0);
+    for (round = 0; round < TIME_BENCH_ROUNDS; round++) {
+        for (i = 0; i < n; i++) {
+            t = &samples[i];
+            flb_parser_time_parse(t->str, t->len, now, t->parser, &out);
+        }
+    }
+    flb_time_get(&t1);
+    flb_time_diff(&t1, &t0, &diff);
+    elapsed[1] = flb_time_to_double(&diff);
+
+    printf("\n[time parse bench] %i lookups: strptime %.3f secs, "
+           "time parser %.3f secs (x%.1f)\n", n * TIME_BENCH_ROUNDS,
+           elapsed[0], elapsed[1], elapsed[0] / elapsed[1]);
+
+    flb_free(data);
+    flb_parser_exit(config);
+    flb_free(config);
+}
+
 TEST_LIST = {
     { "tzone_offset", test_parser_tzone_offset},
     { "time_lookup", test_parser_time_lookup},
     { "json_time_lookup", test_json_parser_time_lookup},
     { "regex_time_lookup", test_regex_parser_time_lookup},
+    { "time_parse", test_parser_time_parse},
+    { "time_bench", test_parser_time_bench},
     { 0 }
 };
@@ -0,0 +1,165 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_macros.h>
+#include <fluent-bit/flb_regex.h>
+
+#include "flb_tests_internal.h"
+
+/* Patterns and the literal every match must contain (NULL = none) */
+struct literal_check {
+    char *pattern;
+    char *literal;
+};
+
+struct literal_check literal_entries[] = {
+    {"error"                       , "error"       },
+    {"/error/"                     , "error"       },
+    {"^\\[warn\\] disk"            , "[warn] disk" },
+    {"connection refused$"         , "connection refused"},
+    {"colou?r"                     , "colo"        },
+    {"ab*cdef"                     , "cdef"        },
+    {"x+yz"                        , "yz"          },
+    {"abc{2}de"                    , "ab"          },
+    {"caf\xc3\xa9?s"               , "caf"         },
+    {"(?<host>[^ ]*) - \\[(?<time>[^\\]]*)\\] GET", "] GET"},
+    {"timeout|refused"             , NULL          },
+    {"(?i)error"                   , NULL          },
+    {"\\d+\\s\\w"                  , NULL          },
+    {"[a-z]+"                      , NULL          },
+    {"a"                           , NULL          },
+};
+
+/* Subjects for the match checks */
+char *subjects[] = {
+    "",
+    "error",
+    "an error happened",
+    "ERROR",
+    "[warn] disk full",
+    "[warn]  disk full",
+    "connection refused",
+    "connection refused by peer",
+    "color", "colour", "colr",
+    "acdef", "abbbcdef",
+    "xxyz", "yz",
+    "abccde", "abcde",
+    "caf\xc3\xa9s", "cafs", "caf\xc3s",
+    "10.0.0.1 - [01/Jan/2018:00:00:00 +0000] GET /",
+    "10.0.0.1 - [01/Jan/2018:00:00:00 +0000] POST /",
+    "timeout", "refused",
+    "12 a",
+};
+
+/* Literals extracted at compile time */
+void test_regex_literal()
+{
+    int i;
+    struct flb_regex *r;
+    struct literal_check *t;
+
+    flb_regex_init();
+
+    for (i = 0; i < sizeof(literal_entries) / sizeof(struct literal_check); i++) {
+        t = &literal_entries[i];
+
+        r = flb_regex_create((unsigned char *) t->pattern);
+        TEST_CHECK(r != NULL);
+        if (!r) {
+            continue;
+        }
+
+        if (t->literal) {
+            TEST_CHECK(r->literal != NULL &&
+                       r->literal_len == strlen(t->literal) &&
+                       memcmp(r->literal, t->literal, r->literal_len) == 0);
+            TEST_MSG("pattern '%s': expected literal '%s'",
+                     t->pattern, t->literal);
+        }
+        else {
+            TEST_CHECK(r->literal == NULL);
+            TEST_MSG("pattern '%s': unexpected literal", t->pattern);
+        }
+
+        flb_regex_destroy(r);
+    }
+}
+
+/* The literal prefilter never changes the result of a match */
+void test_regex_prefilter()
+{
+    int i;
+    int j;
+    int ret;
+    int ref;
+    size_t len;
+    unsigned char *literal;
+    struct flb_regex *r;
+
+    flb_regex_init();
+
+    for (i = 0; i < sizeof(literal_entries) / sizeof(struct literal_check); i++) {
+        r = flb_regex_create((unsigned char *) literal_entries[i].pattern);
+        TEST_CHECK(r != NULL);
+        if (!r) {
+            continue;
+        }
+
+        for (j = 0; j < sizeof(subjects) / sizeof(char *); j++) {
+            len = strlen(subjects[j]);
+            ret = flb_regex_match(r, (unsigned char *) subjects[j], len);
+
+            /* Same match without the prefilter */
+            literal = r->literal;
+            r->literal = NULL;
+            ref = flb_regex_match(r, (unsigned char *) subjects[j], len);
+            r->literal = literal;
+
+            TEST_CHECK(ret == ref);
+            TEST_MSG("pattern '%s', subject '%s'",
+                     literal_entries[i].pattern, subjects[j]);
+        }
+
+        flb_regex_destroy(r);
+    }
+}
+
+/* The match region is reused across searches */
+void test_regex_region_reuse()
+{
+    int i;
+    ssize_t n;
+    char *str;
+    struct flb_regex *r;
+    struct flb_regex_search result;
+
+    flb_regex_init();
+
+    r = flb_regex_create((unsigned char *) "^(?<key>[a-z]+)=(?<val>\\d+)$");
+    TEST_CHECK(r != NULL);
+    if (!r) {
+        return;
+    }
+
+    for (i = 0; i < 1000; i++) {
+        str = (i % 2) ? "abc=123" : "abc=def";
+        n = flb_regex_do(r, (unsigned char *) str, strlen(str), &result);
+        if (i % 2) {
+            TEST_CHECK(n == 2);
+            TEST_CHECK(result.region == r->region);
+            TEST_CHECK(flb_regex_parse(r, &result, NULL, NULL) == 7);
+        }
+        else {
+            TEST_CHECK(n == -1);
+        }
+    }
+
+    flb_regex_destroy(r);
+}
+
+TEST_LIST = {
+    { "literal"      , test_regex_literal },
+    { "prefilter"    , test_regex_prefilter },
+    { "region_reuse" , test_regex_region_reuse },
+    { 0 }
+};
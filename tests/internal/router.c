@@ -0,0 +1,183 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_filter.h>
+#include <fluent-bit/flb_router.h>
+
+#include "flb_tests_internal.h"
+
+struct match {
+    char *tag;
+    char *pattern;
+    int   ret;
+};
+
+struct match matches[] = {
+    {"a",              "a",          1},
+    {"a",              "b",          0},
+    {"a",              "*",          1},
+    {"",               "*",          1},
+    {"",               "",           1},
+    {"a",              "",           0},
+    {"aaa",            "a",          0},
+    {"a",              "aaa",        0},
+    {"a",              "a*",         1},
+    {"a",              "*a",         1},
+    {"a",              "a*a",        0},
+    {"aa",             "a*a",        1},
+    {"a",              "**",         1},
+    {"app.web",        "app.*",      1},
+    {"app",            "app.*",      0},
+    {"app.web",        "*.web",      1},
+    {"app.web.1",      "*.web",      0},
+    {"app.web.1",      "app.*.1",    1},
+    {"app.web.2",      "app.*.1",    0},
+    {"app.1.web.1",    "app.*.1",    1},
+    {"kube.a.b.c",     "kube.*.c",   1},
+    {"kube.a.b.c",     "*b*",        1},
+    {"kube.a.b.c",     "*x*",        0},
+    {"abcabcabd",      "*abd",       1},
+    {"abcabcabd",      "a*c*d",      1},
+    {"abcabcabd",      "a*c*c*d",    1},
+    {"abcabcabd",      "a*c*c*c*d",  0},
+    {"abcabcabd",      "a**b***d",   1},
+    {"mississippi",    "*sip*",      1},
+    {"mississippi",    "m*iss*ppi",  1},
+    {"mississippi",    "m*iss*ssi",  0},
+};
+
+void test_match()
+{
+    int i;
+    int ret;
+    struct match *m;
+    struct flb_router_rule *rule;
+
+    for (i = 0; i < sizeof(matches) / sizeof(struct match); i++) {
+        m = &matches[i];
+
+        ret = flb_router_match(m->tag, m->pattern);
+        TEST_CHECK(ret == m->ret);
+        TEST_MSG("flb_router_match tag='%s' pattern='%s' ret=%i",
+                 m->tag, m->pattern, ret);
+
+        rule = flb_router_rule_create(m->pattern);
+        TEST_CHECK(rule != NULL);
+        ret = flb_router_rule_match(rule, m->tag, strlen(m->tag));
+        TEST_CHECK(ret == m->ret);
+        TEST_MSG("flb_router_rule_match tag='%s' pattern='%s' ret=%i",
+                 m->tag, m->pattern, ret);
+        flb_router_rule_destroy(rule);
+    }
+}
+
+/* Tags are not required to be null terminated */
+void test_match_len()
+{
+    int ret;
+    struct flb_router_rule *rule;
+
+    rule = flb_router_rule_create("app.*.log");
+    TEST_CHECK(rule != NULL);
+
+    ret = flb_router_rule_match(rule, "app.web.log.1", 11);
+    TEST_CHECK(ret == 1);
+    ret = flb_router_rule_match(rule, "app.web.log.1", 10);
+    TEST_CHECK(ret == 0);
+
+    flb_router_rule_destroy(rule);
+}
+
+static struct flb_output_instance *output_create(struct flb_config *config,
+                                                 char *match)
+{
+    struct flb_output_instance *out;
+
+    out = flb_output_new(config, "null", NULL);
+    TEST_CHECK(out != NULL);
+    flb_output_set_property(out, "match", match);
+
+    return out;
+}
+
+static struct flb_filter_instance *filter_create(struct flb_config *config,
+                                                 char *match)
+{
+    struct flb_filter_instance *filter;
+
+    filter = flb_filter_new(config, "stdout", NULL);
+    TEST_CHECK(filter != NULL);
+    flb_filter_set_property(filter, "match", match);
+
+    return filter;
+}
+
+void test_routes_cache()
+{
+    int ret;
+    struct flb_config *config;
+    struct flb_output_instance *o_app;
+    struct flb_output_instance *o_all;
+    struct flb_filter_instance *f_kube;
+    struct flb_router_routes *routes;
+
+    config = flb_config_init();
+    TEST_CHECK(config != NULL);
+
+    o_app  = output_create(config, "app.*");
+    o_all  = output_create(config, "*");
+    f_kube = filter_create(config, "kube.*");
+
+    ret = flb_router_io_set(config);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(o_app->match_rule != NULL);
+    TEST_CHECK(f_kube->match_rule != NULL);
+
+    routes = flb_router_routes_get(config, "app.web", 7);
+    TEST_CHECK(routes != NULL);
+    TEST_CHECK(routes->n_outputs == 2);
+    TEST_CHECK(routes->n_filters == 0);
+    TEST_CHECK(flb_router_routes_output(routes, 0) == o_app);
+    TEST_CHECK(flb_router_routes_output(routes, 1) == o_all);
+
+    routes = flb_router_routes_get(config, "kube.pod", 8);
+    TEST_CHECK(routes != NULL);
+    TEST_CHECK(routes->n_outputs == 1);
+    TEST_CHECK(routes->n_filters == 1);
+    TEST_CHECK(flb_router_routes_output(routes, 0) == o_all);
+    TEST_CHECK(flb_router_routes_filter(routes, 0) == f_kube);
+
+    /* Same answers without the cache, used when routes can't be resolved */
+    TEST_CHECK(flb_router_output_match(o_app, "app.web", 7) == FLB_TRUE);
+    TEST_CHECK(flb_router_output_match(o_app, "kube.pod", 8) == FLB_FALSE);
+    TEST_CHECK(flb_router_output_match(o_all, "kube.pod", 8) == FLB_TRUE);
+    TEST_CHECK(flb_router_filter_match(f_kube, "kube.pod", 8) == FLB_TRUE);
+    TEST_CHECK(flb_router_filter_match(f_kube, "app.web", 7) == FLB_FALSE);
+
+    /* Second lookup is served from the cache */
+    TEST_CHECK(flb_router_routes_get(config, "kube.pod", 8) == routes);
+
+    /* Changing the configuration drops the cached routes */
+    flb_router_cache_invalidate(config);
+    TEST_CHECK(config->route_cache == NULL);
+    routes = flb_router_routes_get(config, "app.web", 7);
+    TEST_CHECK(routes != NULL && routes->n_outputs == 2);
+
+    flb_router_exit(config);
+    TEST_CHECK(config->route_cache == NULL);
+    TEST_CHECK(o_app->match_rule == NULL);
+
+    flb_filter_exit(config);
+    flb_output_exit(config);
+    flb_config_exit(config);
+}
+
+TEST_LIST = {
+    { "match",        test_match },
+    { "match_len",    test_match_len },
+    { "routes_cache", test_routes_cache },
+    { 0 }
+};
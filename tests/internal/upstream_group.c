@@ -0,0 +1,175 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_upstream_group.h>
+
+#include "flb_tests_internal.h"
+
+static struct flb_upstream_node *group_node(struct flb_upstream_group *g,
+                                            struct flb_config *config,
+                                            int port, int weight, int backup)
+{
+    struct flb_upstream *u;
+
+    u = flb_upstream_create(config, "127.0.0.1", port, FLB_IO_TCP, NULL);
+    TEST_CHECK(u != NULL);
+
+    return flb_upstream_group_add(g, u, weight, backup);
+}
+
+/* Weighted round-robin interleaves the nodes */
+void test_group_round_robin()
+{
+    int i;
+    int count[3] = {0};
+    int prev = -1;
+    int bursts = 0;
+    struct flb_config *config;
+    struct flb_upstream_group *g;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *nodes[3];
+
+    config = flb_config_init();
+    g = flb_upstream_group_create(FLB_UPSTREAM_GROUP_RR);
+    nodes[0] = group_node(g, config, 1000, 3, FLB_FALSE);
+    nodes[1] = group_node(g, config, 1001, 1, FLB_FALSE);
+    nodes[2] = group_node(g, config, 1002, 1, FLB_FALSE);
+
+    for (i = 0; i < 500; i++) {
+        node = flb_upstream_group_next(g, 100);
+        TEST_CHECK(node != NULL);
+        count[node->u->tcp_port - 1000]++;
+        if (node->u->tcp_port - 1000 == prev) {
+            bursts++;
+        }
+        prev = node->u->tcp_port - 1000;
+        flb_upstream_group_done(g, node, 100, FLB_TRUE);
+    }
+
+    TEST_CHECK(count[0] == 300);
+    TEST_CHECK(count[1] == 100);
+    TEST_CHECK(count[2] == 100);
+
+    /* The heavy node is never selected three times in a row */
+    TEST_CHECK(bursts <= 100);
+    TEST_CHECK(nodes[0]->outstanding == 0 && nodes[0]->in_flight == 0);
+
+    flb_upstream_group_destroy(g);
+    flb_config_exit(config);
+}
+
+/* Failed nodes are skipped, backup nodes are only used as last resort */
+void test_group_health()
+{
+    int i;
+    struct flb_config *config;
+    struct flb_upstream_group *g;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *a;
+    struct flb_upstream_node *b;
+    struct flb_upstream_node *backup;
+
+    config = flb_config_init();
+    g = flb_upstream_group_create(FLB_UPSTREAM_GROUP_RR);
+    a = group_node(g, config, 1000, 1, FLB_FALSE);
+    b = group_node(g, config, 1001, 1, FLB_FALSE);
+    backup = group_node(g, config, 1002, 1, FLB_TRUE);
+
+    /* 'a' fails: it's out until the backoff expires */
+    node = flb_upstream_group_next(g, 10);
+    TEST_CHECK(node == a);
+    flb_upstream_group_done(g, node, 10, FLB_FALSE);
+    TEST_CHECK(a->failures == 1 && a->retry_at > 0);
+
+    for (i = 0; i < 10; i++) {
+        node = flb_upstream_group_next(g, 10);
+        TEST_CHECK(node == b);
+        flb_upstream_group_done(g, node, 10, FLB_TRUE);
+    }
+
+    /* Every primary node is down: use the backup */
+    node = flb_upstream_group_next(g, 10);
+    flb_upstream_group_done(g, node, 10, FLB_FALSE);
+    node = flb_upstream_group_next(g, 10);
+    TEST_CHECK(node == backup);
+    flb_upstream_group_done(g, node, 10, FLB_FALSE);
+
+    /* Nothing left */
+    node = flb_upstream_group_next(g, 10);
+    TEST_CHECK(node == NULL);
+
+    /* Backoff expired: the node is tried again and recovers */
+    a->retry_at = 0;
+    node = flb_upstream_group_next(g, 10);
+    TEST_CHECK(node == a);
+    flb_upstream_group_done(g, node, 10, FLB_TRUE);
+    TEST_CHECK(a->failures == 0 && a->retry_at == 0);
+
+    /* The backoff grows with consecutive failures */
+    for (i = 0; i < 3; i++) {
+        b->retry_at = 0;
+        b->current_weight = 100;
+        node = flb_upstream_group_next(g, 10);
+        TEST_CHECK(node == b);
+        flb_upstream_group_done(g, node, 10, FLB_FALSE);
+    }
+    TEST_CHECK(b->failures == 4);
+    TEST_CHECK(b->retry_at - time(NULL) >= 7);
+
+    flb_upstream_group_destroy(g);
+    flb_config_exit(config);
+}
+
+/* In-flight bytes steer the selection to the least loaded node */
+void test_group_least_outstanding()
+{
+    int i;
+    struct flb_config *config;
+    struct flb_upstream_group *g;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *a;
+    struct flb_upstream_node *b;
+    struct flb_upstream_node *inflight[4];
+
+    config = flb_config_init();
+    g = flb_upstream_group_create(FLB_UPSTREAM_GROUP_LEAST);
+    a = group_node(g, config, 1000, 1, FLB_FALSE);
+    b = group_node(g, config, 1001, 1, FLB_FALSE);
+
+    /* A big flush on one node, the next ones go to the other node */
+    inflight[0] = flb_upstream_group_next(g, 1000000);
+    for (i = 1; i < 4; i++) {
+        inflight[i] = flb_upstream_group_next(g, 1000);
+        TEST_CHECK(inflight[i] != inflight[0]);
+    }
+    TEST_CHECK(a->in_flight + b->in_flight == 4);
+    TEST_CHECK(a->outstanding + b->outstanding == 1003000);
+
+    flb_upstream_group_done(g, inflight[0], 1000000, FLB_TRUE);
+    for (i = 1; i < 4; i++) {
+        flb_upstream_group_done(g, inflight[i], 1000, FLB_TRUE);
+    }
+    TEST_CHECK(a->outstanding == 0 && b->outstanding == 0);
+
+    /* Idle nodes share the load */
+    for (i = 0; i < 10; i++) {
+        node = flb_upstream_group_next(g, 10);
+        flb_upstream_group_done(g, node, 10, FLB_TRUE);
+    }
+    TEST_CHECK(a->n_ok == 6 || a->n_ok == 5);
+    TEST_CHECK(a->n_ok + b->n_ok == 14);
+
+    flb_upstream_group_destroy(g);
+    flb_config_exit(config);
+}
+
+TEST_LIST = {
+    { "round_robin",       test_group_round_robin },
+    { "health",            test_group_health },
+    { "least_outstanding", test_group_least_outstanding },
+    { 0 }
+};
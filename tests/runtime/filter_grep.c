@@ -4,17 +4,41 @@
 #include "flb_tests_runtime.h"
 
 /* Test data */
+static pthread_mutex_t result_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int records_kept;
+
+/* Count the records delivered by the lib output */
+static int cb_count_records(void *record, size_t size, void *data)
+{
+    char *p;
+    (void) data;
+
+    pthread_mutex_lock(&result_mutex);
+    p = record;
+    while ((p = strstr(p, "\"log\""))) {
+        records_kept++;
+        p++;
+    }
+    pthread_mutex_unlock(&result_mutex);
+
+    if (size > 0) {
+        flb_free(record);
+    }
+    return 0;
+}
 
 /* Test functions */
 void flb_test_filter_grep_regex(void);
 void flb_test_filter_grep_exclude(void);
 void flb_test_filter_grep_invalid(void);
+void flb_test_filter_grep_multiple(void);
 
 /* Test list */
 TEST_LIST = {
-    {"regex",   flb_test_filter_grep_regex   },
-    {"exclude", flb_test_filter_grep_exclude },
-    {"invalid", flb_test_filter_grep_invalid },
+    {"regex",    flb_test_filter_grep_regex    },
+    {"exclude",  flb_test_filter_grep_exclude  },
+    {"invalid",  flb_test_filter_grep_invalid  },
+    {"multiple", flb_test_filter_grep_multiple },
     {NULL, NULL}
 };
 
@@ -152,3 +176,66 @@ void flb_test_filter_grep_invalid(void)
     flb_stop(ctx);
     flb_destroy(ctx);
 }
+
+/* Several rules over the same fields, applied in order */
+void flb_test_filter_grep_multiple(void)
+{
+    int i;
+    int ret;
+    int bytes;
+    char *p;
+    flb_ctx_t *ctx;
+    int in_ffd;
+    int out_ffd;
+    int filter_ffd;
+    static struct flb_lib_out_cb cb_data;
+    char *records[] = {
+        "[1, {\"level\": \"info\", \"log\": \"connection error\"}]",
+        "[2, {\"level\": \"debug\", \"log\": \"connection error\"}]",
+        "[3, {\"level\": \"info\", \"log\": \"connection closed\"}]",
+        "[4, {\"log\": \"disk error (code 5)\", \"level\": \"warn\"}]",
+        "[5, {\"level\": \"info\", \"log\": \"ERROR\"}]",
+    };
+
+    records_kept = 0;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "Grace", "1", NULL);
+
+    in_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    flb_input_set(ctx, in_ffd, "tag", "test", NULL);
+
+    cb_data.cb = cb_count_records;
+    cb_data.data = NULL;
+    out_ffd = flb_output(ctx, (char *) "lib", (void *) &cb_data);
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(ctx, out_ffd, "match", "test", "format", "json", NULL);
+
+    filter_ffd = flb_filter(ctx, (char *) "grep", NULL);
+    TEST_CHECK(filter_ffd >= 0);
+    ret = flb_filter_set(ctx, filter_ffd, "match", "*", NULL);
+    TEST_CHECK(ret == 0);
+    ret = flb_filter_set(ctx, filter_ffd, "Exclude", "level ^debug$", NULL);
+    TEST_CHECK(ret == 0);
+    ret = flb_filter_set(ctx, filter_ffd, "Regex", "log (?<what>\\w+) error", NULL);
+    TEST_CHECK(ret == 0);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    for (i = 0; i < sizeof(records) / sizeof(char *); i++) {
+        p = records[i];
+        bytes = flb_lib_push(ctx, in_ffd, p, strlen(p));
+        TEST_CHECK(bytes == strlen(p));
+    }
+
+    sleep(2); /* waiting flush */
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+
+    /* 'connection error' (info) and 'disk error' */
+    TEST_CHECK(records_kept == 2);
+    TEST_MSG("records kept: %d", records_kept);
+}
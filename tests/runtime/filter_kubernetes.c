@@ -2,6 +2,7 @@
 
 #include <fluent-bit.h>
 #include <monkey/mk_lib.h>
+#include <glob.h>
 #include "flb_tests_runtime.h"
 
 struct kube_test {
@@ -10,8 +11,9 @@ struct kube_test {
 };
 
 /* Test target mode */
-#define KUBE_TAIL     0
-#define KUBE_SYSTEMD  1
+#define KUBE_TAIL       0
+#define KUBE_SYSTEMD    1
+#define KUBE_TAIL_WATCH 2   /* tail, Pods prefetched through the watch */
 
 /* Constants */
 #define KUBE_IP       "127.0.0.1"
@@ -70,6 +72,62 @@ static int file_to_buf(char *path, char **out_buf, size_t *out_size)
     return 0;
 }
 
+/* Compose a PodList with the content of all the .meta files */
+static int pod_list_to_buf(char **out_buf, size_t *out_size)
+{
+    int i;
+    int ret;
+    char *buf;
+    char *tmp;
+    char *meta_buf;
+    size_t size;
+    size_t meta_size;
+    glob_t globbuf;
+
+    ret = glob(DPATH "*.meta", 0, NULL, &globbuf);
+    if (ret != 0) {
+        return -1;
+    }
+
+    buf = flb_strdup("{\"kind\":\"PodList\",\"metadata\":"
+                     "{\"resourceVersion\":\"1\"},\"items\":[");
+    size = strlen(buf);
+
+    for (i = 0; i < globbuf.gl_pathc; i++) {
+        ret = file_to_buf(globbuf.gl_pathv[i], &meta_buf, &meta_size);
+        if (ret == -1) {
+            continue;
+        }
+
+        tmp = flb_realloc(buf, size + meta_size + 3);
+        if (!tmp) {
+            flb_free(meta_buf);
+            break;
+        }
+        buf = tmp;
+        if (i > 0) {
+            buf[size++] = ',';
+        }
+        memcpy(buf + size, meta_buf, meta_size);
+        size += meta_size;
+        flb_free(meta_buf);
+    }
+    globfree(&globbuf);
+
+    tmp = flb_realloc(buf, size + 2);
+    if (!tmp) {
+        flb_free(buf);
+        return -1;
+    }
+    buf = tmp;
+    buf[size++] = ']';
+    buf[size++] = '}';
+
+    *out_buf = buf;
+    *out_size = size;
+    return 0;
+}
+
 static void cb_api_server_root(mk_request_t *request, void *data)
 {
     int ret;
@@ -86,6 +144,21 @@ static void cb_api_server_root(mk_request_t *request, void *data)
     }
 
     snprintf(meta, sizeof(meta) - 1, "%s%s.meta", DPATH, pod);
+
+    /* Pods list and watch requests: the watch never reports changes */
+    if (strcmp(pod, "/pods") == 0) {
+        flb_free(uri);
+        mk_http_status(request, 200);
+        if (request->query_string.len == 0) {
+            ret = pod_list_to_buf(&meta_buf, &meta_size);
+            if (ret == 0) {
+                mk_http_send(request, meta_buf, meta_size, NULL);
+                flb_free(meta_buf);
+            }
+        }
+        mk_http_done(request);
+        return;
+    }
     flb_free(uri);
 
     ret = file_to_buf(meta, &meta_buf, &meta_size);
@@ -229,7 +302,7 @@ static struct kube_test *kube_test_create(char *target, int type)
                     "Parsers_File", "../conf/parsers.conf",
                     NULL);
 
-    if (type == KUBE_TAIL) {
+    if (type == KUBE_TAIL || type == KUBE_TAIL_WATCH) {
         in_ffd = flb_input(ctx->flb, "tail", NULL);
         ret = flb_input_set(ctx->flb, in_ffd,
                             "Tag", "kube.*",
@@ -256,11 +329,16 @@ static struct kube_test *kube_test_create(char *target, int type)
                          "k8s-logging.parser", "On",
                          NULL);
 
-    if (type == KUBE_TAIL) {
+    if (type == KUBE_TAIL || type == KUBE_TAIL_WATCH) {
         ret = flb_filter_set(ctx->flb, filter_ffd,
                              "Regex_Parser", "filter-kube-test",
                              NULL);
     }
+    if (type == KUBE_TAIL_WATCH) {
+        ret = flb_filter_set(ctx->flb, filter_ffd,
+                             "Watch_Namespace", "default",
+                             NULL);
+    }
     else if (type == KUBE_SYSTEMD) {
         flb_filter_set(ctx->flb, filter_ffd,
                        "Use_Journal", "On",
@@ -352,6 +430,28 @@ void flb_test_json_logs_invalid()
     kube_test_destroy(ctx);
 }
 
+void flb_test_apache_logs_annotated_watch()
+{
+    struct kube_test *ctx;
+
+    ctx = kube_test_create(T_APACHE_LOGS_ANN, KUBE_TAIL_WATCH);
+    if (!ctx) {
+        exit(EXIT_FAILURE);
+    }
+    kube_test_destroy(ctx);
+}
+
+void flb_test_json_logs_watch()
+{
+    struct kube_test *ctx;
+
+    ctx = kube_test_create(T_JSON_LOGS, KUBE_TAIL_WATCH);
+    if (!ctx) {
+        exit(EXIT_FAILURE);
+    }
+    kube_test_destroy(ctx);
+}
+
 #include <systemd/sd-journal.h>
 void flb_test_systemd_logs()
 {
@@ -385,5 +485,7 @@ TEST_LIST = {
     {"kube_json_logs", flb_test_json_logs},
     {"kube_json_logs_invalid", flb_test_json_logs_invalid},
     {"kube_systemd_logs", flb_test_systemd_logs},
+    {"kube_apache_logs_annotated_watch", flb_test_apache_logs_annotated_watch},
+    {"kube_json_logs_watch", flb_test_json_logs_watch},
     {NULL, NULL}
 };
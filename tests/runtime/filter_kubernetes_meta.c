@@ -0,0 +1,573 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit.h>
+#include <monkey/mk_lib.h>
+#include "flb_tests_runtime.h"
+
+/*
+ * Kubernetes filter metadata cache and API server workers, tested against a
+ * fake API server which serves Pods generated from the 'pods' table below.
+ */
+
+#define KUBE_IP       "127.0.0.1"
+#define KUBE_PORT     "8003"
+#define KUBE_URL      "http://" KUBE_IP ":" KUBE_PORT
+
+#define POD_TAG(pod)  "kube.var.log.containers." pod "_default_app-"  \
+    "ac6095b6c715d823d732dcc9067f75b1299de5cc69a012b08d616a6058bdc0ad.log"
+
+#define MAX_PODS      8
+
+struct fake_pod {
+    char name[32];
+    char version[16];
+    int exclude;               /* annotated with fluentbit.io/exclude ? */
+    int gets;                  /* GET requests received for this Pod */
+};
+
+/* Fake API server state */
+static pthread_mutex_t api_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fake_pod pods[MAX_PODS];
+static int pods_count;
+static int api_lists;
+static int api_delay;          /* seconds to wait before answering a GET */
+static char api_event[1024];   /* next watch event */
+
+/* Output records */
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+static char out_buf[65536];
+
+static void fake_pod_set(char *name, char *version)
+{
+    int i;
+
+    pthread_mutex_lock(&api_lock);
+    for (i = 0; i < pods_count; i++) {
+        if (strcmp(pods[i].name, name) == 0) {
+            break;
+        }
+    }
+    if (i == pods_count) {
+        pods_count++;
+        memset(&pods[i], '\0', sizeof(struct fake_pod));
+        strcpy(pods[i].name, name);
+    }
+    strcpy(pods[i].version, version);
+    pthread_mutex_unlock(&api_lock);
+}
+
+static void fake_pod_exclude(char *name)
+{
+    int i;
+
+    pthread_mutex_lock(&api_lock);
+    for (i = 0; i < pods_count && i < MAX_PODS; i++) {
+        if (strcmp(pods[i].name, name) == 0) {
+            pods[i].exclude = 1;
+        }
+    }
+    pthread_mutex_unlock(&api_lock);
+}
+
+static int fake_pod_gets(char *name)
+{
+    int i;
+    int gets = 0;
+
+    pthread_mutex_lock(&api_lock);
+    for (i = 0; i < pods_count && i < MAX_PODS; i++) {
+        if (strcmp(pods[i].name, name) == 0) {
+            gets = pods[i].gets;
+        }
+    }
+    pthread_mutex_unlock(&api_lock);
+
+    return gets;
+}
+
+static int pod_json(struct fake_pod *pod, char *buf, size_t size)
+{
+    return snprintf(buf, size,
+                    "{\"kind\":\"Pod\",\"metadata\":{\"name\":\"%s\","
+                    "\"namespace\":\"default\",\"uid\":\"uid-%s\","
+                    "\"resourceVersion\":\"10\",%s"
+                    "\"labels\":{\"version\":\"%s\"}},"
+                    "\"spec\":{\"nodeName\":\"node-1\"}}",
+                    pod->name, pod->name,
+                    pod->exclude ?
+                    "\"annotations\":{\"fluentbit.io/exclude\":\"true\"}," : "",
+                    pod->version);
+}
+
+static void cb_api_server(mk_request_t *request, void *data)
+{
+    int i;
+    int len = 0;
+    int delay = 0;
+    char *pod;
+    char uri[256];
+    char *buf;
+    size_t size = 8192;
+    (void) data;
+
+    buf = flb_malloc(size);
+    if (!buf) {
+        return;
+    }
+
+    snprintf(uri, sizeof(uri), "%.*s", (int) request->uri.len,
+             request->uri.data);
+    pod = strrchr(uri, '/') + 1;
+
+    pthread_mutex_lock(&api_lock);
+    if (strcmp(pod, "pods") == 0) {
+        if (request->query_string.len > 0 &&
+            strstr(request->query_string.data, "watch=1")) {
+            /* Watch: send the pending event, if any */
+            len = snprintf(buf, size, "%s", api_event);
+            api_event[0] = '\0';
+        }
+        else {
+            /* List */
+            api_lists++;
+            len = snprintf(buf, size,
+                           "{\"kind\":\"PodList\",\"metadata\":"
+                           "{\"resourceVersion\":\"10\"},\"items\":[");
+            for (i = 0; i < pods_count; i++) {
+                if (i > 0) {
+                    buf[len++] = ',';
+                }
+                len += pod_json(&pods[i], buf + len, size - len);
+            }
+            len += snprintf(buf + len, size - len, "]}");
+        }
+    }
+    else {
+        for (i = 0; i < pods_count; i++) {
+            if (strcmp(pods[i].name, pod) == 0) {
+                pods[i].gets++;
+                len = pod_json(&pods[i], buf, size);
+                delay = api_delay;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&api_lock);
+
+    if (delay > 0) {
+        sleep(delay);
+    }
+
+    if (len == 0 && strcmp(pod, "pods") != 0) {
+        mk_http_status(request, 404);
+        mk_http_send(request, "Resource not found\n", 19, NULL);
+    }
+    else {
+        mk_http_status(request, 200);
+        if (len > 0) {
+            mk_http_send(request, buf, len, NULL);
+        }
+    }
+    mk_http_done(request);
+    flb_free(buf);
+}
+
+static mk_ctx_t *api_server_create()
+{
+    int vid;
+    int ret;
+    mk_ctx_t *ctx;
+
+    pods_count = 0;
+    api_lists = 0;
+    api_delay = 0;
+    api_event[0] = '\0';
+    out_buf[0] = '\0';
+
+    ctx = mk_create();
+    TEST_CHECK(ctx != NULL);
+    if (!ctx) {
+        exit(EXIT_FAILURE);
+    }
+
+    mk_config_set(ctx, "Listen", KUBE_IP ":" KUBE_PORT, NULL);
+    vid = mk_vhost_create(ctx, NULL);
+    mk_vhost_set(ctx, vid, "Name", "rt-filter_kube_meta", NULL);
+    mk_vhost_handler(ctx, vid, "/", cb_api_server, NULL);
+
+    ret = mk_start(ctx);
+    TEST_CHECK(ret == 0);
+    if (ret != 0) {
+        mk_destroy(ctx);
+        exit(EXIT_FAILURE);
+    }
+
+    return ctx;
+}
+
+static void api_server_stop(mk_ctx_t *ctx)
+{
+    mk_stop(ctx);
+    mk_destroy(ctx);
+}
+
+static int cb_store_result(void *record, size_t size, void *data)
+{
+    (void) data;
+
+    pthread_mutex_lock(&out_lock);
+    strncat(out_buf, record, sizeof(out_buf) - strlen(out_buf) - 2);
+    strcat(out_buf, "\n");
+    pthread_mutex_unlock(&out_lock);
+
+    if (size > 0) {
+        flb_free(record);
+    }
+    return 0;
+}
+
+/* Number of output records containing 'str' */
+static int out_count(char *str)
+{
+    int n = 0;
+    char *p;
+
+    pthread_mutex_lock(&out_lock);
+    p = out_buf;
+    while ((p = strstr(p, str))) {
+        n++;
+        p += strlen(str);
+    }
+    pthread_mutex_unlock(&out_lock);
+
+    return n;
+}
+
+static flb_ctx_t *flb_kube_create(int *filter_ffd)
+{
+    int out_ffd;
+    flb_ctx_t *ctx;
+    static struct flb_lib_out_cb cb_data;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "Grace", "1", NULL);
+
+    *filter_ffd = flb_filter(ctx, "kubernetes", NULL);
+    TEST_CHECK(*filter_ffd >= 0);
+    flb_filter_set(ctx, *filter_ffd,
+                   "Match", "kube.*",
+                   "Kube_URL", KUBE_URL,
+                   NULL);
+
+    cb_data.cb = cb_store_result;
+    cb_data.data = NULL;
+    out_ffd = flb_output(ctx, "lib", (void *) &cb_data);
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(ctx, out_ffd,
+                   "Match", "kube.*",
+                   "format", "json",
+                   NULL);
+
+    return ctx;
+}
+
+static int pod_input(flb_ctx_t *ctx, char *tag)
+{
+    int in_ffd;
+
+    in_ffd = flb_input(ctx, "lib", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    flb_input_set(ctx, in_ffd, "Tag", tag, NULL);
+
+    return in_ffd;
+}
+
+static void push(flb_ctx_t *ctx, int in_ffd)
+{
+    int ret;
+    char *rec = "[1519234013, {\"log\":\"hello\"}]";
+
+    ret = flb_lib_push(ctx, in_ffd, rec, strlen(rec));
+    TEST_CHECK(ret == strlen(rec));
+}
+
+/* Pods in the watch scope are loaded at startup */
+void flb_test_kube_meta_prefetch()
+{
+    int in_ffd;
+    int filter_ffd;
+    mk_ctx_t *http;
+    flb_ctx_t *ctx;
+
+    http = api_server_create();
+    fake_pod_set("pod-a", "v1");
+
+    ctx = flb_kube_create(&filter_ffd);
+    flb_filter_set(ctx, filter_ffd, "Watch_Namespace", "default", NULL);
+    in_ffd = pod_input(ctx, POD_TAG("pod-a"));
+    TEST_CHECK(flb_start(ctx) == 0);
+
+    push(ctx, in_ffd);
+    sleep(2);
+
+    TEST_CHECK(out_count("\"pod_id\":\"uid-pod-a\"") == 1);
+    TEST_CHECK(out_count("\"host\":\"node-1\"") == 1);
+    TEST_CHECK(api_lists >= 1);
+    TEST_CHECK(fake_pod_gets("pod-a") == 0);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    api_server_stop(http);
+}
+
+/* A miss waits for the lookup, the first records get the Pod metadata */
+void flb_test_kube_meta_miss_wait()
+{
+    int i;
+    int in_ffd;
+    int filter_ffd;
+    mk_ctx_t *http;
+    flb_ctx_t *ctx;
+
+    http = api_server_create();
+    fake_pod_set("pod-h", "v1");
+    api_delay = 1;
+
+    ctx = flb_kube_create(&filter_ffd);
+    in_ffd = pod_input(ctx, POD_TAG("pod-h"));
+    TEST_CHECK(flb_start(ctx) == 0);
+
+    for (i = 0; i < 3; i++) {
+        push(ctx, in_ffd);
+    }
+    sleep(3);
+
+    TEST_CHECK(out_count("\"pod_name\":\"pod-h\"") == 3);
+    TEST_CHECK(out_count("\"pod_id\":\"uid-pod-h\"") == 3);
+    TEST_CHECK(fake_pod_gets("pod-h") == 1);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    api_server_stop(http);
+}
+
+/*
+ * With Async_Lookup a slow API server does not hold the records: they go
+ * out with the Tag metadata and concurrent misses share one request.
+ */
+void flb_test_kube_meta_miss()
+{
+    int i;
+    int in_ffd;
+    int filter_ffd;
+    mk_ctx_t *http;
+    flb_ctx_t *ctx;
+
+    http = api_server_create();
+    fake_pod_set("pod-b", "v1");
+    api_delay = 3;
+
+    ctx = flb_kube_create(&filter_ffd);
+    flb_filter_set(ctx, filter_ffd, "Async_Lookup", "On", NULL);
+    in_ffd = pod_input(ctx, POD_TAG("pod-b"));
+    TEST_CHECK(flb_start(ctx) == 0);
+
+    for (i = 0; i < 3; i++) {
+        push(ctx, in_ffd);
+        usleep(300000);
+    }
+    sleep(1);
+
+    /* Flushed before the API server answered */
+    TEST_CHECK(out_count("\"pod_name\":\"pod-b\"") == 3);
+    TEST_CHECK(out_count("\"pod_id\"") == 0);
+    TEST_CHECK(fake_pod_gets("pod-b") == 1);
+
+    sleep(3);
+    push(ctx, in_ffd);
+    sleep(2);
+
+    TEST_CHECK(out_count("\"pod_id\":\"uid-pod-b\"") == 1);
+    TEST_CHECK(fake_pod_gets("pod-b") == 1);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    api_server_stop(http);
+}
+
+/*
+ * Exclusion can't be decided from the Tag: even with Async_Lookup the
+ * records of an excluded Pod are not flushed while its lookup is pending.
+ */
+void flb_test_kube_meta_exclude()
+{
+    int in_ffd;
+    int filter_ffd;
+    mk_ctx_t *http;
+    flb_ctx_t *ctx;
+
+    http = api_server_create();
+    fake_pod_set("pod-i", "v1");
+    fake_pod_exclude("pod-i");
+    api_delay = 1;
+
+    ctx = flb_kube_create(&filter_ffd);
+    flb_filter_set(ctx, filter_ffd,
+                   "Async_Lookup", "On",
+                   "K8S-Logging.Exclude", "On",
+                   NULL);
+    in_ffd = pod_input(ctx, POD_TAG("pod-i"));
+    TEST_CHECK(flb_start(ctx) == 0);
+
+    push(ctx, in_ffd);
+    push(ctx, in_ffd);
+    sleep(3);
+
+    TEST_CHECK(out_count("\"pod_name\":\"pod-i\"") == 0);
+    TEST_CHECK(fake_pod_gets("pod-i") == 1);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    api_server_stop(http);
+}
+
+/* Expired entries are served while they get refreshed */
+void flb_test_kube_meta_ttl()
+{
+    int in_ffd;
+    int filter_ffd;
+    mk_ctx_t *http;
+    flb_ctx_t *ctx;
+
+    http = api_server_create();
+    fake_pod_set("pod-c", "v1");
+
+    ctx = flb_kube_create(&filter_ffd);
+    flb_filter_set(ctx, filter_ffd, "Cache_TTL", "1", NULL);
+    in_ffd = pod_input(ctx, POD_TAG("pod-c"));
+    TEST_CHECK(flb_start(ctx) == 0);
+
+    push(ctx, in_ffd);
+    sleep(1);
+    push(ctx, in_ffd);
+    sleep(1);
+    TEST_CHECK(out_count("\"version\":\"v1\"") >= 1);
+
+    fake_pod_set("pod-c", "v2");
+    sleep(1);
+
+    /* Expired: still v1, refresh requested */
+    push(ctx, in_ffd);
+    sleep(2);
+    push(ctx, in_ffd);
+    sleep(2);
+
+    TEST_CHECK(out_count("\"version\":\"v2\"") >= 1);
+    TEST_CHECK(fake_pod_gets("pod-c") >= 2);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    api_server_stop(http);
+}
+
+/* The least recently used Pod is evicted when the cache is full */
+void flb_test_kube_meta_lru()
+{
+    int a;
+    int b;
+    int c;
+    int filter_ffd;
+    mk_ctx_t *http;
+    flb_ctx_t *ctx;
+
+    http = api_server_create();
+    fake_pod_set("pod-d", "v1");
+    fake_pod_set("pod-e", "v1");
+    fake_pod_set("pod-f", "v1");
+
+    ctx = flb_kube_create(&filter_ffd);
+    flb_filter_set(ctx, filter_ffd, "Cache_Size", "2", NULL);
+    a = pod_input(ctx, POD_TAG("pod-d"));
+    b = pod_input(ctx, POD_TAG("pod-e"));
+    c = pod_input(ctx, POD_TAG("pod-f"));
+    TEST_CHECK(flb_start(ctx) == 0);
+
+    push(ctx, a);
+    sleep(1);
+    push(ctx, b);
+    sleep(1);
+
+    /* pod-d is used again, pod-e becomes the oldest one */
+    push(ctx, a);
+    sleep(1);
+    push(ctx, c);
+    sleep(1);
+    push(ctx, a);
+    push(ctx, b);
+    sleep(2);
+
+    TEST_CHECK(fake_pod_gets("pod-d") == 1);
+    TEST_CHECK(fake_pod_gets("pod-e") == 2);
+    TEST_CHECK(fake_pod_gets("pod-f") == 1);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    api_server_stop(http);
+}
+
+/* Watch events update the cache */
+void flb_test_kube_meta_watch()
+{
+    int in_ffd;
+    int filter_ffd;
+    mk_ctx_t *http;
+    flb_ctx_t *ctx;
+    struct fake_pod pod;
+
+    http = api_server_create();
+    fake_pod_set("pod-g", "v1");
+
+    ctx = flb_kube_create(&filter_ffd);
+    flb_filter_set(ctx, filter_ffd,
+                   "Watch_Namespace", "default",
+                   "Watch_Timeout", "1",
+                   NULL);
+    in_ffd = pod_input(ctx, POD_TAG("pod-g"));
+    TEST_CHECK(flb_start(ctx) == 0);
+
+    push(ctx, in_ffd);
+    sleep(2);
+    TEST_CHECK(out_count("\"version\":\"v1\"") == 1);
+
+    /* Labels changed */
+    memset(&pod, '\0', sizeof(pod));
+    strcpy(pod.name, "pod-g");
+    strcpy(pod.version, "v2");
+    pthread_mutex_lock(&api_lock);
+    strcpy(api_event, "{\"type\":\"MODIFIED\",\"object\":");
+    pod_json(&pod, api_event + strlen(api_event),
+             sizeof(api_event) - strlen(api_event) - 2);
+    strcat(api_event, "}\n");
+    pthread_mutex_unlock(&api_lock);
+    sleep(3);
+
+    push(ctx, in_ffd);
+    sleep(2);
+    TEST_CHECK(out_count("\"version\":\"v2\"") == 1);
+    TEST_CHECK(fake_pod_gets("pod-g") == 0);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+    api_server_stop(http);
+}
+
+TEST_LIST = {
+    {"kube_meta_prefetch", flb_test_kube_meta_prefetch},
+    {"kube_meta_miss_wait", flb_test_kube_meta_miss_wait},
+    {"kube_meta_miss", flb_test_kube_meta_miss},
+    {"kube_meta_exclude", flb_test_kube_meta_exclude},
+    {"kube_meta_ttl", flb_test_kube_meta_ttl},
+    {"kube_meta_lru", flb_test_kube_meta_lru},
+    {"kube_meta_watch", flb_test_kube_meta_watch},
+    {NULL, NULL}
+};
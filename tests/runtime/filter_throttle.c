@@ -7,13 +7,45 @@
 
 /* Utility functions */
 pthread_mutex_t result_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int noisy_count;
+static int quiet_count;
+
+/* Count the records of each key delivered by the lib output */
+static int str_count(char *buf, char *str)
+{
+    int n = 0;
+    char *p = buf;
+
+    while ((p = strstr(p, str))) {
+        n++;
+        p += strlen(str);
+    }
+    return n;
+}
+
+static int cb_count_keys(void *record, size_t size, void *data)
+{
+    (void) data;
+
+    pthread_mutex_lock(&result_mutex);
+    noisy_count += str_count(record, "\"noisy\"");
+    quiet_count += str_count(record, "\"quiet\"");
+    pthread_mutex_unlock(&result_mutex);
+
+    if (size > 0) {
+        flb_free(record);
+    }
+    return 0;
+}
 
 /* Test functions */
 void flb_test_filter_throttle(void);
+void flb_test_filter_throttle_key(void);
 
 /* Test list */
 TEST_LIST = {
-    {"throttle",   flb_test_filter_throttle   },
+    {"throttle",      flb_test_filter_throttle     },
+    {"throttle_key",  flb_test_filter_throttle_key },
     {NULL, NULL}
 };
 
@@ -68,3 +100,69 @@ void flb_test_filter_throttle(void)
     flb_stop(ctx);
     flb_destroy(ctx);
 }
+
+void flb_test_filter_throttle_key(void)
+{
+    int i;
+    int ret;
+    int bytes;
+    char p[100];
+    flb_ctx_t *ctx;
+    int in_ffd;
+    int out_ffd;
+    int filter_ffd;
+    static struct flb_lib_out_cb cb_data;
+
+    noisy_count = 0;
+    quiet_count = 0;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "Grace", "1", NULL);
+
+    in_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    flb_input_set(ctx, in_ffd, "tag", "test", NULL);
+
+    cb_data.cb = cb_count_keys;
+    cb_data.data = NULL;
+    out_ffd = flb_output(ctx, (char *) "lib", (void *) &cb_data);
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(ctx, out_ffd, "match", "test", "format", "json", NULL);
+
+    /* 5 records per second and key, bursts of up to 10 records */
+    filter_ffd = flb_filter(ctx, (char *) "throttle", NULL);
+    TEST_CHECK(filter_ffd >= 0);
+    ret = flb_filter_set(ctx, filter_ffd,
+                         "match", "*",
+                         "rate", "5",
+                         "window", "2",
+                         "interval", "1s",
+                         "key", "app",
+                         NULL);
+    TEST_CHECK(ret == 0);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    /* A noisy key must not eat the budget of a quiet one */
+    for (i = 0; i < 200; i++) {
+        snprintf(p, sizeof(p), "[%d, {\"app\": \"noisy\", \"val\": %d}]", i, i);
+        bytes = flb_lib_push(ctx, in_ffd, p, strlen(p));
+        TEST_CHECK(bytes == strlen(p));
+    }
+    for (i = 0; i < 5; i++) {
+        snprintf(p, sizeof(p), "[%d, {\"app\": \"quiet\", \"val\": %d}]", i, i);
+        bytes = flb_lib_push(ctx, in_ffd, p, strlen(p));
+        TEST_CHECK(bytes == strlen(p));
+    }
+
+    sleep(2); /* waiting flush */
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+
+    TEST_CHECK(quiet_count == 5);
+    TEST_MSG("quiet records: %d", quiet_count);
+    TEST_CHECK(noisy_count >= 10 && noisy_count < 200);
+    TEST_MSG("noisy records: %d", noisy_count);
+}
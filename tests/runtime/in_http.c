@@ -0,0 +1,531 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2015-2016 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <fluent-bit.h>
+#include <fluent-bit/flb_gzip.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "flb_tests_runtime.h"
+
+#define HTTP_PORT      "9881"
+#define HTTP_RECORD    "{\"key\": \"in_http\", \"n\": 1234}"
+
+/* Test functions */
+void flb_test_in_http_json(void);
+void flb_test_in_http_msgpack(void);
+void flb_test_in_http_chunked(void);
+void flb_test_in_http_gzip(void);
+void flb_test_in_http_pipeline(void);
+void flb_test_in_http_errors(void);
+void flb_test_in_http_backpressure(void);
+#ifdef FLB_TESTS_RT_LOAD
+void flb_test_in_http_load(void);
+#endif
+
+/* Test list */
+TEST_LIST = {
+    {"json",         flb_test_in_http_json },
+    {"msgpack",      flb_test_in_http_msgpack },
+    {"chunked",      flb_test_in_http_chunked },
+    {"gzip",         flb_test_in_http_gzip },
+    {"pipeline",     flb_test_in_http_pipeline },
+    {"errors",       flb_test_in_http_errors },
+    {"backpressure", flb_test_in_http_backpressure },
+#ifdef FLB_TESTS_RT_LOAD
+    {"load",         flb_test_in_http_load },
+#endif
+    {NULL, NULL}
+};
+
+pthread_mutex_t result_mutex;
+int num_records;
+
+static void clear_records(void)
+{
+    pthread_mutex_lock(&result_mutex);
+    num_records = 0;
+    pthread_mutex_unlock(&result_mutex);
+}
+
+static int get_records(void)
+{
+    int val;
+
+    pthread_mutex_lock(&result_mutex);
+    val = num_records;
+    pthread_mutex_unlock(&result_mutex);
+
+    return val;
+}
+
+/* The lib output delivers one JSON record per call */
+int callback_test(void* data, size_t size, void *cb_data)
+{
+    if (size > 0) {
+        if (strstr(data, "in_http") != NULL) {
+            pthread_mutex_lock(&result_mutex);
+            num_records++;
+            pthread_mutex_unlock(&result_mutex);
+        }
+        flb_lib_free(data);
+    }
+    return 0;
+}
+
+/* Wait up to 5 seconds for the records to be flushed */
+static int wait_records(int expected)
+{
+    int i;
+
+    for (i = 0; i < 50 && get_records() < expected; i++) {
+        usleep(100000);
+    }
+    return get_records();
+}
+
+static flb_ctx_t *http_start(char *output, char *mem_buf_limit)
+{
+    int ret;
+    int in_ffd;
+    int out_ffd;
+    flb_ctx_t *ctx;
+    struct flb_lib_out_cb cb;
+
+    cb.cb   = callback_test;
+    cb.data = NULL;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "Log_Level", "error", NULL);
+
+    in_ffd = flb_input(ctx, (char *) "http", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    flb_input_set(ctx, in_ffd, "port", HTTP_PORT, NULL);
+    if (mem_buf_limit) {
+        flb_input_set(ctx, in_ffd, "mem_buf_limit", mem_buf_limit, NULL);
+    }
+
+    if (strcmp(output, "lib") == 0) {
+        out_ffd = flb_output(ctx, (char *) "lib", &cb);
+        flb_output_set(ctx, out_ffd, "format", "json", NULL);
+    }
+    else {
+        out_ffd = flb_output(ctx, output, NULL);
+    }
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(ctx, out_ffd, "match", "*", NULL);
+
+    clear_records();
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    return ctx;
+}
+
+static void http_stop(flb_ctx_t *ctx)
+{
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+static int http_connect(void)
+{
+    int fd;
+    int ret;
+    struct timeval tv = {5, 0};
+    struct sockaddr_in addr;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    TEST_CHECK(fd != -1);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(atoi(HTTP_PORT));
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+    ret = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+    TEST_CHECK(ret == 0);
+    return fd;
+}
+
+static int http_write(int fd, char *buf, size_t size)
+{
+    ssize_t ret;
+    size_t off = 0;
+
+    while (off < size) {
+        ret = write(fd, buf + off, size - off);
+        if (ret <= 0) {
+            return -1;
+        }
+        off += ret;
+    }
+    return 0;
+}
+
+/*
+ * Read responses until 'expected' of them were received, returns the
+ * number of responses having the 'status' code.
+ */
+static int http_responses(int fd, int expected, char *status)
+{
+    int found = 0;
+    int matches = 0;
+    int len = 0;
+    ssize_t ret;
+    char *p;
+    char *end;
+    char buf[8192];
+
+    while (found < expected) {
+        ret = read(fd, buf + len, sizeof(buf) - len - 1);
+        if (ret <= 0) {
+            break;
+        }
+        len += ret;
+        buf[len] = '\0';
+
+        /* Responses have no body, they end with an empty line */
+        p = buf;
+        while ((end = strstr(p, "\r\n\r\n")) != NULL) {
+            if (strncmp(p, "HTTP/1.1 100", 12) != 0) {
+                found++;
+                if (strncmp(p + 9, status, 3) == 0) {
+                    matches++;
+                }
+            }
+            p = end + 4;
+        }
+        len -= (p - buf);
+        memmove(buf, p, len);
+    }
+
+    return matches;
+}
+
+static int http_post(char *path, char *headers, char *body, size_t size)
+{
+    int fd;
+    int ret;
+    char req[1024];
+
+    fd = http_connect();
+    snprintf(req, sizeof(req) - 1,
+             "POST %s HTTP/1.1\r\n"
+             "Host: 127.0.0.1\r\n"
+             "%s"
+             "Content-Length: %lu\r\n\r\n",
+             path, headers, size);
+    http_write(fd, req, strlen(req));
+    http_write(fd, body, size);
+    ret = http_responses(fd, 1, "201");
+    close(fd);
+
+    return ret;
+}
+
+void flb_test_in_http_json(void)
+{
+    int ret;
+    flb_ctx_t *ctx;
+    char *body = "[" HTTP_RECORD "," HTTP_RECORD "]" HTTP_RECORD;
+
+    ctx = http_start("lib", NULL);
+
+    ret = http_post("/app/logs", "Content-Type: application/json\r\n",
+                    body, strlen(body));
+    TEST_CHECK(ret == 1);
+    TEST_CHECK(wait_records(3) == 3);
+
+    http_stop(ctx);
+}
+
+void flb_test_in_http_msgpack(void)
+{
+    int ret;
+    flb_ctx_t *ctx;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+
+    ctx = http_start("lib", NULL);
+
+    msgpack_sbuffer_init(&sbuf);
+    msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+    msgpack_pack_map(&pck, 1);
+    msgpack_pack_str(&pck, 3);
+    msgpack_pack_str_body(&pck, "key", 3);
+    msgpack_pack_str(&pck, 7);
+    msgpack_pack_str_body(&pck, "in_http", 7);
+
+    ret = http_post("/mp", "Content-Type: application/msgpack\r\n",
+                    sbuf.data, sbuf.size);
+    TEST_CHECK(ret == 1);
+    TEST_CHECK(wait_records(1) == 1);
+
+    msgpack_sbuffer_destroy(&sbuf);
+    http_stop(ctx);
+}
+
+void flb_test_in_http_chunked(void)
+{
+    int fd;
+    int ret;
+    flb_ctx_t *ctx;
+    char *req =
+        "POST /chunked HTTP/1.1\r\n"
+        "Transfer-Encoding: chunked\r\n\r\n"
+        "5\r\n[{\"ke\r\n"
+        "19;ext=1\r\ny\": \"in_http\"}, {\"key\": \"\r\n"
+        "a\r\nin_http\"}]\r\n"
+        "0\r\n\r\n";
+
+    ctx = http_start("lib", NULL);
+
+    /* Write the request in two steps: the body arrives split */
+    fd = http_connect();
+    http_write(fd, req, 60);
+    usleep(100000);
+    http_write(fd, req + 60, strlen(req) - 60);
+    ret = http_responses(fd, 1, "201");
+    TEST_CHECK(ret == 1);
+    close(fd);
+    TEST_CHECK(wait_records(2) == 2);
+
+    http_stop(ctx);
+}
+
+void flb_test_in_http_gzip(void)
+{
+    int i;
+    int ret;
+    int len;
+    char *body;
+    void *gz;
+    size_t gz_size;
+    flb_ctx_t *ctx;
+
+    ctx = http_start("lib", NULL);
+
+    /* Many records compress well */
+    len = sizeof(HTTP_RECORD) - 1;
+    body = malloc(len * 100);
+    for (i = 0; i < 100; i++) {
+        memcpy(body + (len * i), HTTP_RECORD, len);
+    }
+    ret = flb_gzip_compress(body, len * 100, &gz, &gz_size);
+    TEST_CHECK(ret == 0);
+
+    ret = http_post("/gz", "Content-Encoding: gzip\r\n", gz, gz_size);
+    TEST_CHECK(ret == 1);
+    TEST_CHECK(wait_records(100) == 100);
+
+    flb_free(gz);
+    free(body);
+    http_stop(ctx);
+}
+
+/* Many requests written at once on a keep-alive connection */
+void flb_test_in_http_pipeline(void)
+{
+    int i;
+    int fd;
+    int ret;
+    int len;
+    char req[256];
+    flb_ctx_t *ctx;
+
+    ctx = http_start("lib", NULL);
+
+    len = snprintf(req, sizeof(req) - 1,
+                   "POST /pipeline HTTP/1.1\r\n"
+                   "Content-Length: %lu\r\n\r\n%s",
+                   sizeof(HTTP_RECORD) - 1, HTTP_RECORD);
+
+    fd = http_connect();
+    for (i = 0; i < 500; i++) {
+        http_write(fd, req, len);
+    }
+    ret = http_responses(fd, 500, "201");
+    TEST_CHECK(ret == 500);
+    TEST_CHECK(wait_records(500) == 500);
+
+    /* The connection is still usable */
+    http_write(fd, req, len);
+    ret = http_responses(fd, 1, "201");
+    TEST_CHECK(ret == 1);
+    close(fd);
+
+    http_stop(ctx);
+}
+
+void flb_test_in_http_errors(void)
+{
+    int fd;
+    int ret;
+    flb_ctx_t *ctx;
+    char *req;
+
+    ctx = http_start("lib", NULL);
+
+    /* Invalid content */
+    ret = http_post("/bad", "", "{\"key\": ", 8);
+    TEST_CHECK(ret == 0);
+    ret = http_post("/bad", "", "[1, 2]", 6);
+    TEST_CHECK(ret == 0);
+
+    /* Unsupported method and encoding, the connection stays open */
+    fd = http_connect();
+    req = "GET / HTTP/1.1\r\n\r\n";
+    http_write(fd, req, strlen(req));
+    ret = http_responses(fd, 1, "405");
+    TEST_CHECK(ret == 1);
+    req = "POST / HTTP/1.1\r\nContent-Encoding: br\r\n"
+          "Content-Length: 2\r\n\r\n{}";
+    http_write(fd, req, strlen(req));
+    ret = http_responses(fd, 1, "415");
+    TEST_CHECK(ret == 1);
+    close(fd);
+
+    /* Too large, the connection is closed */
+    fd = http_connect();
+    req = "POST / HTTP/1.1\r\nContent-Length: 100000000\r\n\r\n";
+    http_write(fd, req, strlen(req));
+    ret = http_responses(fd, 1, "413");
+    TEST_CHECK(ret == 1);
+    TEST_CHECK(read(fd, req, 1) == 0);
+    close(fd);
+
+    TEST_CHECK(wait_records(0) == 0);
+    http_stop(ctx);
+}
+
+/* The instance is paused and resumed many times, nothing is lost */
+void flb_test_in_http_backpressure(void)
+{
+    int i;
+    int fd;
+    int ret;
+    int len;
+    char req[256];
+    flb_ctx_t *ctx;
+
+    ctx = http_start("lib", "16K");
+
+    len = snprintf(req, sizeof(req) - 1,
+                   "POST /bp HTTP/1.1\r\n"
+                   "Content-Length: %lu\r\n\r\n%s",
+                   sizeof(HTTP_RECORD) - 1, HTTP_RECORD);
+
+    fd = http_connect();
+    for (i = 0; i < 2000; i++) {
+        http_write(fd, req, len);
+    }
+    ret = http_responses(fd, 2000, "201");
+    TEST_CHECK(ret == 2000);
+    close(fd);
+    TEST_CHECK(wait_records(2000) == 2000);
+    TEST_MSG("records=%i", get_records());
+
+    http_stop(ctx);
+}
+
+#ifdef FLB_TESTS_RT_LOAD
+/*
+ * Load harness: a few connections write batches of pipelined requests,
+ * the throughput is reported to compare changes. It's only built in the
+ * flb-rt-in_http_load target, not part of the test suite.
+ */
+#define LOAD_CONNS     4
+#define LOAD_BATCH     500
+#define LOAD_REQUESTS  20000
+
+static void *load_client(void *data)
+{
+    int i;
+    int fd;
+    int len;
+    int *ok = data;
+    char req[256];
+    char *batch;
+
+    len = snprintf(req, sizeof(req) - 1,
+                   "POST /load HTTP/1.1\r\n"
+                   "Content-Type: application/json\r\n"
+                   "Content-Length: %lu\r\n\r\n%s",
+                   sizeof(HTTP_RECORD) - 1, HTTP_RECORD);
+
+    batch = malloc(len * LOAD_BATCH);
+    for (i = 0; i < LOAD_BATCH; i++) {
+        memcpy(batch + (len * i), req, len);
+    }
+
+    fd = http_connect();
+    for (i = 0; i < LOAD_REQUESTS / LOAD_CONNS / LOAD_BATCH; i++) {
+        if (http_write(fd, batch, len * LOAD_BATCH) == -1) {
+            break;
+        }
+        *ok += http_responses(fd, LOAD_BATCH, "201");
+    }
+    close(fd);
+    free(batch);
+
+    return NULL;
+}
+
+void flb_test_in_http_load(void)
+{
+    int i;
+    int total = 0;
+    int ok[LOAD_CONNS] = {0};
+    double secs;
+    size_t bytes;
+    struct timeval start;
+    struct timeval end;
+    pthread_t tids[LOAD_CONNS];
+    flb_ctx_t *ctx;
+
+    ctx = http_start("null", NULL);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < LOAD_CONNS; i++) {
+        pthread_create(&tids[i], NULL, load_client, &ok[i]);
+    }
+    for (i = 0; i < LOAD_CONNS; i++) {
+        pthread_join(tids[i], NULL);
+        total += ok[i];
+    }
+    gettimeofday(&end, NULL);
+
+    TEST_CHECK(total == LOAD_REQUESTS);
+
+    secs = (end.tv_sec - start.tv_sec) +
+           ((end.tv_usec - start.tv_usec) / 1000000.0);
+    bytes = (size_t) total * (sizeof(HTTP_RECORD) - 1);
+    printf("\n[in_http load] %i requests in %.3fs: %.0f req/s, "
+           "%.2f MB/s of records\n",
+           total, secs, total / secs, (bytes / secs) / (1024 * 1024));
+
+    http_stop(ctx);
+}
+#endif